@@ -0,0 +1,172 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * AF_PACKET socket filter dropping the packets of bypassed flows.
+ *
+ * Suricata adds both directions of a bypassed TCP or UDP flow to the
+ * flow_table_v4 or flow_table_v6 map. Packets of these flows are not
+ * delivered to the socket, the filter only updates the packet and byte
+ * counters and the last seen time of the map entry. The bypassed flow
+ * manager in Suricata uses these to remove idle entries.
+ *
+ * Keys use host byte order for the addresses and ports and must match
+ * the structures in src/util-ebpf.h.
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+
+#include "bpf_helpers.h"
+
+#define LINUX_VERSION_CODE 263682
+
+#ifndef IP_MF
+#define IP_MF       0x2000
+#endif
+#ifndef IP_OFFSET
+#define IP_OFFSET   0x1FFF
+#endif
+
+struct flowv4_keys {
+    __u32 src;
+    __u32 dst;
+    __u16 sp;
+    __u16 dp;
+    __u32 ip_proto;
+};
+
+struct flowv6_keys {
+    __u32 src[4];
+    __u32 dst[4];
+    __u16 sp;
+    __u16 dp;
+    __u32 ip_proto;
+};
+
+struct pair {
+    __u64 time;
+    __u64 packets;
+    __u64 bytes;
+};
+
+struct bpf_map_def SEC("maps") flow_table_v4 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv4_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+struct bpf_map_def SEC("maps") flow_table_v6 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv6_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+static __always_inline int FlowUpdate(struct pair *value, __u32 len)
+{
+    value->time = bpf_ktime_get_ns();
+    value->packets++;
+    value->bytes += len;
+    return 0;
+}
+
+static __always_inline int ipv4_filter(struct __sk_buff *skb, __u32 nhoff)
+{
+    struct flowv4_keys tuple;
+    struct pair *value;
+    __u32 verlen;
+
+    tuple.ip_proto = load_byte(skb, nhoff + offsetof(struct iphdr, protocol));
+    if (tuple.ip_proto != IPPROTO_TCP && tuple.ip_proto != IPPROTO_UDP)
+        return -1;
+    /* fragments have no ports, let Suricata reassemble them */
+    if (load_half(skb, nhoff + offsetof(struct iphdr, frag_off)) & (IP_MF | IP_OFFSET))
+        return -1;
+
+    tuple.src = load_word(skb, nhoff + offsetof(struct iphdr, saddr));
+    tuple.dst = load_word(skb, nhoff + offsetof(struct iphdr, daddr));
+
+    verlen = load_byte(skb, nhoff);
+    nhoff += (verlen & 0xF) << 2;
+    tuple.sp = load_half(skb, nhoff);
+    tuple.dp = load_half(skb, nhoff + 2);
+
+    value = bpf_map_lookup_elem(&flow_table_v4, &tuple);
+    if (value) {
+        FlowUpdate(value, skb->len);
+        return 0;
+    }
+    return -1;
+}
+
+static __always_inline int ipv6_filter(struct __sk_buff *skb, __u32 nhoff)
+{
+    struct flowv6_keys tuple;
+    struct pair *value;
+    int i;
+
+    /* extension headers are not followed */
+    tuple.ip_proto = load_byte(skb, nhoff + offsetof(struct ipv6hdr, nexthdr));
+    if (tuple.ip_proto != IPPROTO_TCP && tuple.ip_proto != IPPROTO_UDP)
+        return -1;
+
+#pragma unroll
+    for (i = 0; i < 4; i++) {
+        tuple.src[i] = load_word(skb, nhoff + offsetof(struct ipv6hdr, saddr) + i * 4);
+        tuple.dst[i] = load_word(skb, nhoff + offsetof(struct ipv6hdr, daddr) + i * 4);
+    }
+
+    nhoff += sizeof(struct ipv6hdr);
+    tuple.sp = load_half(skb, nhoff);
+    tuple.dp = load_half(skb, nhoff + 2);
+
+    value = bpf_map_lookup_elem(&flow_table_v6, &tuple);
+    if (value) {
+        FlowUpdate(value, skb->len);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * \retval 0 drop the packet
+ * \retval -1 pass the whole packet to the socket
+ */
+int SEC("filter") hashfilter(struct __sk_buff *skb)
+{
+    /* VLAN tags are removed by the kernel before the filter runs */
+    __u32 nhoff = ETH_HLEN;
+
+    switch (load_half(skb, offsetof(struct ethhdr, h_proto))) {
+        case ETH_P_IP:
+            return ipv4_filter(skb, nhoff);
+        case ETH_P_IPV6:
+            return ipv6_filter(skb, nhoff);
+        default:
+            return -1;
+    }
+}
+
+char __license[] SEC("license") = "GPL";
+
+__u32 __version SEC("version") = LINUX_VERSION_CODE;
@@ -0,0 +1,206 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * XDP program dropping the packets of bypassed flows in the driver.
+ *
+ * Same maps and keys as bypass_filter.c, but the packets of bypassed
+ * flows are dropped before an skb is allocated for them. Up to two VLAN
+ * headers are skipped, as the tags may still be in the packet data at
+ * this point.
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_vlan.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+
+#include "bpf_helpers.h"
+
+#define LINUX_VERSION_CODE 263682
+
+#ifndef IP_MF
+#define IP_MF       0x2000
+#endif
+#ifndef IP_OFFSET
+#define IP_OFFSET   0x1FFF
+#endif
+
+struct vlan_hdr {
+    __u16 h_vlan_TCI;
+    __u16 h_vlan_encapsulated_proto;
+};
+
+struct flowv4_keys {
+    __u32 src;
+    __u32 dst;
+    __u16 sp;
+    __u16 dp;
+    __u32 ip_proto;
+};
+
+struct flowv6_keys {
+    __u32 src[4];
+    __u32 dst[4];
+    __u16 sp;
+    __u16 dp;
+    __u32 ip_proto;
+};
+
+struct pair {
+    __u64 time;
+    __u64 packets;
+    __u64 bytes;
+};
+
+struct bpf_map_def SEC("maps") flow_table_v4 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv4_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+struct bpf_map_def SEC("maps") flow_table_v6 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv6_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+static __always_inline int FlowUpdate(struct pair *value, __u64 len)
+{
+    value->time = bpf_ktime_get_ns();
+    value->packets++;
+    value->bytes += len;
+    return 0;
+}
+
+/** \brief read the ports of a TCP or UDP header, both are at the start */
+static __always_inline int get_ports(void *l4, void *data_end,
+        __u16 *sp, __u16 *dp)
+{
+    struct udphdr *uh = l4;
+
+    if ((void *)(uh + 1) > data_end)
+        return -1;
+    *sp = bpf_ntohs(uh->source);
+    *dp = bpf_ntohs(uh->dest);
+    return 0;
+}
+
+static __always_inline int filter_ipv4(void *data, __u64 nh_off,
+        void *data_end, __u64 len)
+{
+    struct iphdr *iph = data + nh_off;
+    struct flowv4_keys tuple;
+    struct pair *value;
+
+    if ((void *)(iph + 1) > data_end)
+        return XDP_PASS;
+    if (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP)
+        return XDP_PASS;
+    /* fragments have no ports, let Suricata reassemble them */
+    if (iph->frag_off & bpf_htons(IP_MF | IP_OFFSET))
+        return XDP_PASS;
+
+    tuple.ip_proto = iph->protocol;
+    tuple.src = bpf_ntohl(iph->saddr);
+    tuple.dst = bpf_ntohl(iph->daddr);
+    if (get_ports((void *)iph + (iph->ihl << 2), data_end,
+                &tuple.sp, &tuple.dp) < 0)
+        return XDP_PASS;
+
+    value = bpf_map_lookup_elem(&flow_table_v4, &tuple);
+    if (value) {
+        FlowUpdate(value, len);
+        return XDP_DROP;
+    }
+    return XDP_PASS;
+}
+
+static __always_inline int filter_ipv6(void *data, __u64 nh_off,
+        void *data_end, __u64 len)
+{
+    struct ipv6hdr *ip6h = data + nh_off;
+    struct flowv6_keys tuple;
+    struct pair *value;
+    int i;
+
+    if ((void *)(ip6h + 1) > data_end)
+        return XDP_PASS;
+    /* extension headers are not followed */
+    if (ip6h->nexthdr != IPPROTO_TCP && ip6h->nexthdr != IPPROTO_UDP)
+        return XDP_PASS;
+
+    tuple.ip_proto = ip6h->nexthdr;
+#pragma unroll
+    for (i = 0; i < 4; i++) {
+        tuple.src[i] = bpf_ntohl(ip6h->saddr.s6_addr32[i]);
+        tuple.dst[i] = bpf_ntohl(ip6h->daddr.s6_addr32[i]);
+    }
+    if (get_ports(ip6h + 1, data_end, &tuple.sp, &tuple.dp) < 0)
+        return XDP_PASS;
+
+    value = bpf_map_lookup_elem(&flow_table_v6, &tuple);
+    if (value) {
+        FlowUpdate(value, len);
+        return XDP_DROP;
+    }
+    return XDP_PASS;
+}
+
+int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
+{
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct ethhdr *eth = data;
+    __u64 nh_off = sizeof(*eth);
+    __u16 h_proto;
+    int i;
+
+    if (data + nh_off > data_end)
+        return XDP_PASS;
+
+    h_proto = eth->h_proto;
+#pragma unroll
+    for (i = 0; i < 2; i++) {
+        if (h_proto == bpf_htons(ETH_P_8021Q) ||
+                h_proto == bpf_htons(ETH_P_8021AD)) {
+            struct vlan_hdr *vhdr = data + nh_off;
+
+            if ((void *)(vhdr + 1) > data_end)
+                return XDP_PASS;
+            nh_off += sizeof(struct vlan_hdr);
+            h_proto = vhdr->h_vlan_encapsulated_proto;
+        }
+    }
+
+    if (h_proto == bpf_htons(ETH_P_IP))
+        return filter_ipv4(data, nh_off, data_end, data_end - data);
+    else if (h_proto == bpf_htons(ETH_P_IPV6))
+        return filter_ipv6(data, nh_off, data_end, data_end - data);
+    return XDP_PASS;
+}
+
+char __license[] SEC("license") = "GPL";
+
+__u32 __version SEC("version") = LINUX_VERSION_CODE;
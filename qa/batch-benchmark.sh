@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Replay a pcap with pcap-file.batch-size set to 1..256 and report the
+# packets per second and IPC of the reading thread for each size.
+#
+# usage: batch-benchmark.sh <suricata> <suricata.yaml> <pcap> [suricata args]
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 <suricata> <suricata.yaml> <pcap> [suricata args]"
+    exit 1
+fi
+
+SURICATA=$1
+CONFIG=$2
+PCAP=$3
+shift 3
+
+LOGDIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$LOGDIR"' EXIT
+
+for SIZE in 1 2 4 8 16 32 64 128 256; do
+    "$SURICATA" -c "$CONFIG" -r "$PCAP" -l "$LOGDIR" --runmode single \
+        --max-pending-packets 1024 \
+        --set pcap-file.batch-size=$SIZE --set pcap-file.benchmark=yes \
+        "$@" 2>&1 | grep "pcap-file benchmark:" | sed -e 's/.*pcap-file benchmark: //'
+    rm -f "$LOGDIR"/*
+done
@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+#
+# Replay a storm of overlapping IPv4 fragments under each of the defrag
+# OS policies and report the run time per policy.
+#
+# The script writes a pcap with a number of datagrams, each split into
+# many small fragments that overlap their neighbours and are sent in a
+# random order. The storm is sent to a single host, which is mapped to
+# each of the host-os-policy flavours in turn.
+#
+# usage: defrag-storm-benchmark.py <suricata> <suricata.yaml>
+#            [--datagrams N] [--fragments N] [--keep-pcap FILE]
+#            [-- suricata args]
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+STORM_DST = "10.99.0.1"
+STORM_SRC = "10.99.0.2"
+
+# host-os-policy flavour per defrag policy
+POLICIES = [
+    ("bsd", "bsd"),
+    ("bsd-right", "bsd-right"),
+    ("linux", "linux"),
+    ("first", "old-solaris"),
+    ("solaris", "solaris"),
+    ("windows", "windows"),
+]
+
+def ip_checksum(hdr):
+    s = 0
+    for i in range(0, len(hdr), 2):
+        s += (hdr[i] << 8) + hdr[i + 1]
+    while s >> 16:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+def ip_addr(a):
+    return bytearray(int(x) for x in a.split("."))
+
+def fragment(ip_id, offset, payload, more):
+    flags_off = (offset // 8) | (0x2000 if more else 0)
+    hdr = bytearray(struct.pack("!BBHHHBBH", 0x45, 0, 20 + len(payload),
+                                ip_id, flags_off, 64, 17, 0))
+    hdr += ip_addr(STORM_SRC) + ip_addr(STORM_DST)
+    struct.pack_into("!H", hdr, 10, ip_checksum(hdr))
+    eth = b"\x00\x01\x02\x03\x04\x05" + b"\x00\x01\x02\x03\x04\x06" + b"\x08\x00"
+    return eth + bytes(hdr) + payload
+
+def write_pcap(path, datagrams, fragments):
+    rnd = random.Random(1)
+    ts = 1500000000
+    with open(path, "wb") as fp:
+        fp.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+        for d in range(datagrams):
+            ip_id = d & 0xffff
+            # each fragment carries 16 bytes but the next one starts
+            # 8 bytes further, so every fragment overlaps its neighbours
+            frags = []
+            for i in range(fragments):
+                data = bytes(bytearray([(d + i) & 0xff]) * 16)
+                frags.append((i * 8, data, i != fragments - 1))
+            rnd.shuffle(frags)
+            for offset, data, more in frags:
+                pkt = fragment(ip_id, offset, data, more)
+                ts += 1
+                fp.write(struct.pack("<IIII", ts // 1000000, ts % 1000000,
+                                     len(pkt), len(pkt)))
+                fp.write(pkt)
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Overlapping fragment storm benchmark")
+    parser.add_argument("suricata")
+    parser.add_argument("config")
+    parser.add_argument("--datagrams", type=int, default=200)
+    parser.add_argument("--fragments", type=int, default=4000)
+    parser.add_argument("--keep-pcap")
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    # max offset of a fragment is 65528
+    if args.fragments < 2 or args.fragments * 8 + 8 > 65535:
+        print("--fragments must be between 2 and 8190", file=sys.stderr)
+        return 1
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        pcap = args.keep_pcap or os.path.join(tmpdir, "storm.pcap")
+        write_pcap(pcap, args.datagrams, args.fragments)
+
+        print("%d datagrams of %d fragments, %d packets" % (
+            args.datagrams, args.fragments, args.datagrams * args.fragments))
+        for name, flavour in POLICIES:
+            config = os.path.join(tmpdir, "suricata.yaml")
+            with open(config, "w") as fp:
+                fp.write("%%YAML 1.1\n---\n\ninclude: %s\n\n"
+                         "host-os-policy:\n  %s: [%s]\n" % (
+                             os.path.abspath(args.config), flavour, STORM_DST))
+            logdir = os.path.join(tmpdir, "log")
+            os.mkdir(logdir)
+
+            start = time.time()
+            proc = subprocess.Popen(
+                [args.suricata, "-c", config, "-r", pcap, "-l", logdir,
+                 "--runmode", "single",
+                 "--set", "defrag.max-frags=%d" % (args.fragments * 2),
+                 "--set", "pcap-file.benchmark=yes"] + extra,
+                stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+            output = proc.communicate()[0].decode("utf-8", "replace")
+            elapsed = time.time() - start
+            shutil.rmtree(logdir)
+
+            if proc.returncode != 0:
+                print(output)
+                print("%-10s suricata failed (%d)" % (name, proc.returncode))
+                return 1
+            bench = ""
+            for line in output.splitlines():
+                if "pcap-file benchmark:" in line:
+                    bench = line.split("pcap-file benchmark: ", 1)[1]
+            print("%-10s %8.2fs %s" % (name, elapsed, bench))
+    finally:
+        shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
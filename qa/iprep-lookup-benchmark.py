@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+#
+# Compare the radix tree and compact CIDR lookups of the IP reputation
+# code on a large reputation list.
+#
+# The script writes a reputation file with many random netblocks in a
+# single category, a set of iprep rules that never match and a pcap of
+# packets with random addresses. Each rule does a CIDR lookup for both
+# addresses of every packet. Suricata is run once for each value of
+# reputation-lookup and the max RSS and run time are reported.
+#
+# usage: iprep-lookup-benchmark.py <suricata> <suricata.yaml>
+#            [--prefixes N] [--packets N] [--rules N] [--keep-dir DIR]
+#            [-- suricata args]
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+LOOKUPS = ["radix", "compact"]
+
+def write_reputation(path, prefixes):
+    rnd = random.Random(1)
+    with open(path, "w") as fp:
+        for _ in range(prefixes):
+            # mostly long prefixes, like real block lists
+            plen = rnd.choice([8, 12, 16, 20, 22, 24, 24, 24, 28, 32, 32, 32])
+            addr = rnd.getrandbits(32) & ((0xffffffff << (32 - plen)) & 0xffffffff)
+            fp.write("%d.%d.%d.%d/%d,1,%d\n" % (
+                addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                addr & 0xff, plen, rnd.randint(1, 100)))
+
+def write_rules(path, rules):
+    with open(path, "w") as fp:
+        for sid in range(1, rules + 1):
+            fp.write("alert ip any any -> any any (msg:\"iprep lookup %d\"; "
+                     "iprep:any,BadHosts,>,100; sid:%d;)\n" % (sid, sid))
+
+def write_pcap(path, packets):
+    rnd = random.Random(2)
+    eth = b"\x00\x01\x02\x03\x04\x05" + b"\x00\x01\x02\x03\x04\x06" + b"\x08\x00"
+    payload = b"x" * 16
+    ts = 1500000000
+    with open(path, "wb") as fp:
+        fp.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+        for _ in range(packets):
+            udp = struct.pack("!HHHH", rnd.randint(1024, 65535), 53,
+                              8 + len(payload), 0) + payload
+            ip = struct.pack("!BBHHHBBHII", 0x45, 0, 20 + len(udp), 0, 0,
+                             64, 17, 0, rnd.getrandbits(32),
+                             rnd.getrandbits(32))
+            pkt = eth + ip + udp
+            ts += 1
+            fp.write(struct.pack("<IIII", ts // 1000000, ts % 1000000,
+                                 len(pkt), len(pkt)))
+            fp.write(pkt)
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="IP reputation CIDR lookup benchmark")
+    parser.add_argument("suricata")
+    parser.add_argument("config")
+    parser.add_argument("--prefixes", type=int, default=5000000)
+    parser.add_argument("--packets", type=int, default=1000000)
+    parser.add_argument("--rules", type=int, default=10)
+    parser.add_argument("--keep-dir")
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    tmpdir = args.keep_dir or tempfile.mkdtemp()
+    try:
+        cats = os.path.join(tmpdir, "categories.txt")
+        reputation = os.path.join(tmpdir, "reputation.list")
+        rules = os.path.join(tmpdir, "iprep.rules")
+        pcap = os.path.join(tmpdir, "iprep.pcap")
+        if not os.path.exists(reputation):
+            with open(cats, "w") as fp:
+                fp.write("1,BadHosts,Known bad hosts\n")
+            write_reputation(reputation, args.prefixes)
+            write_rules(rules, args.rules)
+            write_pcap(pcap, args.packets)
+
+        lookups = args.packets * args.rules * 2
+        print("%d prefixes, %d packets, %d rules, %d lookups" % (
+            args.prefixes, args.packets, args.rules, lookups))
+        for lookup in LOOKUPS:
+            logdir = os.path.join(tmpdir, "log")
+            os.mkdir(logdir)
+
+            start = time.time()
+            proc = subprocess.Popen(
+                [args.suricata, "-c", args.config, "-r", pcap, "-l", logdir,
+                 "-S", rules, "--runmode", "single",
+                 "--set", "reputation-categories-file=%s" % cats,
+                 "--set", "reputation-files.0=%s" % reputation,
+                 "--set", "reputation-lookup=%s" % lookup,
+                 "--set", "pcap-file.benchmark=yes"] + extra,
+                stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+            output = proc.stdout.read().decode("utf-8", "replace")
+            _, status, rusage = os.wait4(proc.pid, 0)
+            elapsed = time.time() - start
+            shutil.rmtree(logdir)
+
+            if status != 0:
+                print(output)
+                print("%-8s suricata failed (%d)" % (lookup, status))
+                return 1
+            bench = ""
+            for line in output.splitlines():
+                if "pcap-file benchmark:" in line:
+                    bench = line.split("pcap-file benchmark: ", 1)[1]
+            # ru_maxrss is in kilobytes on Linux
+            print("%-8s %8.2fs maxrss %7.1f MiB  %s" % (
+                lookup, elapsed, rusage.ru_maxrss / 1024.0, bench))
+    finally:
+        if not args.keep_dir:
+            shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+#
+# Measure the cost of adding out of order segments to a TCP stream as
+# the number of segments held by the stream grows.
+#
+# The script writes pcaps with a single TCP session. The client sends
+# many 1 byte segments that the server never acknowledges, so all of
+# them stay in the stream. With the default "gaps" order every other
+# segment is sent first, then the gaps are filled, so each segment of
+# the second half is inserted in front of segments already in the
+# stream. With "random" the segments are sent in a random order.
+#
+# The segment data is added to the stream's streaming buffer as the
+# segments come in, and every segment that doesn't touch the data
+# already there adds a block to the buffer's block tree. Both orders
+# leave thousands of blocks in the tree, so this also measures the
+# block tree updates with random insertion orders.
+#
+# Suricata is run on a pcap for each segment count and on a pcap with
+# just the handshake. The handshake run time is subtracted to get the
+# cost per segment, which should stay flat as the segment count grows.
+#
+# usage: tcp-segment-storm-benchmark.py <suricata> <suricata.yaml>
+#            [--segments N,N,...] [--order gaps|random] [--keep-dir DIR]
+#            [-- suricata args]
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+CLIENT = "10.98.0.2"
+SERVER = "10.98.0.1"
+SPORT = 40000
+DPORT = 8080
+CLIENT_ISN = 1000
+SERVER_ISN = 5000
+
+TH_SYN = 0x02
+TH_ACK = 0x10
+
+def checksum(data):
+    if len(data) & 1:
+        data += b"\x00"
+    data = bytearray(data)
+    s = 0
+    for i in range(0, len(data), 2):
+        s += (data[i] << 8) + data[i + 1]
+    while s >> 16:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+def ip_addr(a):
+    return bytes(bytearray(int(x) for x in a.split(".")))
+
+def tcp_packet(src, dst, sport, dport, seq, ack, flags, payload=b""):
+    # window scale option so that the whole storm fits in the window
+    opts = b"\x01\x03\x03\x0e" if flags & TH_SYN else b""
+    doff = (20 + len(opts)) // 4
+    tcp = bytearray(struct.pack("!HHIIBBHHH", sport, dport, seq, ack,
+                                doff << 4, flags, 65535, 0, 0) + opts)
+    tcp += payload
+    pseudo = ip_addr(src) + ip_addr(dst) + struct.pack("!BBH", 0, 6, len(tcp))
+    struct.pack_into("!H", tcp, 16, checksum(pseudo + bytes(tcp)))
+
+    ip = bytearray(struct.pack("!BBHHHBBH", 0x45, 0, 20 + len(tcp),
+                               0, 0x4000, 64, 6, 0))
+    ip += ip_addr(src) + ip_addr(dst)
+    struct.pack_into("!H", ip, 10, checksum(bytes(ip)))
+    eth = b"\x00\x01\x02\x03\x04\x05" + b"\x00\x01\x02\x03\x04\x06" + b"\x08\x00"
+    return eth + bytes(ip) + bytes(tcp)
+
+def segment_order(segments, order):
+    if order == "random":
+        slots = list(range(segments))
+        random.Random(1).shuffle(slots)
+        return slots
+    return list(range(0, segments, 2)) + list(range(1, segments, 2))
+
+def write_pcap(path, segments, order):
+    pkts = [
+        tcp_packet(CLIENT, SERVER, SPORT, DPORT, CLIENT_ISN, 0, TH_SYN),
+        tcp_packet(SERVER, CLIENT, DPORT, SPORT, SERVER_ISN, CLIENT_ISN + 1,
+                   TH_SYN | TH_ACK),
+        tcp_packet(CLIENT, SERVER, SPORT, DPORT, CLIENT_ISN + 1,
+                   SERVER_ISN + 1, TH_ACK),
+    ]
+    ts = 1500000000
+    with open(path, "wb") as fp:
+        fp.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+        def write(pkt):
+            fp.write(struct.pack("<IIII", ts // 1000000, ts % 1000000,
+                                 len(pkt), len(pkt)))
+            fp.write(pkt)
+        for pkt in pkts:
+            write(pkt)
+            ts += 1
+        for slot in segment_order(segments, order):
+            write(tcp_packet(CLIENT, SERVER, SPORT, DPORT,
+                             CLIENT_ISN + 1 + slot, SERVER_ISN + 1, TH_ACK,
+                             bytes(bytearray([0x41 + (slot % 26)]))))
+            ts += 1
+
+def run(args, extra, tmpdir, pcap):
+    logdir = os.path.join(tmpdir, "log")
+    os.mkdir(logdir)
+    start = time.time()
+    proc = subprocess.Popen(
+        [args.suricata, "-c", args.config, "-r", pcap, "-l", logdir,
+         "-S", "/dev/null", "--runmode", "single",
+         "--set", "stream.reassembly.depth=0",
+         "--set", "stream.reassembly.memcap=4gb",
+         "--set", "stream.memcap=1gb"] + extra,
+        stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    output = proc.communicate()[0].decode("utf-8", "replace")
+    elapsed = time.time() - start
+    shutil.rmtree(logdir)
+    if proc.returncode != 0:
+        print(output)
+        print("suricata failed (%d)" % proc.returncode)
+        return None
+    return elapsed
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Out of order TCP segment storm benchmark")
+    parser.add_argument("suricata")
+    parser.add_argument("config")
+    parser.add_argument("--segments", default="16384,32768,65536,131072,262144")
+    parser.add_argument("--order", choices=["gaps", "random"], default="gaps")
+    parser.add_argument("--keep-dir")
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    counts = [int(x) for x in args.segments.split(",")]
+    if min(counts) < 2 or max(counts) > (1 << 24):
+        print("--segments must be between 2 and %d" % (1 << 24),
+              file=sys.stderr)
+        return 1
+
+    tmpdir = args.keep_dir or tempfile.mkdtemp()
+    try:
+        pcap = os.path.join(tmpdir, "handshake.pcap")
+        write_pcap(pcap, 0, args.order)
+        base = run(args, extra, tmpdir, pcap)
+        if base is None:
+            return 1
+        print("order %s, handshake only: %.2fs" % (args.order, base))
+
+        for segments in counts:
+            pcap = os.path.join(tmpdir, "storm-%d.pcap" % segments)
+            write_pcap(pcap, segments, args.order)
+            elapsed = run(args, extra, tmpdir, pcap)
+            if elapsed is None:
+                return 1
+            print("%8d segments %8.2fs %8.3f usec/segment" % (
+                segments, elapsed,
+                max(elapsed - base, 0) * 1000000.0 / segments))
+    finally:
+        if not args.keep_dir:
+            shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -214,6 +214,36 @@ void *DNSGetTx(void *alstate, uint64_t tx_id)
     return NULL;
 }
 
+/** \brief tx iterator walking the tx list
+ *
+ *  The iterator state holds the tx after the one last returned. */
+AppLayerGetTxIterTuple DNSGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    AppLayerGetTxIterTuple tuple = { NULL, 0, false };
+    DNSState *dns_state = (DNSState *)alstate;
+
+    DNSTransaction *tx = state->un.ptr;
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&dns_state->tx_list);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        const uint64_t tx_id = tx->tx_num - 1;
+        if (tx_id < min_tx_id)
+            continue;
+        if (tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        tuple.tx_ptr = tx;
+        tuple.tx_id = tx_id;
+        tuple.has_next = (state->un.ptr != NULL);
+        return tuple;
+    }
+    return tuple;
+}
+
 uint64_t DNSGetTxCnt(void *alstate)
 {
     DNSState *dns_state = (DNSState *)alstate;
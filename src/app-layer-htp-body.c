@@ -62,10 +62,30 @@
 #include "conf.h"
 
 #include "util-memcmp.h"
+#include "counters.h"
 
 static StreamingBufferConfig default_cfg = {
     0, 0, 3072, HTPMalloc, HTPCalloc, HTPRealloc, HTPFree };
 
+/** bytes moved by sliding the body buffers. The detection engine inspects
+ *  the body buffers in place, so this is all the body data copied after
+ *  the initial append. */
+SC_ATOMIC_DECLARE(uint64_t, htp_body_copied_bytes);
+
+/** \brief get the number of body bytes moved by sliding so far */
+uint64_t HtpBodyCopiedBytes(void)
+{
+    uint64_t tmpval = SC_ATOMIC_GET(htp_body_copied_bytes);
+    return tmpval;
+}
+
+void HtpBodyRegisterGlobalCounters(void)
+{
+    SC_ATOMIC_INIT(htp_body_copied_bytes);
+    StatsRegisterGlobalCounter("http.body_copied_bytes",
+            HtpBodyCopiedBytes);
+}
+
 /**
  * \brief Append a chunk of body to the HtpBody struct
  *
@@ -220,9 +240,20 @@ void HtpBodyPrune(HtpState *state, HtpBody *body, int direction)
     if (left_edge)
         left_edge -= window;
 
-    if (left_edge) {
-        SCLogDebug("sliding body to offset %"PRIu64, left_edge);
-        StreamingBufferSlideToOffset(body->sb, left_edge);
+    /* Sliding moves the data we keep to the start of the buffer. Only do
+     * it once the data before the left edge is at least as large as the
+     * data after it, so the memmove costs at most one byte per appended
+     * byte instead of a full window on every prune. */
+    if (left_edge && left_edge > body->sb->stream_offset) {
+        const uint64_t buf_end = body->sb->stream_offset + body->sb->buf_offset;
+        const uint64_t before = left_edge - body->sb->stream_offset;
+        const uint64_t after = left_edge < buf_end ? buf_end - left_edge : 0;
+        if (before >= after) {
+            SCLogDebug("sliding body to offset %"PRIu64", moving %"PRIu64
+                    " bytes", left_edge, after);
+            StreamingBufferSlideToOffset(body->sb, left_edge);
+            (void) SC_ATOMIC_ADD(htp_body_copied_bytes, after);
+        }
     }
 
     SCLogDebug("pruning chunks of body %p", body);
@@ -32,5 +32,7 @@ int HtpBodyAppendChunk(const HTPCfgDir *, HtpBody *, const uint8_t *, uint32_t);
 void HtpBodyPrint(HtpBody *);
 void HtpBodyFree(HtpBody *);
 void HtpBodyPrune(HtpState *, HtpBody *, int);
+void HtpBodyRegisterGlobalCounters(void);
+uint64_t HtpBodyCopiedBytes(void);
 
 #endif /* __APP_LAYER_HTP_BODY_H__ */
@@ -108,6 +108,7 @@ typedef struct AppLayerParserProtoCtx_
     int (*StateGetProgress)(void *alstate, uint8_t direction);
     uint64_t (*StateGetTxCnt)(void *alstate);
     void *(*StateGetTx)(void *alstate, uint64_t tx_id);
+    AppLayerGetTxIteratorFunc StateGetTxIterator;
     int (*StateGetProgressCompletionStatus)(uint8_t direction);
     int (*StateGetEventInfo)(const char *event_name,
                              int *event_id, AppLayerEventType *event_type);
@@ -522,6 +523,17 @@ void AppLayerParserRegisterGetTx(uint8_t ipproto, AppProto alproto,
     SCReturn;
 }
 
+void AppLayerParserRegisterGetTxIterator(uint8_t ipproto, AppProto alproto,
+                      AppLayerGetTxIteratorFunc Func)
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].
+        StateGetTxIterator = Func;
+
+    SCReturn;
+}
+
 void AppLayerParserRegisterGetStateProgressCompletionStatus(AppProto alproto,
     int (*StateGetProgressCompletionStatus)(uint8_t direction))
 {
@@ -648,6 +660,35 @@ void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate, uint64_t tx_
     SCReturn;
 }
 
+/** \internal
+ *  \brief find the id of the first tx from idx on that is not complete
+ *
+ *  \retval id of that tx, or max(idx, total_txs) if all are complete
+ */
+static uint64_t AppLayerParserFirstIncompleteTx(const Flow *f, void *alstate,
+        uint64_t idx, const uint64_t total_txs, const int state_done_progress,
+        const uint8_t flags)
+{
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (idx < total_txs) {
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto, alstate,
+                idx, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            return total_txs;
+
+        int state_progress = AppLayerParserGetStateProgress(f->proto,
+                f->alproto, ires.tx_ptr, flags);
+        if (state_progress < state_done_progress)
+            return ires.tx_id;
+
+        idx = ires.tx_id + 1;
+    }
+    return idx;
+}
+
 uint64_t AppLayerParserGetTransactionInspectId(AppLayerParserState *pstate, uint8_t direction)
 {
     SCEnter();
@@ -667,19 +708,9 @@ void AppLayerParserSetTransactionInspectId(const Flow *f, AppLayerParserState *p
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
     uint64_t idx = AppLayerParserGetTransactionInspectId(pstate, flags);
     const int state_done_progress = AppLayerParserGetStateProgressCompletionStatus(f->alproto, flags);
-    void *tx;
-    int state_progress;
-
-    for (; idx < total_txs; idx++) {
-        tx = AppLayerParserGetTx(f->proto, f->alproto, alstate, idx);
-        if (tx == NULL)
-            continue;
-        state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto, tx, flags);
-        if (state_progress >= state_done_progress)
-            continue;
-        else
-            break;
-    }
+
+    idx = AppLayerParserFirstIncompleteTx(f, alstate, idx, total_txs,
+            state_done_progress, flags);
     pstate->inspect_id[direction] = idx;
 
     SCReturn;
@@ -767,21 +798,9 @@ uint64_t AppLayerTransactionGetActiveLogOnly(Flow *f, uint8_t flags)
 
     /* logger is disabled, return highest 'complete' tx id */
     uint64_t total_txs = AppLayerParserGetTxCnt(f, f->alstate);
-    uint64_t idx = f->alparser->min_id;
     int state_done_progress = AppLayerParserGetStateProgressCompletionStatus(f->alproto, flags);
-    void *tx;
-    int state_progress;
-
-    for (; idx < total_txs; idx++) {
-        tx = AppLayerParserGetTx(f->proto, f->alproto, f->alstate, idx);
-        if (tx == NULL)
-            continue;
-        state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto, tx, flags);
-        if (state_progress >= state_done_progress)
-            continue;
-        else
-            break;
-    }
+    uint64_t idx = AppLayerParserFirstIncompleteTx(f, f->alstate,
+            f->alparser->min_id, total_txs, state_done_progress, flags);
     SCLogDebug("returning %"PRIu64, idx);
     return idx;
 }
@@ -825,19 +844,24 @@ static void AppLayerParserTransactionsCleanup(Flow *f)
 
     uint64_t min = MIN(tx_id_ts, tx_id_tc);
     if (min > 0) {
-        uint64_t x = f->alparser->min_id;
-        for ( ; x < min - 1; x++) {
-            void *tx = AppLayerParserGetTx(f->proto, f->alproto, f->alstate, x);
-            if (tx != 0) {
-                SCLogDebug("while freeing %"PRIu64", also free TX at %"PRIu64, min - 1, x);
-                p->StateTransactionFree(f->alstate, x);
-            }
-        }
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+        AppLayerGetTxIterState state;
+        memset(&state, 0, sizeof(state));
 
-        SCLogDebug("freeing %"PRIu64" %p", min - 1, p->StateTransactionFree);
+        /* free all txs up to and including min - 1. The iterator state
+         * points past the tx we free, so it stays valid. */
+        uint64_t x = f->alparser->min_id;
+        while (x < min) {
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto,
+                    f->alstate, x, min, &state);
+            if (ires.tx_ptr == NULL)
+                break;
 
-        if ((AppLayerParserGetTx(f->proto, f->alproto, f->alstate, min - 1))) {
-            p->StateTransactionFree(f->alstate, min - 1);
+            SCLogDebug("freeing TX at %"PRIu64" (min %"PRIu64")", ires.tx_id, min);
+            p->StateTransactionFree(f->alstate, ires.tx_id);
+            if (!ires.has_next)
+                break;
+            x = ires.tx_id + 1;
         }
         f->alparser->min_id = min - 1;
         SCLogDebug("f->alparser->min_id %"PRIu64, f->alparser->min_id);
@@ -885,6 +909,46 @@ void *AppLayerParserGetTx(uint8_t ipproto, AppProto alproto, void *alstate, uint
     SCReturnPtr(r, "void *");
 }
 
+/** \brief tx iterator for parsers that don't register their own
+ *
+ *  Looks up the txs one by one through StateGetTx. The state holds the
+ *  id after the last returned tx. */
+static AppLayerGetTxIterTuple AppLayerDefaultGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    uint64_t tx_id = MAX(min_tx_id, state->un.u64);
+
+    for ( ; tx_id < max_tx_id; tx_id++) {
+        void *tx_ptr = AppLayerParserGetTx(ipproto, alproto, alstate, tx_id);
+        if (tx_ptr != NULL) {
+            state->un.u64 = tx_id + 1;
+            AppLayerGetTxIterTuple tuple = {
+                .tx_ptr = tx_ptr,
+                .tx_id = tx_id,
+                .has_next = (tx_id + 1 < max_tx_id),
+            };
+            return tuple;
+        }
+    }
+
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, false };
+    return no_tuple;
+}
+
+/** \brief get the tx iterator for a protocol
+ *
+ *  Parsers that store their txs in a list should register an iterator
+ *  so that walking all txs is linear instead of quadratic. */
+AppLayerGetTxIteratorFunc AppLayerGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto)
+{
+    AppLayerGetTxIteratorFunc Func =
+        alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateGetTxIterator;
+    return Func ? Func : AppLayerDefaultGetTxIterator;
+}
+
 int AppLayerParserGetStateProgressCompletionStatus(AppProto alproto,
                                                    uint8_t direction)
 {
@@ -1560,6 +1560,39 @@ static void *SMTPStateGetTx(void *state, uint64_t id)
 
 }
 
+/** \brief tx iterator walking the tx list, so walking all txs is linear
+ *
+ *  The iterator state holds the tx after the one last returned, so
+ *  min_tx_id is expected to be past the id of that tx. */
+static AppLayerGetTxIterTuple SMTPGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    AppLayerGetTxIterTuple tuple = { NULL, 0, false };
+    SMTPState *smtp_state = alstate;
+    if (smtp_state == NULL)
+        return tuple;
+
+    SMTPTransaction *tx = state->un.ptr;
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&smtp_state->tx_list);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_id < min_tx_id)
+            continue;
+        if (tx->tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = TAILQ_NEXT(tx, next);
+        tuple.tx_ptr = tx;
+        tuple.tx_id = tx->tx_id;
+        tuple.has_next = (state->un.ptr != NULL);
+        return tuple;
+    }
+    return tuple;
+}
+
 static void SMTPStateSetTxLogged(void *state, void *vtx, uint32_t logger)
 {
     SMTPTransaction *tx = vtx;
@@ -1672,6 +1705,8 @@ void RegisterSMTPParsers(void)
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetAlstateProgress);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxCnt);
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP,
+                                            SMTPGetTxIterator);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxLogged,
                                           SMTPStateSetTxLogged);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_SMTP,
@@ -5143,6 +5178,50 @@ static int SMTPProcessDataChunkTest05(void){
     PASS;
 }
 
+/**
+ * \test walk the txs with the tx iterator, skipping a freed tx
+ */
+static int SMTPGetTxIteratorTest01(void)
+{
+    SMTPState *state = SMTPStateAlloc();
+    FAIL_IF_NULL(state);
+
+    int i;
+    for (i = 0; i < 4; i++) {
+        SMTPTransaction *tx = SMTPTransactionCreate();
+        FAIL_IF_NULL(tx);
+        TAILQ_INSERT_TAIL(&state->tx_list, tx, next);
+        tx->tx_id = state->tx_cnt++;
+    }
+    SMTPStateTransactionFree(state, 2);
+
+    AppLayerGetTxIterState iter_state;
+    memset(&iter_state, 0, sizeof(iter_state));
+    const uint64_t expect[] = { 1, 3 };
+    uint64_t tx_id = 1;
+    for (i = 0; i < 2; i++) {
+        AppLayerGetTxIterTuple ires = SMTPGetTxIterator(IPPROTO_TCP,
+                ALPROTO_SMTP, state, tx_id, state->tx_cnt, &iter_state);
+        FAIL_IF_NULL(ires.tx_ptr);
+        FAIL_IF(ires.tx_id != expect[i]);
+        FAIL_IF(((SMTPTransaction *)ires.tx_ptr)->tx_id != expect[i]);
+        FAIL_IF(ires.has_next != (i == 0));
+        tx_id = ires.tx_id + 1;
+    }
+    AppLayerGetTxIterTuple ires = SMTPGetTxIterator(IPPROTO_TCP,
+            ALPROTO_SMTP, state, tx_id, state->tx_cnt, &iter_state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    /* upper bound is exclusive */
+    memset(&iter_state, 0, sizeof(iter_state));
+    ires = SMTPGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP, state, 2, 3,
+            &iter_state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    SMTPStateFree(state);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SMTPParserRegisterTests(void)
@@ -5167,6 +5246,7 @@ void SMTPParserRegisterTests(void)
     UtRegisterTest("SMTPProcessDataChunkTest03", SMTPProcessDataChunkTest03);
     UtRegisterTest("SMTPProcessDataChunkTest04", SMTPProcessDataChunkTest04);
     UtRegisterTest("SMTPProcessDataChunkTest05", SMTPProcessDataChunkTest05);
+    UtRegisterTest("SMTPGetTxIteratorTest01", SMTPGetTxIteratorTest01);
 #endif /* UNITTESTS */
 
     return;
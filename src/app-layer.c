@@ -44,6 +44,8 @@
 #include "util-validate.h"
 #include "decode-events.h"
 
+#include "app-layer-htp.h"
+#include "app-layer-htp-body.h"
 #include "app-layer-htp-mem.h"
 #include "app-layer-dns-common.h"
 
@@ -824,6 +826,7 @@ void AppLayerRegisterGlobalCounters(void)
     StatsRegisterGlobalCounter("dns.memcap_global", DNSMemcapGetMemcapGlobalCounter);
     StatsRegisterGlobalCounter("http.memuse", HTPMemuseGlobalCounter);
     StatsRegisterGlobalCounter("http.memcap", HTPMemcapGlobalCounter);
+    HtpBodyRegisterGlobalCounters();
 }
 
 #define IPPROTOS_MAX 2
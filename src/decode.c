@@ -52,6 +52,7 @@
 #include "conf.h"
 #include "decode.h"
 #include "decode-teredo.h"
+#include "defrag.h"
 #include "util-debug.h"
 #include "util-mem.h"
 #include "app-layer-detect-proto.h"
@@ -436,6 +437,11 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_flow_icmp4 = StatsRegisterCounter("flow.icmpv4", tv);
     dtv->counter_flow_icmp6 = StatsRegisterCounter("flow.icmpv6", tv);
 
+    dtv->counter_flow_lookup_lockless =
+        StatsRegisterCounter("flow.lookup.lockless", tv);
+    dtv->counter_flow_lookup_fallback =
+        StatsRegisterCounter("flow.lookup.lockless_fallback", tv);
+
     dtv->counter_defrag_ipv4_fragments =
         StatsRegisterCounter("defrag.ipv4.fragments", tv);
     dtv->counter_defrag_ipv4_reassembled =
@@ -504,6 +510,7 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     memset(dtv, 0, sizeof(DecodeThreadVars));
 
     dtv->app_tctx = AppLayerGetCtxThread(tv);
+    dtv->defrag_tctx = DefragThreadCtxAlloc();
 
     if (OutputFlowLogThreadInit(tv, NULL, &dtv->output_flow_thread_data) != TM_ECODE_OK) {
         SCLogError(SC_ERR_THREAD_INIT, "initializing flow log API for thread failed");
@@ -527,6 +534,9 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
         if (dtv->app_tctx != NULL)
             AppLayerDestroyCtxThread(dtv->app_tctx);
 
+        if (dtv->defrag_tctx != NULL)
+            DefragThreadCtxFree(dtv->defrag_tctx);
+
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
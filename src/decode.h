@@ -92,6 +92,7 @@ enum PktSrcEnum {
 /* forward declarations */
 struct DetectionEngineThreadCtx_;
 typedef struct AppLayerThreadCtx_ AppLayerThreadCtx;
+typedef struct DefragThreadCtx_ DefragThreadCtx;
 
 struct PktPool_;
 
@@ -621,6 +622,9 @@ typedef struct DecodeThreadVars_
     /** Specific context for udp protocol detection (here atm) */
     AppLayerThreadCtx *app_tctx;
 
+    /** fragment and tracker cache for defrag */
+    DefragThreadCtx *defrag_tctx;
+
     int vlan_disabled;
 
     /** stats/counters */
@@ -670,11 +674,17 @@ typedef struct DecodeThreadVars_
     uint16_t counter_flow_icmp4;
     uint16_t counter_flow_icmp6;
 
+    uint16_t counter_flow_lookup_lockless;
+    uint16_t counter_flow_lookup_fallback;
+
      uint16_t counter_invalid_events[DECODE_EVENT_PACKET_MAX];
     /* thread data for flow logging api: only used at forced
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
+    /** flow hash partition of this thread, if the hash is partitioned */
+    uint32_t flow_partition;
+
 #ifdef __SC_CUDA_SUPPORT__
     CudaThreadVars cuda_vars;
 #endif
@@ -41,6 +41,15 @@ void DefragTrackerMoveToSpare(DefragTracker *h)
     (void) SC_ATOMIC_SUB(defragtracker_counter, 1);
 }
 
+/** \brief return the spare trackers cached by a thread to the spare queue */
+void DefragTrackerThreadCacheFlush(DefragThreadCtx *dtc)
+{
+    while (dtc->trackers_cnt > 0) {
+        DefragTrackerEnqueue(&defragtracker_spare_q,
+                dtc->trackers[--dtc->trackers_cnt]);
+    }
+}
+
 static DefragTracker *DefragTrackerAlloc(void)
 {
     if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
@@ -100,7 +109,7 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p)
     dt->remove = 0;
     dt->seen_last = 0;
 
-    TAILQ_INIT(&dt->frags);
+    RB_INIT(&dt->fragment_tree);
     (void) DefragTrackerIncrUsecnt(dt);
 }
 
@@ -429,12 +438,23 @@ static inline int DefragTrackerCompare(DefragTracker *t, Packet *p)
  *
  *  \retval dt *LOCKED* tracker on succes, NULL on error.
  */
-static DefragTracker *DefragTrackerGetNew(Packet *p)
+static DefragTracker *DefragTrackerGetNew(DefragThreadCtx *dtc, Packet *p)
 {
     DefragTracker *dt = NULL;
 
-    /* get a tracker from the spare queue */
-    dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    /* get a tracker from the thread cache, refilling it from the spare
+     * queue in one go when it ran empty. Without a thread cache get it
+     * from the spare queue directly. */
+    if (dtc != NULL) {
+        if (dtc->trackers_cnt == 0) {
+            dtc->trackers_cnt = DefragTrackerDequeueBatch(&defragtracker_spare_q,
+                    dtc->trackers, DEFRAG_THREAD_TRACKER_BATCH);
+        }
+        if (dtc->trackers_cnt > 0)
+            dt = dtc->trackers[--dtc->trackers_cnt];
+    } else {
+        dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    }
     if (dt == NULL) {
         /* If we reached the max memcap, we get a used tracker */
         if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
@@ -480,9 +500,11 @@ static DefragTracker *DefragTrackerGetNew(Packet *p)
  * tracker pointer. Then compares the packet with the found tracker to see if it is
  * the tracker we need. If it isn't, walk the list until the right tracker is found.
  *
+ * New trackers are taken from the thread cache dtc, which may be NULL.
+ *
  * returns a *LOCKED* tracker or NULL
  */
-DefragTracker *DefragGetTrackerFromHash (Packet *p)
+DefragTracker *DefragGetTrackerFromHash (DefragThreadCtx *dtc, Packet *p)
 {
     DefragTracker *dt = NULL;
 
@@ -494,7 +516,7 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
 
     /* see if the bucket already has a tracker */
     if (hb->head == NULL) {
-        dt = DefragTrackerGetNew(p);
+        dt = DefragTrackerGetNew(dtc, p);
         if (dt == NULL) {
             DRLOCK_UNLOCK(hb);
             return NULL;
@@ -523,7 +545,7 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
             dt = dt->hnext;
 
             if (dt == NULL) {
-                dt = pdt->hnext = DefragTrackerGetNew(p);
+                dt = pdt->hnext = DefragTrackerGetNew(dtc, p);
                 if (dt == NULL) {
                     DRLOCK_UNLOCK(hb);
                     return NULL;
@@ -93,10 +93,11 @@ void DefragInitConfig(char quiet);
 void DefragHashShutdown(void);
 
 DefragTracker *DefragLookupTrackerFromHash (Packet *);
-DefragTracker *DefragGetTrackerFromHash (Packet *);
+DefragTracker *DefragGetTrackerFromHash (DefragThreadCtx *, Packet *);
 void DefragTrackerRelease(DefragTracker *);
 void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
+void DefragTrackerThreadCacheFlush(DefragThreadCtx *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
 #endif /* __DEFRAG_HASH_H__ */
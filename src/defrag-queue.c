@@ -133,6 +133,46 @@ DefragTracker *DefragTrackerDequeue (DefragTrackerQueue *q)
     return dt;
 }
 
+/**
+ *  \brief remove up to cnt trackers from the queue at once
+ *
+ *  \param q queue
+ *  \param array array to store the trackers in
+ *  \param cnt max number of trackers to remove
+ *
+ *  \retval number of trackers stored in array
+ */
+uint32_t DefragTrackerDequeueBatch(DefragTrackerQueue *q,
+        DefragTracker **array, uint32_t cnt)
+{
+    uint32_t n = 0;
+
+    DQLOCK_LOCK(q);
+    while (n < cnt && q->bot != NULL) {
+        DefragTracker *dt = q->bot;
+
+        if (q->bot->lprev != NULL) {
+            q->bot = q->bot->lprev;
+            q->bot->lnext = NULL;
+        } else {
+            q->top = NULL;
+            q->bot = NULL;
+        }
+
+#ifdef DEBUG
+        BUG_ON(q->len == 0);
+#endif
+        if (q->len > 0)
+            q->len--;
+
+        dt->lnext = NULL;
+        dt->lprev = NULL;
+        array[n++] = dt;
+    }
+    DQLOCK_UNLOCK(q);
+    return n;
+}
+
 uint32_t DefragTrackerQueueLen(DefragTrackerQueue *q)
 {
     uint32_t len;
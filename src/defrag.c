@@ -100,6 +100,108 @@ static int default_policy = DEFRAG_POLICY_BSD;
  * context. */
 static DefragContext *defrag_context;
 
+static inline uint32_t DefragFragEnd(const Frag *frag)
+{
+    return (uint32_t)frag->offset + frag->data_len;
+}
+
+/**
+ * \brief Recompute the max_end of a fragment from its children.
+ */
+static inline void DefragFragAugment(Frag *frag)
+{
+    uint32_t max_end = DefragFragEnd(frag);
+    const Frag *child = RB_LEFT(frag, rb);
+    if (child != NULL && child->max_end > max_end)
+        max_end = child->max_end;
+    child = RB_RIGHT(frag, rb);
+    if (child != NULL && child->max_end > max_end)
+        max_end = child->max_end;
+    frag->max_end = max_end;
+}
+
+/* The fragment tree is augmented with the highest fragment end of each
+ * subtree, so that looking up the fragments a new fragment overlaps can
+ * skip the subtrees that end before it. */
+#undef RB_AUGMENT
+#define RB_AUGMENT(x) DefragFragAugment(x)
+RB_GENERATE(IP_FRAGMENTS, Frag_, rb, DefragRbFragCompare);
+#undef RB_AUGMENT
+#define RB_AUGMENT(x) do {} while (0)
+
+int DefragRbFragCompare(struct Frag_ *a, struct Frag_ *b)
+{
+    if (a->offset < b->offset)
+        return -1;
+    return 1;
+}
+
+/**
+ * \brief Insert a fragment into the tracker's fragment tree.
+ *
+ * The max_end of the nodes on the insert path is updated first, so the
+ * rebalancing can recompute the nodes it rotates from their children.
+ */
+static void DefragFragInsert(DefragTracker *tracker, Frag *new)
+{
+    const uint32_t end = DefragFragEnd(new);
+    new->max_end = end;
+
+    Frag *tmp = RB_ROOT(&tracker->fragment_tree);
+    while (tmp != NULL) {
+        if (tmp->max_end < end)
+            tmp->max_end = end;
+        if (DefragRbFragCompare(new, tmp) < 0)
+            tmp = RB_LEFT(tmp, rb);
+        else
+            tmp = RB_RIGHT(tmp, rb);
+    }
+    RB_INSERT(IP_FRAGMENTS, &tracker->fragment_tree, new);
+}
+
+/**
+ * \brief Find the first fragment, in offset order, of a subtree that
+ *     ends at or after offset.
+ */
+static Frag *DefragFragFirstEndingAfter(Frag *frag, const uint32_t offset)
+{
+    while (frag != NULL && frag->max_end >= offset) {
+        Frag *left = RB_LEFT(frag, rb);
+        if (left != NULL && left->max_end >= offset) {
+            frag = left;
+            continue;
+        }
+        if (DefragFragEnd(frag) >= offset)
+            return frag;
+        frag = RB_RIGHT(frag, rb);
+    }
+    return NULL;
+}
+
+/**
+ * \brief Find the next fragment, in offset order, after frag that ends
+ *     at or after offset.
+ */
+static Frag *DefragFragNextEndingAfter(Frag *frag, const uint32_t offset)
+{
+    Frag *next = DefragFragFirstEndingAfter(RB_RIGHT(frag, rb), offset);
+    if (next != NULL)
+        return next;
+
+    Frag *parent;
+    while ((parent = RB_PARENT(frag, rb)) != NULL) {
+        if (RB_LEFT(parent, rb) == frag) {
+            if (DefragFragEnd(parent) >= offset)
+                return parent;
+            next = DefragFragFirstEndingAfter(RB_RIGHT(parent, rb), offset);
+            if (next != NULL)
+                return next;
+        }
+        frag = parent;
+    }
+    return NULL;
+}
+
 /**
  * Utility/debugging function to dump the frags associated with a
  * tracker.  Only enable when unit tests are enabled.
@@ -112,7 +214,7 @@ DumpFrags(DefragTracker *tracker)
     Frag *frag;
 
     printf("Dumping frags for packet: ID=%d\n", tracker->id);
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
+    RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         printf("-> Frag: frag_offset=%d, frag_len=%d, data_len=%d, ltrim=%d, skip=%d\n", frag->offset, frag->len, frag->data_len, frag->ltrim, frag->skip);
         PrintRawDataFp(stdout, frag->pkt, frag->len);
     }
@@ -149,13 +251,13 @@ DefragFragInit(void *data, void *initdata)
 void
 DefragTrackerFreeFrags(DefragTracker *tracker)
 {
-    Frag *frag;
+    Frag *frag, *tmp;
 
     /* Lock the frag pool as we'll be return items to it. */
     SCMutexLock(&defrag_context->frag_pool_lock);
 
-    while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
-        TAILQ_REMOVE(&tracker->frags, frag, next);
+    RB_FOREACH_SAFE(frag, IP_FRAGMENTS, &tracker->fragment_tree, tmp) {
+        RB_REMOVE(IP_FRAGMENTS, &tracker->fragment_tree, frag);
 
         /* Don't SCFree the frag, just give it back to its pool. */
         DefragFragReset(frag);
@@ -165,6 +267,162 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
     SCMutexUnlock(&defrag_context->frag_pool_lock);
 }
 
+/**
+ * \brief Number of frags a thread may keep in its cache.
+ *
+ * The thread caches share the frag pool, so a thread doesn't keep more
+ * than its part of max-frags. With more threads than frags nothing is
+ * cached at all.
+ */
+static inline uint32_t
+DefragThreadCacheSize(void)
+{
+    const uint32_t threads = SC_ATOMIC_GET(defrag_context->thread_caches);
+    const uint32_t size = defrag_context->max_frags / MAX(threads, 1);
+    return MIN(size, DEFRAG_THREAD_FRAG_CACHE);
+}
+
+/**
+ * \brief Return the top cnt frags of a thread cache to the frag pool.
+ */
+static void
+DefragThreadCacheFlush(DefragThreadCtx *dtc, uint32_t cnt)
+{
+    SCMutexLock(&defrag_context->frag_pool_lock);
+    while (cnt-- > 0 && dtc->frags_cnt > 0) {
+        PoolReturn(defrag_context->frag_pool, dtc->frags[--dtc->frags_cnt]);
+    }
+    SCMutexUnlock(&defrag_context->frag_pool_lock);
+}
+
+/**
+ * \brief Get a frag, from the thread cache if there is one.
+ *
+ * An empty cache is refilled with a batch of frags from the frag pool.
+ *
+ * \param dtc thread cache, may be NULL.
+ *
+ * \retval frag or NULL if the frag pool is exhausted.
+ */
+static Frag *
+DefragFragGet(DefragThreadCtx *dtc)
+{
+    Frag *frag;
+
+    if (dtc == NULL) {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        frag = PoolGet(defrag_context->frag_pool);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        return frag;
+    }
+
+    if (dtc->frags_cnt == 0) {
+        const uint32_t batch = MIN(DefragThreadCacheSize(),
+                DEFRAG_THREAD_FRAG_BATCH);
+        if (batch == 0) {
+            return DefragFragGet(NULL);
+        }
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        while (dtc->frags_cnt < batch) {
+            frag = PoolGet(defrag_context->frag_pool);
+            if (frag == NULL)
+                break;
+            dtc->frags[dtc->frags_cnt++] = frag;
+        }
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+
+        if (dtc->frags_cnt == 0)
+            return NULL;
+    }
+    return dtc->frags[--dtc->frags_cnt];
+}
+
+/**
+ * \brief Return a frag to the thread cache if there is one.
+ *
+ * A full cache first gives a batch of frags back to the frag pool.
+ *
+ * \param dtc thread cache, may be NULL.
+ */
+static void
+DefragFragRelease(DefragThreadCtx *dtc, Frag *frag)
+{
+    DefragFragReset(frag);
+
+    if (dtc == NULL) {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        PoolReturn(defrag_context->frag_pool, frag);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        return;
+    }
+
+    /* the size shrinks as threads start, so the cache may be over it */
+    const uint32_t size = DefragThreadCacheSize();
+    if (dtc->frags_cnt >= size) {
+        const uint32_t batch = MIN(size, DEFRAG_THREAD_FRAG_BATCH);
+        DefragThreadCacheFlush(dtc, dtc->frags_cnt - size + batch);
+    }
+    if (size == 0) {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        PoolReturn(defrag_context->frag_pool, frag);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        return;
+    }
+    dtc->frags[dtc->frags_cnt++] = frag;
+}
+
+/**
+ * \brief Free all frags of a tracker into the thread cache.
+ *
+ * \param dtc thread cache, may be NULL.
+ */
+static void
+DefragTrackerFreeFragsThread(DefragThreadCtx *dtc, DefragTracker *tracker)
+{
+    Frag *frag, *tmp;
+
+    if (dtc == NULL) {
+        DefragTrackerFreeFrags(tracker);
+        return;
+    }
+
+    RB_FOREACH_SAFE(frag, IP_FRAGMENTS, &tracker->fragment_tree, tmp) {
+        RB_REMOVE(IP_FRAGMENTS, &tracker->fragment_tree, frag);
+        DefragFragRelease(dtc, frag);
+    }
+}
+
+/**
+ * \brief Allocate the defrag cache of a decoder thread.
+ */
+DefragThreadCtx *
+DefragThreadCtxAlloc(void)
+{
+    DefragThreadCtx *dtc = SCCalloc(1, sizeof(*dtc));
+    if (unlikely(dtc == NULL))
+        return NULL;
+    (void)SC_ATOMIC_ADD(defrag_context->thread_caches, 1);
+    return dtc;
+}
+
+/**
+ * \brief Give the cached frags and trackers of a decoder thread back
+ *     to the shared pools and free the cache.
+ */
+void
+DefragThreadCtxFree(DefragThreadCtx *dtc)
+{
+    if (dtc == NULL)
+        return;
+
+    if (dtc->frags_cnt > 0)
+        DefragThreadCacheFlush(dtc, dtc->frags_cnt);
+    if (dtc->trackers_cnt > 0)
+        DefragTrackerThreadCacheFlush(dtc);
+    (void)SC_ATOMIC_SUB(defrag_context->thread_caches, 1);
+    SCFree(dtc);
+}
+
 /**
  * \brief Create a new DefragContext.
  *
@@ -200,6 +458,8 @@ DefragContextNew(void)
             "Defrag: Failed to initialize fragment pool.");
         exit(EXIT_FAILURE);
     }
+    dc->max_frags = (uint32_t)frag_pool_size;
+    SC_ATOMIC_INIT(dc->thread_caches);
     if (SCMutexInit(&dc->frag_pool_lock, NULL) != 0) {
         SCLogError(SC_ERR_MUTEX,
             "Defrag: Failed to initialize frag pool mutex.");
@@ -251,7 +511,8 @@ DefragContextDestroy(DefragContext *dc)
  * \param tracker The defragmentation tracker to reassemble from.
  */
 static Packet *
-Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+Defrag4Reassemble(ThreadVars *tv, DefragThreadCtx *dtc, DefragTracker *tracker,
+    Packet *p)
 {
     Packet *rp = NULL;
 
@@ -263,12 +524,13 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     /* Check that we have all the data. Relies on the fact that
      * fragments are inserted if frag_offset order. */
     Frag *frag;
+    Frag *first = RB_MIN(IP_FRAGMENTS, &tracker->fragment_tree);
     int len = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
+    RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         if (frag->skip)
             continue;
 
-        if (frag == TAILQ_FIRST(&tracker->frags)) {
+        if (frag == first) {
             if (frag->offset != 0) {
                 goto done;
             }
@@ -302,7 +564,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     int fragmentable_len = 0;
     int hlen = 0;
     int ip_hdr_offset = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
+    RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         SCLogDebug("frag %p, data_len %u, offset %u, pcap_cnt %"PRIu64,
                 frag, frag->data_len, frag->offset, frag->pcap_cnt);
 
@@ -358,13 +620,13 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     SET_PKT_LEN(rp, ip_hdr_offset + hlen + fragmentable_len);
 
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerFreeFragsThread(dtc, tracker);
 done:
     return rp;
 
 error_remove_tracker:
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerFreeFragsThread(dtc, tracker);
     if (rp != NULL)
         PacketFreeOrRelease(rp);
     return NULL;
@@ -376,7 +638,8 @@ error_remove_tracker:
  * \param tracker The defragmentation tracker to reassemble from.
  */
 static Packet *
-Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+Defrag6Reassemble(ThreadVars *tv, DefragThreadCtx *dtc, DefragTracker *tracker,
+    Packet *p)
 {
     Packet *rp = NULL;
 
@@ -387,12 +650,13 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     /* Check that we have all the data. Relies on the fact that
      * fragments are inserted if frag_offset order. */
     Frag *frag;
+    Frag *first = RB_MIN(IP_FRAGMENTS, &tracker->fragment_tree);
     int len = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
+    RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         if (frag->skip)
             continue;
 
-        if (frag == TAILQ_FIRST(&tracker->frags)) {
+        if (frag == first) {
             if (frag->offset != 0) {
                 goto done;
             }
@@ -426,7 +690,7 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     int fragmentable_len = 0;
     int ip_hdr_offset = 0;
     uint8_t next_hdr = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
+    RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
         if (frag->skip)
             continue;
         if (frag->data_len - frag->ltrim <= 0)
@@ -485,13 +749,13 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             unfragmentable_len + fragmentable_len);
 
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerFreeFragsThread(dtc, tracker);
 done:
     return rp;
 
 error_remove_tracker:
     tracker->remove = 1;
-    DefragTrackerFreeFrags(tracker);
+    DefragTrackerFreeFragsThread(dtc, tracker);
     if (rp != NULL)
         PacketFreeOrRelease(rp);
     return NULL;
@@ -604,155 +868,159 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
     tracker->timeout.tv_sec = p->ts.tv_sec + tracker->host_timeout;
     tracker->timeout.tv_usec = p->ts.tv_usec;
 
-    Frag *prev = NULL, *next;
+    Frag *prev, *next;
     int overlap = 0;
     ltrim = 0;
-    if (!TAILQ_EMPTY(&tracker->frags)) {
-        TAILQ_FOREACH(prev, &tracker->frags, next) {
-            if (prev->skip) {
-                continue;
-            }
-            next = TAILQ_NEXT(prev, next);
-
-            switch (tracker->policy) {
-            case DEFRAG_POLICY_BSD:
-                if (frag_offset < prev->offset + prev->data_len) {
-                    if (frag_offset >= prev->offset) {
-                        ltrim = prev->offset + prev->data_len - frag_offset;
-                        overlap++;
-                    }
-                    if ((next != NULL) && (frag_end > next->offset)) {
-                        next->ltrim = frag_end - next->offset;
-                        overlap++;
-                    }
-                    if ((frag_offset < prev->offset) &&
-                        (frag_end >= prev->offset + prev->data_len)) {
-                        prev->skip = 1;
-                        overlap++;
-                    }
-                    goto insert;
-                }
-                break;
-            case DEFRAG_POLICY_LINUX:
-                /* Check if new fragment overlaps the end of previous
-                 * fragment, if it does, trim the new fragment.
-                 *
-                 * Old: AAAAAAAA AAAAAAAA AAAAAAAA
-                 * New:          BBBBBBBB BBBBBBBB BBBBBBBB
-                 * Res: AAAAAAAA AAAAAAAA AAAAAAAA BBBBBBBB
-                 */
-                if (prev->offset + prev->ltrim < frag_offset + ltrim &&
-                        prev->offset + prev->data_len > frag_offset + ltrim) {
-                    ltrim += prev->offset + prev->data_len - frag_offset;
-                    overlap++;
-                }
+    /* Walk the fragments in offset order. None of the policies act on a
+     * fragment that ends before the new one starts or that starts after
+     * the new one ends, so only the fragments in between are visited. */
+    for (prev = DefragFragFirstEndingAfter(RB_ROOT(&tracker->fragment_tree), frag_offset);
+         prev != NULL && prev->offset <= frag_end;
+         prev = DefragFragNextEndingAfter(prev, frag_offset))
+    {
+        if (prev->skip) {
+            continue;
+        }
 
-                /* Check if new fragment overlaps the beginning of
-                 * previous fragment, if it does, tim the previous
-                 * fragment.
-                 *
-                 * Old:          AAAAAAAA AAAAAAAA
-                 * New: BBBBBBBB BBBBBBBB BBBBBBBB
-                 * Res: BBBBBBBB BBBBBBBB BBBBBBBB
-                 */
-                if (frag_offset + ltrim < prev->offset + prev->ltrim &&
-                        frag_end > prev->offset + prev->ltrim) {
-                    prev->ltrim += frag_end - (prev->offset + prev->ltrim);
+        switch (tracker->policy) {
+        case DEFRAG_POLICY_BSD:
+            if (frag_offset < prev->offset + prev->data_len) {
+                next = IP_FRAGMENTS_RB_NEXT(prev);
+                if (frag_offset >= prev->offset) {
+                    ltrim = prev->offset + prev->data_len - frag_offset;
                     overlap++;
                 }
-
-                /* If the new fragment completely overlaps the
-                 * previous fragment, mark the previous to be
-                 * skipped. Re-assembly would succeed without doing
-                 * this, but this will prevent the bytes from being
-                 * copied just to be overwritten. */
-                if (frag_offset + ltrim <= prev->offset + prev->ltrim &&
-                        frag_end >= prev->offset + prev->data_len) {
-                    prev->skip = 1;
-                }
-                break;
-            case DEFRAG_POLICY_WINDOWS:
-                /* If new fragment fits inside a previous fragment, drop it. */
-                if (frag_offset + ltrim >= prev->offset + ltrim &&
-                        frag_end <= prev->offset + prev->data_len) {
+                if ((next != NULL) && (frag_end > next->offset)) {
+                    next->ltrim = frag_end - next->offset;
                     overlap++;
-                    goto done;
                 }
-
-                /* If new fragment starts before and ends after
-                 * previous fragment, drop the previous fragment. */
-                if (frag_offset + ltrim < prev->offset + ltrim &&
-                        frag_end > prev->offset + prev->data_len) {
+                if ((frag_offset < prev->offset) &&
+                    (frag_end >= prev->offset + prev->data_len)) {
                     prev->skip = 1;
                     overlap++;
-                    goto insert;
                 }
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_LINUX:
+            /* Check if new fragment overlaps the end of previous
+             * fragment, if it does, trim the new fragment.
+             *
+             * Old: AAAAAAAA AAAAAAAA AAAAAAAA
+             * New:          BBBBBBBB BBBBBBBB BBBBBBBB
+             * Res: AAAAAAAA AAAAAAAA AAAAAAAA BBBBBBBB
+             */
+            if (prev->offset + prev->ltrim < frag_offset + ltrim &&
+                    prev->offset + prev->data_len > frag_offset + ltrim) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+            }
 
-                /* Check if new fragment overlaps the end of previous
-                 * fragment, if it does, trim the new fragment.
-                 *
-                 * Old: AAAAAAAA AAAAAAAA AAAAAAAA
-                 * New:          BBBBBBBB BBBBBBBB BBBBBBBB
-                 * Res: AAAAAAAA AAAAAAAA AAAAAAAA BBBBBBBB
-                 */
-                if (frag_offset + ltrim > prev->offset + prev->ltrim &&
-                        frag_offset + ltrim < prev->offset + prev->data_len) {
-                    ltrim += prev->offset + prev->data_len - frag_offset;
-                    overlap++;
-                    goto insert;
-                }
+            /* Check if new fragment overlaps the beginning of
+             * previous fragment, if it does, tim the previous
+             * fragment.
+             *
+             * Old:          AAAAAAAA AAAAAAAA
+             * New: BBBBBBBB BBBBBBBB BBBBBBBB
+             * Res: BBBBBBBB BBBBBBBB BBBBBBBB
+             */
+            if (frag_offset + ltrim < prev->offset + prev->ltrim &&
+                    frag_end > prev->offset + prev->ltrim) {
+                prev->ltrim += frag_end - (prev->offset + prev->ltrim);
+                overlap++;
+            }
+
+            /* If the new fragment completely overlaps the
+             * previous fragment, mark the previous to be
+             * skipped. Re-assembly would succeed without doing
+             * this, but this will prevent the bytes from being
+             * copied just to be overwritten. */
+            if (frag_offset + ltrim <= prev->offset + prev->ltrim &&
+                    frag_end >= prev->offset + prev->data_len) {
+                prev->skip = 1;
+            }
+            break;
+        case DEFRAG_POLICY_WINDOWS:
+            /* If new fragment fits inside a previous fragment, drop it. */
+            if (frag_offset + ltrim >= prev->offset + ltrim &&
+                    frag_end <= prev->offset + prev->data_len) {
+                overlap++;
+                goto done;
+            }
 
-                /* If new fragment starts at same offset as an
-                 * existing fragment, but ends after it, trim the new
-                 * fragment. */
-                if (frag_offset + ltrim == prev->offset + ltrim &&
-                        frag_end > prev->offset + prev->data_len) {
-                    ltrim += prev->offset + prev->data_len - frag_offset;
+            /* If new fragment starts before and ends after
+             * previous fragment, drop the previous fragment. */
+            if (frag_offset + ltrim < prev->offset + ltrim &&
+                    frag_end > prev->offset + prev->data_len) {
+                prev->skip = 1;
+                overlap++;
+                goto insert;
+            }
+
+            /* Check if new fragment overlaps the end of previous
+             * fragment, if it does, trim the new fragment.
+             *
+             * Old: AAAAAAAA AAAAAAAA AAAAAAAA
+             * New:          BBBBBBBB BBBBBBBB BBBBBBBB
+             * Res: AAAAAAAA AAAAAAAA AAAAAAAA BBBBBBBB
+             */
+            if (frag_offset + ltrim > prev->offset + prev->ltrim &&
+                    frag_offset + ltrim < prev->offset + prev->data_len) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+
+            /* If new fragment starts at same offset as an
+             * existing fragment, but ends after it, trim the new
+             * fragment. */
+            if (frag_offset + ltrim == prev->offset + ltrim &&
+                    frag_end > prev->offset + prev->data_len) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_SOLARIS:
+            if (frag_offset < prev->offset + prev->data_len) {
+                if (frag_offset >= prev->offset) {
+                    ltrim = prev->offset + prev->data_len - frag_offset;
                     overlap++;
-                    goto insert;
-                }
-                break;
-            case DEFRAG_POLICY_SOLARIS:
-                if (frag_offset < prev->offset + prev->data_len) {
-                    if (frag_offset >= prev->offset) {
-                        ltrim = prev->offset + prev->data_len - frag_offset;
-                        overlap++;
-                    }
-                    if ((frag_offset < prev->offset) &&
-                        (frag_end >= prev->offset + prev->data_len)) {
-                        prev->skip = 1;
-                        overlap++;
-                    }
-                    goto insert;
                 }
-                break;
-            case DEFRAG_POLICY_FIRST:
-                if ((frag_offset >= prev->offset) &&
-                    (frag_end <= prev->offset + prev->data_len)) {
+                if ((frag_offset < prev->offset) &&
+                    (frag_end >= prev->offset + prev->data_len)) {
+                    prev->skip = 1;
                     overlap++;
-                    goto done;
-                }
-                if (frag_offset < prev->offset) {
-                    goto insert;
                 }
-                if (frag_offset < prev->offset + prev->data_len) {
-                    ltrim = prev->offset + prev->data_len - frag_offset;
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_FIRST:
+            if ((frag_offset >= prev->offset) &&
+                (frag_end <= prev->offset + prev->data_len)) {
+                overlap++;
+                goto done;
+            }
+            if (frag_offset < prev->offset) {
+                goto insert;
+            }
+            if (frag_offset < prev->offset + prev->data_len) {
+                ltrim = prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_LAST:
+            if (frag_offset <= prev->offset) {
+                if (frag_end > prev->offset) {
+                    prev->ltrim = frag_end - prev->offset;
                     overlap++;
-                    goto insert;
-                }
-                break;
-            case DEFRAG_POLICY_LAST:
-                if (frag_offset <= prev->offset) {
-                    if (frag_end > prev->offset) {
-                        prev->ltrim = frag_end - prev->offset;
-                        overlap++;
-                    }
-                    goto insert;
                 }
-                break;
-            default:
-                break;
+                goto insert;
             }
+            break;
+        default:
+            break;
         }
     }
 
@@ -764,9 +1032,8 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    DefragThreadCtx *dtc = dtv != NULL ? dtv->defrag_tctx : NULL;
+    Frag *new = DefragFragGet(dtc);
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -777,9 +1044,7 @@ insert:
     }
     new->pkt = SCMalloc(GET_PKT_LEN(p));
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        DefragFragRelease(dtc, new);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -811,17 +1076,7 @@ insert:
     new->pcap_cnt = pcap_cnt;
 #endif
 
-    Frag *frag;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
-        if (new->offset < frag->offset)
-            break;
-    }
-    if (frag == NULL) {
-        TAILQ_INSERT_TAIL(&tracker->frags, new, next);
-    }
-    else {
-        TAILQ_INSERT_BEFORE(frag, new, next);
-    }
+    DefragFragInsert(tracker, new);
 
     if (!more_frags) {
         tracker->seen_last = 1;
@@ -829,7 +1084,7 @@ insert:
 
     if (tracker->seen_last) {
         if (tracker->af == AF_INET) {
-            r = Defrag4Reassemble(tv, tracker, p);
+            r = Defrag4Reassemble(tv, dtc, tracker, p);
             if (r != NULL && tv != NULL && dtv != NULL) {
                 StatsIncr(tv, dtv->counter_defrag_ipv4_reassembled);
                 if (pq && DecodeIPV4(tv, dtv, r, (void *)r->ip4h,
@@ -845,7 +1100,7 @@ insert:
             }
         }
         else if (tracker->af == AF_INET6) {
-            r = Defrag6Reassemble(tv, tracker, p);
+            r = Defrag6Reassemble(tv, dtc, tracker, p);
             if (r != NULL && tv != NULL && dtv != NULL) {
                 StatsIncr(tv, dtv->counter_defrag_ipv6_reassembled);
                 if (pq && DecodeIPV6(tv, dtv, r, (uint8_t *)r->ip6h,
@@ -950,7 +1205,7 @@ DefragGetOsPolicy(Packet *p)
 static DefragTracker *
 DefragGetTracker(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
-    return DefragGetTrackerFromHash(p);
+    return DefragGetTrackerFromHash(dtv != NULL ? dtv->defrag_tctx : NULL, p);
 }
 
 /**
@@ -2112,6 +2367,105 @@ static int DefragIPv4NoDataTest(void)
     PASS;
 }
 
+/**
+ * Fragments of a thread with a defrag cache come from and go back to the
+ * cache, the frag pool only sees whole batches.
+ */
+static int DefragThreadCacheTest(void)
+{
+    DecodeThreadVars dtv;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL;
+    Packet *reassembled = NULL;
+    int id = 12;
+
+    DefragInit();
+
+    memset(&dtv, 0, sizeof(dtv));
+    dtv.defrag_tctx = DefragThreadCtxAlloc();
+    FAIL_IF_NULL(dtv.defrag_tctx);
+
+    p1 = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    p2 = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+    p3 = BuildTestPacket(IPPROTO_ICMP, id, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, &dtv, p1, NULL) != NULL);
+    FAIL_IF(defrag_context->frag_pool->outstanding != DEFRAG_THREAD_FRAG_BATCH);
+    FAIL_IF(dtv.defrag_tctx->frags_cnt != DEFRAG_THREAD_FRAG_BATCH - 1);
+
+    FAIL_IF(Defrag(NULL, &dtv, p2, NULL) != NULL);
+    reassembled = Defrag(NULL, &dtv, p3, NULL);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(IPV4_GET_IPLEN(reassembled) != 39);
+
+    /* the frags went back to the cache, not to the pool */
+    FAIL_IF(defrag_context->frag_pool->outstanding != DEFRAG_THREAD_FRAG_BATCH);
+    FAIL_IF(dtv.defrag_tctx->frags_cnt != DEFRAG_THREAD_FRAG_BATCH);
+
+    DefragThreadCtxFree(dtv.defrag_tctx);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    SCFree(reassembled);
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * The thread caches together don't keep more than max-frags, and a
+ * cache shrinks when more threads start.
+ */
+static int DefragThreadCacheSizeTest(void)
+{
+    Frag *frags[32];
+    int i;
+
+    DefragInit();
+    defrag_context->max_frags = 20;
+
+    DefragThreadCtx *dtc1 = DefragThreadCtxAlloc();
+    FAIL_IF_NULL(dtc1);
+    FAIL_IF(DefragThreadCacheSize() != 20);
+
+    for (i = 0; i < 32; i++) {
+        frags[i] = DefragFragGet(dtc1);
+        FAIL_IF_NULL(frags[i]);
+    }
+    for (i = 0; i < 32; i++) {
+        DefragFragRelease(dtc1, frags[i]);
+        FAIL_IF(dtc1->frags_cnt > 20);
+    }
+
+    /* a second thread halves the cache, the first trims its cache on
+     * the next release */
+    DefragThreadCtx *dtc2 = DefragThreadCtxAlloc();
+    FAIL_IF_NULL(dtc2);
+    FAIL_IF(DefragThreadCacheSize() != 10);
+    frags[0] = DefragFragGet(dtc1);
+    FAIL_IF_NULL(frags[0]);
+    DefragFragRelease(dtc1, frags[0]);
+    FAIL_IF(dtc1->frags_cnt > 10);
+
+    /* more threads than frags: nothing is cached */
+    defrag_context->max_frags = 1;
+    frags[0] = DefragFragGet(dtc2);
+    FAIL_IF_NULL(frags[0]);
+    DefragFragRelease(dtc2, frags[0]);
+    FAIL_IF(dtc2->frags_cnt != 0);
+
+    DefragThreadCtxFree(dtc1);
+    DefragThreadCtxFree(dtc2);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    DefragDestroy();
+    PASS;
+}
+
 static int DefragIPv4TooLargeTest(void)
 {
     DefragContext *dc = NULL;
@@ -2424,6 +2778,237 @@ static int DefragTestJeremyLinux(void)
     PASS;
 }
 
+/** fragment state of the list based reference in DefragRandomOverlapTest */
+typedef struct DefragTestFrag_ {
+    uint16_t offset;
+    uint16_t data_len;
+    uint16_t ltrim;
+    uint8_t skip;
+} DefragTestFrag;
+
+static uint32_t DefragTestRand(uint32_t *state)
+{
+    /* xorshift32, so the test is the same on every platform */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/**
+ * \brief reference for the overlap handling: the list based version of
+ *        DefragInsertFrag, which walks all fragments in offset order.
+ *
+ * \retval overlap number of overlaps found
+ */
+static int DefragTestInsertRef(DefragTestFrag *frags, int *cnt, int policy,
+        uint16_t frag_offset, uint16_t data_len)
+{
+    uint16_t frag_end = frag_offset + data_len;
+    int ltrim = 0;
+    int overlap = 0;
+    int i;
+
+    for (i = 0; i < *cnt; i++) {
+        DefragTestFrag *prev = &frags[i];
+        DefragTestFrag *next = (i + 1 < *cnt) ? &frags[i + 1] : NULL;
+
+        if (prev->skip) {
+            continue;
+        }
+
+        switch (policy) {
+        case DEFRAG_POLICY_BSD:
+            if (frag_offset < prev->offset + prev->data_len) {
+                if (frag_offset >= prev->offset) {
+                    ltrim = prev->offset + prev->data_len - frag_offset;
+                    overlap++;
+                }
+                if ((next != NULL) && (frag_end > next->offset)) {
+                    next->ltrim = frag_end - next->offset;
+                    overlap++;
+                }
+                if ((frag_offset < prev->offset) &&
+                    (frag_end >= prev->offset + prev->data_len)) {
+                    prev->skip = 1;
+                    overlap++;
+                }
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_LINUX:
+            if (prev->offset + prev->ltrim < frag_offset + ltrim &&
+                    prev->offset + prev->data_len > frag_offset + ltrim) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+            }
+            if (frag_offset + ltrim < prev->offset + prev->ltrim &&
+                    frag_end > prev->offset + prev->ltrim) {
+                prev->ltrim += frag_end - (prev->offset + prev->ltrim);
+                overlap++;
+            }
+            if (frag_offset + ltrim <= prev->offset + prev->ltrim &&
+                    frag_end >= prev->offset + prev->data_len) {
+                prev->skip = 1;
+            }
+            break;
+        case DEFRAG_POLICY_WINDOWS:
+            if (frag_offset + ltrim >= prev->offset + ltrim &&
+                    frag_end <= prev->offset + prev->data_len) {
+                overlap++;
+                return overlap;
+            }
+            if (frag_offset + ltrim < prev->offset + ltrim &&
+                    frag_end > prev->offset + prev->data_len) {
+                prev->skip = 1;
+                overlap++;
+                goto insert;
+            }
+            if (frag_offset + ltrim > prev->offset + prev->ltrim &&
+                    frag_offset + ltrim < prev->offset + prev->data_len) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+            if (frag_offset + ltrim == prev->offset + ltrim &&
+                    frag_end > prev->offset + prev->data_len) {
+                ltrim += prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_SOLARIS:
+            if (frag_offset < prev->offset + prev->data_len) {
+                if (frag_offset >= prev->offset) {
+                    ltrim = prev->offset + prev->data_len - frag_offset;
+                    overlap++;
+                }
+                if ((frag_offset < prev->offset) &&
+                    (frag_end >= prev->offset + prev->data_len)) {
+                    prev->skip = 1;
+                    overlap++;
+                }
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_FIRST:
+            if ((frag_offset >= prev->offset) &&
+                (frag_end <= prev->offset + prev->data_len)) {
+                overlap++;
+                return overlap;
+            }
+            if (frag_offset < prev->offset) {
+                goto insert;
+            }
+            if (frag_offset < prev->offset + prev->data_len) {
+                ltrim = prev->offset + prev->data_len - frag_offset;
+                overlap++;
+                goto insert;
+            }
+            break;
+        case DEFRAG_POLICY_LAST:
+            if (frag_offset <= prev->offset) {
+                if (frag_end > prev->offset) {
+                    prev->ltrim = frag_end - prev->offset;
+                    overlap++;
+                }
+                goto insert;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+insert:
+    if (ltrim > data_len) {
+        return overlap;
+    }
+
+    /* insert after the fragments with a lower or the same offset */
+    DefragTestFrag new = { frag_offset + ltrim, data_len - ltrim, 0, 0 };
+    for (i = 0; i < *cnt; i++) {
+        if (new.offset < frags[i].offset)
+            break;
+    }
+    memmove(&frags[i + 1], &frags[i], (*cnt - i) * sizeof(DefragTestFrag));
+    frags[i] = new;
+    (*cnt)++;
+    return overlap;
+}
+
+/**
+ * Insert random, overlapping fragments under every policy and compare
+ * the fragments kept in the tree and the overlap events with the list
+ * based reference, which visits every fragment.
+ */
+static int DefragRandomOverlapTest(void)
+{
+#define DEFRAG_TEST_ROUNDS  200
+#define DEFRAG_TEST_FRAGS   16
+    static const int policies[] = {
+        DEFRAG_POLICY_FIRST, DEFRAG_POLICY_LAST, DEFRAG_POLICY_BSD,
+        DEFRAG_POLICY_BSD_RIGHT, DEFRAG_POLICY_LINUX,
+        DEFRAG_POLICY_WINDOWS, DEFRAG_POLICY_SOLARIS,
+    };
+    uint32_t seed = 0x5eed1234;
+    size_t pol;
+
+    for (pol = 0; pol < sizeof(policies) / sizeof(policies[0]); pol++) {
+        DefragInit();
+        default_policy = policies[pol];
+
+        for (int round = 0; round < DEFRAG_TEST_ROUNDS; round++) {
+            DefragTestFrag ref[DEFRAG_TEST_FRAGS];
+            int ref_cnt = 0;
+            Packet *p = NULL;
+            const uint16_t id = (uint16_t)(round + 1);
+            const int nfrags = 2 + DefragTestRand(&seed) % (DEFRAG_TEST_FRAGS - 1);
+
+            for (int i = 0; i < nfrags; i++) {
+                /* offsets 0-248 and lengths 8-64, in 8 byte units */
+                const uint16_t off = DefragTestRand(&seed) % 32;
+                const int len = 8 * (1 + DefragTestRand(&seed) % 8);
+
+                if (p != NULL)
+                    SCFree(p);
+                /* more fragments is always set, so nothing is reassembled
+                 * and the tracker keeps all fragments */
+                p = BuildTestPacket(IPPROTO_ICMP, id, off, 1, 'A' + i, len);
+                FAIL_IF_NULL(p);
+                FAIL_IF_NOT_NULL(Defrag(NULL, NULL, p, NULL));
+
+                int overlap = DefragTestInsertRef(ref, &ref_cnt,
+                        default_policy, off << 3, len);
+                FAIL_IF(!!overlap != !!ENGINE_ISSET_EVENT(p, IPV4_FRAG_OVERLAP));
+            }
+
+            DefragTracker *tracker = DefragGetTracker(NULL, NULL, p);
+            FAIL_IF_NULL(tracker);
+            Frag *frag;
+            int i = 0;
+            RB_FOREACH(frag, IP_FRAGMENTS, &tracker->fragment_tree) {
+                FAIL_IF(i >= ref_cnt);
+                FAIL_IF(frag->offset != ref[i].offset);
+                FAIL_IF(frag->data_len != ref[i].data_len);
+                FAIL_IF(frag->ltrim != ref[i].ltrim);
+                FAIL_IF(!!frag->skip != !!ref[i].skip);
+                i++;
+            }
+            FAIL_IF(i != ref_cnt);
+            DefragTrackerRelease(tracker);
+            SCFree(p);
+        }
+
+        DefragDestroy();
+    }
+    PASS;
+#undef DEFRAG_TEST_ROUNDS
+#undef DEFRAG_TEST_FRAGS
+}
+
 #endif /* UNITTESTS */
 
 void DefragRegisterTests(void)
@@ -2465,8 +3050,11 @@ void DefragRegisterTests(void)
     UtRegisterTest("DefragTimeoutTest", DefragTimeoutTest);
     UtRegisterTest("DefragMfIpv4Test", DefragMfIpv4Test);
     UtRegisterTest("DefragMfIpv6Test", DefragMfIpv6Test);
+    UtRegisterTest("DefragThreadCacheTest", DefragThreadCacheTest);
+    UtRegisterTest("DefragThreadCacheSizeTest", DefragThreadCacheSizeTest);
     UtRegisterTest("DefragTestBadProto", DefragTestBadProto);
 
     UtRegisterTest("DefragTestJeremyLinux", DefragTestJeremyLinux);
+    UtRegisterTest("DefragRandomOverlapTest", DefragRandomOverlapTest);
 #endif /* UNITTESTS */
 }
@@ -24,6 +24,7 @@
 #ifndef __DEFRAG_H__
 #define __DEFRAG_H__
 
+#include "tree.h"
 #include "util-pool.h"
 
 /**
@@ -33,6 +34,10 @@
 typedef struct DefragContext_ {
     Pool *frag_pool; /**< Pool of fragments. */
     SCMutex frag_pool_lock;
+    uint32_t max_frags; /**< Size of the frag pool. */
+
+    /** Number of thread caches, which share max_frags. */
+    SC_ATOMIC_DECLARE(uint32_t, thread_caches);
 
     time_t timeout; /**< Default timeout. */
 } DefragContext;
@@ -68,9 +73,23 @@ typedef struct Frag_ {
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
 #endif
 
-    TAILQ_ENTRY(Frag_) next;    /**< Pointer to next fragment for tailq. */
+    uint32_t max_end;           /**< Highest offset + data_len in the
+                                 *   subtree rooted at this fragment. */
+
+    RB_ENTRY(Frag_) rb;         /**< Node in the tracker's fragment tree. */
 } Frag;
 
+/** \brief compare function for the fragment tree
+ *
+ *  Fragments are ordered by offset. Fragments with the same offset are
+ *  never equal: a new fragment is placed after the existing ones.
+ */
+int DefragRbFragCompare(struct Frag_ *a, struct Frag_ *b);
+
+/* red-black tree prototype for Frag */
+RB_HEAD(IP_FRAGMENTS, Frag_);
+RB_PROTOTYPE(IP_FRAGMENTS, Frag_, rb, DefragRbFragCompare);
+
 /**
  * A defragmentation tracker.  Used to track fragments that make up a
  * single packet.
@@ -104,7 +123,7 @@ typedef struct DefragTracker_ {
     /** use cnt, reference counter */
     SC_ATOMIC_DECLARE(unsigned int, use_cnt);
 
-    TAILQ_HEAD(frag_tailq, Frag_) frags; /**< Head of list of fragments. */
+    struct IP_FRAGMENTS fragment_tree; /**< Fragments, ordered by offset. */
 
     /** hash pointers, protected by hash row mutex/spin */
     struct DefragTracker_ *hnext;
@@ -115,12 +134,35 @@ typedef struct DefragTracker_ {
     struct DefragTracker_ *lprev;
 } DefragTracker;
 
+/** Max number of fragments a thread keeps in its cache. The cache is
+ *  further limited to max-frags divided by the number of threads. */
+#define DEFRAG_THREAD_FRAG_CACHE    256
+/** Number of fragments moved between the cache and the frag pool at once. */
+#define DEFRAG_THREAD_FRAG_BATCH    64
+/** Number of spare trackers a thread takes from the spare queue at once. */
+#define DEFRAG_THREAD_TRACKER_BATCH 16
+
+/**
+ * Per thread cache of fragments and spare trackers. Decoder threads take
+ * fragments and trackers from their cache and only go to the shared frag
+ * pool and tracker spare queue to exchange a batch, so the locks of the
+ * shared pools are taken once per batch instead of once per fragment.
+ */
+struct DefragThreadCtx_ {
+    uint32_t frags_cnt;
+    uint32_t trackers_cnt;
+    Frag *frags[DEFRAG_THREAD_FRAG_CACHE];
+    DefragTracker *trackers[DEFRAG_THREAD_TRACKER_BATCH];
+};
+
 void DefragInit(void);
 void DefragDestroy(void);
 void DefragReload(void); /**< use only in unittests */
 
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
+DefragThreadCtx *DefragThreadCtxAlloc(void);
+void DefragThreadCtxFree(DefragThreadCtx *);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *, PacketQueue *);
 void DefragRegisterTests(void);
 
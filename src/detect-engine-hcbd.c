@@ -58,6 +58,7 @@
 #include "util-unittest-helper.h"
 #include "app-layer.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-body.h"
 #include "app-layer-protos.h"
 
 #include "conf.h"
@@ -197,10 +198,18 @@ static const uint8_t *DetectEngineHCBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
         }
     }
 
+    /* the body is kept in one contiguous buffer, so it is inspected in
+     * place. If the start of the window was pruned already, inspect from
+     * the oldest data that is left. */
+    if (offset < htud->request_body.sb->stream_offset)
+        offset = htud->request_body.sb->stream_offset;
+
     StreamingBufferGetDataAtOffset(htud->request_body.sb,
             &det_ctx->hcbd[index].buffer, &det_ctx->hcbd[index].buffer_len,
             offset);
     det_ctx->hcbd[index].offset = offset;
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_http_body_zero_copy,
+            det_ctx->hcbd[index].buffer_len);
 
     /* move inspected tracker to end of the data. HtpBodyPrune will consider
      * the window sizes when freeing data */
@@ -1052,6 +1061,158 @@ libhtp:\n\
     return RunTest(steps, sig, yaml);
 }
 
+/** \test the body is inspected in place. The buffer returned points into
+ *  the streaming buffer, the prune slides are the only copies and a
+ *  window start that was pruned already is moved up to the oldest data
+ *  left. */
+static int DetectEngineHttpClientBodyZeroCopyTest01(void)
+{
+    const char yaml[] = "\
+%YAML 1.1\n\
+---\n\
+libhtp:\n\
+\n\
+  default-config:\n\
+\n\
+    http-body-inline: yes\n\
+    request-body-minimal-inspect-size: 8\n\
+    request-body-inspect-window: 4\n\
+";
+    uint8_t http_buf1[] =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: www.openinfosecfoundation.org\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 30\r\n"
+        "\r\n"
+        "0123456789";
+    uint8_t http_buf2[] = "abcdefghij";
+    uint8_t http_buf3[] = "klmnopqrst";
+    TcpSession ssn;
+    Flow f;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    const uint8_t *buffer;
+    uint32_t buffer_len = 0;
+    uint32_t offset = 0;
+
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    ConfCreateContextBackup();
+    ConfInit();
+    HtpConfigCreateBackup();
+    ConfYamlLoadString(yaml, strlen(yaml));
+    HTPConfigure();
+    EngineModeSetIPS();
+
+    StreamTcpInitConfig(TRUE);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"x\"; http_client_body; sid:1;)"));
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+    StatsSetupPrivate(&th_v);
+
+    const uint64_t copied = HtpBodyCopiedBytes();
+
+    FLOWLOCK_WRLOCK(&f);
+    FAIL_IF(AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER,
+                http_buf1, sizeof(http_buf1) - 1) != 0);
+    FLOWLOCK_UNLOCK(&f);
+
+    HtpState *htp_state = f.alstate;
+    FAIL_IF_NULL(htp_state);
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, 0);
+    FAIL_IF_NULL(tx);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(htud);
+    StreamingBuffer *sb = htud->request_body.sb;
+    FAIL_IF_NULL(sb);
+
+    /* contiguous body: inspected where it is */
+    buffer = DetectEngineHCBDGetBufferForTX(tx, 0, de_ctx, det_ctx, &f,
+            htp_state, STREAM_TOSERVER, &buffer_len, &offset);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(buffer != sb->buf);
+    FAIL_IF(buffer_len != 10);
+    FAIL_IF(memcmp(buffer, "0123456789", 10) != 0);
+    FAIL_IF(offset != 0);
+    FAIL_IF(StatsGetLocalCounterValue(&th_v,
+                det_ctx->counter_http_body_zero_copy) != 10);
+    FAIL_IF(HtpBodyCopiedBytes() - copied != 0);
+    DetectEngineCleanHCBDBuffers(det_ctx);
+
+    /* the body of a GET isn't parsed as a file, so the parser doesn't
+     * prune it. Mark it parsed like the POST and PUT handlers would. */
+    htud->request_body.body_parsed = htud->request_body.content_len_so_far;
+
+    /* the prune before the append slides the body to offset 6, copying
+     * the 4 bytes after it. The window then starts in the kept data. */
+    FLOWLOCK_WRLOCK(&f);
+    FAIL_IF(AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER,
+                http_buf2, sizeof(http_buf2) - 1) != 0);
+    FLOWLOCK_UNLOCK(&f);
+    FAIL_IF(sb->stream_offset != 6);
+    FAIL_IF(HtpBodyCopiedBytes() - copied != 4);
+
+    buffer = DetectEngineHCBDGetBufferForTX(tx, 0, de_ctx, det_ctx, &f,
+            htp_state, STREAM_TOSERVER, &buffer_len, &offset);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(buffer != sb->buf + 3);
+    FAIL_IF(buffer_len != 11);
+    FAIL_IF(memcmp(buffer, "9abcdefghij", 11) != 0);
+    FAIL_IF(offset != 9);
+    FAIL_IF(StatsGetLocalCounterValue(&th_v,
+                det_ctx->counter_http_body_zero_copy) != 21);
+    FAIL_IF(HtpBodyCopiedBytes() - copied != 4);
+    DetectEngineCleanHCBDBuffers(det_ctx);
+
+    /* the window would start at 19, but the data before 25 is gone */
+    FLOWLOCK_WRLOCK(&f);
+    FAIL_IF(AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER,
+                http_buf3, sizeof(http_buf3) - 1) != 0);
+    FLOWLOCK_UNLOCK(&f);
+    FAIL_IF(sb->stream_offset != 16);
+    FAIL_IF(HtpBodyCopiedBytes() - copied != 8);
+    StreamingBufferSlideToOffset(sb, 25);
+
+    buffer = DetectEngineHCBDGetBufferForTX(tx, 0, de_ctx, det_ctx, &f,
+            htp_state, STREAM_TOSERVER, &buffer_len, &offset);
+    FAIL_IF_NULL(buffer);
+    FAIL_IF(buffer != sb->buf);
+    FAIL_IF(buffer_len != 5);
+    FAIL_IF(memcmp(buffer, "pqrst", 5) != 0);
+    FAIL_IF(offset != 25);
+    FAIL_IF(StatsGetLocalCounterValue(&th_v,
+                det_ctx->counter_http_body_zero_copy) != 26);
+    DetectEngineCleanHCBDBuffers(det_ctx);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    StatsThreadCleanup(&th_v);
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    HtpConfigRestoreBackup();
+    ConfRestoreContextBackup();
+    EngineModeSetIDS();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void DetectEngineHttpClientBodyRegisterTests(void)
@@ -1121,6 +1282,8 @@ void DetectEngineHttpClientBodyRegisterTests(void)
                    DetectEngineHttpClientBodyTest30);
     UtRegisterTest("DetectEngineHttpClientBodyTest31",
                    DetectEngineHttpClientBodyTest31);
+    UtRegisterTest("DetectEngineHttpClientBodyZeroCopyTest01",
+                   DetectEngineHttpClientBodyZeroCopyTest01);
 #endif /* UNITTESTS */
 
     return;
@@ -519,6 +519,8 @@ static SigNumArray *SigNumArrayNew(DetectEngineCtx *de_ctx,
 
     memset(new->array, 0, io_ctx->max_idx / 8 + 1);
     new->size = io_ctx->max_idx / 8 + 1;
+    new->first = 0;
+    new->last = new->size - 1;
 
     SCLogDebug("max idx= %u", io_ctx->max_idx);
 
@@ -544,6 +546,8 @@ static SigNumArray *SigNumArrayCopy(SigNumArray *orig)
 
     memset(new, 0, sizeof(SigNumArray));
     new->size = orig->size;
+    new->first = orig->first;
+    new->last = orig->last;
 
     new->array = SCMalloc(orig->size);
     if (new->array == NULL) {
@@ -571,6 +575,46 @@ static void SigNumArrayFree(void *tmp)
     SCFree(sna);
 }
 
+static uint32_t SigNumArrayHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const SigNumArray *sna = (SigNumArray *)data;
+    uint32_t hash = 0;
+    uint32_t u;
+
+    for (u = 0; u < sna->size; u++)
+        hash = hash * 31 + sna->array[u];
+
+    return hash % ht->array_size;
+}
+
+static char SigNumArrayCompareFunc(void *data1, uint16_t len1,
+                                   void *data2, uint16_t len2)
+{
+    const SigNumArray *sna1 = (SigNumArray *)data1;
+    const SigNumArray *sna2 = (SigNumArray *)data2;
+
+    return (sna1->size == sna2->size &&
+            memcmp(sna1->array, sna2->array, sna1->size) == 0);
+}
+
+/**
+ * \brief Limit first and last of a SigNumArray to the bytes with bits set
+ */
+static void SigNumArraySetBounds(SigNumArray *sna)
+{
+    uint32_t u;
+
+    sna->first = sna->size;
+    sna->last = 0;
+    for (u = 0; u < sna->size; u++) {
+        if (sna->array[u] != 0) {
+            if (sna->first == sna->size)
+                sna->first = u;
+            sna->last = u;
+        }
+    }
+}
+
 /**
  * \brief This function parses and return a list of IPOnlyCIDRItem
  *
@@ -924,6 +968,20 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
         SCRadixReleaseRadixTree(io_ctx->tree_ipv6dst);
     io_ctx->tree_ipv6dst = NULL;
 
+    /* the compact trees don't own their SigNumArrays, sna_hash does */
+    SCRadixCompactReleaseTree(io_ctx->compact_ipv4src);
+    io_ctx->compact_ipv4src = NULL;
+    SCRadixCompactReleaseTree(io_ctx->compact_ipv4dst);
+    io_ctx->compact_ipv4dst = NULL;
+    SCRadixCompactReleaseTree(io_ctx->compact_ipv6src);
+    io_ctx->compact_ipv6src = NULL;
+    SCRadixCompactReleaseTree(io_ctx->compact_ipv6dst);
+    io_ctx->compact_ipv6dst = NULL;
+
+    if (io_ctx->sna_hash != NULL)
+        HashListTableFree(io_ctx->sna_hash);
+    io_ctx->sna_hash = NULL;
+
     if (io_ctx->sig_init_array)
         SCFree(io_ctx->sig_init_array);
     io_ctx->sig_init_array = NULL;
@@ -984,18 +1042,34 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     void *user_data_src = NULL, *user_data_dst = NULL;
 
     if (p->src.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
+        if (io_ctx->compact_ipv4src != NULL)
+            (void)SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
+                                                     io_ctx->compact_ipv4src, &user_data_src);
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
                                               io_ctx->tree_ipv4src, &user_data_src);
     } else if (p->src.family == AF_INET6) {
-        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
+        if (io_ctx->compact_ipv6src != NULL)
+            (void)SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
+                                                     io_ctx->compact_ipv6src, &user_data_src);
+        else
+            (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
                                               io_ctx->tree_ipv6src, &user_data_src);
     }
 
     if (p->dst.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
+        if (io_ctx->compact_ipv4dst != NULL)
+            (void)SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
+                                                     io_ctx->compact_ipv4dst, &user_data_dst);
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
                                               io_ctx->tree_ipv4dst, &user_data_dst);
     } else if (p->dst.family == AF_INET6) {
-        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
+        if (io_ctx->compact_ipv6dst != NULL)
+            (void)SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
+                                                     io_ctx->compact_ipv6dst, &user_data_dst);
+        else
+            (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
                                               io_ctx->tree_ipv6dst, &user_data_dst);
     }
 
@@ -1005,8 +1079,10 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     if (src == NULL || dst == NULL)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
+    /* only the bytes where both arrays can have bits set */
+    uint32_t u = MAX(src->first, dst->first);
+    const uint32_t last = MIN(src->last, dst->last);
+    for ( ; u <= last; u++) {
         SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
 
         /* The final results will be at io_tctx */
@@ -1104,6 +1180,100 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     }
 }
 
+/**
+ * \brief Compile a radix tree into a compact tree, sharing the SigNumArrays
+ *
+ * Many prefixes end up with the same signatures, their SigNumArrays are
+ * replaced by a single copy kept in sna_hash. Neighbouring address ranges
+ * that now share a SigNumArray are merged. If the tree can't be compiled
+ * the radix tree is kept.
+ *
+ * \param io_ctx Pointer to the current ip only detection engine
+ * \param tree Pointer to the radix tree, set to NULL if it was compiled
+ * \param key_bitlen 32 for an IPv4 tree, 128 for an IPv6 tree
+ *
+ * \retval t compact tree or NULL
+ */
+static SCRadixCompactTree *IPOnlyCompileTree(DetectEngineIPOnlyCtx *io_ctx,
+                                             SCRadixTree **tree,
+                                             uint16_t key_bitlen)
+{
+    SCRadixCompactTree *t = SCRadixCompactCompileTree(*tree, key_bitlen);
+    if (t == NULL)
+        return NULL;
+    *tree = NULL;
+
+    uint32_t i;
+    for (i = 1; i <= t->user_cnt; i++) {
+        SigNumArray *sna = (SigNumArray *)t->user[i];
+        if (sna == NULL)
+            continue;
+
+        SigNumArray *shared = HashListTableLookup(io_ctx->sna_hash, sna, 0);
+        if (shared == sna)
+            continue;
+        if (shared != NULL) {
+            SigNumArrayFree(sna);
+            t->user[i] = shared;
+        } else {
+            SigNumArraySetBounds(sna);
+            if (HashListTableAdd(io_ctx->sna_hash, sna, 0) != 0) {
+                SCLogError(SC_ERR_FATAL, "Fatal error encountered in "
+                        "IPOnlyCompileTree. Exiting...");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    t->Free = NULL;
+
+    SCRadixCompactMergeRanges(t);
+    return t;
+}
+
+/**
+ * \brief Replace the radix trees by compact trees
+ *
+ * \param de_ctx Pointer to the current detection engine
+ */
+static void IPOnlyCompileTrees(DetectEngineCtx *de_ctx)
+{
+    DetectEngineIPOnlyCtx *io_ctx = &de_ctx->io_ctx;
+
+    io_ctx->sna_hash = HashListTableInit(4096, SigNumArrayHashFunc,
+                                         SigNumArrayCompareFunc,
+                                         SigNumArrayFree);
+    if (io_ctx->sna_hash == NULL)
+        return;
+
+    io_ctx->compact_ipv4src = IPOnlyCompileTree(io_ctx, &io_ctx->tree_ipv4src, 32);
+    io_ctx->compact_ipv4dst = IPOnlyCompileTree(io_ctx, &io_ctx->tree_ipv4dst, 32);
+    io_ctx->compact_ipv6src = IPOnlyCompileTree(io_ctx, &io_ctx->tree_ipv6src, 128);
+    io_ctx->compact_ipv6dst = IPOnlyCompileTree(io_ctx, &io_ctx->tree_ipv6dst, 128);
+
+    uint32_t ranges = 0;
+    uint64_t memuse = 0;
+    SCRadixCompactTree *trees[4] = { io_ctx->compact_ipv4src, io_ctx->compact_ipv4dst,
+                                     io_ctx->compact_ipv6src, io_ctx->compact_ipv6dst };
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (trees[i] != NULL) {
+            ranges += trees[i]->ranges_cnt;
+            memuse += trees[i]->memuse;
+        }
+    }
+
+    uint32_t snas = 0;
+    HashListTableBucket *hb = HashListTableGetListHead(io_ctx->sna_hash);
+    for ( ; hb != NULL; hb = HashListTableGetListNext(hb)) {
+        SigNumArray *sna = HashListTableGetListData(hb);
+        memuse += sizeof(SigNumArray) + sna->size;
+        snas++;
+    }
+
+    SCLogPerf("IP-only: %u address ranges, %u unique signature sets, "
+            "%"PRIu64" bytes", ranges, snas, memuse);
+}
+
 /**
  * \brief Build the radix trees from the lists of parsed adresses in CIDR format
  *        the result should be 4 radix trees: src/dst ipv4 and src/dst ipv6
@@ -1521,6 +1691,8 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv6dst);
     SCLogDebug("__________________");
     */
+
+    IPOnlyCompileTrees(de_ctx);
 }
 
 /**
@@ -2252,6 +2424,67 @@ static int IPOnlyTestSig17(void)
     return result;
 }
 
+/**
+ * \test check that the compiled trees match like the radix trees and that
+ *       prefixes with the same signatures share their SigNumArray
+ */
+static int IPOnlyTestSig18(void)
+{
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+
+    Packet *p[3];
+    p[0] = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, "192.168.1.1", "10.1.1.1");
+    p[1] = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, "192.168.2.1", "10.2.0.1");
+    p[2] = UTHBuildPacketSrcDst(buf, buflen, IPPROTO_TCP, "1.2.3.5", "8.8.8.8");
+    FAIL_IF(p[0] == NULL || p[1] == NULL || p[2] == NULL);
+
+    const char *sigs[5];
+    sigs[0] = "alert ip 192.168.0.0/16 any -> any any (sid:1;)";
+    sigs[1] = "alert ip 192.168.1.0/24 any -> any any (sid:2;)";
+    sigs[2] = "alert ip 192.168.0.0/16 any -> 10.0.0.0/8 any (sid:3;)";
+    sigs[3] = "alert ip any any -> 10.1.0.0/16 any (sid:4;)";
+    sigs[4] = "alert ip [1.2.3.4,1.2.3.5] any -> any any (sid:5;)";
+
+    uint32_t sid[5] = { 1, 2, 3, 4, 5 };
+    uint32_t results[3][5] = {
+        { 1, 1, 1, 1, 0 },
+        { 1, 0, 1, 0, 0 },
+        { 0, 0, 0, 0, 1 } };
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF(de_ctx == NULL);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF(UTHAppendSigs(de_ctx, sigs, 5) == 0);
+    FAIL_IF(UTHMatchPacketsWithResults(de_ctx, p, 3, sid,
+                (uint32_t *)results, 5) == 0);
+
+    DetectEngineIPOnlyCtx *io_ctx = &de_ctx->io_ctx;
+    FAIL_IF(io_ctx->compact_ipv4src == NULL);
+    FAIL_IF(io_ctx->compact_ipv4dst == NULL);
+    FAIL_IF(io_ctx->tree_ipv4src != NULL);
+    FAIL_IF(io_ctx->tree_ipv4dst != NULL);
+    FAIL_IF(io_ctx->sna_hash == NULL);
+
+    /* 1.2.3.4 and 1.2.3.5 have the same signatures and are merged */
+    void *user1 = NULL, *user2 = NULL;
+    uint8_t a1[4] = { 1, 2, 3, 4 };
+    uint8_t a2[4] = { 1, 2, 3, 5 };
+    FAIL_IF(SCRadixCompactFindKeyIPV4BestMatch(a1, io_ctx->compact_ipv4src, &user1) == 0);
+    FAIL_IF(SCRadixCompactFindKeyIPV4BestMatch(a2, io_ctx->compact_ipv4src, &user2) == 0);
+    FAIL_IF(user1 != user2);
+
+    SigNumArray *sna = user1;
+    FAIL_IF(sna->first > sna->last);
+
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(p, 3);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void)
@@ -2287,6 +2520,7 @@ void IPOnlyRegisterTests(void)
     UtRegisterTest("IPOnlyTestSig16", IPOnlyTestSig16);
 
     UtRegisterTest("IPOnlyTestSig17", IPOnlyTestSig17);
+    UtRegisterTest("IPOnlyTestSig18", IPOnlyTestSig18);
 #endif
 
     return;
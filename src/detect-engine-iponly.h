@@ -33,6 +33,10 @@
 typedef struct SigNumArray_ {
     uint8_t *array; /* bit array of sig nums */
     uint32_t size;  /* size in bytes of the array */
+    /* first and last byte of the array that can have bits set,
+     * first > last if none are set */
+    uint32_t first;
+    uint32_t last;
 } SigNumArray;
 
 void IPOnlyCIDRListFree(IPOnlyCIDRItem *tmphead);
@@ -41,7 +41,9 @@
  *
  * After the engines have run the resulting list of match candidates is
  * sorted by the rule id's so that the individual inspection happens in
- * the correct order.
+ * the correct order. Depending on the number of candidates and the range
+ * of rule id's they cover this uses a quicksort, a per thread bitmap of
+ * the rule id's or a radix sort.
  */
 
 #include "suricata-common.h"
@@ -88,6 +90,139 @@ static inline void QuickSortSigIntId(SigIntId *sids, uint32_t n)
     QuickSortSigIntId(l, sids + n - l);
 }
 
+/** candidate lists up to this size are sorted using quicksort */
+#define PREFILTER_SORT_QSORT_MAX    64
+/** candidate lists from this size are radix sorted if the bitmap
+ *  doesn't fit them */
+#define PREFILTER_SORT_RADIX_MIN    1024
+
+/** \internal
+ *  \brief sort and dedup the candidates using the thread's bitmap
+ *
+ *  Only the part of the bitmap between the lowest and highest id is
+ *  walked. The bitmap is left cleared. */
+static void PrefilterSortBitmap(uint64_t *bitmap, PrefilterRuleStore *pmq,
+        const SigIntId min, const SigIntId max)
+{
+    SigIntId *sids = pmq->rule_id_array;
+    uint32_t i;
+    for (i = 0; i < pmq->rule_id_array_cnt; i++) {
+        bitmap[sids[i] / 64] |= (1ULL << (sids[i] % 64));
+    }
+
+    uint32_t cnt = 0;
+    uint32_t w;
+    for (w = min / 64; w <= (uint32_t)max / 64; w++) {
+        uint64_t word = bitmap[w];
+        if (word == 0)
+            continue;
+        bitmap[w] = 0;
+        do {
+            const uint32_t bit = __builtin_ctzll(word);
+            sids[cnt++] = (SigIntId)(w * 64 + bit);
+            word &= word - 1;
+        } while (word != 0);
+    }
+    pmq->rule_id_array_cnt = cnt;
+}
+
+/** \internal
+ *  \brief LSD radix sort with 8 bit digits over the bits that differ
+ *         between the lowest and highest id
+ *
+ *  \param tmp scratch space of at least pmq->rule_id_array_cnt entries
+ */
+static void PrefilterSortRadix(SigIntId *tmp, PrefilterRuleStore *pmq,
+        const SigIntId min, const SigIntId max)
+{
+    const uint32_t n = pmq->rule_id_array_cnt;
+    SigIntId *src = pmq->rule_id_array;
+    SigIntId *dst = tmp;
+    uint32_t range = (uint32_t)(max - min);
+    uint32_t shift = 0;
+
+    do {
+        uint32_t count[256];
+        memset(count, 0, sizeof(count));
+
+        uint32_t i;
+        for (i = 0; i < n; i++)
+            count[((uint32_t)(src[i] - min) >> shift) & 0xff]++;
+        uint32_t total = 0;
+        for (i = 0; i < 256; i++) {
+            uint32_t c = count[i];
+            count[i] = total;
+            total += c;
+        }
+        for (i = 0; i < n; i++)
+            dst[count[((uint32_t)(src[i] - min) >> shift) & 0xff]++] = src[i];
+
+        SigIntId *t = src;
+        src = dst;
+        dst = t;
+        shift += 8;
+        range >>= 8;
+    } while (range != 0);
+
+    if (src != pmq->rule_id_array)
+        memcpy(pmq->rule_id_array, src, n * sizeof(SigIntId));
+}
+
+/** \internal
+ *  \brief sort the candidates in the rule store, picking the method
+ *         based on the number of candidates and the range of ids
+ *
+ *  \retval method the PREFILTER_SORT_* method that was used
+ */
+static int PrefilterSortCandidates(DetectEngineThreadCtx *det_ctx,
+        PrefilterRuleStore *pmq)
+{
+    const uint32_t n = pmq->rule_id_array_cnt;
+    if (n <= 1)
+        return PREFILTER_SORT_NONE;
+    if (n <= PREFILTER_SORT_QSORT_MAX) {
+        QuickSortSigIntId(pmq->rule_id_array, n);
+        return PREFILTER_SORT_QSORT;
+    }
+
+    SigIntId min = pmq->rule_id_array[0];
+    SigIntId max = min;
+    uint32_t i;
+    for (i = 1; i < n; i++) {
+        const SigIntId id = pmq->rule_id_array[i];
+        if (id < min)
+            min = id;
+        else if (id > max)
+            max = id;
+    }
+
+    /* walking the bitmap costs a word per 64 ids, so use it as long as
+     * that doesn't exceed the number of candidates */
+    const uint32_t words = (uint32_t)max / 64 - (uint32_t)min / 64 + 1;
+    if (det_ctx->pf_bitmap != NULL && words <= n) {
+        PrefilterSortBitmap(det_ctx->pf_bitmap, pmq, min, max);
+        return PREFILTER_SORT_BITMAP;
+    }
+
+    if (n >= PREFILTER_SORT_RADIX_MIN) {
+        if (det_ctx->pf_radix_tmp_size < pmq->rule_id_array_size) {
+            SigIntId *tmp = SCRealloc(det_ctx->pf_radix_tmp,
+                    pmq->rule_id_array_size * sizeof(SigIntId));
+            if (tmp != NULL) {
+                det_ctx->pf_radix_tmp = tmp;
+                det_ctx->pf_radix_tmp_size = pmq->rule_id_array_size;
+            }
+        }
+        if (det_ctx->pf_radix_tmp_size >= n) {
+            PrefilterSortRadix(det_ctx->pf_radix_tmp, pmq, min, max);
+            return PREFILTER_SORT_RADIX;
+        }
+    }
+
+    QuickSortSigIntId(pmq->rule_id_array, n);
+    return PREFILTER_SORT_QSORT;
+}
+
 static inline void PrefilterTx(DetectEngineThreadCtx *det_ctx,
         const SigGroupHead *sgh, Packet *p, const uint8_t flags)
 {
@@ -112,11 +247,18 @@ static inline void PrefilterTx(DetectEngineThreadCtx *det_ctx,
         }
     }
 
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(ipproto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
     /* run our engines against each tx */
-    for (; idx < total_txs; idx++) {
-        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, idx);
-        if (tx == NULL)
-            continue;
+    while (idx < total_txs) {
+        AppLayerGetTxIterTuple ires = IterFunc(ipproto, alproto, alstate,
+                idx, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            break;
+        void * const tx = ires.tx_ptr;
+        idx = ires.tx_id;
 
         uint64_t mpm_ids = AppLayerParserGetTxMpmIDs(ipproto, alproto, tx);
         const int tx_progress = AppLayerParserGetStateProgress(ipproto, alproto, tx, flags);
@@ -152,6 +294,9 @@ static inline void PrefilterTx(DetectEngineThreadCtx *det_ctx,
             //SCLogNotice("tx %p Mpm IDs: %"PRIx64, tx, mpm_ids);
             AppLayerParserSetTxMpmIDs(ipproto, alproto, tx, mpm_ids);
         }
+        if (!ires.has_next)
+            break;
+        idx++;
     }
 }
 
@@ -208,13 +353,27 @@ void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
         }
     }
 
+#ifdef PROFILING
+    det_ctx->pf_candidates_cnt = det_ctx->pmq.rule_id_array_cnt;
+#endif
     /* Sort the rule list to lets look at pmq.
-     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries */
+     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries,
+     * the bitmap sort removes them, the others leave them in place. */
     if (likely(det_ctx->pmq.rule_id_array_cnt > 1)) {
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_PF_SORT1);
-        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+        int method = PrefilterSortCandidates(det_ctx, &det_ctx->pmq);
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_PF_SORT1);
+#ifdef PROFILING
+        det_ctx->pf_sort_method = (uint8_t)method;
+#else
+        (void)method;
+#endif
+    }
+#ifdef PROFILING
+    else {
+        det_ctx->pf_sort_method = PREFILTER_SORT_NONE;
     }
+#endif
 }
 
 int PrefilterAppendEngine(SigGroupHead *sgh,
@@ -607,3 +766,73 @@ const char *PrefilterStoreGetName(const uint32_t id)
     return name;
 }
 #endif
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+static int PrefilterSortIsOrdered(const PrefilterRuleStore *pmq, int unique)
+{
+    uint32_t i;
+    for (i = 1; i < pmq->rule_id_array_cnt; i++) {
+        if (pmq->rule_id_array[i - 1] > pmq->rule_id_array[i])
+            return 0;
+        if (unique && pmq->rule_id_array[i - 1] == pmq->rule_id_array[i])
+            return 0;
+    }
+    return 1;
+}
+
+/** \test candidate ordering picks bitmap for dense and radix for
+ *        sparse large candidate sets, both giving ordered output */
+static int PrefilterSortTest01(void)
+{
+    const uint32_t max_sids = 200000;
+    DetectEngineThreadCtx det_ctx;
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    det_ctx.pf_bitmap = SCCalloc((max_sids + 63) / 64, sizeof(uint64_t));
+    FAIL_IF_NULL(det_ctx.pf_bitmap);
+
+    PrefilterRuleStore pmq;
+    FAIL_IF(PmqSetup(&pmq) != 0);
+
+    SigIntId sids[2000];
+    uint32_t i;
+
+    /* dense: every id in 1000..1999 twice, in reverse order */
+    for (i = 0; i < 2000; i++) {
+        sids[i] = (SigIntId)(1999 - i / 2);
+    }
+    PrefilterAddSids(&pmq, sids, 2000);
+    FAIL_IF(PrefilterSortCandidates(&det_ctx, &pmq) != PREFILTER_SORT_BITMAP);
+    FAIL_IF(pmq.rule_id_array_cnt != 1000);
+    FAIL_IF(pmq.rule_id_array[0] != 1000);
+    FAIL_IF(!PrefilterSortIsOrdered(&pmq, 1));
+    /* bitmap is left cleared */
+    uint32_t w;
+    for (w = 0; w < (max_sids + 63) / 64; w++) {
+        FAIL_IF(det_ctx.pf_bitmap[w] != 0);
+    }
+
+    /* sparse: 2000 ids spread over the full range */
+    PmqReset(&pmq);
+    for (i = 0; i < 2000; i++) {
+        sids[i] = (SigIntId)((i * 7919) % max_sids);
+    }
+    PrefilterAddSids(&pmq, sids, 2000);
+    FAIL_IF(PrefilterSortCandidates(&det_ctx, &pmq) != PREFILTER_SORT_RADIX);
+    FAIL_IF(pmq.rule_id_array_cnt != 2000);
+    FAIL_IF(!PrefilterSortIsOrdered(&pmq, 0));
+
+    PmqFree(&pmq);
+    SCFree(det_ctx.pf_bitmap);
+    SCFree(det_ctx.pf_radix_tmp);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PrefilterSortTest01", PrefilterSortTest01);
+#endif /* UNITTESTS */
+}
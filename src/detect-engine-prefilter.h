@@ -24,6 +24,14 @@
 #ifndef __DETECT_ENGINE_PREFILTER_H__
 #define __DETECT_ENGINE_PREFILTER_H__
 
+/** method used to order the prefilter candidates */
+enum {
+    PREFILTER_SORT_NONE = 0,
+    PREFILTER_SORT_QSORT,
+    PREFILTER_SORT_BITMAP,
+    PREFILTER_SORT_RADIX,
+};
+
 void Prefilter(DetectEngineThreadCtx *, const SigGroupHead *, Packet *p,
         const uint8_t flags, const bool has_state);
 
@@ -52,4 +60,6 @@ void PrefilterCleanupRuleGroup(SigGroupHead *sgh);
 const char *PrefilterStoreGetName(const uint32_t id);
 #endif
 
+void PrefilterRegisterTests(void);
+
 #endif
@@ -22,11 +22,12 @@
  * This is done by this code. It uses the ::Flow structure to store
  * the list of signatures to match on the reconstructed stream.
  *
- * The Flow::de_state is a ::DetectEngineState structure. This is
- * basically a containter for storage item of type ::DeStateStore.
- * They contains an array of ::DeStateStoreItem which store the
+ * The Flow::de_state is a ::DetectEngineState structure. Per direction
+ * it contains an array of ::DeStateStoreItem which store the
  * state of match for an individual signature identified by
- * DeStateStoreItem::sid.
+ * DeStateStoreItem::sid. The first few items are stored inline, the
+ * items of signatures that are done with the tx are kept at the end of
+ * the array so that continuing detection only inspects the others.
  *
  * The state is constructed by DeStateDetectStartDetection() which
  * also starts the matching. Work is continued by
@@ -76,6 +77,8 @@
 #include "util-unittest-helper.h"
 #include "util-profiling.h"
 
+#include "counters.h"
+
 #include "flow-util.h"
 
 /** convert enum to string */
@@ -93,6 +96,11 @@
  */
 #define MAX_STORED_TXID_OFFSET 127
 
+/** memory used by DetectEngineState's and their stores */
+SC_ATOMIC_DECLARE(uint64_t, de_state_memuse);
+/** number of DetectEngineState's */
+SC_ATOMIC_DECLARE(uint64_t, de_state_cnt);
+
 /******** static internal helpers *********/
 
 static inline int StateIsValid(uint16_t alproto, void *alstate)
@@ -117,36 +125,69 @@ static inline int TxIsLast(uint64_t tx_id, uint64_t total_txs)
     return 0;
 }
 
-static DeStateStore *DeStateStoreAlloc(void)
+/** \internal
+ *  \brief get the tx right after tx_id, if it exists
+ *
+ *  Uses a copy of the iterator state so the caller's walk isn't affected.
+ */
+static inline void *DeStatePeekNextTx(AppLayerGetTxIteratorFunc IterFunc,
+        const Flow *f, const AppProto alproto, void *alstate,
+        const uint64_t tx_id, const AppLayerGetTxIterState *state)
 {
-    DeStateStore *d = SCMalloc(sizeof(DeStateStore));
-    if (unlikely(d == NULL))
-        return NULL;
-    memset(d, 0, sizeof(DeStateStore));
+    AppLayerGetTxIterState next_state = *state;
+    AppLayerGetTxIterTuple next = IterFunc(f->proto, alproto, alstate,
+            tx_id + 1, tx_id + 2, &next_state);
+    return next.tx_ptr;
+}
 
-    return d;
+/** \internal
+ *  \brief double the size of the store of a direction
+ *
+ *  The first time the inline items are moved to an allocated store.
+ */
+static int DeStateStoreGrow(DetectEngineStateDirection *dir_state)
+{
+    const SigIntId size = dir_state->size * 2;
+    DeStateStoreItem *store;
+
+    if (dir_state->store == dir_state->inline_store) {
+        store = SCMalloc(size * sizeof(DeStateStoreItem));
+        if (unlikely(store == NULL))
+            return -1;
+        memcpy(store, dir_state->inline_store,
+                dir_state->cnt * sizeof(DeStateStoreItem));
+        (void)SC_ATOMIC_ADD(de_state_memuse, size * sizeof(DeStateStoreItem));
+    } else {
+        store = SCRealloc(dir_state->store, size * sizeof(DeStateStoreItem));
+        if (unlikely(store == NULL))
+            return -1;
+        (void)SC_ATOMIC_ADD(de_state_memuse,
+                (size - dir_state->size) * sizeof(DeStateStoreItem));
+    }
+
+    dir_state->store = store;
+    dir_state->size = size;
+    return 0;
+}
+
+static inline void DeStateStoreItemSwap(DeStateStoreItem *a, DeStateStoreItem *b)
+{
+    DeStateStoreItem tmp = *a;
+    *a = *b;
+    *b = tmp;
 }
 
 static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIntId num)
 {
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
-    DeStateStore *tx_store = dir_state->head;
-    SigIntId store_cnt;
-    SigIntId state_cnt = 0;
-
-    for (; tx_store != NULL; tx_store = tx_store->next) {
-        SCLogDebug("tx_store %p", tx_store);
-        for (store_cnt = 0;
-             store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
-             store_cnt++, state_cnt++)
-        {
-            DeStateStoreItem *item = &tx_store->store[store_cnt];
-            if (item->sid == num) {
-                SCLogDebug("sid %u already in state: %p %p %p %u %u, direction %s",
-                            num, state, dir_state, tx_store, state_cnt,
-                            store_cnt, direction & STREAM_TOSERVER ? "toserver" : "toclient");
-                return 1;
-            }
+    SigIntId i;
+
+    for (i = 0; i < dir_state->cnt; i++) {
+        if (dir_state->store[i].sid == num) {
+            SCLogDebug("sid %u already in state: %p %p %u, direction %s",
+                        num, state, dir_state, i,
+                        direction & STREAM_TOSERVER ? "toserver" : "toclient");
+            return 1;
         }
     }
     return 0;
@@ -155,42 +196,25 @@ static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIn
 static void DeStateSignatureAppend(DetectEngineState *state,
         const Signature *s, uint32_t inspect_flags, uint8_t direction)
 {
-    int jump = 0;
-    int i = 0;
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
 
 #ifdef DEBUG_VALIDATION
     BUG_ON(DeStateSearchState(state, direction, s->num));
 #endif
-    DeStateStore *store = dir_state->head;
-
-    if (store == NULL) {
-        store = DeStateStoreAlloc();
-        if (store != NULL) {
-            dir_state->head = store;
-            dir_state->tail = store;
-        }
-    } else {
-        jump = dir_state->cnt / DE_STATE_CHUNK_SIZE;
-        for (i = 0; i < jump; i++) {
-            store = store->next;
-        }
-        if (store == NULL) {
-            store = DeStateStoreAlloc();
-            if (store != NULL) {
-                dir_state->tail->next = store;
-                dir_state->tail = store;
-            }
-        }
+    if (dir_state->cnt == dir_state->size) {
+        if (DeStateStoreGrow(dir_state) < 0)
+            return;
     }
 
-    if (store == NULL)
-        return;
-
-    SigIntId idx = dir_state->cnt++ % DE_STATE_CHUNK_SIZE;
-    store->store[idx].sid = s->num;
-    store->store[idx].flags = inspect_flags;
+    DeStateStoreItem *item = &dir_state->store[dir_state->cnt++];
+    item->sid = s->num;
+    item->flags = inspect_flags;
 
+    /* keep the items that still need inspection in front */
+    if (!(inspect_flags & DE_STATE_FLAG_DONE)) {
+        DeStateStoreItemSwap(item, &dir_state->store[dir_state->active_cnt]);
+        dir_state->active_cnt++;
+    }
     return;
 }
 
@@ -216,25 +240,32 @@ DetectEngineState *DetectEngineStateAlloc(void)
         return NULL;
     memset(d, 0, sizeof(DetectEngineState));
 
+    int i;
+    for (i = 0; i < 2; i++) {
+        d->dir_state[i].store = d->dir_state[i].inline_store;
+        d->dir_state[i].size = DE_STATE_INLINE_SIZE;
+    }
+
+    (void)SC_ATOMIC_ADD(de_state_memuse, sizeof(DetectEngineState));
+    (void)SC_ATOMIC_ADD(de_state_cnt, 1);
     return d;
 }
 
 void DetectEngineStateFree(DetectEngineState *state)
 {
-    DeStateStore *store;
-    DeStateStore *store_next;
+    uint64_t memuse = sizeof(DetectEngineState);
     int i = 0;
 
     for (i = 0; i < 2; i++) {
-        store = state->dir_state[i].head;
-        while (store != NULL) {
-            store_next = store->next;
-            SCFree(store);
-            store = store_next;
+        if (state->dir_state[i].store != state->dir_state[i].inline_store) {
+            memuse += state->dir_state[i].size * sizeof(DeStateStoreItem);
+            SCFree(state->dir_state[i].store);
         }
     }
     SCFree(state);
 
+    (void)SC_ATOMIC_SUB(de_state_memuse, memuse);
+    (void)SC_ATOMIC_SUB(de_state_cnt, 1);
     return;
 }
 
@@ -390,13 +421,20 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
 
     SCLogDebug("starting: start tx %u, packet %u", (uint)tx_id, (uint)p->pcap_cnt);
 
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
     det_ctx->stream_already_inspected = false;
-    for (; tx_id < total_txs; tx_id++) {
+    while (tx_id < total_txs) {
         int total_matches = 0;
-        void *tx = AppLayerParserGetTx(f->proto, alproto, alstate, tx_id);
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+                tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            break;
+        void *tx = ires.tx_ptr;
+        tx_id = ires.tx_id;
         SCLogDebug("tx %p", tx);
-        if (tx == NULL)
-            continue;
         det_ctx->tx_id = tx_id;
         det_ctx->tx_id_set = 1;
         det_ctx->p = p;
@@ -406,7 +444,8 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
          * a sig to the 'no inspect array'. */
         int next_tx_no_progress = 0;
         if (!TxIsLast(tx_id, total_txs)) {
-            void *next_tx = AppLayerParserGetTx(f->proto, alproto, alstate, tx_id+1);
+            void *next_tx = DeStatePeekNextTx(IterFunc, f, alproto, alstate,
+                    tx_id, &state);
             if (next_tx != NULL) {
                 int c = AppLayerParserGetStateProgress(f->proto, alproto, next_tx, flags);
                 if (c == 0) {
@@ -502,7 +541,10 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
     try_next:
         if (next_tx_no_progress)
             break;
-    } /* for */
+        if (!ires.has_next)
+            break;
+        tx_id++;
+    } /* while */
 
     det_ctx->tx_id = 0;
     det_ctx->tx_id_set = 0;
@@ -724,14 +766,80 @@ static int DoInspectItem(ThreadVars *tv,
     return 1;
 }
 
+/** \internal
+ *  \brief de_state_sig_array value for a sig that is done with a tx
+ *
+ *  Mirrors DoInspectItem: if no newer tx needs inspection the sig is
+ *  bypassed, otherwise the offset of the next tx is stored so that
+ *  StartDetection doesn't inspect this tx again.
+ */
+static inline uint8_t DeStateDoneValue(const Flow *f, const uint8_t flags,
+        const uint64_t inspect_tx_id, const uint64_t total_txs,
+        const int inprogress, const int next_tx_no_progress)
+{
+    if (TxIsLast(inspect_tx_id, total_txs) || inprogress || next_tx_no_progress)
+        return DE_STATE_MATCH_NO_NEW_STATE;
+
+    uint64_t base_tx_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
+    uint64_t offset = (inspect_tx_id + 1) - base_tx_id;
+    if (offset > MAX_STORED_TXID_OFFSET)
+        offset = MAX_STORED_TXID_OFFSET;
+    return (uint8_t)offset;
+}
+
+/** \internal
+ *  \brief move the items that are done behind the active ones
+ *
+ *  The active items keep their order.
+ */
+static void DeStateRetireDoneItems(DetectEngineStateDirection *dir_state)
+{
+    SigIntId active_cnt = 0;
+    SigIntId i;
+
+    for (i = 0; i < dir_state->active_cnt; i++) {
+        if (dir_state->store[i].flags & DE_STATE_FLAG_DONE)
+            continue;
+        if (i != active_cnt) {
+            DeStateStoreItemSwap(&dir_state->store[i],
+                    &dir_state->store[active_cnt]);
+        }
+        active_cnt++;
+    }
+    dir_state->active_cnt = active_cnt;
+}
+
+/** \internal
+ *  \brief move the done items waiting for a new file back to the
+ *         active part of the store, DoInspectItem decides on them
+ *
+ *  The items are added behind the active ones in the order they are
+ *  found, the active items keep their order.
+ */
+static void DeStateReactivateFileItems(DetectEngineStateDirection *dir_state)
+{
+    SigIntId i;
+
+    for (i = dir_state->active_cnt; i < dir_state->cnt; i++) {
+        if (dir_state->store[i].flags &
+                (DE_STATE_FLAG_FILE_TC_INSPECT|DE_STATE_FLAG_FILE_TS_INSPECT))
+        {
+            if (i != dir_state->active_cnt) {
+                DeStateStoreItemSwap(&dir_state->store[i],
+                        &dir_state->store[dir_state->active_cnt]);
+            }
+            dir_state->active_cnt++;
+        }
+    }
+}
+
 void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
                                     DetectEngineThreadCtx *det_ctx,
                                     Packet *p, Flow *f, uint8_t flags,
                                     AppProto alproto)
 {
     uint16_t file_no_match = 0;
-    SigIntId store_cnt = 0;
-    SigIntId state_cnt = 0;
+    SigIntId i = 0;
     uint64_t inspect_tx_id = 0;
     uint64_t total_txs = 0;
     uint8_t direction = (flags & STREAM_TOSERVER) ? 0 : 1;
@@ -746,71 +854,97 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
     inspect_tx_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
     total_txs = AppLayerParserGetTxCnt(f, alstate);
 
-    for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (inspect_tx_id < total_txs) {
         int inspect_tx_inprogress = 0;
         int next_tx_no_progress = 0;
-        void *inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id);
-        if (inspect_tx != NULL) {
-            int a = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
-            int b = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
-            if (a < b) {
-                inspect_tx_inprogress = 1;
-            }
-            SCLogDebug("tx %"PRIu64" (%"PRIu64") => %s", inspect_tx_id, total_txs,
-                    inspect_tx_inprogress ? "in progress" : "done");
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+                inspect_tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            break;
+        void *inspect_tx = ires.tx_ptr;
+        inspect_tx_id = ires.tx_id;
+        int a = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
+        int b = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
+        if (a < b) {
+            inspect_tx_inprogress = 1;
+        }
+        SCLogDebug("tx %"PRIu64" (%"PRIu64") => %s", inspect_tx_id, total_txs,
+                inspect_tx_inprogress ? "in progress" : "done");
 
-            DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, alproto, inspect_tx);
-            if (tx_de_state == NULL) {
-                SCLogDebug("NO STATE tx %"PRIu64" (%"PRIu64")", inspect_tx_id, total_txs);
-                continue;
-            }
-            DetectEngineStateDirection *tx_dir_state = &tx_de_state->dir_state[direction];
-            DeStateStore *tx_store = tx_dir_state->head;
-
-            SCLogDebug("tx_dir_state->filestore_cnt %u", tx_dir_state->filestore_cnt);
-
-            /* see if we need to consider the next tx in our decision to add
-             * a sig to the 'no inspect array'. */
-            if (!TxIsLast(inspect_tx_id, total_txs)) {
-                void *next_inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id+1);
-                if (next_inspect_tx != NULL) {
-                    int c = AppLayerParserGetStateProgress(f->proto, alproto, next_inspect_tx, flags);
-                    if (c == 0) {
-                        next_tx_no_progress = 1;
-                    }
+        DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, alproto, inspect_tx);
+        if (tx_de_state == NULL) {
+            SCLogDebug("NO STATE tx %"PRIu64" (%"PRIu64")", inspect_tx_id, total_txs);
+            goto next;
+        }
+        DetectEngineStateDirection *tx_dir_state = &tx_de_state->dir_state[direction];
+
+        SCLogDebug("tx_dir_state->filestore_cnt %u", tx_dir_state->filestore_cnt);
+
+        /* see if we need to consider the next tx in our decision to add
+         * a sig to the 'no inspect array'. */
+        if (!TxIsLast(inspect_tx_id, total_txs)) {
+            void *next_inspect_tx = DeStatePeekNextTx(IterFunc, f, alproto,
+                    alstate, inspect_tx_id, &state);
+            if (next_inspect_tx != NULL) {
+                int c = AppLayerParserGetStateProgress(f->proto, alproto, next_inspect_tx, flags);
+                if (c == 0) {
+                    next_tx_no_progress = 1;
                 }
             }
+        }
 
-            /* Loop through stored 'items' (stateful rules) and inspect them */
-            state_cnt = 0;
-            for (; tx_store != NULL; tx_store = tx_store->next) {
-                SCLogDebug("tx_store %p", tx_store);
-                for (store_cnt = 0;
-                        store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < tx_dir_state->cnt;
-                        store_cnt++, state_cnt++)
-                {
-                    DeStateStoreItem *item = &tx_store->store[store_cnt];
-                    int r = DoInspectItem(tv, de_ctx, det_ctx,
-                            item, tx_dir_state->flags,
-                            p, f, alproto, flags,
-                            inspect_tx_id, total_txs,
-                            &file_no_match, inspect_tx_inprogress, next_tx_no_progress);
-                    if (r < 0) {
-                        SCLogDebug("failed");
-                        goto end;
-                    }
-                }
+        if (tx_dir_state->flags &
+                (DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW|DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW))
+        {
+            DeStateReactivateFileItems(tx_dir_state);
+        }
+
+        /* sigs that are done with this tx only need to be kept out of
+         * the detection loop */
+        if (tx_dir_state->active_cnt < tx_dir_state->cnt) {
+            const uint8_t done = DeStateDoneValue(f, flags, inspect_tx_id,
+                    total_txs, inspect_tx_inprogress, next_tx_no_progress);
+            for (i = tx_dir_state->active_cnt; i < tx_dir_state->cnt; i++) {
+                det_ctx->de_state_sig_array[tx_dir_state->store[i].sid] = done;
             }
+        }
 
-            tx_dir_state->flags &=
-                ~(DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW|DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW);
+        /* Loop through the active 'items' (stateful rules) and inspect
+         * them. Items that are done after this are moved behind the
+         * active ones. */
+        int r = 0;
+        for (i = 0; i < tx_dir_state->active_cnt; i++) {
+            r = DoInspectItem(tv, de_ctx, det_ctx,
+                    &tx_dir_state->store[i], tx_dir_state->flags,
+                    p, f, alproto, flags,
+                    inspect_tx_id, total_txs,
+                    &file_no_match, inspect_tx_inprogress, next_tx_no_progress);
+            if (r < 0) {
+                SCLogDebug("failed");
+                break;
+            }
         }
+        DeStateRetireDoneItems(tx_dir_state);
+        if (r < 0)
+            goto end;
+
+        tx_dir_state->flags &=
+            ~(DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW|DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW);
+
         /* if the current tx is in progress, we won't advance to any newer
          * tx' just yet. */
         if (inspect_tx_inprogress) {
             SCLogDebug("break out");
             break;
         }
+    next:
+        if (!ires.has_next)
+            break;
+        inspect_tx_id++;
     }
 
 end:
@@ -852,25 +986,53 @@ void DetectEngineStateResetTxs(Flow *f)
 
     uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
 
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
     for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
-        void *inspect_tx = AppLayerParserGetTx(f->proto, f->alproto, alstate, inspect_tx_id);
-        if (inspect_tx != NULL) {
-            DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, f->alproto, inspect_tx);
-            if (tx_de_state == NULL) {
-                continue;
-            }
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto, alstate,
+                inspect_tx_id, total_txs, &state);
+        void *inspect_tx = ires.tx_ptr;
+        if (inspect_tx == NULL)
+            break;
+        inspect_tx_id = ires.tx_id;
+        DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, f->alproto, inspect_tx);
+        if (tx_de_state == NULL) {
+            continue;
+        }
 
-            tx_de_state->dir_state[0].cnt = 0;
-            tx_de_state->dir_state[0].filestore_cnt = 0;
-            tx_de_state->dir_state[0].flags = 0;
+        tx_de_state->dir_state[0].cnt = 0;
+        tx_de_state->dir_state[0].active_cnt = 0;
+        tx_de_state->dir_state[0].filestore_cnt = 0;
+        tx_de_state->dir_state[0].flags = 0;
 
-            tx_de_state->dir_state[1].cnt = 0;
-            tx_de_state->dir_state[1].filestore_cnt = 0;
-            tx_de_state->dir_state[1].flags = 0;
-        }
+        tx_de_state->dir_state[1].cnt = 0;
+        tx_de_state->dir_state[1].active_cnt = 0;
+        tx_de_state->dir_state[1].filestore_cnt = 0;
+        tx_de_state->dir_state[1].flags = 0;
     }
 }
 
+static uint64_t DeStateMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(de_state_memuse);
+}
+
+static uint64_t DeStateCounter(void)
+{
+    return SC_ATOMIC_GET(de_state_cnt);
+}
+
+void DeStateRegisterGlobalCounters(void)
+{
+    SC_ATOMIC_INIT(de_state_memuse);
+    SC_ATOMIC_INIT(de_state_cnt);
+
+    StatsRegisterGlobalCounter("detect.state_memuse", DeStateMemuseCounter);
+    StatsRegisterGlobalCounter("detect.states", DeStateCounter);
+}
+
 /*********Unittests*********/
 
 #ifdef UNITTESTS
@@ -879,8 +1041,8 @@ static int DeStateTest01(void)
 {
     SCLogDebug("sizeof(DetectEngineState)\t\t%"PRIuMAX,
             (uintmax_t)sizeof(DetectEngineState));
-    SCLogDebug("sizeof(DeStateStore)\t\t\t%"PRIuMAX,
-            (uintmax_t)sizeof(DeStateStore));
+    SCLogDebug("sizeof(DetectEngineStateDirection)\t%"PRIuMAX,
+            (uintmax_t)sizeof(DetectEngineStateDirection));
     SCLogDebug("sizeof(DeStateStoreItem)\t\t%"PRIuMAX"",
             (uintmax_t)sizeof(DeStateStoreItem));
 
@@ -937,27 +1099,28 @@ static int DeStateTest02(void)
     s.num = 166;
     DeStateSignatureAppend(state, &s, 0, direction);
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].cnt != 17) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 11) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].sid != 11) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store ==
+            state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].inline_store) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[14].sid != 144) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[14].sid != 144) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[0].sid != 155) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[15].sid != 155) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[1].sid != 166) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[16].sid != 166) {
         goto end;
     }
 
@@ -984,15 +1147,121 @@ static int DeStateTest03(void)
     s.num = 22;
     DeStateSignatureAppend(state, &s, BIT_U32(DE_STATE_FLAG_BASE), direction);
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL);
+    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].cnt != 2);
+
+    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].sid != 11);
+
+    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].flags & BIT_U32(DE_STATE_FLAG_BASE));
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].sid != 11);
+    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].sid != 22);
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].flags & BIT_U32(DE_STATE_FLAG_BASE));
+    FAIL_IF(!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].flags & BIT_U32(DE_STATE_FLAG_BASE)));
 
-    FAIL_IF(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 22);
+    DetectEngineStateFree(state);
+    PASS;
+}
 
-    FAIL_IF(!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].flags & BIT_U32(DE_STATE_FLAG_BASE)));
+/** \test sigs that are done are kept behind the active ones */
+static int DeStateTest04(void)
+{
+    DetectEngineState *state = DetectEngineStateAlloc();
+    FAIL_IF_NULL(state);
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+
+    DetectEngineStateDirection *dir_state = &state->dir_state[0];
+
+    s.num = 11;
+    DeStateSignatureAppend(state, &s, DE_STATE_FLAG_FULL_INSPECT, STREAM_TOSERVER);
+    s.num = 22;
+    DeStateSignatureAppend(state, &s, BIT_U32(DE_STATE_FLAG_BASE), STREAM_TOSERVER);
+    s.num = 33;
+    DeStateSignatureAppend(state, &s, DE_STATE_FLAG_SIG_CANT_MATCH, STREAM_TOSERVER);
+    s.num = 44;
+    DeStateSignatureAppend(state, &s, 0, STREAM_TOSERVER);
+
+    FAIL_IF(dir_state->cnt != 4);
+    FAIL_IF(dir_state->active_cnt != 2);
+    FAIL_IF(dir_state->store != dir_state->inline_store);
+
+    SigIntId i;
+    for (i = 0; i < dir_state->cnt; i++) {
+        if (i < dir_state->active_cnt) {
+            FAIL_IF(dir_state->store[i].flags & DE_STATE_FLAG_DONE);
+            FAIL_IF(dir_state->store[i].sid != 22 && dir_state->store[i].sid != 44);
+        } else {
+            FAIL_IF(!(dir_state->store[i].flags & DE_STATE_FLAG_DONE));
+        }
+    }
+
+    FAIL_IF_NOT(DeStateSearchState(state, STREAM_TOSERVER, 33));
+    FAIL_IF(DeStateSearchState(state, STREAM_TOSERVER, 55));
+    FAIL_IF(DeStateSearchState(state, STREAM_TOCLIENT, 33));
+
+    s.num = 55;
+    DeStateSignatureAppend(state, &s, 0, STREAM_TOSERVER);
+    FAIL_IF(dir_state->cnt != 5);
+    FAIL_IF(dir_state->active_cnt != 3);
+    FAIL_IF(dir_state->store == dir_state->inline_store);
+    FAIL_IF(dir_state->size != DE_STATE_INLINE_SIZE * 2);
+    FAIL_IF_NOT(DeStateSearchState(state, STREAM_TOSERVER, 11));
+    FAIL_IF_NOT(DeStateSearchState(state, STREAM_TOSERVER, 55));
+
+    DetectEngineStateFree(state);
+    PASS;
+}
+
+/** \test retiring and reactivating items keeps the active ones in order */
+static int DeStateTest05(void)
+{
+    DetectEngineState *state = DetectEngineStateAlloc();
+    FAIL_IF_NULL(state);
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+
+    DetectEngineStateDirection *dir_state = &state->dir_state[0];
+
+    /* 1..8 active, 2, 4 and 7 wait for a new file */
+    SigIntId num;
+    for (num = 1; num <= 8; num++) {
+        s.num = num;
+        uint32_t flags = BIT_U32(DE_STATE_FLAG_BASE);
+        if (num == 2 || num == 4 || num == 7)
+            flags |= DE_STATE_FLAG_FILE_TS_INSPECT;
+        DeStateSignatureAppend(state, &s, flags, STREAM_TOSERVER);
+    }
+    FAIL_IF(dir_state->active_cnt != 8);
+
+    /* 2, 4, 5 and 7 are done */
+    SigIntId i;
+    for (i = 0; i < dir_state->cnt; i++) {
+        const SigIntId sid = dir_state->store[i].sid;
+        if (sid == 2 || sid == 4 || sid == 5 || sid == 7)
+            dir_state->store[i].flags |= DE_STATE_FLAG_FULL_INSPECT;
+    }
+    DeStateRetireDoneItems(dir_state);
+    FAIL_IF(dir_state->cnt != 8);
+    FAIL_IF(dir_state->active_cnt != 4);
+    static const SigIntId active[] = { 1, 3, 6, 8 };
+    for (i = 0; i < dir_state->active_cnt; i++) {
+        FAIL_IF(dir_state->store[i].sid != active[i]);
+    }
+    for (i = dir_state->active_cnt; i < dir_state->cnt; i++) {
+        FAIL_IF(!(dir_state->store[i].flags & DE_STATE_FLAG_DONE));
+    }
+
+    /* a new file: 2, 4 and 7 go behind the active ones, 5 stays done */
+    DeStateReactivateFileItems(dir_state);
+    FAIL_IF(dir_state->active_cnt != 7);
+    for (i = 0; i < 4; i++) {
+        FAIL_IF(dir_state->store[i].sid != active[i]);
+    }
+    for (i = 4; i < dir_state->active_cnt; i++) {
+        FAIL_IF(!(dir_state->store[i].flags & DE_STATE_FLAG_FILE_TS_INSPECT));
+    }
+    FAIL_IF(dir_state->store[7].sid != 5);
 
     DetectEngineStateFree(state);
     PASS;
@@ -1241,7 +1510,7 @@ static int DeStateSigTest02(void)
     FAIL_IF(tx_de_state->dir_state[0].cnt != 1);
     /* http_header(mpm): 6, uri: 4, method: 7, cookie: 8 */
     uint32_t expected_flags = (BIT_U32(6) | BIT_U32(4) | BIT_U32(7) |BIT_U32(8));
-    FAIL_IF(tx_de_state->dir_state[0].head->store[0].flags != expected_flags);
+    FAIL_IF(tx_de_state->dir_state[0].store[0].flags != expected_flags);
 
     FLOWLOCK_WRLOCK(&f);
     r = AppLayerParserParse(NULL, alp_tctx, &f, ALPROTO_HTTP,
@@ -1934,6 +2203,8 @@ void DeStateRegisterTests(void)
     UtRegisterTest("DeStateTest01", DeStateTest01);
     UtRegisterTest("DeStateTest02", DeStateTest02);
     UtRegisterTest("DeStateTest03", DeStateTest03);
+    UtRegisterTest("DeStateTest04", DeStateTest04);
+    UtRegisterTest("DeStateTest05", DeStateTest05);
     UtRegisterTest("DeStateSigTest01", DeStateSigTest01);
     UtRegisterTest("DeStateSigTest02", DeStateSigTest02);
     UtRegisterTest("DeStateSigTest03", DeStateSigTest03);
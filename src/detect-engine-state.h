@@ -46,8 +46,10 @@
  *  more files that have ongoing inspection. */
 #define DETECT_ENGINE_INSPECT_SIG_MATCH_MORE_FILES 4
 
-/** number of DeStateStoreItem's in one DeStateStore object */
-#define DE_STATE_CHUNK_SIZE             15
+/** number of DeStateStoreItem's stored in the DetectEngineStateDirection
+ *  itself. Once more are needed the items move to an allocated store that
+ *  doubles in size when full. */
+#define DE_STATE_INLINE_SIZE            4
 
 /* per sig flags */
 #define DE_STATE_FLAG_FULL_INSPECT              BIT_U32(0)
@@ -56,6 +58,10 @@
 #define DE_STATE_FLAG_FILE_TC_INSPECT           BIT_U32(2)
 #define DE_STATE_FLAG_FILE_TS_INSPECT           BIT_U32(3)
 
+/* sigs with any of these flags are done with the tx, unless a new file
+ * shows up in it */
+#define DE_STATE_FLAG_DONE  (DE_STATE_FLAG_FULL_INSPECT|DE_STATE_FLAG_SIG_CANT_MATCH)
+
 /* first bit position after the built-ins */
 #define DE_STATE_FLAG_BASE                      4UL
 
@@ -90,17 +96,17 @@ typedef struct DeStateStoreItem_ {
     SigIntId sid;
 } DeStateStoreItem;
 
-typedef struct DeStateStore_ {
-    DeStateStoreItem store[DE_STATE_CHUNK_SIZE];
-    struct DeStateStore_ *next;
-} DeStateStore;
-
 typedef struct DetectEngineStateDirection_ {
-    DeStateStore *head;
-    DeStateStore *tail;
+    /** cnt items, either inline_store or an allocated array of size
+     *  items. The first active_cnt items still need inspection, the
+     *  others have DE_STATE_FLAG_DONE set. */
+    DeStateStoreItem *store;
     SigIntId cnt;
+    SigIntId active_cnt;
+    SigIntId size;
     uint16_t filestore_cnt;
     uint8_t flags;
+    DeStateStoreItem inline_store[DE_STATE_INLINE_SIZE];
 } DetectEngineStateDirection;
 
 typedef struct DetectEngineState_ {
@@ -176,6 +182,8 @@ void DeStateUpdateInspectTransactionId(Flow *f, const uint8_t flags);
 
 void DetectEngineStateResetTxs(Flow *f);
 
+void DeStateRegisterGlobalCounters(void);
+
 void DeStateRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_STATE_H__ */
@@ -70,6 +70,7 @@
 #include "util-magic.h"
 #include "util-signal.h"
 #include "util-spm.h"
+#include "util-affinity.h"
 
 #include "util-var-name.h"
 
@@ -878,7 +879,12 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
             old_det_ctx[i] = FlowWorkerGetDetectCtxPtr(SC_ATOMIC_GET(slots->slot_data));
             detect_tvs[i] = tv;
 
+            /* allocate the new ctx on the node of the detect thread */
+            AffinityMemoryPolicy mem_policy;
+            AffinitySaveThreadMemoryPolicy(&mem_policy);
+            AffinitySetThreadMemoryNode(tv->numa_node);
             new_det_ctx[i] = DetectEngineThreadCtxInitForReload(tv, new_de_ctx, 1);
+            AffinityRestoreThreadMemoryPolicy(&mem_policy);
             if (new_det_ctx[i] == NULL) {
                 SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
                            "failure in live rule swap.  Let's get out of here");
@@ -1723,6 +1729,13 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
         BUG_ON(det_ctx->non_pf_id_array == NULL);
     }
 
+    /* bitmap for ordering the prefilter candidates. If we can't get it
+     * the prefilter falls back to sorting. */
+    if (de_ctx->sig_array_len > 0) {
+        det_ctx->pf_bitmap = SCCalloc((de_ctx->sig_array_len + 63) / 64,
+                sizeof(uint64_t));
+    }
+
     /* IP-ONLY */
     DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
 
@@ -1771,6 +1784,13 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
 #endif
     SC_ATOMIC_INIT(det_ctx->so_far_used_by_detect);
 
+    if (de_ctx->srepCIDR_ctx != NULL) {
+        det_ctx->srep_thread = SRepThreadRegister(de_ctx->srepCIDR_ctx);
+        if (det_ctx->srep_thread == NULL) {
+            return TM_ECODE_FAILED;
+        }
+    }
+
     return TM_ECODE_OK;
 }
 
@@ -1796,6 +1816,8 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /* first register the counter. In delayed detect mode we exit right after if the
      * rules haven't been loaded yet. */
     uint16_t counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    uint16_t counter_http_body_zero_copy =
+        StatsRegisterCounter("detect.http_body_zero_copy_bytes", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1832,6 +1854,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
 
     /** alert counter setup */
     det_ctx->counter_alerts = counter_alerts;
+    det_ctx->counter_http_body_zero_copy = counter_http_body_zero_copy;
 #ifdef PROFILING
     det_ctx->counter_mpm_list = counter_mpm_list;
     det_ctx->counter_nonmpm_list = counter_nonmpm_list;
@@ -1884,6 +1907,8 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_http_body_zero_copy =
+        StatsRegisterCounter("detect.http_body_zero_copy_bytes", tv);
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1931,6 +1956,9 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 
     DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
 
+    if (det_ctx->srep_thread != NULL)
+        SRepThreadDeregister(det_ctx->srep_thread);
+
     /** \todo get rid of this static */
     if (det_ctx->de_ctx != NULL) {
         PatternMatchThreadDestroy(&det_ctx->mtc, det_ctx->de_ctx->mpm_matcher);
@@ -1946,6 +1974,10 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 
     if (det_ctx->non_pf_id_array != NULL)
         SCFree(det_ctx->non_pf_id_array);
+    if (det_ctx->pf_bitmap != NULL)
+        SCFree(det_ctx->pf_bitmap);
+    if (det_ctx->pf_radix_tmp != NULL)
+        SCFree(det_ctx->pf_radix_tmp);
 
     if (det_ctx->de_state_sig_array != NULL)
         SCFree(det_ctx->de_state_sig_array);
@@ -1115,7 +1115,7 @@ void SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineT
 #ifdef PROFILING
     if (th_v) {
         StatsAddUI64(th_v, det_ctx->counter_mpm_list,
-                             (uint64_t)det_ctx->pmq.rule_id_array_cnt);
+                             (uint64_t)det_ctx->pf_candidates_cnt);
         StatsAddUI64(th_v, det_ctx->counter_nonmpm_list,
                              (uint64_t)det_ctx->non_pf_store_cnt);
         /* non mpm sigs after mask prefilter */
@@ -1582,6 +1582,10 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
     } else {
         DetectNoFlow(tv, de_ctx, det_ctx, p);
     }
+
+    /* done with the packet, so with any IP reputation tree */
+    if (det_ctx->srep_thread != NULL)
+        SRepThreadQuiesce(det_ctx->srep_thread);
     return TM_ECODE_OK;
 error:
     return TM_ECODE_FAILED;
@@ -40,6 +40,7 @@
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-radix-tree.h"
+#include "util-radix-compact.h"
 #include "util-file.h"
 #include "reputation.h"
 
@@ -533,6 +534,13 @@ typedef struct DetectEngineIPOnlyCtx_ {
     SCRadixTree *tree_ipv4src, *tree_ipv4dst;
     SCRadixTree *tree_ipv6src, *tree_ipv6dst;
 
+    /* Compiled lookup trees, replacing the radix trees once all
+     * signatures are added. Their SigNumArrays are deduplicated
+     * and owned by sna_hash. */
+    SCRadixCompactTree *compact_ipv4src, *compact_ipv4dst;
+    SCRadixCompactTree *compact_ipv6src, *compact_ipv6dst;
+    HashListTable *sna_hash;
+
     /* Used to build the radix trees */
     IPOnlyCIDRItem *ip_src, *ip_dst;
 
@@ -792,6 +800,17 @@ typedef struct DetectEngineThreadCtx_ {
     SigIntId *non_pf_id_array;
     uint32_t non_pf_id_cnt; // size is cnt * sizeof(uint32_t)
 
+    /* ordering of the prefilter candidates: bitmap of sig_array_len bits
+     * and scratch space for the radix sort */
+    uint64_t *pf_bitmap;
+    SigIntId *pf_radix_tmp;
+    uint32_t pf_radix_tmp_size;
+#ifdef PROFILING
+    /** candidates before ordering/dedup and how they were ordered */
+    uint32_t pf_candidates_cnt;
+    uint8_t pf_sort_method;
+#endif
+
     uint32_t mt_det_ctxs_cnt;
     struct DetectEngineThreadCtx_ **mt_det_ctxs;
     HashTable *mt_det_ctxs_hash;
@@ -831,6 +850,8 @@ typedef struct DetectEngineThreadCtx_ {
 
     /** id for alert counter */
     uint16_t counter_alerts;
+    /** body bytes inspected in place from the http body buffers */
+    uint16_t counter_http_body_zero_copy;
 #ifdef PROFILING
     uint16_t counter_mpm_list;
     uint16_t counter_nonmpm_list;
@@ -852,6 +873,10 @@ typedef struct DetectEngineThreadCtx_ {
 
     SC_ATOMIC_DECLARE(int, so_far_used_by_detect);
 
+    /** IP reputation lookup state, to let the compact trees replaced by
+     *  deltas be freed */
+    SRepThread *srep_thread;
+
     /* holds the current recursion depth on content inspection */
     int inspection_recursion_counter;
 
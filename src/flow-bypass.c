@@ -0,0 +1,188 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Bypassed flow manager.
+ *
+ * Once a flow is bypassed in the capture method, Suricata no longer sees
+ * its packets and times it out like any other flow. The capture method
+ * keeps its own table of bypassed flows though, e.g. the eBPF maps of
+ * AF_PACKET. This thread calls the check functions registered by the
+ * capture methods every second, so that they can remove the entries the
+ * kernel has not seen packets for, and accounts the packets and bytes
+ * that were dropped in the capture method for these flows.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "runmodes.h"
+#include "flow-bypass.h"
+#include "util-debug.h"
+#include "util-signal.h"
+
+#define BYPASSFUNCMAX   4
+
+typedef struct BypassedFlowManagerThreadData_ {
+    uint16_t flow_bypassed_cnt_clo;
+    uint16_t flow_bypassed_pkts;
+    uint16_t flow_bypassed_bytes;
+} BypassedFlowManagerThreadData;
+
+typedef struct BypassedCheckFuncItem_ {
+    BypassedCheckFunc Func;
+    void *data;
+} BypassedCheckFuncItem;
+
+static int g_bypassed_func_max_index = 0;
+static BypassedCheckFuncItem bypassedfunclist[BYPASSFUNCMAX];
+
+static TmEcode BypassedFlowManager(ThreadVars *th_v, void *thread_data)
+{
+    BypassedFlowManagerThreadData *ftd = thread_data;
+
+    /* block usr2.  usr1 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    while (1) {
+        if (TmThreadsCheckFlag(th_v, THV_PAUSE)) {
+            TmThreadsSetFlag(th_v, THV_PAUSED);
+            TmThreadTestThreadUnPaused(th_v);
+            TmThreadsUnsetFlag(th_v, THV_PAUSED);
+        }
+
+        /* the kernel time stamps use the monotonic clock */
+        struct timespec curtime;
+        if (clock_gettime(CLOCK_MONOTONIC, &curtime) != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "Can't get time: %s (%d)",
+                    strerror(errno), errno);
+        } else {
+            int i;
+            for (i = 0; i < g_bypassed_func_max_index; i++) {
+                FlowBypassStats bypassstats = { 0, 0, 0 };
+                int tcount = bypassedfunclist[i].Func(&bypassstats, &curtime,
+                        bypassedfunclist[i].data);
+                if (tcount > 0) {
+                    StatsAddUI64(th_v, ftd->flow_bypassed_cnt_clo,
+                            bypassstats.count);
+                    StatsAddUI64(th_v, ftd->flow_bypassed_pkts,
+                            bypassstats.packets);
+                    StatsAddUI64(th_v, ftd->flow_bypassed_bytes,
+                            bypassstats.bytes);
+                }
+            }
+        }
+
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            StatsSyncCounters(th_v);
+            return TM_ECODE_OK;
+        }
+
+        sleep(1);
+        StatsSyncCountersIfSignalled(th_v);
+    }
+    return TM_ECODE_OK;
+}
+
+static TmEcode BypassedFlowManagerThreadInit(ThreadVars *t, const void *initdata, void **data)
+{
+    BypassedFlowManagerThreadData *ftd = SCCalloc(1, sizeof(BypassedFlowManagerThreadData));
+    if (ftd == NULL)
+        return TM_ECODE_FAILED;
+
+    *data = ftd;
+
+    ftd->flow_bypassed_cnt_clo = StatsRegisterCounter("flow_bypassed.closed", t);
+    ftd->flow_bypassed_pkts = StatsRegisterCounter("flow_bypassed.pkts", t);
+    ftd->flow_bypassed_bytes = StatsRegisterCounter("flow_bypassed.bytes", t);
+
+    return TM_ECODE_OK;
+}
+
+static TmEcode BypassedFlowManagerThreadDeinit(ThreadVars *t, void *data)
+{
+    if (data)
+        SCFree(data);
+    return TM_ECODE_OK;
+}
+
+/** \brief spawn the bypassed flow manager if a capture method registered
+ *         a check function */
+void BypassedFlowManagerThreadSpawn(void)
+{
+#ifdef AFLFUZZ_DISABLE_MGTTHREADS
+    return;
+#endif
+    if (g_bypassed_func_max_index == 0)
+        return;
+
+    ThreadVars *tv_flowmgr = TmThreadCreateMgmtThreadByName(
+            thread_name_flow_bypass, "BypassedFlowManager", 0);
+    BUG_ON(tv_flowmgr == NULL);
+
+    if (tv_flowmgr == NULL) {
+        printf("ERROR: TmThreadsCreate failed\n");
+        exit(1);
+    }
+    if (TmThreadSpawn(tv_flowmgr) != TM_ECODE_OK) {
+        printf("ERROR: TmThreadSpawn failed\n");
+        exit(1);
+    }
+}
+
+/**
+ *  \brief register a function removing the timed out bypassed flows of
+ *         a capture method
+ *
+ *  Must be called before the management threads are spawned.
+ *
+ *  \retval 0 ok
+ *  \retval -1 too many functions registered
+ */
+int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc,
+        void *data)
+{
+    if (CheckFunc == NULL) {
+        return -1;
+    }
+
+    if (g_bypassed_func_max_index < BYPASSFUNCMAX) {
+        bypassedfunclist[g_bypassed_func_max_index].Func = CheckFunc;
+        bypassedfunclist[g_bypassed_func_max_index].data = data;
+        g_bypassed_func_max_index++;
+    } else {
+        SCLogError(SC_ERR_INVALID_VALUE, "too many bypassed flow check "
+                "functions, max is %d", BYPASSFUNCMAX);
+        return -1;
+    }
+
+    return 0;
+}
+
+void TmModuleBypassedFlowManagerRegister(void)
+{
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].name = "BypassedFlowManager";
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].ThreadInit = BypassedFlowManagerThreadInit;
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].ThreadDeinit = BypassedFlowManagerThreadDeinit;
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].Management = BypassedFlowManager;
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].cap_flags = 0;
+    tmm_modules[TMM_BYPASSEDFLOWMANAGER].flags = TM_FLAG_MANAGEMENT_TM;
+    SCLogDebug("%s registered", tmm_modules[TMM_BYPASSEDFLOWMANAGER].name);
+}
@@ -0,0 +1,52 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Management of the flows bypassed in the capture method.
+ */
+
+#ifndef __FLOW_BYPASS_H__
+#define __FLOW_BYPASS_H__
+
+/** flows closed by a check function and their counters as seen by
+ *  the capture method after the bypass */
+typedef struct FlowBypassStats_ {
+    uint64_t count;
+    uint64_t packets;
+    uint64_t bytes;
+} FlowBypassStats;
+
+/** \brief remove the timed out bypassed flows of a capture method
+ *
+ *  \param bypassstats stats of the removed flows to update
+ *  \param curtime CLOCK_MONOTONIC time of the check
+ *  \param data data registered with the function
+ *
+ *  \retval number of flows removed, -1 on error
+ */
+typedef int (*BypassedCheckFunc)(FlowBypassStats *bypassstats,
+        struct timespec *curtime, void *data);
+
+int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc,
+        void *data);
+
+void BypassedFlowManagerThreadSpawn(void);
+void TmModuleBypassedFlowManagerRegister(void);
+
+#endif /* __FLOW_BYPASS_H__ */
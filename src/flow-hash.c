@@ -37,16 +37,21 @@
 #include "flow-manager.h"
 #include "flow-storage.h"
 #include "app-layer-parser.h"
+#include "stream-tcp-private.h"
 
 #include "util-time.h"
 #include "util-debug.h"
 
 #include "util-hash-lookup3.h"
+#include "util-affinity.h"
 
 #include "conf.h"
 #include "output.h"
 #include "output-flow.h"
 
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
@@ -442,6 +447,7 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     f->hnext = fb->head;
     fb->head->hprev = f;
     fb->head = f;
+    FlowBucketTagsPushHead(fb, FLOW_HASH_TAG(hash));
 
     /* initialize and return */
     FlowInit(f, p);
@@ -452,18 +458,220 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     return f;
 }
 
+/* flow hash partitioning: worker threads register during their init, the
+ * partitions are set up once all threads are initialized. */
+static SCMutex flow_partition_mutex = SCMUTEX_INITIALIZER;
+static uint32_t flow_partition_threads = 0;
+static int flow_partition_affinity = 1;
+/** NUMA node of each registered thread, -1 if unknown */
+static int *flow_partition_nodes = NULL;
+static uint32_t flow_partition_nodes_size = 0;
+
+/**
+ *  \brief Register a thread doing flow lookups
+ *
+ *  Must be called from the thread's init function.
+ *
+ *  \retval id partition id of the thread, used if the hash gets partitioned
+ */
+uint32_t FlowHashRegisterThread(ThreadVars *tv)
+{
+    SCMutexLock(&flow_partition_mutex);
+    uint32_t id = flow_partition_threads++;
+    if (tv == NULL || tv->flow_affinity == 0)
+        flow_partition_affinity = 0;
+
+    if (id >= flow_partition_nodes_size) {
+        uint32_t size = MAX(16, flow_partition_nodes_size * 2);
+        int *nodes = SCRealloc(flow_partition_nodes, size * sizeof(int));
+        if (nodes != NULL) {
+            uint32_t i;
+            for (i = flow_partition_nodes_size; i < size; i++)
+                nodes[i] = -1;
+            flow_partition_nodes = nodes;
+            flow_partition_nodes_size = size;
+        }
+    }
+    if (id < flow_partition_nodes_size && tv != NULL)
+        flow_partition_nodes[id] = tv->numa_node;
+    SCMutexUnlock(&flow_partition_mutex);
+    return id;
+}
+
+/** \internal
+ *  \brief move the rows of each partition to the NUMA node of its thread
+ */
+static void FlowHashPlacePartitions(void)
+{
+    const uint32_t size = flow_config.hash_partition_size;
+    uint32_t p;
+
+    for (p = 0; p < flow_config.hash_partitions; p++) {
+        int node = p < flow_partition_nodes_size ? flow_partition_nodes[p] : -1;
+        AffinityBindMemoryNode(&flow_hash[p * size], size * sizeof(FlowBucket),
+                node);
+    }
+}
+
+/**
+ *  \brief Split the flow hash between the registered threads
+ *
+ *  Only done if flow.thread-partitions is enabled and every registered
+ *  thread is guaranteed to see all packets of its flows. Otherwise the
+ *  hash stays shared. Called after all threads are initialized, before
+ *  they start processing packets.
+ *
+ *  With NUMA placement, the rows of a partition are moved to the node of
+ *  its thread. A shared hash is spread over the nodes.
+ */
+void FlowHashSetupPartitions(void)
+{
+    SCMutexLock(&flow_partition_mutex);
+    flow_config.hash_partitions = 0;
+    flow_config.hash_partition_size = 0;
+
+    const uint32_t threads = flow_partition_threads;
+    if (flow_config.thread_partitions && threads > 0) {
+        if (!flow_partition_affinity) {
+            SCLogConfig("flow: capture method doesn't guarantee flow affinity, "
+                    "using a shared flow hash");
+        } else if (threads > flow_config.hash_size) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "flow: hash-size %u too small "
+                    "for %u partitions, using a shared flow hash",
+                    flow_config.hash_size, threads);
+        } else {
+            flow_config.hash_partition_size = flow_config.hash_size / threads;
+            flow_config.hash_partitions = threads;
+            SCLogConfig("flow: hash split in %u partitions of %u rows",
+                    flow_config.hash_partitions,
+                    flow_config.hash_partition_size);
+            FlowHashPlacePartitions();
+        }
+        /* FlowInitConfig left the placement to us */
+        if (flow_config.hash_partitions == 0) {
+            AffinityInterleaveMemory(flow_hash,
+                    flow_config.hash_size * sizeof(FlowBucket));
+        }
+    }
+
+    if (flow_partition_nodes != NULL) {
+        SCFree(flow_partition_nodes);
+        flow_partition_nodes = NULL;
+        flow_partition_nodes_size = 0;
+    }
+    flow_partition_threads = 0;
+    flow_partition_affinity = 1;
+    SCMutexUnlock(&flow_partition_mutex);
+}
+
+/** \internal
+ *  \brief get the hash row for a flow hash
+ *
+ *  If the hash is partitioned, rows are only looked up in the partition of
+ *  the current thread.
+ */
+static inline FlowBucket *FlowGetBucket(const DecodeThreadVars *dtv,
+        const uint32_t hash)
+{
+    if (flow_config.hash_partitions != 0 && dtv != NULL) {
+        const uint32_t size = flow_config.hash_partition_size;
+        return &flow_hash[dtv->flow_partition * size + hash % size];
+    }
+    return &flow_hash[hash % flow_config.hash_size];
+}
+
+/** \internal
+ *  \brief Look up an existing flow without taking the row lock
+ *
+ *  Walks the row while checking the row's sequence counter. If the counter
+ *  is odd (a writer holds the row) or changes during the walk, the lookup
+ *  is abandoned. On a match the flow is locked and the counter checked once
+ *  more: if it is unchanged, no writer touched the row since we started so
+ *  the flow is still in the row and still ours.
+ *
+ *  Flows with a tag that doesn't match the packet's are skipped without
+ *  comparing them. If the row's tags cover all its flows and none match,
+ *  the flow is not in the row and no flow memory is touched at all.
+ *
+ *  Flows are never freed at runtime when lockless lookups are enabled, so
+ *  reading a flow that was removed from the row concurrently is safe.
+ *
+ *  TCP session reuse is not handled here as it needs the row lock. Such
+ *  flows are left to the locked path.
+ *
+ *  \retval f *LOCKED* flow or NULL if the locked path needs to be used
+ */
+static inline Flow *FlowGetExistingFlowLockless(ThreadVars *tv,
+        DecodeThreadVars *dtv, FlowBucket *fb, const Packet *p, Flow **dest)
+{
+    const uint16_t tag = FLOW_HASH_TAG(p->flow_hash);
+    const uint32_t seq = SC_ATOMIC_GET(fb->seq);
+    if (seq & 1)
+        goto fallback;
+    hw_barrier();
+
+    const uint8_t tags_cnt = fb->tags_cnt;
+    const uint8_t tags_complete = fb->tags_complete;
+    if (tags_complete && !FlowBucketTagsHave(fb, tag)) {
+        /* miss: creating a new flow requires the lock */
+        return NULL;
+    }
+
+    Flow *f = fb->head;
+    uint32_t pos = 0;
+    while (f != NULL) {
+        if ((pos >= tags_cnt || fb->tags[pos] == tag) && FlowCompare(f, p) != 0)
+            break;
+        f = f->hnext;
+        pos++;
+        hw_barrier();
+        if (SC_ATOMIC_GET(fb->seq) != seq)
+            goto fallback;
+    }
+    if (f == NULL) {
+        return NULL;
+    }
+
+    FLOWLOCK_WRLOCK(f);
+    hw_barrier();
+    if (SC_ATOMIC_GET(fb->seq) != seq || FlowCompare(f, p) == 0 ||
+        unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1))
+    {
+        FLOWLOCK_UNLOCK(f);
+        goto fallback;
+    }
+
+    FlowReference(dest, f);
+#ifdef UNITTESTS
+    if (tv && dtv)
+#endif
+        StatsIncr(tv, dtv->counter_flow_lookup_lockless);
+    return f;
+
+fallback:
+#ifdef UNITTESTS
+    if (tv && dtv)
+#endif
+        StatsIncr(tv, dtv->counter_flow_lookup_fallback);
+    return NULL;
+}
+
 /** \brief Get Flow for packet
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
  * flow pointer. Then compares the packet with the found flow to see if it is
  * the flow we need. If it isn't, walk the list until the right flow is found.
+ * Flows whose tag doesn't match the packet are skipped without comparing.
  *
  * If the flow is not found or the bucket was emtpy, a new flow is taken from
  * the queue. FlowDequeue() will alloc new flows as long as we stay within our
- * memcap limit.
+ * memcap limit. New flows are added to the start of the list.
  *
  * The p->flow pointer is updated to point to the flow.
  *
+ * If lockless lookups are enabled, existing flows are first looked up
+ * without locking the bucket. See FlowGetExistingFlowLockless().
+ *
  *  \param tv thread vars
  *  \param dtv decode thread vars (for flow log api thread data)
  *
@@ -475,71 +683,30 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
 
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
+    const uint16_t tag = FLOW_HASH_TAG(hash);
+    FlowBucket *fb = FlowGetBucket(dtv, hash);
 
-    SCLogDebug("fb %p fb->head %p", fb, fb->head);
-
-    /* see if the bucket already has a flow */
-    if (fb->head == NULL) {
-        f = FlowGetNew(tv, dtv, p);
-        if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
-            return NULL;
-        }
-
-        /* flow is locked */
-        fb->head = f;
-        fb->tail = f;
-
-        /* got one, now lock, initialize and return */
-        FlowInit(f, p);
-        f->flow_hash = hash;
-        f->fb = fb;
-        FlowUpdateState(f, FLOW_STATE_NEW);
-
-        FlowReference(dest, f);
-
-        FBLOCK_UNLOCK(fb);
-        return f;
+    if (flow_config.lockless_lookup) {
+        f = FlowGetExistingFlowLockless(tv, dtv, fb, p, dest);
+        if (f != NULL)
+            return f;
     }
 
-    /* ok, we have a flow in the bucket. Let's find out if it is our flow */
-    f = fb->head;
-
-    /* see if this is the flow we are looking for */
-    if (FlowCompare(f, p) == 0) {
-        Flow *pf = NULL; /* previous flow */
-
-        while (f) {
-            pf = f;
-            f = f->hnext;
-
-            if (f == NULL) {
-                f = pf->hnext = FlowGetNew(tv, dtv, p);
-                if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
-                    return NULL;
-                }
-                fb->tail = f;
-
-                /* flow is locked */
-
-                f->hprev = pf;
-
-                /* initialize and return */
-                FlowInit(f, p);
-                f->flow_hash = hash;
-                f->fb = fb;
-                FlowUpdateState(f, FLOW_STATE_NEW);
-
-                FlowReference(dest, f);
+    FBLOCK_LOCK(fb);
 
-                FBLOCK_UNLOCK(fb);
-                return f;
-            }
+    SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
-            if (FlowCompare(f, p) != 0) {
+    /* see if the bucket already has our flow. If all flows in the bucket
+     * have a tag and none matches, we don't need to look. */
+    if (!fb->tags_complete || FlowBucketTagsHave(fb, tag)) {
+        uint32_t pos = 0;
+        for (f = fb->head; f != NULL; f = f->hnext, pos++) {
+            if (pos < fb->tags_cnt && fb->tags[pos] != tag)
+                continue;
+            if (FlowCompare(f, p) == 0)
+                continue;
+
+            if (f != fb->head) {
                 /* we found our flow, lets put it on top of the
                  * hash list -- this rewards active flows */
                 if (f->hnext) {
@@ -556,35 +723,52 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 f->hprev = NULL;
                 fb->head->hprev = f;
                 fb->head = f;
+                FlowBucketTagsMoveToFront(fb, pos, FLOW_HASH_TAG(f->flow_hash));
+            }
 
-                /* found our flow, lock & return */
-                FLOWLOCK_WRLOCK(f);
-                if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-                    f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-                    if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
-                        return NULL;
-                    }
+            /* found our flow, lock & return */
+            FLOWLOCK_WRLOCK(f);
+            if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
+                f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
+                if (f == NULL) {
+                    FBLOCK_UNLOCK(fb);
+                    return NULL;
                 }
+            }
 
-                FlowReference(dest, f);
+            FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
-                return f;
-            }
+            FBLOCK_UNLOCK(fb);
+            return f;
         }
     }
 
-    /* lock & return */
-    FLOWLOCK_WRLOCK(f);
-    if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-        f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-        if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
-            return NULL;
-        }
+    /* not found, get a new flow */
+    f = FlowGetNew(tv, dtv, p);
+    if (f == NULL) {
+        FBLOCK_UNLOCK(fb);
+        return NULL;
     }
 
+    /* flow is locked */
+
+    /* put at the start of the list */
+    if (fb->head == NULL) {
+        fb->tail = f;
+        FlowBucketTagsReset(fb);
+    } else {
+        f->hnext = fb->head;
+        fb->head->hprev = f;
+    }
+    fb->head = f;
+    FlowBucketTagsPushHead(fb, tag);
+
+    /* initialize and return */
+    FlowInit(f, p);
+    f->flow_hash = hash;
+    f->fb = fb;
+    FlowUpdateState(f, FLOW_STATE_NEW);
+
     FlowReference(dest, f);
 
     FBLOCK_UNLOCK(fb);
@@ -648,6 +832,7 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
             fb->head = f->hnext;
         if (fb->tail == f)
             fb->tail = f->hprev;
+        FlowBucketTagsRemoveTail(fb);
 
         f->hnext = NULL;
         f->hprev = NULL;
@@ -688,3 +873,469 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
     return NULL;
 }
+
+#ifdef UNITTESTS
+/** \brief check that the tags of a bucket match its flow list
+ *
+ *  \retval 1 tags are valid
+ *  \retval 0 tags are invalid
+ */
+int FlowBucketTagsCheck(const FlowBucket *fb)
+{
+    const Flow *f = fb->head;
+    uint8_t cnt = 0;
+    while (f != NULL && cnt < fb->tags_cnt) {
+        if (fb->tags[cnt] != FLOW_HASH_TAG(f->flow_hash))
+            return 0;
+        f = f->hnext;
+        cnt++;
+    }
+    /* more tags than flows */
+    if (cnt != fb->tags_cnt)
+        return 0;
+    /* tags_complete must be set iff no flow is left without a tag */
+    if (fb->tags_complete != (f == NULL))
+        return 0;
+    return 1;
+}
+
+/** \internal
+ *  \brief look up the flow for 'sport' in the hash, using 'hash' as the
+ *         packet's flow hash
+ *
+ *  \retval f unlocked and unreferenced flow or NULL
+ */
+static Flow *FlowHashTestLookup(ThreadVars *tv, DecodeThreadVars *dtv,
+        uint16_t sport, uint32_t hash, uint8_t flags)
+{
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+            "10.0.0.1", "10.0.0.2", sport, 80);
+    if (p == NULL)
+        return NULL;
+    p->flow_hash = hash;
+    p->tcph->th_flags = flags;
+    p->tcph->th_seq = htonl(100);
+
+    Flow *f = FlowGetFlowFromHash(tv, dtv, p, &p->flow);
+    if (f != NULL) {
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&p->flow);
+    }
+    UTHFreePacket(p);
+    return f;
+}
+
+/**
+ *  \test tags follow the flow list on insert, move to front and tail
+ *        eviction
+ */
+static int FlowHashTest01(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 1234 % size;
+    FlowBucket *fb = &flow_hash[idx];
+    Flow *flows[30];
+    uint32_t k;
+
+    /* insert: every flow lands in the same row */
+    for (k = 0; k < 30; k++) {
+        flows[k] = FlowHashTestLookup(NULL, NULL, 1000 + k, idx + k * size, 0);
+        FAIL_IF_NULL(flows[k]);
+        FAIL_IF(fb->head != flows[k]);
+        FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+        FAIL_IF(fb->tags_cnt != MIN(k + 1, FLOW_BUCKET_TAGS));
+        FAIL_IF(fb->tags_complete != (k < FLOW_BUCKET_TAGS));
+    }
+
+    /* move to front of a flow that has a tag */
+    FAIL_IF(FlowHashTestLookup(NULL, NULL, 1020, idx + 20 * size, 0) != flows[20]);
+    FAIL_IF(fb->head != flows[20]);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != FLOW_BUCKET_TAGS);
+
+    /* move to front of the oldest flow, which has no tag */
+    FAIL_IF(FlowHashTestLookup(NULL, NULL, 1000, idx, 0) != flows[0]);
+    FAIL_IF(fb->head != flows[0]);
+    FAIL_IF(fb->tail != flows[1]);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != FLOW_BUCKET_TAGS);
+
+    /* evict the tail until the row is empty */
+    uint32_t left = 30;
+    while (fb->tail != NULL) {
+        Flow *tail = fb->tail;
+        Flow *f = FlowGetUsedFlow(NULL, NULL);
+        FAIL_IF(f != tail);
+        FlowEnqueue(&flow_spare_q, f);
+        left--;
+
+        FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+        FAIL_IF(fb->tags_cnt != MIN(left, FLOW_BUCKET_TAGS));
+        FAIL_IF(fb->tags_complete != (left <= FLOW_BUCKET_TAGS));
+    }
+    FAIL_IF(left != 0);
+    FAIL_IF(fb->head != NULL);
+
+    /* the row is used again after it ran empty */
+    FAIL_IF_NULL(FlowHashTestLookup(NULL, NULL, 2000, idx, 0));
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != 1);
+
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test tags follow the flow list on TCP session reuse
+ */
+static int FlowHashTest02(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 4321 % size;
+    FlowBucket *fb = &flow_hash[idx];
+    Flow *flows[FLOW_BUCKET_TAGS];
+    uint32_t k;
+
+    for (k = 0; k < FLOW_BUCKET_TAGS; k++) {
+        flows[k] = FlowHashTestLookup(NULL, NULL, 1000 + k, idx + k * size, 0);
+        FAIL_IF_NULL(flows[k]);
+    }
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_complete != 1);
+
+    /* a closed session gets replaced by a SYN on the same tuple */
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+    ssn.state = TCP_CLOSED;
+    ssn.client.isn = 1;
+    flows[10]->protoctx = &ssn;
+
+    Flow *f = FlowHashTestLookup(NULL, NULL, 1010, idx + 10 * size, TH_SYN);
+    flows[10]->protoctx = NULL;
+    FAIL_IF_NULL(f);
+    FAIL_IF(f == flows[10]);
+    FAIL_IF_NOT(flows[10]->flags & FLOW_TCP_REUSED);
+    FAIL_IF(fb->head != f);
+
+    /* the reused flow stays in the row, so the tags no longer cover it */
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != FLOW_BUCKET_TAGS);
+    FAIL_IF(fb->tags_complete != 0);
+
+    /* the new flow is found, the reused one isn't */
+    FAIL_IF(FlowHashTestLookup(NULL, NULL, 1010, idx + 10 * size, 0) != f);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+
+    FlowShutdown();
+    PASS;
+}
+
+/** \internal
+ *  \brief set up thread vars with the flow lookup counters */
+static void FlowHashTestThreadInit(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    memset(tv, 0, sizeof(*tv));
+    memset(dtv, 0, sizeof(*dtv));
+    strlcpy(tv->name, "flow_hash_test", sizeof(tv->name));
+    DecodeRegisterPerfCounters(dtv, tv);
+    StatsSetupPrivate(tv);
+}
+
+#define FLOW_HASH_TEST_COUNTERS(tv, dtv, lockless, fallback) \
+    FAIL_IF(StatsGetLocalCounterValue((tv), (dtv)->counter_flow_lookup_lockless) != (lockless)); \
+    FAIL_IF(StatsGetLocalCounterValue((tv), (dtv)->counter_flow_lookup_fallback) != (fallback))
+
+/**
+ *  \test lockless lookup of an existing flow
+ */
+static int FlowHashTest03(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.lockless_lookup = 1;
+    FlowHashTestThreadInit(&tv, &dtv);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 1111 % size;
+    FlowBucket *fb = &flow_hash[idx];
+    Flow *flows[3];
+    uint32_t k;
+
+    /* new flows need the row lock, but a miss is not a fallback */
+    for (k = 0; k < 3; k++) {
+        flows[k] = FlowHashTestLookup(&tv, &dtv, 1000 + k, idx + k * size, 0);
+        FAIL_IF_NULL(flows[k]);
+    }
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 0, 0);
+
+    /* hit: found without the row lock, so the row is left as is */
+    const uint32_t seq = SC_ATOMIC_GET(fb->seq);
+    FAIL_IF(FlowHashTestLookup(&tv, &dtv, 1000, idx, 0) != flows[0]);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 1, 0);
+    FAIL_IF(SC_ATOMIC_GET(fb->seq) != seq);
+    FAIL_IF(fb->head != flows[2]);
+    FAIL_IF(fb->tail != flows[0]);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+
+    FAIL_IF(FlowHashTestLookup(&tv, &dtv, 1001, idx + size, 0) != flows[1]);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 2, 0);
+
+    StatsThreadCleanup(&tv);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test lockless lookup falls back to the locked path if a writer holds
+ *        the row
+ */
+static int FlowHashTest04(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.lockless_lookup = 1;
+    FlowHashTestThreadInit(&tv, &dtv);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 2222 % size;
+    FlowBucket *fb = &flow_hash[idx];
+    Flow *flows[3];
+    uint32_t k;
+
+    for (k = 0; k < 3; k++) {
+        flows[k] = FlowHashTestLookup(&tv, &dtv, 1000 + k, idx + k * size, 0);
+        FAIL_IF_NULL(flows[k]);
+    }
+
+    /* make the seq odd as if a writer is in the row */
+    (void)SC_ATOMIC_ADD(fb->seq, 1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(fb->seq) & 1);
+
+    /* the locked path finds the flow and moves it to the front */
+    FAIL_IF(FlowHashTestLookup(&tv, &dtv, 1000, idx, 0) != flows[0]);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 0, 1);
+    FAIL_IF(fb->head != flows[0]);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+
+    /* writer done: lockless again */
+    (void)SC_ATOMIC_SUB(fb->seq, 1);
+    FAIL_IF(SC_ATOMIC_GET(fb->seq) & 1);
+    FAIL_IF(FlowHashTestLookup(&tv, &dtv, 1001, idx + size, 0) != flows[1]);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 1, 1);
+
+    StatsThreadCleanup(&tv);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test lockless lookup falls back to the locked path on TCP session
+ *        reuse
+ */
+static int FlowHashTest05(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.lockless_lookup = 1;
+    FlowHashTestThreadInit(&tv, &dtv);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 3333 % size;
+    FlowBucket *fb = &flow_hash[idx];
+
+    Flow *old_f = FlowHashTestLookup(&tv, &dtv, 1000, idx, 0);
+    FAIL_IF_NULL(old_f);
+
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+    ssn.state = TCP_CLOSED;
+    ssn.client.isn = 1;
+    old_f->protoctx = &ssn;
+
+    Flow *f = FlowHashTestLookup(&tv, &dtv, 1000, idx, TH_SYN);
+    old_f->protoctx = NULL;
+    FAIL_IF_NULL(f);
+    FAIL_IF(f == old_f);
+    FAIL_IF_NOT(old_f->flags & FLOW_TCP_REUSED);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 0, 1);
+    FAIL_IF(fb->head != f);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+
+    /* the new flow is found without the lock */
+    FAIL_IF(FlowHashTestLookup(&tv, &dtv, 1000, idx, 0) != f);
+    FLOW_HASH_TEST_COUNTERS(&tv, &dtv, 1, 1);
+
+    StatsThreadCleanup(&tv);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test run the TCP reuse test with flow.lockless-lookup enabled
+ */
+static int FlowHashTest06(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF_NOT(ConfSet("flow.lockless-lookup", "yes"));
+
+    int r = FlowHashTest02();
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return r;
+}
+
+/** \internal
+ *  \brief register 'n' threads for the flow hash partitions
+ *  \retval id partition id of the last thread */
+static uint32_t FlowHashTestRegister(uint32_t n, uint8_t flow_affinity)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    tv.flow_affinity = flow_affinity;
+    tv.numa_node = -1;
+
+    uint32_t id = 0;
+    while (n--)
+        id = FlowHashRegisterThread(&tv);
+    return id;
+}
+
+/**
+ *  \test the hash is only partitioned if all threads have flow affinity
+ */
+static int FlowHashTest07(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FlowConfig backup;
+    memcpy(&backup, &flow_config, sizeof(FlowConfig));
+    flow_config.thread_partitions = 1;
+
+    /* one thread without flow affinity keeps the hash shared */
+    FAIL_IF(FlowHashTestRegister(3, 1) != 2);
+    FAIL_IF(FlowHashTestRegister(1, 0) != 3);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 0);
+    FAIL_IF(flow_config.hash_partition_size != 0);
+
+    /* registration starts over after the setup */
+    FAIL_IF(FlowHashTestRegister(4, 1) != 3);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 4);
+    FAIL_IF(flow_config.hash_partition_size != flow_config.hash_size / 4);
+
+    /* not enabled in the config */
+    flow_config.thread_partitions = 0;
+    FlowHashTestRegister(4, 1);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 0);
+
+    memcpy(&flow_config, &backup, sizeof(FlowConfig));
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test the hash stays shared if there are more threads than rows
+ */
+static int FlowHashTest08(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FlowConfig backup;
+    memcpy(&backup, &flow_config, sizeof(FlowConfig));
+    flow_config.thread_partitions = 1;
+    /* only use the first rows of the hash */
+    flow_config.hash_size = 4;
+
+    FlowHashTestRegister(5, 1);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 0);
+    FAIL_IF(flow_config.hash_partition_size != 0);
+
+    FlowHashTestRegister(4, 1);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 4);
+    FAIL_IF(flow_config.hash_partition_size != 1);
+
+    memcpy(&flow_config, &backup, sizeof(FlowConfig));
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ *  \test lookups of a thread stay in its partition
+ */
+static int FlowHashTest09(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FlowConfig backup;
+    memcpy(&backup, &flow_config, sizeof(FlowConfig));
+    flow_config.thread_partitions = 1;
+
+    /* 3 doesn't divide the hash size, so the last rows are unused */
+    FlowHashTestRegister(3, 1);
+    FlowHashSetupPartitions();
+    FAIL_IF(flow_config.hash_partitions != 3);
+    const uint32_t size = flow_config.hash_partition_size;
+    FAIL_IF(size == 0);
+
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+    uint32_t part;
+    for (part = 0; part < 3; part++) {
+        dtv.flow_partition = part;
+
+        uint32_t i;
+        for (i = 0; i < 1000; i++) {
+            const uint32_t hash = (i == 999) ? UINT32_MAX : i * 2654435761U;
+            const FlowBucket *fb = FlowGetBucket(&dtv, hash);
+            const uint32_t idx = fb - flow_hash;
+            FAIL_IF(idx < part * size || idx >= (part + 1) * size);
+        }
+    }
+
+    /* the same tuple gets a flow in each partition */
+    Flow *flows[3];
+    for (part = 0; part < 3; part++) {
+        dtv.flow_partition = part;
+        flows[part] = FlowHashTestLookup(NULL, &dtv, 1000, 12345, 0);
+        FAIL_IF_NULL(flows[part]);
+        const uint32_t idx = flows[part]->fb - flow_hash;
+        FAIL_IF(idx != part * size + 12345 % size);
+    }
+    FAIL_IF(flows[0] == flows[1] || flows[1] == flows[2]);
+
+    /* and finds it there again */
+    for (part = 0; part < 3; part++) {
+        dtv.flow_partition = part;
+        FAIL_IF(FlowHashTestLookup(NULL, &dtv, 1000, 12345, 0) != flows[part]);
+    }
+
+    memcpy(&flow_config, &backup, sizeof(FlowConfig));
+    FlowShutdown();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowHashTest01", FlowHashTest01);
+    UtRegisterTest("FlowHashTest02", FlowHashTest02);
+    UtRegisterTest("FlowHashTest03", FlowHashTest03);
+    UtRegisterTest("FlowHashTest04", FlowHashTest04);
+    UtRegisterTest("FlowHashTest05", FlowHashTest05);
+    UtRegisterTest("FlowHashTest06", FlowHashTest06);
+    UtRegisterTest("FlowHashTest07", FlowHashTest07);
+    UtRegisterTest("FlowHashTest08", FlowHashTest08);
+    UtRegisterTest("FlowHashTest09", FlowHashTest09);
+#endif /* UNITTESTS */
+}
@@ -34,12 +34,37 @@
     #endif
 #endif
 
+/** number of flow tags kept in a bucket */
+#define FLOW_BUCKET_TAGS 24
+
+/** tag of a flow in its bucket. The low bits of the hash select the
+ *  bucket, so take the tag from the high bits. */
+#define FLOW_HASH_TAG(hash) (uint16_t)((hash) >> 16)
+
 /* flow hash bucket -- the hash is basically an array of these buckets.
  * Each bucket contains a flow or list of flows. All these flows have
  * the same hashkey (the hash is a chained hash). When doing modifications
- * to the list, the entire bucket is locked. */
+ * to the list, the entire bucket is locked.
+ *
+ * Each bucket also has a sequence counter that is incremented when the
+ * bucket lock is taken and again when it is released. An odd value means
+ * a writer holds the bucket. Lookups can walk the list without the lock
+ * and use the counter to detect if the list changed under them.
+ *
+ * The bucket keeps the tags of the first flows in the list, in list order.
+ * A lookup can skip flows with a different tag without touching their
+ * memory. If tags_complete is set, all flows in the list have a tag, so a
+ * lookup that matches no tag is a miss. Everything a lookup needs is in
+ * the first cache line, the lock and the fields used by writers and the
+ * flow manager are in the second. */
 typedef struct FlowBucket_ {
     Flow *head;
+    /** sequence counter, odd while the bucket is locked */
+    SC_ATOMIC_DECLARE(uint32_t, seq);
+    uint8_t tags_cnt;       /**< number of valid tags */
+    uint8_t tags_complete;  /**< tags cover the whole list */
+    uint16_t tags[FLOW_BUCKET_TAGS];
+
     Flow *tail;
 #ifdef FBLOCK_MUTEX
     SCMutex m;
@@ -56,27 +81,122 @@ typedef struct FlowBucket_ {
     SC_ATOMIC_DECLARE(int32_t, next_ts);
 } __attribute__((aligned(CLS))) FlowBucket;
 
+/* mark the start and end of a write to the bucket */
+#define FBSEQ_BEGIN(fb) (void)SC_ATOMIC_ADD((fb)->seq, 1)
+#define FBSEQ_END(fb) (void)SC_ATOMIC_ADD((fb)->seq, 1)
+
 #ifdef FBLOCK_SPIN
-    #define FBLOCK_INIT(fb) SCSpinInit(&(fb)->s, 0)
+    #define FBLOCK_INIT(fb) ({ SC_ATOMIC_INIT((fb)->seq); SCSpinInit(&(fb)->s, 0); })
     #define FBLOCK_DESTROY(fb) SCSpinDestroy(&(fb)->s)
-    #define FBLOCK_LOCK(fb) SCSpinLock(&(fb)->s)
-    #define FBLOCK_TRYLOCK(fb) SCSpinTrylock(&(fb)->s)
-    #define FBLOCK_UNLOCK(fb) SCSpinUnlock(&(fb)->s)
+    #define FBLOCK_LOCK(fb) ({ SCSpinLock(&(fb)->s); FBSEQ_BEGIN(fb); })
+    #define FBLOCK_TRYLOCK(fb) ({ \
+        int _r = SCSpinTrylock(&(fb)->s); \
+        if (_r == 0) \
+            FBSEQ_BEGIN(fb); \
+        _r; \
+    })
+    #define FBLOCK_UNLOCK(fb) ({ FBSEQ_END(fb); SCSpinUnlock(&(fb)->s); })
 #elif defined FBLOCK_MUTEX
-    #define FBLOCK_INIT(fb) SCMutexInit(&(fb)->m, NULL)
+    #define FBLOCK_INIT(fb) ({ SC_ATOMIC_INIT((fb)->seq); SCMutexInit(&(fb)->m, NULL); })
     #define FBLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->m)
-    #define FBLOCK_LOCK(fb) SCMutexLock(&(fb)->m)
-    #define FBLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->m)
-    #define FBLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->m)
+    #define FBLOCK_LOCK(fb) ({ SCMutexLock(&(fb)->m); FBSEQ_BEGIN(fb); })
+    #define FBLOCK_TRYLOCK(fb) ({ \
+        int _r = SCMutexTrylock(&(fb)->m); \
+        if (_r == 0) \
+            FBSEQ_BEGIN(fb); \
+        _r; \
+    })
+    #define FBLOCK_UNLOCK(fb) ({ FBSEQ_END(fb); SCMutexUnlock(&(fb)->m); })
 #else
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/* flow tag handling. All of these must be called with the bucket locked. */
+
+/** \brief reset the tags of an empty bucket */
+static inline void FlowBucketTagsReset(FlowBucket *fb)
+{
+    fb->tags_cnt = 0;
+    fb->tags_complete = 1;
+}
+
+/** \brief recreate the tags from the flow list */
+static inline void FlowBucketTagsRebuild(FlowBucket *fb)
+{
+    uint8_t cnt = 0;
+    Flow *f = fb->head;
+    while (f != NULL && cnt < FLOW_BUCKET_TAGS) {
+        fb->tags[cnt++] = FLOW_HASH_TAG(f->flow_hash);
+        f = f->hnext;
+    }
+    fb->tags_cnt = cnt;
+    fb->tags_complete = (f == NULL);
+}
+
+/** \brief update tags for a flow added to the start of the list */
+static inline void FlowBucketTagsPushHead(FlowBucket *fb, const uint16_t tag)
+{
+    if (fb->tags_cnt < FLOW_BUCKET_TAGS) {
+        memmove(&fb->tags[1], &fb->tags[0], fb->tags_cnt * sizeof(uint16_t));
+        fb->tags_cnt++;
+    } else {
+        memmove(&fb->tags[1], &fb->tags[0],
+                (FLOW_BUCKET_TAGS - 1) * sizeof(uint16_t));
+        fb->tags_complete = 0;
+    }
+    fb->tags[0] = tag;
+}
+
+/** \brief update tags for the flow at position 'pos' moving to the start
+ *         of the list */
+static inline void FlowBucketTagsMoveToFront(FlowBucket *fb,
+        const uint32_t pos, const uint16_t tag)
+{
+    if (pos < fb->tags_cnt) {
+        memmove(&fb->tags[1], &fb->tags[0], pos * sizeof(uint16_t));
+        fb->tags[0] = tag;
+    } else {
+        FlowBucketTagsPushHead(fb, tag);
+    }
+}
+
+/** \brief update tags after the tail flow was removed */
+static inline void FlowBucketTagsRemoveTail(FlowBucket *fb)
+{
+    if (fb->tags_complete) {
+        if (fb->tags_cnt > 0)
+            fb->tags_cnt--;
+    } else {
+        /* we don't know if the tail had a tag, and the list may now be
+         * short enough to be fully covered */
+        FlowBucketTagsRebuild(fb);
+    }
+}
+
+/** \brief check if any tag in the bucket is 'tag' */
+static inline int FlowBucketTagsHave(const FlowBucket *fb, const uint16_t tag)
+{
+    uint8_t i;
+    for (i = 0; i < fb->tags_cnt; i++) {
+        if (fb->tags[i] == tag)
+            return 1;
+    }
+    return 0;
+}
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
 
 void FlowDisableTcpReuseHandling(void);
 
+uint32_t FlowHashRegisterThread(ThreadVars *tv);
+void FlowHashSetupPartitions(void);
+
+#ifdef UNITTESTS
+int FlowBucketTagsCheck(const FlowBucket *fb);
+#endif
+void FlowHashRegisterTests(void);
+
 #endif /* __FLOW_HASH_H__ */
 
@@ -464,7 +464,11 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
         int32_t next_ts = 0;
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts);
+        uint32_t removed = FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts);
+        if (removed > 0) {
+            FlowBucketTagsRebuild(fb);
+            cnt += removed;
+        }
 
         SC_ATOMIC_SET(fb->next_ts, next_ts);
 
@@ -551,6 +555,7 @@ static uint32_t FlowCleanupHash(void){
         if (fb->tail != NULL) {
             /* we have a flow, or more than one */
             cnt += FlowManagerHashRowCleanup(fb->tail);
+            FlowBucketTagsReset(fb);
         }
 
         FBLOCK_UNLOCK(fb);
@@ -1208,7 +1213,7 @@ static int FlowMgrTest02 (void)
     memset(&fb, 0, sizeof(FlowBucket));
     memset(&ts, 0, sizeof(ts));
     memset(&seg, 0, sizeof(TcpSegment));
-    memset(&client, 0, sizeof(TcpSegment));
+    memset(&client, 0, sizeof(TcpStream));
 
     FBLOCK_INIT(&fb);
     FLOW_INITIALIZE(&f);
@@ -1216,9 +1221,7 @@ static int FlowMgrTest02 (void)
 
     TimeGet(&ts);
     TCP_SEG_LEN(&seg) = 3;
-    seg.next = NULL;
-    seg.prev = NULL;
-    client.seg_list = &seg;
+    TCPSEG_RB_INSERT(&client.seg_tree, &seg);
     ssn.client = client;
     ssn.server = client;
     ssn.state = TCP_ESTABLISHED;
@@ -1314,7 +1317,7 @@ static int FlowMgrTest04 (void)
     memset(&fb, 0, sizeof(FlowBucket));
     memset(&ts, 0, sizeof(ts));
     memset(&seg, 0, sizeof(TcpSegment));
-    memset(&client, 0, sizeof(TcpSegment));
+    memset(&client, 0, sizeof(TcpStream));
 
     FBLOCK_INIT(&fb);
     FLOW_INITIALIZE(&f);
@@ -1322,9 +1325,7 @@ static int FlowMgrTest04 (void)
 
     TimeGet(&ts);
     TCP_SEG_LEN(&seg) = 3;
-    seg.next = NULL;
-    seg.prev = NULL;
-    client.seg_list = &seg;
+    TCPSEG_RB_INSERT(&client.seg_tree, &seg);
     ssn.client = client;
     ssn.server = client;
     ssn.state = TCP_ESTABLISHED;
@@ -1399,6 +1400,81 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+/** \internal
+ *  \brief time out every 'step'th flow in 'flows' */
+static void FlowMgrTestExpire(Flow **flows, uint32_t cnt, uint32_t step,
+        const struct timeval *ts)
+{
+    uint32_t k;
+    for (k = 0; k < cnt; k++) {
+        if (flows[k] == NULL || (k % step) != 0)
+            continue;
+        flows[k]->lastts.tv_sec = ts->tv_sec - 5000;
+        flows[k]->flags |= FLOW_TIMEOUT_REASSEMBLY_DONE;
+        flows[k] = NULL;
+    }
+}
+
+/**
+ *  \test tags of a hash row follow the flow list when the timeout sweep
+ *        removes flows from it
+ */
+static int FlowMgrTest06 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    const uint32_t size = flow_config.hash_size;
+    const uint32_t idx = 777 % size;
+    FlowBucket *fb = &flow_hash[idx];
+    Flow *flows[30];
+    uint32_t k;
+
+    for (k = 0; k < 30; k++) {
+        Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP,
+                "10.0.0.1", "10.0.0.2", 1000 + k, 80);
+        FAIL_IF_NULL(p);
+        p->flow_hash = idx + k * size;
+        flows[k] = FlowGetFlowFromHash(NULL, NULL, p, &p->flow);
+        FAIL_IF_NULL(flows[k]);
+        FLOWLOCK_UNLOCK(flows[k]);
+        FlowDeReference(&p->flow);
+        UTHFreePacket(p);
+    }
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_complete != 0);
+
+    struct timeval ts;
+    TimeGet(&ts);
+    FlowTimeoutCounters counters;
+
+    /* 3 flows time out: 27 left, the tags still can't cover all of them */
+    FlowMgrTestExpire(flows, 30, 10, &ts);
+    memset(&counters, 0, sizeof(counters));
+    FAIL_IF(FlowTimeoutHash(&ts, 0, idx, idx + 1, &counters) != 3);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != FLOW_BUCKET_TAGS);
+    FAIL_IF(fb->tags_complete != 0);
+
+    /* 9 more, some with and some without a tag: 18 left, all tagged */
+    FlowMgrTestExpire(flows, 30, 3, &ts);
+    memset(&counters, 0, sizeof(counters));
+    FAIL_IF(FlowTimeoutHash(&ts, 0, idx, idx + 1, &counters) != 9);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != 18);
+    FAIL_IF(fb->tags_complete != 1);
+
+    /* the rest */
+    FlowMgrTestExpire(flows, 30, 1, &ts);
+    memset(&counters, 0, sizeof(counters));
+    FAIL_IF(FlowTimeoutHash(&ts, 0, idx, idx + 1, &counters) != 18);
+    FAIL_IF(fb->head != NULL);
+    FAIL_IF_NOT(FlowBucketTagsCheck(fb));
+    FAIL_IF(fb->tags_cnt != 0);
+
+    FlowShutdown();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1417,5 +1493,7 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Flow tags after timing out flows",
+                   FlowMgrTest06);
 #endif /* UNITTESTS */
 }
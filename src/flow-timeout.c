@@ -220,8 +220,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
             p->tcph->th_ack = htonl(ssn->server.last_ack);
         } else {
             p->tcph->th_seq = htonl(ssn->client.next_seq);
-            p->tcph->th_ack = htonl(ssn->server.seg_list_tail->seq +
-                                    TCP_SEG_LEN(ssn->server.seg_list_tail));
+            p->tcph->th_ack = htonl(ssn->server.segs_right_edge);
         }
 
         /* to client */
@@ -234,8 +233,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
             p->tcph->th_ack = htonl(ssn->client.last_ack);
         } else {
             p->tcph->th_seq = htonl(ssn->server.next_seq);
-            p->tcph->th_ack = htonl(ssn->client.seg_list_tail->seq +
-                                    TCP_SEG_LEN(ssn->client.seg_list_tail));
+            p->tcph->th_ack = htonl(ssn->client.segs_right_edge);
         }
     }
 
@@ -43,6 +43,7 @@
 #include "util-validate.h"
 
 #include "flow-util.h"
+#include "flow-hash.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -119,6 +120,8 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
         return TM_ECODE_FAILED;
     }
 
+    fw->dtv->flow_partition = FlowHashRegisterThread(tv);
+
     DecodeRegisterPerfCounters(fw->dtv, tv);
     AppLayerRegisterThreadCounters(tv);
 
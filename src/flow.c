@@ -55,6 +55,7 @@
 
 #include "util-debug.h"
 #include "util-privs.h"
+#include "util-affinity.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -129,6 +130,11 @@ int FlowUpdateSpareFlows(void)
             FlowEnqueue(&flow_spare_q,f);
         }
     } else if (len > flow_config.prealloc) {
+        /* lockless lookups may still touch a flow that was just moved
+         * to the spare queue, so flow memory is only freed at shutdown */
+        if (flow_config.lockless_lookup)
+            return 1;
+
         tofree = len - flow_config.prealloc;
 
         uint32_t i;
@@ -434,6 +440,20 @@ void FlowInitConfig(char quiet)
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
 
+    /* off by default: with it, flows above prealloc are not freed */
+    int lockless = 0;
+    if (ConfGetBool("flow.lockless-lookup", &lockless) == 0) {
+        lockless = 0;
+    }
+    flow_config.lockless_lookup = lockless;
+    SCLogDebug("flow.lockless-lookup: %s", lockless ? "yes" : "no");
+
+    int partitions = 0;
+    if (ConfGetBool("flow.thread-partitions", &partitions) == 0) {
+        partitions = 0;
+    }
+    flow_config.thread_partitions = partitions;
+
     /* alloc hash memory */
     uint64_t hash_size = flow_config.hash_size * sizeof(FlowBucket);
     if (!(FLOW_CHECK_MEMCAP(hash_size))) {
@@ -450,12 +470,18 @@ void FlowInitConfig(char quiet)
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
+    /* the hash is used by the threads of all nodes. If it's split between
+     * the threads, FlowHashSetupPartitions places it once the threads are
+     * known. */
+    if (!flow_config.thread_partitions)
+        AffinityInterleaveMemory(flow_hash, flow_config.hash_size * sizeof(FlowBucket));
     memset(flow_hash, 0, flow_config.hash_size * sizeof(FlowBucket));
 
     uint32_t i = 0;
     for (i = 0; i < flow_config.hash_size; i++) {
         FBLOCK_INIT(&flow_hash[i]);
         SC_ATOMIC_INIT(flow_hash[i].next_ts);
+        FlowBucketTagsReset(&flow_hash[i]);
     }
     (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
 
@@ -1160,6 +1186,25 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Run the memcap tests with flow.lockless-lookup enabled
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowTest10 (void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    FAIL_IF_NOT(ConfSet("flow.lockless-lookup", "yes"));
+
+    int result = FlowTest07() && FlowTest08() && FlowTest09();
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1177,8 +1222,11 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test flow Allocations with lockless lookups",
+                   FlowTest10);
 
     FlowMgrRegisterTests();
+    FlowHashRegisterTests();
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
 }
@@ -256,6 +256,16 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** walk the hash rows without taking the row lock on lookup. Requires
+     *  that flow memory is not freed at runtime. */
+    int lockless_lookup;
+
+    /** give each worker thread its own part of the hash if the capture
+     *  method guarantees flow affinity */
+    int thread_partitions;
+    uint32_t hash_partitions;       /**< 0 if the hash is shared */
+    uint32_t hash_partition_size;   /**< rows per partition */
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
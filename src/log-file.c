@@ -424,6 +424,13 @@ static OutputCtx *LogFileLogInitCtx(ConfNode *conf)
         LogFileFreeCtx(logfile_ctx);
         return NULL;
     }
+    /* we write to the fp directly */
+    if (logfile_ctx->threads != NULL) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s: per thread "
+                "files are not supported", conf->name);
+        LogFileFreeCtx(logfile_ctx);
+        return NULL;
+    }
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
     if (unlikely(output_ctx == NULL))
@@ -47,6 +47,8 @@
 #include "util-file.h"
 #include "util-time.h"
 #include "util-misc.h"
+#include "util-fmemopen.h"
+#include "util-signal.h"
 
 #include "output.h"
 
@@ -71,6 +73,13 @@ typedef struct LogFilestoreLogThread_ {
     /** LogFilestoreCtx has the pointer to the file and a mutex to allow multithreading */
     uint32_t file_cnt;
     uint16_t counter_max_hits;
+
+    /** scratch buffer the meta data is formatted in, in async mode */
+    char *meta_buf;
+    size_t meta_buf_size;
+    /** meta records too large to write since the last warning */
+    uint32_t meta_too_large_cnt;
+    time_t meta_too_large_ts;
 } LogFilestoreLogThread;
 
 static uint64_t LogFilestoreOpenFilesCounter(void)
@@ -79,6 +88,346 @@ static uint64_t LogFilestoreOpenFilesCounter(void)
     return fcopy;
 }
 
+/* Async writer
+ *
+ * In async mode the workers don't touch the disk. They copy the file
+ * data and the formatted meta data into jobs and queue them to one of
+ * the writer threads. All jobs of a file go to the same writer, picked
+ * by the file store id, so they are written in order. The memory used
+ * by the queued jobs is bounded: once max-queued is reached workers
+ * wait for the writers to catch up.
+ */
+
+/** default size of the meta scratch buffer, and max it can grow to */
+#define FILESTORE_META_BUF_SIZE         4096
+#define FILESTORE_META_BUF_MAX          (1024 * 1024)
+/** min seconds between warnings about meta data that is too large */
+#define FILESTORE_META_WARN_SECS        60
+/** number of files a writer keeps open if max-open-files is not set */
+#define FILESTORE_ASYNC_FDS_DEFAULT     64
+#define FILESTORE_ASYNC_WRITERS_DEFAULT 2
+#define FILESTORE_ASYNC_MAX_QUEUED_DEFAULT (64 * 1024 * 1024)
+/** time a worker waits for the queue to drain before checking again */
+#define FILESTORE_ASYNC_FULL_USEC       1000
+
+#define FILESTORE_JOB_FILE              0
+#define FILESTORE_JOB_META              1
+
+#define FILESTORE_JOB_FLAG_OPEN         BIT_U8(0)
+#define FILESTORE_JOB_FLAG_CLOSE        BIT_U8(1)
+
+typedef struct LogFilestoreJob_ {
+    uint8_t type;
+    /** for file jobs open and/or close, for meta jobs open means the meta
+     *  file is created, otherwise the data is appended to it */
+    uint8_t flags;
+    uint32_t file_id;
+    uint32_t len;
+    /** time the job was queued, for the latency counters */
+    struct timeval queued;
+    struct LogFilestoreJob_ *next;
+    uint8_t data[];
+} LogFilestoreJob;
+
+/** a file kept open by a writer */
+typedef struct LogFilestoreWriterFd_ {
+    uint32_t file_id;
+    int fd;
+} LogFilestoreWriterFd;
+
+typedef struct LogFilestoreWriter_ {
+    pthread_t thread;
+    char name[16];
+
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;
+    LogFilestoreJob *head;
+    LogFilestoreJob *tail;
+    int run;
+
+    /** open files, indexed by file id modulo fds_size. Only used by the
+     *  writer thread. */
+    LogFilestoreWriterFd *fds;
+    uint32_t fds_size;
+
+    /** max job latency seen by this writer. Only updated by the writer
+     *  thread, merged over all writers when reported. */
+    SC_ATOMIC_DECLARE(uint64_t, latency_max_usecs);
+} LogFilestoreWriter;
+
+typedef struct LogFilestoreAsync_ {
+    LogFilestoreWriter *writers;
+    uint32_t writers_cnt;
+    uint64_t max_queued;
+
+    /** workers wait on this for space in the queues */
+    SCCtrlMutex space_mutex;
+    SCCtrlCondT space_cond;
+
+    SC_ATOMIC_DECLARE(uint64_t, queued_bytes);
+    SC_ATOMIC_DECLARE(uint64_t, jobs);
+    SC_ATOMIC_DECLARE(uint64_t, backpressure);
+    SC_ATOMIC_DECLARE(uint64_t, latency_usecs);
+} LogFilestoreAsync;
+
+static LogFilestoreAsync *g_filestore_async = NULL;
+
+static uint64_t LogFilestoreAsyncQueuedCounter(void)
+{
+    return g_filestore_async ? SC_ATOMIC_GET(g_filestore_async->queued_bytes) : 0;
+}
+
+static uint64_t LogFilestoreAsyncJobsCounter(void)
+{
+    return g_filestore_async ? SC_ATOMIC_GET(g_filestore_async->jobs) : 0;
+}
+
+static uint64_t LogFilestoreAsyncBackpressureCounter(void)
+{
+    return g_filestore_async ? SC_ATOMIC_GET(g_filestore_async->backpressure) : 0;
+}
+
+static uint64_t LogFilestoreAsyncLatencyAvgCounter(void)
+{
+    if (g_filestore_async == NULL)
+        return 0;
+    uint64_t jobs = SC_ATOMIC_GET(g_filestore_async->jobs);
+    return jobs ? SC_ATOMIC_GET(g_filestore_async->latency_usecs) / jobs : 0;
+}
+
+static uint64_t LogFilestoreAsyncLatencyMax(LogFilestoreAsync *async)
+{
+    uint64_t max = 0;
+    uint32_t i;
+    for (i = 0; i < async->writers_cnt; i++) {
+        uint64_t usecs = SC_ATOMIC_GET(async->writers[i].latency_max_usecs);
+        if (usecs > max)
+            max = usecs;
+    }
+    return max;
+}
+
+static uint64_t LogFilestoreAsyncLatencyMaxCounter(void)
+{
+    return g_filestore_async ? LogFilestoreAsyncLatencyMax(g_filestore_async) : 0;
+}
+
+/** \internal
+ *  \brief get the fd of an open file of the writer, or open it
+ *
+ *  A file using the same slot is closed, it will be reopened in append
+ *  mode if more data shows up for it.
+ */
+static int LogFilestoreWriterGetFd(LogFilestoreWriter *w, uint32_t file_id,
+                                   int create)
+{
+    LogFilestoreWriterFd *slot = &w->fds[file_id % w->fds_size];
+    if (slot->fd != -1) {
+        if (slot->file_id == file_id && !create)
+            return slot->fd;
+        close(slot->fd);
+        slot->fd = -1;
+        SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+    }
+
+    char filename[PATH_MAX] = "";
+    snprintf(filename, sizeof(filename), "%s/file.%u",
+            g_logfile_base_dir, file_id);
+    int fd;
+    if (create)
+        fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+    else
+        fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+    if (fd == -1) {
+        SCLogDebug("failed to open file %s: %s", filename, strerror(errno));
+        return -1;
+    }
+
+    slot->file_id = file_id;
+    slot->fd = fd;
+    SC_ATOMIC_ADD(filestore_open_file_cnt, 1);
+    return fd;
+}
+
+static void LogFilestoreWriterCloseFd(LogFilestoreWriter *w, uint32_t file_id)
+{
+    LogFilestoreWriterFd *slot = &w->fds[file_id % w->fds_size];
+    if (slot->fd != -1 && slot->file_id == file_id) {
+        close(slot->fd);
+        slot->fd = -1;
+        SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+    }
+}
+
+static void LogFilestoreWriterWrite(int fd, const uint8_t *data, uint32_t len)
+{
+    while (len > 0) {
+        ssize_t r = write(fd, (const void *)data, (size_t)len);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            SCLogDebug("write failed: %s", strerror(errno));
+            return;
+        }
+        data += r;
+        len -= (uint32_t)r;
+    }
+}
+
+static void LogFilestoreWriterDoJob(LogFilestoreWriter *w, LogFilestoreJob *job)
+{
+    if (job->type == FILESTORE_JOB_META) {
+        char metafilename[PATH_MAX] = "";
+        snprintf(metafilename, sizeof(metafilename), "%s/file.%u.meta",
+                g_logfile_base_dir, job->file_id);
+        int fd;
+        if (job->flags & FILESTORE_JOB_FLAG_OPEN)
+            fd = open(metafilename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+        else
+            fd = open(metafilename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+        if (fd == -1) {
+            SCLogInfo("opening %s failed: %s", metafilename, strerror(errno));
+            return;
+        }
+        LogFilestoreWriterWrite(fd, job->data, job->len);
+        close(fd);
+        return;
+    }
+
+    int fd = LogFilestoreWriterGetFd(w, job->file_id,
+            (job->flags & FILESTORE_JOB_FLAG_OPEN) ? 1 : 0);
+    if (fd != -1) {
+        LogFilestoreWriterWrite(fd, job->data, job->len);
+    }
+    if (job->flags & FILESTORE_JOB_FLAG_CLOSE) {
+        LogFilestoreWriterCloseFd(w, job->file_id);
+    }
+}
+
+static void *LogFilestoreWriterThread(void *arg)
+{
+    LogFilestoreWriter *w = (LogFilestoreWriter *)arg;
+    LogFilestoreAsync *async = g_filestore_async;
+
+    /* block usr2.  usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName(w->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (1) {
+        /* take all queued jobs at once */
+        SCCtrlMutexLock(&w->mutex);
+        while (w->head == NULL && w->run) {
+            SCCtrlCondWait(&w->cond, &w->mutex);
+        }
+        LogFilestoreJob *job = w->head;
+        w->head = w->tail = NULL;
+        int run = w->run;
+        SCCtrlMutexUnlock(&w->mutex);
+
+        if (job == NULL && !run)
+            break;
+
+        uint64_t bytes = 0;
+        while (job != NULL) {
+            LogFilestoreJob *next = job->next;
+            LogFilestoreWriterDoJob(w, job);
+
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            uint64_t usecs = (uint64_t)(now.tv_sec - job->queued.tv_sec) * 1000000 +
+                (now.tv_usec - job->queued.tv_usec);
+            (void)SC_ATOMIC_ADD(async->latency_usecs, usecs);
+            if (usecs > SC_ATOMIC_GET(w->latency_max_usecs))
+                SC_ATOMIC_SET(w->latency_max_usecs, usecs);
+            (void)SC_ATOMIC_ADD(async->jobs, 1);
+
+            bytes += sizeof(LogFilestoreJob) + job->len;
+            SCFree(job);
+            job = next;
+        }
+
+        /* let the workers waiting for space know */
+        SC_ATOMIC_SUB(async->queued_bytes, bytes);
+        SCCtrlMutexLock(&async->space_mutex);
+        SCCtrlCondBroadcast(&async->space_cond);
+        SCCtrlMutexUnlock(&async->space_mutex);
+    }
+
+    uint32_t i;
+    for (i = 0; i < w->fds_size; i++) {
+        if (w->fds[i].fd != -1) {
+            close(w->fds[i].fd);
+            w->fds[i].fd = -1;
+            SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+        }
+    }
+    return NULL;
+}
+
+/** \internal
+ *  \brief queue a job to the writer of its file
+ *
+ *  If the queues are at max-queued, wait for the writers to make room.
+ *  A job is always accepted if nothing is queued, so files with large
+ *  chunks still make progress.
+ */
+static void LogFilestoreAsyncQueue(LogFilestoreAsync *async, LogFilestoreJob *job)
+{
+    const uint64_t size = sizeof(LogFilestoreJob) + job->len;
+
+    if (SC_ATOMIC_GET(async->queued_bytes) + size > async->max_queued) {
+        (void)SC_ATOMIC_ADD(async->backpressure, 1);
+        SCCtrlMutexLock(&async->space_mutex);
+        while (SC_ATOMIC_GET(async->queued_bytes) != 0 &&
+               SC_ATOMIC_GET(async->queued_bytes) + size > async->max_queued)
+        {
+            struct timeval tv;
+            struct timespec cond_time;
+            gettimeofday(&tv, NULL);
+            uint64_t usec = (uint64_t)tv.tv_usec + FILESTORE_ASYNC_FULL_USEC;
+            cond_time.tv_sec = tv.tv_sec + (usec / 1000000);
+            cond_time.tv_nsec = (usec % 1000000) * 1000;
+            SCCtrlCondTimedwait(&async->space_cond, &async->space_mutex,
+                    &cond_time);
+        }
+        SCCtrlMutexUnlock(&async->space_mutex);
+    }
+    (void)SC_ATOMIC_ADD(async->queued_bytes, size);
+
+    gettimeofday(&job->queued, NULL);
+    job->next = NULL;
+
+    LogFilestoreWriter *w = &async->writers[job->file_id % async->writers_cnt];
+    SCCtrlMutexLock(&w->mutex);
+    if (w->tail != NULL)
+        w->tail->next = job;
+    else
+        w->head = job;
+    w->tail = job;
+    SCCtrlCondSignal(&w->cond);
+    SCCtrlMutexUnlock(&w->mutex);
+}
+
+static int LogFilestoreAsyncQueueData(LogFilestoreAsync *async, uint8_t type,
+        uint8_t flags, uint32_t file_id, const uint8_t *data, uint32_t len)
+{
+    LogFilestoreJob *job = SCMalloc(sizeof(LogFilestoreJob) + len);
+    if (unlikely(job == NULL))
+        return -1;
+    job->type = type;
+    job->flags = flags;
+    job->file_id = file_id;
+    job->len = len;
+    if (len > 0)
+        memcpy(job->data, data, len);
+
+    LogFilestoreAsyncQueue(async, job);
+    return 0;
+}
+
 static void LogFilestoreMetaGetUri(FILE *fp, const Packet *p, const File *ff)
 {
     HtpState *htp_state = (HtpState *)p->flow->alstate;
@@ -203,85 +552,216 @@ static uint32_t FileGetMaxOpenFiles(void)
     return g_file_store_max_open_files;
 }
 
-static void LogFilestoreLogCreateMetaFile(const Packet *p, const File *ff, char *filename, int ipver) {
-    if (!FileWriteMeta())
-        return;
+static void LogFilestoreWriteMetaOpen(FILE *fp, const Packet *p, const File *ff, int ipver)
+{
+    char timebuf[64];
 
-    char metafilename[PATH_MAX] = "";
-    snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
-    FILE *fp = fopen(metafilename, "w+");
-    if (fp != NULL) {
-        char timebuf[64];
+    CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    fprintf(fp, "TIME:              %s\n", timebuf);
+    if (p->pcap_cnt > 0) {
+        fprintf(fp, "PCAP PKT NUM:      %"PRIu64"\n", p->pcap_cnt);
+    }
 
-        CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
+    char srcip[46], dstip[46];
+    Port sp, dp;
+    switch (ipver) {
+        case AF_INET:
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+            break;
+        case AF_INET6:
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+            break;
+        default:
+            strlcpy(srcip, "<unknown>", sizeof(srcip));
+            strlcpy(dstip, "<unknown>", sizeof(dstip));
+            break;
+    }
+    sp = p->sp;
+    dp = p->dp;
+
+    fprintf(fp, "SRC IP:            %s\n", srcip);
+    fprintf(fp, "DST IP:            %s\n", dstip);
+    fprintf(fp, "PROTO:             %" PRIu32 "\n", p->proto);
+    if (PKT_IS_TCP(p) || PKT_IS_UDP(p)) {
+        fprintf(fp, "SRC PORT:          %" PRIu16 "\n", sp);
+        fprintf(fp, "DST PORT:          %" PRIu16 "\n", dp);
+    }
 
-        fprintf(fp, "TIME:              %s\n", timebuf);
-        if (p->pcap_cnt > 0) {
-            fprintf(fp, "PCAP PKT NUM:      %"PRIu64"\n", p->pcap_cnt);
-        }
+    fprintf(fp, "APP PROTO:         %s\n",
+            AppProtoToString(p->flow->alproto));
 
-        char srcip[46], dstip[46];
-        Port sp, dp;
-        switch (ipver) {
-            case AF_INET:
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
-                break;
-            case AF_INET6:
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
-                break;
-            default:
-                strlcpy(srcip, "<unknown>", sizeof(srcip));
-                strlcpy(dstip, "<unknown>", sizeof(dstip));
-                break;
-        }
-        sp = p->sp;
-        dp = p->dp;
-
-        fprintf(fp, "SRC IP:            %s\n", srcip);
-        fprintf(fp, "DST IP:            %s\n", dstip);
-        fprintf(fp, "PROTO:             %" PRIu32 "\n", p->proto);
-        if (PKT_IS_TCP(p) || PKT_IS_UDP(p)) {
-            fprintf(fp, "SRC PORT:          %" PRIu16 "\n", sp);
-            fprintf(fp, "DST PORT:          %" PRIu16 "\n", dp);
+    /* Only applicable to HTTP traffic */
+    if (p->flow->alproto == ALPROTO_HTTP) {
+        fprintf(fp, "HTTP URI:          ");
+        LogFilestoreMetaGetUri(fp, p, ff);
+        fprintf(fp, "\n");
+        fprintf(fp, "HTTP HOST:         ");
+        LogFilestoreMetaGetHost(fp, p, ff);
+        fprintf(fp, "\n");
+        fprintf(fp, "HTTP REFERER:      ");
+        LogFilestoreMetaGetReferer(fp, p, ff);
+        fprintf(fp, "\n");
+        fprintf(fp, "HTTP USER AGENT:   ");
+        LogFilestoreMetaGetUserAgent(fp, p, ff);
+        fprintf(fp, "\n");
+    } else if (p->flow->alproto == ALPROTO_SMTP) {
+        /* Only applicable to SMTP */
+        LogFilestoreMetaGetSmtp(fp, p, ff);
+    }
+
+    fprintf(fp, "FILENAME:          ");
+    PrintRawUriFp(fp, ff->name, ff->name_len);
+    fprintf(fp, "\n");
+}
+
+static void LogFilestoreWriteMetaClose(FILE *fp, const File *ff)
+{
+#ifdef HAVE_MAGIC
+    fprintf(fp, "MAGIC:             %s\n",
+            ff->magic ? ff->magic : "<unknown>");
+#endif
+    switch (ff->state) {
+        case FILE_STATE_CLOSED:
+            fprintf(fp, "STATE:             CLOSED\n");
+#ifdef HAVE_NSS
+            if (ff->flags & FILE_MD5) {
+                fprintf(fp, "MD5:               ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->md5); x++) {
+                    fprintf(fp, "%02x", ff->md5[x]);
+                }
+                fprintf(fp, "\n");
+            }
+            if (ff->flags & FILE_SHA1) {
+                fprintf(fp, "SHA1:              ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha1); x++) {
+                    fprintf(fp, "%02x", ff->sha1[x]);
+                }
+                fprintf(fp, "\n");
+            }
+            if (ff->flags & FILE_SHA256) {
+                fprintf(fp, "SHA256:            ");
+                size_t x;
+                for (x = 0; x < sizeof(ff->sha256); x++) {
+                    fprintf(fp, "%02x", ff->sha256[x]);
+                }
+                fprintf(fp, "\n");
+            }
+#endif
+            break;
+        case FILE_STATE_TRUNCATED:
+            fprintf(fp, "STATE:             TRUNCATED\n");
+            break;
+        case FILE_STATE_ERROR:
+            fprintf(fp, "STATE:             ERROR\n");
+            break;
+        default:
+            fprintf(fp, "STATE:             UNKNOWN\n");
+            break;
+    }
+    fprintf(fp, "SIZE:              %"PRIu64"\n", FileTrackedSize(ff));
+}
+
+static void LogFilestoreWriteMetaCloseAsync(FILE *fp, const Packet *p,
+        const File *ff, int ipver)
+{
+    LogFilestoreWriteMetaClose(fp, ff);
+}
+
+typedef void (*LogFilestoreWriteMetaFunc)(FILE *fp, const Packet *p,
+        const File *ff, int ipver);
+
+/** \internal
+ *  \brief format meta data in the thread's scratch buffer and queue it
+ *
+ *  The buffer grows if the meta data doesn't fit. Meta data that doesn't
+ *  fit in FILESTORE_META_BUF_MAX is not written, and the buffer goes back
+ *  to its default size for the next record.
+ */
+static void LogFilestoreAsyncQueueMeta(LogFilestoreLogThread *aft,
+        const Packet *p, const File *ff, int ipver, int open,
+        LogFilestoreWriteMetaFunc WriteMeta)
+{
+    while (aft->meta_buf_size <= FILESTORE_META_BUF_MAX) {
+        if (aft->meta_buf == NULL) {
+            aft->meta_buf = SCMalloc(aft->meta_buf_size);
+            if (unlikely(aft->meta_buf == NULL))
+                return;
         }
 
-        fprintf(fp, "APP PROTO:         %s\n",
-                AppProtoToString(p->flow->alproto));
+        FILE *fp = SCFmemopen(aft->meta_buf, aft->meta_buf_size, "w");
+        if (fp == NULL)
+            return;
+        WriteMeta(fp, p, ff, ipver);
+        fflush(fp);
+        long len = ftell(fp);
+        fclose(fp);
 
-        /* Only applicable to HTTP traffic */
-        if (p->flow->alproto == ALPROTO_HTTP) {
-            fprintf(fp, "HTTP URI:          ");
-            LogFilestoreMetaGetUri(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP HOST:         ");
-            LogFilestoreMetaGetHost(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP REFERER:      ");
-            LogFilestoreMetaGetReferer(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP USER AGENT:   ");
-            LogFilestoreMetaGetUserAgent(fp, p, ff);
-            fprintf(fp, "\n");
-        } else if (p->flow->alproto == ALPROTO_SMTP) {
-            /* Only applicable to SMTP */
-            LogFilestoreMetaGetSmtp(fp, p, ff);
+        /* the last byte is taken by the terminating NUL */
+        if (len >= 0 && (size_t)len < aft->meta_buf_size - 1) {
+            if (LogFilestoreAsyncQueueData(g_filestore_async, FILESTORE_JOB_META,
+                        open ? FILESTORE_JOB_FLAG_OPEN : 0, ff->file_store_id,
+                        (uint8_t *)aft->meta_buf, (uint32_t)len) != 0) {
+                SCLogDebug("failed to queue meta data");
+            }
+            return;
         }
 
-        fprintf(fp, "FILENAME:          ");
-        PrintRawUriFp(fp, ff->name, ff->name_len);
-        fprintf(fp, "\n");
+        SCFree(aft->meta_buf);
+        aft->meta_buf = NULL;
+        aft->meta_buf_size *= 2;
+    }
+    aft->meta_buf_size = FILESTORE_META_BUF_SIZE;
+
+    aft->meta_too_large_cnt++;
+    time_t now = time(NULL);
+    if (now - aft->meta_too_large_ts >= FILESTORE_META_WARN_SECS) {
+        SCLogWarning(SC_ERR_FWRITE, "meta data of file %u larger than %u "
+                "bytes, not written (%u meta records skipped since the last "
+                "warning)", ff->file_store_id, FILESTORE_META_BUF_MAX,
+                aft->meta_too_large_cnt);
+        aft->meta_too_large_cnt = 0;
+        aft->meta_too_large_ts = now;
+    }
+}
 
+static void LogFilestoreLogCreateMetaFile(LogFilestoreLogThread *aft,
+        const Packet *p, const File *ff, char *filename, int ipver)
+{
+    if (!FileWriteMeta())
+        return;
+
+    if (g_filestore_async != NULL) {
+        LogFilestoreAsyncQueueMeta(aft, p, ff, ipver, 1,
+                LogFilestoreWriteMetaOpen);
+        return;
+    }
+
+    char metafilename[PATH_MAX] = "";
+    snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
+    FILE *fp = fopen(metafilename, "w+");
+    if (fp != NULL) {
+        LogFilestoreWriteMetaOpen(fp, p, ff, ipver);
         fclose(fp);
     }
 }
 
-static void LogFilestoreLogCloseMetaFile(const File *ff)
+static void LogFilestoreLogCloseMetaFile(LogFilestoreLogThread *aft,
+        const Packet *p, const File *ff, int ipver)
 {
     if (!FileWriteMeta())
         return;
 
+    if (g_filestore_async != NULL) {
+        LogFilestoreAsyncQueueMeta(aft, p, ff, ipver, 0,
+                LogFilestoreWriteMetaCloseAsync);
+        return;
+    }
+
     char filename[PATH_MAX] = "";
     snprintf(filename, sizeof(filename), "%s/file.%u",
             g_logfile_base_dir, ff->file_store_id);
@@ -289,58 +769,51 @@ static void LogFilestoreLogCloseMetaFile(const File *ff)
     snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
     FILE *fp = fopen(metafilename, "a");
     if (fp != NULL) {
-#ifdef HAVE_MAGIC
-        fprintf(fp, "MAGIC:             %s\n",
-                ff->magic ? ff->magic : "<unknown>");
-#endif
-        switch (ff->state) {
-            case FILE_STATE_CLOSED:
-                fprintf(fp, "STATE:             CLOSED\n");
-#ifdef HAVE_NSS
-                if (ff->flags & FILE_MD5) {
-                    fprintf(fp, "MD5:               ");
-                    size_t x;
-                    for (x = 0; x < sizeof(ff->md5); x++) {
-                        fprintf(fp, "%02x", ff->md5[x]);
-                    }
-                    fprintf(fp, "\n");
-                }
-                if (ff->flags & FILE_SHA1) {
-                    fprintf(fp, "SHA1:              ");
-                    size_t x;
-                    for (x = 0; x < sizeof(ff->sha1); x++) {
-                        fprintf(fp, "%02x", ff->sha1[x]);
-                    }
-                    fprintf(fp, "\n");
-                }
-                if (ff->flags & FILE_SHA256) {
-                    fprintf(fp, "SHA256:            ");
-                    size_t x;
-                    for (x = 0; x < sizeof(ff->sha256); x++) {
-                        fprintf(fp, "%02x", ff->sha256[x]);
-                    }
-                    fprintf(fp, "\n");
-                }
-#endif
-                break;
-            case FILE_STATE_TRUNCATED:
-                fprintf(fp, "STATE:             TRUNCATED\n");
-                break;
-            case FILE_STATE_ERROR:
-                fprintf(fp, "STATE:             ERROR\n");
-                break;
-            default:
-                fprintf(fp, "STATE:             UNKNOWN\n");
-                break;
-        }
-        fprintf(fp, "SIZE:              %"PRIu64"\n", FileTrackedSize(ff));
-
+        LogFilestoreWriteMetaClose(fp, ff);
         fclose(fp);
     } else {
         SCLogInfo("opening %s failed: %s", metafilename, strerror(errno));
     }
 }
 
+/** \internal
+ *  \brief queue the data of a file to its writer thread
+ */
+static int LogFilestoreLoggerAsync(LogFilestoreLogThread *aft, const Packet *p,
+        File *ff, const uint8_t *data, uint32_t data_len, uint8_t flags,
+        int ipver)
+{
+    char filename[PATH_MAX] = "";
+    uint8_t job_flags = 0;
+
+    if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+        aft->file_cnt++;
+
+        snprintf(filename, sizeof(filename), "%s/file.%u",
+                g_logfile_base_dir, ff->file_store_id);
+        LogFilestoreLogCreateMetaFile(aft, p, ff, filename, ipver);
+        job_flags |= FILESTORE_JOB_FLAG_OPEN;
+    }
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        job_flags |= FILESTORE_JOB_FLAG_CLOSE;
+    }
+
+    if (data == NULL)
+        data_len = 0;
+    if (job_flags != 0 || data_len > 0) {
+        if (LogFilestoreAsyncQueueData(g_filestore_async, FILESTORE_JOB_FILE,
+                    job_flags, ff->file_store_id, data, data_len) != 0) {
+            SCLogDebug("failed to queue file data");
+            return -1;
+        }
+    }
+
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        LogFilestoreLogCloseMetaFile(aft, p, ff, ipver);
+    }
+    return 0;
+}
+
 static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p,
         File *ff, const uint8_t *data, uint32_t data_len, uint8_t flags)
 {
@@ -365,6 +838,10 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
 
     SCLogDebug("ff %p, data %p, data_len %u", ff, data, data_len);
 
+    if (g_filestore_async != NULL) {
+        return LogFilestoreLoggerAsync(aft, p, ff, data, data_len, flags, ipver);
+    }
+
     snprintf(filename, sizeof(filename), "%s/file.%u",
             g_logfile_base_dir, ff->file_store_id);
 
@@ -372,7 +849,7 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
         aft->file_cnt++;
 
         /* create a .meta file that contains time, src/dst/sp/dp/proto */
-        LogFilestoreLogCreateMetaFile(p, ff, filename, ipver);
+        LogFilestoreLogCreateMetaFile(aft, p, ff, filename, ipver);
 
         if (SC_ATOMIC_GET(filestore_open_file_cnt) < FileGetMaxOpenFiles()) {
             SC_ATOMIC_ADD(filestore_open_file_cnt, 1);
@@ -425,7 +902,7 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
             ff->fd = -1;
             SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
         }
-        LogFilestoreLogCloseMetaFile(ff);
+        LogFilestoreLogCloseMetaFile(aft, p, ff, ipver);
     }
 
     return 0;
@@ -468,6 +945,7 @@ static TmEcode LogFilestoreLogThreadInit(ThreadVars *t, const void *initdata, vo
     }
 
     aft->counter_max_hits = StatsRegisterCounter("file_store.open_files_max_hit", t);
+    aft->meta_buf_size = FILESTORE_META_BUF_SIZE;
 
     *data = (void *)aft;
     return TM_ECODE_OK;
@@ -480,6 +958,9 @@ static TmEcode LogFilestoreLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    if (aft->meta_buf != NULL)
+        SCFree(aft->meta_buf);
+
     /* clear memory */
     memset(aft, 0, sizeof(LogFilestoreLogThread));
 
@@ -497,6 +978,128 @@ static void LogFilestoreLogExitPrintStats(ThreadVars *tv, void *data)
     SCLogInfo("(%s) Files extracted %" PRIu32 "", tv->name, aft->file_cnt);
 }
 
+/** \internal
+ *  \brief stop the writer threads after they wrote out all queued jobs,
+ *         and free the async writer */
+static void LogFilestoreAsyncFree(void)
+{
+    LogFilestoreAsync *async = g_filestore_async;
+    uint32_t i;
+
+    if (async == NULL)
+        return;
+
+    for (i = 0; i < async->writers_cnt; i++) {
+        LogFilestoreWriter *w = &async->writers[i];
+        SCCtrlMutexLock(&w->mutex);
+        w->run = 0;
+        SCCtrlCondSignal(&w->cond);
+        SCCtrlMutexUnlock(&w->mutex);
+        pthread_join(w->thread, NULL);
+
+        SCCtrlCondDestroy(&w->cond);
+        SCCtrlMutexDestroy(&w->mutex);
+        SCFree(w->fds);
+    }
+    g_filestore_async = NULL;
+
+    SCLogPerf("file-store async: %"PRIu64" jobs, %"PRIu64" backpressure "
+            "events, max latency %"PRIu64" usecs", SC_ATOMIC_GET(async->jobs),
+            SC_ATOMIC_GET(async->backpressure),
+            LogFilestoreAsyncLatencyMax(async));
+
+    SCCtrlCondDestroy(&async->space_cond);
+    SCCtrlMutexDestroy(&async->space_mutex);
+    SCFree(async->writers);
+    SCFree(async);
+}
+
+/** \internal
+ *  \brief set up the async writer threads
+ *  \param conf the 'async' node of the file-store output
+ *  \retval 0 on success
+ *  \retval -1 on error
+ */
+static int LogFilestoreAsyncSetup(ConfNode *conf)
+{
+    intmax_t writers = FILESTORE_ASYNC_WRITERS_DEFAULT;
+    if (ConfGetChildValueInt(conf, "writers", &writers) && writers <= 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                "file-store.async.writers: %"PRIdMAX, writers);
+        return -1;
+    }
+
+    uint64_t max_queued = FILESTORE_ASYNC_MAX_QUEUED_DEFAULT;
+    const char *max_queued_str = ConfNodeLookupChildValue(conf, "max-queued");
+    if (max_queued_str != NULL) {
+        if (ParseSizeStringU64(max_queued_str, &max_queued) < 0 ||
+                max_queued == 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "invalid value for "
+                    "file-store.async.max-queued: %s", max_queued_str);
+            return -1;
+        }
+    }
+
+    /* spread the open files over the writers */
+    uint32_t fds_size = FILESTORE_ASYNC_FDS_DEFAULT;
+    if (FileGetMaxOpenFiles() > 0) {
+        fds_size = MAX(1, FileGetMaxOpenFiles() / (uint32_t)writers);
+    }
+
+    LogFilestoreAsync *async = SCCalloc(1, sizeof(*async));
+    if (unlikely(async == NULL))
+        return -1;
+    async->writers = SCCalloc(writers, sizeof(LogFilestoreWriter));
+    if (unlikely(async->writers == NULL)) {
+        SCFree(async);
+        return -1;
+    }
+    async->max_queued = max_queued;
+    SCCtrlMutexInit(&async->space_mutex, NULL);
+    SCCtrlCondInit(&async->space_cond, NULL);
+    SC_ATOMIC_INIT(async->queued_bytes);
+    SC_ATOMIC_INIT(async->jobs);
+    SC_ATOMIC_INIT(async->backpressure);
+    SC_ATOMIC_INIT(async->latency_usecs);
+    g_filestore_async = async;
+
+    uint32_t i, j;
+    for (i = 0; i < (uint32_t)writers; i++) {
+        LogFilestoreWriter *w = &async->writers[i];
+        w->fds = SCMalloc(fds_size * sizeof(LogFilestoreWriterFd));
+        if (unlikely(w->fds == NULL))
+            goto error;
+        for (j = 0; j < fds_size; j++)
+            w->fds[j].fd = -1;
+        w->fds_size = fds_size;
+        w->run = 1;
+        SC_ATOMIC_INIT(w->latency_max_usecs);
+        SCCtrlMutexInit(&w->mutex, NULL);
+        SCCtrlCondInit(&w->cond, NULL);
+        snprintf(w->name, sizeof(w->name), "FileWriter#%02u", i + 1);
+
+        int rc = pthread_create(&w->thread, NULL, LogFilestoreWriterThread, w);
+        if (rc != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "failed to create file-store "
+                    "writer thread: %s", strerror(rc));
+            SCCtrlCondDestroy(&w->cond);
+            SCCtrlMutexDestroy(&w->mutex);
+            SCFree(w->fds);
+            goto error;
+        }
+        async->writers_cnt++;
+    }
+
+    SCLogConfig("file-store async: %u writer threads, max %"PRIu64" bytes "
+            "queued, %u open files per writer", async->writers_cnt,
+            max_queued, fds_size);
+    return 0;
+
+error:
+    LogFilestoreAsyncFree();
+    return -1;
+}
+
 /**
  *  \internal
  *
@@ -510,6 +1113,7 @@ static void LogFilestoreLogDeInitCtx(OutputCtx *output_ctx)
     LogFileFreeCtx(logfile_ctx);
     SCFree(output_ctx);
 
+    LogFilestoreAsyncFree();
 }
 
 /** \brief Create a new http log LogFilestoreCtx.
@@ -598,6 +1202,15 @@ static OutputCtx *LogFilestoreLogInitCtx(ConfNode *conf)
         }
     }
 
+    ConfNode *async = ConfNodeLookupChild(conf, "async");
+    if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+        if (LogFilestoreAsyncSetup(async) != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "failed to set up "
+                    "file-store async writers. Killing engine");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     SCReturnPtr(output_ctx, "OutputCtx");
 }
 
@@ -605,9 +1218,313 @@ static OutputCtx *LogFilestoreLogInitCtx(ConfNode *conf)
 void LogFilestoreInitConfig(void)
 {
     StatsRegisterGlobalCounter("file_store.open_files", LogFilestoreOpenFilesCounter);
+    StatsRegisterGlobalCounter("file_store.async.queued_bytes", LogFilestoreAsyncQueuedCounter);
+    StatsRegisterGlobalCounter("file_store.async.jobs", LogFilestoreAsyncJobsCounter);
+    StatsRegisterGlobalCounter("file_store.async.backpressure", LogFilestoreAsyncBackpressureCounter);
+    StatsRegisterGlobalCounter("file_store.async.latency_avg_usecs", LogFilestoreAsyncLatencyAvgCounter);
+    StatsRegisterGlobalCounter("file_store.async.latency_max_usecs", LogFilestoreAsyncLatencyMaxCounter);
 }
 
 
+#ifdef UNITTESTS
+#include "conf-yaml-loader.h"
+
+static char filestore_test_saved_dir[PATH_MAX];
+
+/** \internal
+ *  \brief set up the async writers with 'writers' and 'max-queued' from
+ *         the yaml snippet, storing into a fresh directory in which file
+ *         id 1 is a fifo. Opening it stalls the writer until the test
+ *         opens the other end. */
+static int LogFilestoreTestSetup(const char *yaml)
+{
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return -1;
+    strlcpy(filestore_test_saved_dir, g_logfile_base_dir,
+            sizeof(filestore_test_saved_dir));
+    strlcpy(g_logfile_base_dir, dir, sizeof(g_logfile_base_dir));
+
+    char fifo[PATH_MAX];
+    snprintf(fifo, sizeof(fifo), "%s/file.1", g_logfile_base_dir);
+    if (mkfifo(fifo, 0600) != 0)
+        return -1;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(yaml, strlen(yaml));
+    return LogFilestoreAsyncSetup(ConfGetNode("file-store.async"));
+}
+
+static void LogFilestoreTestCleanup(uint32_t files)
+{
+    char path[PATH_MAX];
+    uint32_t i;
+    for (i = 1; i <= files; i++) {
+        snprintf(path, sizeof(path), "%s/file.%u", g_logfile_base_dir, i);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/file.%u.meta", g_logfile_base_dir, i);
+        unlink(path);
+    }
+    rmdir(g_logfile_base_dir);
+    strlcpy(g_logfile_base_dir, filestore_test_saved_dir,
+            sizeof(g_logfile_base_dir));
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+}
+
+/** \internal
+ *  \brief read the data the stalled writer writes into the fifo */
+static int LogFilestoreTestReadFifo(uint32_t len)
+{
+    char fifo[PATH_MAX];
+    uint8_t buf[1024];
+    snprintf(fifo, sizeof(fifo), "%s/file.1", g_logfile_base_dir);
+
+    int fd = open(fifo, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    while (len > 0) {
+        ssize_t r = read(fd, buf, MIN(len, sizeof(buf)));
+        if (r <= 0)
+            break;
+        len -= (uint32_t)r;
+    }
+    close(fd);
+    return len == 0 ? 0 : -1;
+}
+
+static int LogFilestoreTestFileSize(uint32_t file_id, const char *suffix)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/file.%u%s", g_logfile_base_dir,
+            file_id, suffix);
+    if (stat(path, &st) != 0)
+        return -1;
+    return (int)st.st_size;
+}
+
+static uint8_t filestore_test_data[600];
+
+static void *LogFilestoreTestQueueThread(void *arg)
+{
+    LogFilestoreAsyncQueueData((LogFilestoreAsync *)arg, FILESTORE_JOB_FILE,
+            FILESTORE_JOB_FLAG_OPEN|FILESTORE_JOB_FLAG_CLOSE, 2,
+            filestore_test_data, sizeof(filestore_test_data));
+    return NULL;
+}
+
+static void *LogFilestoreTestFreeThread(void *arg)
+{
+    LogFilestoreAsyncFree();
+    return NULL;
+}
+
+/** \test a worker queueing past max-queued waits until the writer
+ *        drained the queue */
+static int LogFilestoreAsyncTest01(void)
+{
+    const char yaml[] = "\
+%YAML 1.1\n\
+---\n\
+file-store:\n\
+  async:\n\
+    writers: 1\n\
+    max-queued: 1kb\n\
+";
+    const uint64_t size = sizeof(LogFilestoreJob) + sizeof(filestore_test_data);
+    pthread_t thread;
+    int i;
+
+    FAIL_IF(LogFilestoreTestSetup(yaml) != 0);
+    LogFilestoreAsync *async = g_filestore_async;
+    FAIL_IF_NULL(async);
+    FAIL_IF(async->max_queued != 1024);
+
+    /* stalls the writer on the fifo, the job stays accounted as queued */
+    FAIL_IF(LogFilestoreAsyncQueueData(async, FILESTORE_JOB_FILE,
+                FILESTORE_JOB_FLAG_OPEN, 1, filestore_test_data,
+                sizeof(filestore_test_data)) != 0);
+    FAIL_IF(SC_ATOMIC_GET(async->backpressure) != 0);
+
+    /* the second job doesn't fit, so it has to wait for the first */
+    FAIL_IF(pthread_create(&thread, NULL, LogFilestoreTestQueueThread, async) != 0);
+    for (i = 0; i < 1000 && SC_ATOMIC_GET(async->backpressure) == 0; i++)
+        usleep(1000);
+    FAIL_IF(SC_ATOMIC_GET(async->backpressure) != 1);
+    usleep(10000);
+    FAIL_IF(SC_ATOMIC_GET(async->queued_bytes) != size);
+
+    /* unstall the writer, which lets the second job in */
+    FAIL_IF(LogFilestoreTestReadFifo(sizeof(filestore_test_data)) != 0);
+    pthread_join(thread, NULL);
+
+    LogFilestoreAsyncFree();
+    FAIL_IF_NOT_NULL(g_filestore_async);
+    FAIL_IF(LogFilestoreTestFileSize(2, "") != (int)sizeof(filestore_test_data));
+
+    LogFilestoreTestCleanup(2);
+    PASS;
+}
+
+/** \test jobs still queued at shutdown are written out before the
+ *        writer threads exit */
+static int LogFilestoreAsyncTest02(void)
+{
+    const char yaml[] = "\
+%YAML 1.1\n\
+---\n\
+file-store:\n\
+  async:\n\
+    writers: 1\n\
+";
+    const uint8_t meta[] = "TIME: test\n";
+    const uint32_t open_files = SC_ATOMIC_GET(filestore_open_file_cnt);
+    pthread_t thread;
+    uint32_t id;
+    int i, run = 1;
+
+    FAIL_IF(LogFilestoreTestSetup(yaml) != 0);
+    LogFilestoreAsync *async = g_filestore_async;
+    FAIL_IF_NULL(async);
+    LogFilestoreWriter *w = &async->writers[0];
+
+    FAIL_IF(LogFilestoreAsyncQueueData(async, FILESTORE_JOB_FILE,
+                FILESTORE_JOB_FLAG_OPEN|FILESTORE_JOB_FLAG_CLOSE, 1,
+                filestore_test_data, 100) != 0);
+    /* wait for the writer to pick it up, so the rest stays queued */
+    for (i = 0; i < 1000; i++) {
+        SCCtrlMutexLock(&w->mutex);
+        int taken = (w->head == NULL);
+        SCCtrlMutexUnlock(&w->mutex);
+        if (taken)
+            break;
+        usleep(1000);
+    }
+    FAIL_IF(i == 1000);
+
+    for (id = 2; id <= 16; id++) {
+        FAIL_IF(LogFilestoreAsyncQueueData(async, FILESTORE_JOB_META,
+                    FILESTORE_JOB_FLAG_OPEN, id, meta, sizeof(meta) - 1) != 0);
+        FAIL_IF(LogFilestoreAsyncQueueData(async, FILESTORE_JOB_FILE,
+                    FILESTORE_JOB_FLAG_OPEN, id, filestore_test_data, 100) != 0);
+        FAIL_IF(LogFilestoreAsyncQueueData(async, FILESTORE_JOB_FILE,
+                    FILESTORE_JOB_FLAG_CLOSE, id, filestore_test_data, 200) != 0);
+    }
+
+    /* shut down while the writer is stalled with all jobs pending */
+    FAIL_IF(pthread_create(&thread, NULL, LogFilestoreTestFreeThread, NULL) != 0);
+    for (i = 0; i < 1000 && run; i++) {
+        SCCtrlMutexLock(&w->mutex);
+        run = w->run;
+        SCCtrlMutexUnlock(&w->mutex);
+        if (run)
+            usleep(1000);
+    }
+    FAIL_IF(run != 0);
+
+    FAIL_IF(LogFilestoreTestReadFifo(100) != 0);
+    pthread_join(thread, NULL);
+    FAIL_IF_NOT_NULL(g_filestore_async);
+
+    for (id = 2; id <= 16; id++) {
+        FAIL_IF(LogFilestoreTestFileSize(id, "") != 300);
+        FAIL_IF(LogFilestoreTestFileSize(id, ".meta") != (int)sizeof(meta) - 1);
+    }
+    FAIL_IF(SC_ATOMIC_GET(filestore_open_file_cnt) != open_files);
+
+    LogFilestoreTestCleanup(16);
+    PASS;
+}
+
+static size_t filestore_test_meta_len = 0;
+
+static void LogFilestoreTestWriteMeta(FILE *fp, const Packet *p,
+        const File *ff, int ipver)
+{
+    size_t i;
+    for (i = 0; i < filestore_test_meta_len; i++)
+        fputc('x', fp);
+}
+
+/** \test meta data too large for the scratch buffer is skipped without
+ *        keeping the next records from being written */
+static int LogFilestoreAsyncTest03(void)
+{
+    const char yaml[] = "\
+%YAML 1.1\n\
+---\n\
+file-store:\n\
+  async:\n\
+    writers: 1\n\
+";
+    LogFilestoreLogThread aft;
+    File ff;
+
+    memset(&aft, 0, sizeof(aft));
+    aft.meta_buf_size = FILESTORE_META_BUF_SIZE;
+    memset(&ff, 0, sizeof(ff));
+
+    FAIL_IF(LogFilestoreTestSetup(yaml) != 0);
+
+    filestore_test_meta_len = 2 * FILESTORE_META_BUF_MAX;
+    ff.file_store_id = 2;
+    LogFilestoreAsyncQueueMeta(&aft, NULL, &ff, AF_INET, 1,
+            LogFilestoreTestWriteMeta);
+    FAIL_IF(aft.meta_buf_size != FILESTORE_META_BUF_SIZE);
+    FAIL_IF(aft.meta_too_large_ts == 0);
+    FAIL_IF(aft.meta_too_large_cnt != 0);
+
+    filestore_test_meta_len = 100;
+    ff.file_store_id = 3;
+    LogFilestoreAsyncQueueMeta(&aft, NULL, &ff, AF_INET, 1,
+            LogFilestoreTestWriteMeta);
+
+    /* grows the buffer */
+    filestore_test_meta_len = 3 * FILESTORE_META_BUF_SIZE;
+    ff.file_store_id = 4;
+    LogFilestoreAsyncQueueMeta(&aft, NULL, &ff, AF_INET, 1,
+            LogFilestoreTestWriteMeta);
+    FAIL_IF(aft.meta_buf_size != 4 * FILESTORE_META_BUF_SIZE);
+
+    /* counted, but no warning right after the last one */
+    filestore_test_meta_len = FILESTORE_META_BUF_MAX;
+    ff.file_store_id = 5;
+    LogFilestoreAsyncQueueMeta(&aft, NULL, &ff, AF_INET, 1,
+            LogFilestoreTestWriteMeta);
+    FAIL_IF(aft.meta_buf_size != FILESTORE_META_BUF_SIZE);
+    FAIL_IF(aft.meta_too_large_cnt != 1);
+
+    filestore_test_meta_len = 200;
+    ff.file_store_id = 6;
+    LogFilestoreAsyncQueueMeta(&aft, NULL, &ff, AF_INET, 1,
+            LogFilestoreTestWriteMeta);
+
+    LogFilestoreAsyncFree();
+    FAIL_IF(LogFilestoreTestFileSize(2, ".meta") != -1);
+    FAIL_IF(LogFilestoreTestFileSize(3, ".meta") != 100);
+    FAIL_IF(LogFilestoreTestFileSize(4, ".meta") != 3 * FILESTORE_META_BUF_SIZE);
+    FAIL_IF(LogFilestoreTestFileSize(5, ".meta") != -1);
+    FAIL_IF(LogFilestoreTestFileSize(6, ".meta") != 200);
+
+    if (aft.meta_buf != NULL)
+        SCFree(aft.meta_buf);
+    LogFilestoreTestCleanup(6);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LogFilestoreRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFilestoreAsyncTest01", LogFilestoreAsyncTest01);
+    UtRegisterTest("LogFilestoreAsyncTest02", LogFilestoreAsyncTest02);
+    UtRegisterTest("LogFilestoreAsyncTest03", LogFilestoreAsyncTest03);
+#endif /* UNITTESTS */
+}
+
 void LogFilestoreRegister (void)
 {
     OutputRegisterFiledataModule(LOGGER_FILE_STORE, MODULE_NAME, "file",
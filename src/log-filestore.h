@@ -26,5 +26,6 @@
 
 void LogFilestoreRegister(void);
 void LogFilestoreInitConfig(void);
+void LogFilestoreRegisterTests(void);
 
 #endif /* __LOG_FILELOG_H__ */
@@ -31,17 +31,6 @@
 #include "app-layer-parser.h"
 #include "util-profiling.h"
 
-typedef struct OutputLoggerThreadStore_ {
-    void *thread_data;
-    struct OutputLoggerThreadStore_ *next;
-} OutputLoggerThreadStore;
-
-/** per thread data for this module, contains a list of per thread
- *  data for the packet loggers. */
-typedef struct OutputLoggerThreadData_ {
-    OutputLoggerThreadStore *store;
-} OutputLoggerThreadData;
-
 /* logger instance, a module + a output ctx,
  * it's perfectly valid that have multiple instances of the same
  * log module (e.g. http.log) with different output ctx'. */
@@ -63,6 +52,32 @@ typedef struct OutputTxLogger_ {
 
 static OutputTxLogger *list = NULL;
 
+/** lowest log progress per direction of all loggers of a protocol. A tx
+ *  that hasn't reached these can't be logged by any of the loggers. */
+typedef struct OutputTxLogProgress_ {
+    int tc_log_progress;
+    int ts_log_progress;
+} OutputTxLogProgress;
+
+static OutputTxLogProgress min_log_progress[ALPROTO_MAX];
+static uint32_t loggers_cnt[ALPROTO_MAX];
+
+/** logger + its thread data */
+typedef struct OutputTxLoggerThreadStore_ {
+    const OutputTxLogger *logger;
+    void *thread_data;
+} OutputTxLoggerThreadStore;
+
+/** per thread data for this module. The per thread data of the loggers
+ *  is stored in a single array grouped by protocol, so that the loggers
+ *  for a flow's protocol can be looked up directly. */
+typedef struct OutputLoggerThreadData_ {
+    OutputTxLoggerThreadStore *store;
+    uint32_t store_cnt;
+    uint32_t alproto_offset[ALPROTO_MAX];
+    uint32_t alproto_cnt[ALPROTO_MAX];
+} OutputLoggerThreadData;
+
 int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
                            TxLogger LogFunc,
                            OutputCtx *output_ctx, int tc_log_progress,
@@ -108,6 +123,21 @@ int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
         op->ts_log_progress = ts_log_progress;
     }
 
+    /* a logger with a condition function decides itself when to log,
+     * so no progress can be assumed for it */
+    const int tc_min = op->LogCondition ? 0 : op->tc_log_progress;
+    const int ts_min = op->LogCondition ? 0 : op->ts_log_progress;
+    if (loggers_cnt[alproto] == 0) {
+        min_log_progress[alproto].tc_log_progress = tc_min;
+        min_log_progress[alproto].ts_log_progress = ts_min;
+    } else {
+        min_log_progress[alproto].tc_log_progress =
+            MIN(min_log_progress[alproto].tc_log_progress, tc_min);
+        min_log_progress[alproto].ts_log_progress =
+            MIN(min_log_progress[alproto].ts_log_progress, ts_min);
+    }
+    loggers_cnt[alproto]++;
+
     if (list == NULL) {
         op->id = 1;
         list = op;
@@ -153,6 +183,13 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
         goto end;
     }
 
+    const OutputTxLoggerThreadStore * const stores =
+        op_thread_data->store + op_thread_data->alproto_offset[alproto];
+    const uint32_t stores_cnt = op_thread_data->alproto_cnt[alproto];
+    const OutputTxLogProgress * const min_progress = &min_log_progress[alproto];
+    const int eof = AppLayerParserStateIssetFlag(f->alparser,
+            APP_LAYER_PARSER_EOF);
+
     const uint8_t ts_disrupt_flags = FlowGetDisruptionFlags(f, STREAM_TOSERVER);
     const uint8_t tc_disrupt_flags = FlowGetDisruptionFlags(f, STREAM_TOCLIENT);
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
@@ -161,19 +198,26 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
     int logged = 0;
     int gap = 0;
 
-    for (; tx_id < total_txs; tx_id++)
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(p->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (tx_id < total_txs)
     {
-        /* Track the number of loggers, of the eligible loggers that
-         * actually logged this transaction. They all must have logged
+        /* Track the number of loggers that actually logged this
+         * transaction. All loggers of the protocol must have logged
          * before the transaction is considered logged. */
-        int number_of_loggers = 0;
-        int loggers_that_logged = 0;
+        uint32_t loggers_that_logged = 0;
 
-        void *tx = AppLayerParserGetTx(p->proto, alproto, alstate, tx_id);
-        if (tx == NULL) {
-            SCLogDebug("tx is NULL not logging");
-            continue;
-        }
+        AppLayerGetTxIterTuple ires = IterFunc(p->proto, alproto, alstate,
+                tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL)
+            break;
+        void * const tx = ires.tx_ptr;
+        tx_id = ires.tx_id;
+
+        if (stores_cnt == 0)
+            goto tx_done;
 
         int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
                 tx, ts_disrupt_flags);
@@ -184,83 +228,75 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
         SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
                 tx_progress_ts, tx_progress_tc);
 
-        const OutputTxLogger *logger = list;
-        const OutputLoggerThreadStore *store = op_thread_data->store;
-#ifdef DEBUG_VALIDATION
-        BUG_ON(logger == NULL && store != NULL);
-        BUG_ON(logger != NULL && store == NULL);
-        BUG_ON(logger == NULL && store == NULL);
-#endif
-        while (logger && store) {
+        /* none of the loggers can log this tx yet */
+        if (!eof && (tx_progress_ts < min_progress->ts_log_progress ||
+                     tx_progress_tc < min_progress->tc_log_progress)) {
+            SCLogDebug("progress not far enough for any logger");
+            goto tx_done;
+        }
+
+        uint32_t i;
+        for (i = 0; i < stores_cnt; i++) {
+            const OutputTxLogger *logger = stores[i].logger;
             BUG_ON(logger->LogFunc == NULL);
 
             SCLogDebug("logger %p, LogCondition %p, ts_log_progress %d "
                     "tc_log_progress %d", logger, logger->LogCondition,
                     logger->ts_log_progress, logger->tc_log_progress);
-            if (logger->alproto == alproto) {
-                SCLogDebug("alproto match, logging tx_id %"PRIu64, tx_id);
-
-                number_of_loggers++;
+            if (AppLayerParserGetTxLogged(f, alstate, tx, logger->id)) {
+                SCLogDebug("logger has already logged this transaction");
+                loggers_that_logged++;
+                continue;
+            }
 
-                if (AppLayerParserGetTxLogged(f, alstate, tx, logger->id)) {
-                    SCLogDebug("logger has already logged this transaction");
-                    loggers_that_logged++;
-                    goto next;
-                }
+            if (!eof) {
+                if (logger->LogCondition) {
+                    int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
+                    if (r == FALSE) {
+                        SCLogDebug("conditions not met, not logging");
+                        continue;
+                    }
+                } else {
+                    if (tx_progress_tc < logger->tc_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        continue;
+                    }
 
-                if (!(AppLayerParserStateIssetFlag(f->alparser,
-                                                   APP_LAYER_PARSER_EOF))) {
-                    if (logger->LogCondition) {
-                        int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
-                        if (r == FALSE) {
-                            SCLogDebug("conditions not met, not logging");
-                            goto next;
-                        }
-                    } else {
-                        if (tx_progress_tc < logger->tc_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next;
-                        }
-
-                        if (tx_progress_ts < logger->ts_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next;
-                        }
+                    if (tx_progress_ts < logger->ts_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        continue;
                     }
                 }
-
-                SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id,
-                    logger->logger_id);
-                PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
-                logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
-                PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
-
-                AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
-                                          logger->id);
-                loggers_that_logged++;
             }
 
-next:
-            logger = logger->next;
-            store = store->next;
-#ifdef DEBUG_VALIDATION
-            BUG_ON(logger == NULL && store != NULL);
-            BUG_ON(logger != NULL && store == NULL);
-#endif
+            SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id,
+                logger->logger_id);
+            PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
+            logger->LogFunc(tv, stores[i].thread_data, p, f, alstate, tx, tx_id);
+            PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
+
+            AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
+                                      logger->id);
+            loggers_that_logged++;
         }
 
+tx_done:
         /* If all loggers logged set a flag and update the last tx_id
          * that was logged.
          *
          * If not all loggers were logged we flag that there was a gap
          * so any subsequent transactions in this loop don't increase
          * the maximum ID that was logged. */
-        if (!gap && loggers_that_logged == number_of_loggers) {
+        if (!gap && loggers_that_logged == stores_cnt) {
             logged = 1;
             max_id = tx_id;
         } else {
             gap = 1;
         }
+
+        if (!ires.has_next)
+            break;
+        tx_id++;
     }
 
     /* Update the the last ID that has been logged with all
@@ -284,35 +320,47 @@ static TmEcode OutputTxLogThreadInit(ThreadVars *tv, const void *initdata, void
         return TM_ECODE_FAILED;
     memset(td, 0x00, sizeof(*td));
 
+    /* count the loggers per protocol, so we can lay out the array
+     * grouped by protocol */
+    OutputTxLogger *logger;
+    for (logger = list; logger != NULL; logger = logger->next) {
+        td->alproto_cnt[logger->alproto]++;
+        td->store_cnt++;
+    }
+    if (td->store_cnt > 0) {
+        td->store = SCCalloc(td->store_cnt, sizeof(*td->store));
+        if (td->store == NULL) {
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    }
+    uint32_t offset = 0;
+    AppProto a;
+    for (a = 0; a < ALPROTO_MAX; a++) {
+        td->alproto_offset[a] = offset;
+        offset += td->alproto_cnt[a];
+        td->alproto_cnt[a] = 0;
+    }
+
     *data = (void *)td;
     SCLogDebug("OutputTxLogThreadInit happy (*data %p)", *data);
 
-    OutputTxLogger *logger = list;
-    while (logger) {
+    for (logger = list; logger != NULL; logger = logger->next) {
+        void *retptr = NULL;
         if (logger->ThreadInit) {
-            void *retptr = NULL;
-            if (logger->ThreadInit(tv, (void *)logger->output_ctx, &retptr) == TM_ECODE_OK) {
-                OutputLoggerThreadStore *ts = SCMalloc(sizeof(*ts));
-/* todo */      BUG_ON(ts == NULL);
-                memset(ts, 0x00, sizeof(*ts));
-
-                /* store thread handle */
-                ts->thread_data = retptr;
-
-                if (td->store == NULL) {
-                    td->store = ts;
-                } else {
-                    OutputLoggerThreadStore *tmp = td->store;
-                    while (tmp->next != NULL)
-                        tmp = tmp->next;
-                    tmp->next = ts;
-                }
-
-                SCLogDebug("%s is now set up", logger->name);
+            if (logger->ThreadInit(tv, (void *)logger->output_ctx, &retptr) != TM_ECODE_OK) {
+                SCLogDebug("%s thread init failed, not using it", logger->name);
+                continue;
             }
         }
 
-        logger = logger->next;
+        OutputTxLoggerThreadStore *ts = &td->store[
+            td->alproto_offset[logger->alproto] + td->alproto_cnt[logger->alproto]];
+        ts->logger = logger;
+        ts->thread_data = retptr;
+        td->alproto_cnt[logger->alproto]++;
+
+        SCLogDebug("%s is now set up", logger->name);
     }
 
     return TM_ECODE_OK;
@@ -321,20 +369,21 @@ static TmEcode OutputTxLogThreadInit(ThreadVars *tv, const void *initdata, void
 static TmEcode OutputTxLogThreadDeinit(ThreadVars *tv, void *thread_data)
 {
     OutputLoggerThreadData *op_thread_data = (OutputLoggerThreadData *)thread_data;
-    OutputLoggerThreadStore *store = op_thread_data->store;
-    OutputTxLogger *logger = list;
-
-    while (logger && store) {
-        if (logger->ThreadDeinit) {
-            logger->ThreadDeinit(tv, store->thread_data);
+    AppProto a;
+
+    for (a = 0; a < ALPROTO_MAX; a++) {
+        const OutputTxLoggerThreadStore *stores =
+            op_thread_data->store + op_thread_data->alproto_offset[a];
+        uint32_t i;
+        for (i = 0; i < op_thread_data->alproto_cnt[a]; i++) {
+            if (stores[i].logger->ThreadDeinit) {
+                stores[i].logger->ThreadDeinit(tv, stores[i].thread_data);
+            }
         }
-
-        OutputLoggerThreadStore *next_store = store->next;
-        SCFree(store);
-        store = next_store;
-        logger = logger->next;
     }
 
+    if (op_thread_data->store != NULL)
+        SCFree(op_thread_data->store);
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
@@ -342,16 +391,17 @@ static TmEcode OutputTxLogThreadDeinit(ThreadVars *tv, void *thread_data)
 static void OutputTxLogExitPrintStats(ThreadVars *tv, void *thread_data)
 {
     OutputLoggerThreadData *op_thread_data = (OutputLoggerThreadData *)thread_data;
-    OutputLoggerThreadStore *store = op_thread_data->store;
-    OutputTxLogger *logger = list;
-
-    while (logger && store) {
-        if (logger->ThreadExitPrintStats) {
-            logger->ThreadExitPrintStats(tv, store->thread_data);
+    AppProto a;
+
+    for (a = 0; a < ALPROTO_MAX; a++) {
+        const OutputTxLoggerThreadStore *stores =
+            op_thread_data->store + op_thread_data->alproto_offset[a];
+        uint32_t i;
+        for (i = 0; i < op_thread_data->alproto_cnt[a]; i++) {
+            if (stores[i].logger->ThreadExitPrintStats) {
+                stores[i].logger->ThreadExitPrintStats(tv, stores[i].thread_data);
+            }
         }
-
-        logger = logger->next;
-        store = store->next;
     }
 }
 
@@ -370,4 +420,6 @@ void OutputTxShutdown(void)
         logger = next_logger;
     }
     list = NULL;
+    memset(min_log_progress, 0, sizeof(min_log_progress));
+    memset(loggers_cnt, 0, sizeof(loggers_cnt));
 }
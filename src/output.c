@@ -109,6 +109,8 @@ typedef struct OutputFileRolloverFlag_ {
 
 TAILQ_HEAD(, OutputFileRolloverFlag_) output_file_rotation_flags =
     TAILQ_HEAD_INITIALIZER(output_file_rotation_flags);
+/* flags can be (un)registered at runtime by per thread log files */
+static SCMutex output_file_rotation_mutex = SCMUTEX_INITIALIZER;
 
 void OutputRegisterRootLoggers(void);
 void OutputRegisterLoggers(void);
@@ -867,7 +869,9 @@ void OutputRegisterFileRotationFlag(int *flag)
         return;
     }
     flag_entry->flag = flag;
+    SCMutexLock(&output_file_rotation_mutex);
     TAILQ_INSERT_TAIL(&output_file_rotation_flags, flag_entry, entries);
+    SCMutexUnlock(&output_file_rotation_mutex);
 }
 
 /**
@@ -883,6 +887,7 @@ void OutputRegisterFileRotationFlag(int *flag)
 void OutputUnregisterFileRotationFlag(int *flag)
 {
     OutputFileRolloverFlag *entry, *next;
+    SCMutexLock(&output_file_rotation_mutex);
     for (entry = TAILQ_FIRST(&output_file_rotation_flags); entry != NULL;
          entry = next) {
         next = TAILQ_NEXT(entry, entries);
@@ -892,6 +897,7 @@ void OutputUnregisterFileRotationFlag(int *flag)
             break;
         }
     }
+    SCMutexUnlock(&output_file_rotation_mutex);
 }
 
 /**
@@ -899,9 +905,11 @@ void OutputUnregisterFileRotationFlag(int *flag)
  */
 void OutputNotifyFileRotation(void) {
     OutputFileRolloverFlag *flag;
+    SCMutexLock(&output_file_rotation_mutex);
     TAILQ_FOREACH(flag, &output_file_rotation_flags, entries) {
         *(flag->flag) = 1;
     }
+    SCMutexUnlock(&output_file_rotation_mutex);
 }
 
 TmEcode OutputLoggerLog(ThreadVars *tv, Packet *p, void *thread_data)
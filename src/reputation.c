@@ -36,6 +36,10 @@
 #include "host.h"
 #include "conf.h"
 #include "detect.h"
+#include "detect-engine.h"
+#include "counters.h"
+#include "util-byte.h"
+#include "util-time.h"
 #include "reputation.h"
 
 /** effective reputation version, atomic as the host
@@ -67,29 +71,25 @@ static uint32_t SRepGetEffectiveVersion(void)
     return SC_ATOMIC_GET(srep_eversion);
 }
 
-static void SRepCIDRFreeUserData(void *data)
-{
-    if (data != NULL)
-        SCFree(data);
+/** memory used by the compact CIDR trees of all detection engines,
+ *  including the retired ones */
+SC_ATOMIC_DECLARE(uint64_t, srep_cidr_memuse);
+/** number of deltas applied and the time the last one took */
+SC_ATOMIC_DECLARE(uint64_t, srep_delta_cnt);
+SC_ATOMIC_DECLARE(uint64_t, srep_delta_usecs);
+/** bumped each time a compact tree is replaced */
+SC_ATOMIC_DECLARE(uint64_t, srep_epoch);
 
-    return;
-}
+/** the reputation value of a netblock is stored as the user data of its
+ *  prefix in the CIDR trees, so that the compact trees can share it when
+ *  they are updated */
+#define SREP_CIDR_VALUE(v)  ((void *)(uintptr_t)(v))
 
 static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, int value)
 {
-    SReputation *user_data = NULL;
-    if ((user_data = SCMalloc(sizeof(SReputation))) == NULL) {
-        SCLogError(SC_ERR_FATAL, "Error allocating memory. Exiting");
-        exit(EXIT_FAILURE);
-    }
-    memset(user_data, 0x00, sizeof(SReputation));
-
-    user_data->version = SRepGetVersion();
-    user_data->rep[cat] = value;
-
     if (strchr(ip, ':') != NULL) {
         if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
-            cidr_ctx->srepIPV6_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
+            cidr_ctx->srepIPV6_tree[cat] = SCRadixCreateRadixTree(NULL, NULL);
             if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
                 SCLogDebug("Error initializing Reputation IPV6 with CIDR module for cat %d", cat);
                 exit(EXIT_FAILURE);
@@ -98,14 +98,14 @@ static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, int v
         }
 
         SCLogDebug("adding ipv6 host %s", ip);
-        if (SCRadixAddKeyIPV6String(ip, cidr_ctx->srepIPV6_tree[cat], (void *)user_data) == NULL) {
+        if (SCRadixAddKeyIPV6String(ip, cidr_ctx->srepIPV6_tree[cat], SREP_CIDR_VALUE(value)) == NULL) {
             SCLogWarning(SC_ERR_INVALID_VALUE,
                         "failed to add ipv6 host %s", ip);
         }
 
     } else {
         if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
-            cidr_ctx->srepIPV4_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
+            cidr_ctx->srepIPV4_tree[cat] = SCRadixCreateRadixTree(NULL, NULL);
             if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
                 SCLogDebug("Error initializing Reputation IPV4 with CIDR module for cat %d", cat);
                 exit(EXIT_FAILURE);
@@ -114,33 +114,86 @@ static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, int v
         }
 
         SCLogDebug("adding ipv4 host %s", ip);
-        if (SCRadixAddKeyIPV4String(ip, cidr_ctx->srepIPV4_tree[cat], (void *)user_data) == NULL) {
+        if (SCRadixAddKeyIPV4String(ip, cidr_ctx->srepIPV4_tree[cat], SREP_CIDR_VALUE(value)) == NULL) {
             SCLogWarning(SC_ERR_INVALID_VALUE,
                         "failed to add ipv4 host %s", ip);
         }
     }
 }
 
+/** \internal
+ *  \brief get the current compact tree of a category
+ *
+ *  The compact trees are replaced by SRepDeltaApply while lookups are
+ *  running, so the pointer is loaded once per lookup.
+ */
+static inline const SCRadixCompactTree *SRepCIDRGetCompact(SCRadixCompactTree **slot)
+{
+    return *(SCRadixCompactTree * volatile *)slot;
+}
+
 static uint8_t SRepCIDRGetIPv4IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv4_addr, uint8_t cat)
 {
     void *user_data = NULL;
-    (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, cidr_ctx->srepIPV4_tree[cat], &user_data);
-    if (user_data == NULL)
-        return 0;
+    const SCRadixCompactTree *t = SRepCIDRGetCompact(&cidr_ctx->srepIPV4_compact[cat]);
+    if (t != NULL)
+        (void)SCRadixCompactFindKeyIPV4BestMatch(ipv4_addr, t, &user_data);
+    else
+        (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, cidr_ctx->srepIPV4_tree[cat], &user_data);
 
-    SReputation *r = (SReputation *)user_data;
-    return r->rep[cat];
+    return (uint8_t)(uintptr_t)user_data;
 }
 
 static uint8_t SRepCIDRGetIPv6IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv6_addr, uint8_t cat)
 {
     void *user_data = NULL;
-    (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, cidr_ctx->srepIPV6_tree[cat], &user_data);
-    if (user_data == NULL)
-        return 0;
+    const SCRadixCompactTree *t = SRepCIDRGetCompact(&cidr_ctx->srepIPV6_compact[cat]);
+    if (t != NULL)
+        (void)SCRadixCompactFindKeyIPV6BestMatch(ipv6_addr, t, &user_data);
+    else
+        (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, cidr_ctx->srepIPV6_tree[cat], &user_data);
+
+    return (uint8_t)(uintptr_t)user_data;
+}
+
+/**
+ *  \brief Replace the CIDR radix trees by their compact versions
+ *
+ *  This is done once all reputation files are loaded, later changes go
+ *  through SRepDeltaApply. Trees that fail to compile are kept.
+ */
+static void SRepCIDRCompile(SRepCIDRTree *cidr_ctx)
+{
+    uint64_t memuse = 0;
+    int cnt = 0;
+    int i;
+
+    for (i = 0; i < SREP_MAX_CATS; i++) {
+        if (cidr_ctx->srepIPV4_tree[i] != NULL) {
+            cidr_ctx->srepIPV4_compact[i] =
+                SCRadixCompactCompileTree(cidr_ctx->srepIPV4_tree[i], 32);
+            if (cidr_ctx->srepIPV4_compact[i] != NULL) {
+                cidr_ctx->srepIPV4_tree[i] = NULL;
+                memuse += cidr_ctx->srepIPV4_compact[i]->memuse;
+                cnt++;
+            }
+        }
+        if (cidr_ctx->srepIPV6_tree[i] != NULL) {
+            cidr_ctx->srepIPV6_compact[i] =
+                SCRadixCompactCompileTree(cidr_ctx->srepIPV6_tree[i], 128);
+            if (cidr_ctx->srepIPV6_compact[i] != NULL) {
+                cidr_ctx->srepIPV6_tree[i] = NULL;
+                memuse += cidr_ctx->srepIPV6_compact[i]->memuse;
+                cnt++;
+            }
+        }
+    }
 
-    SReputation *r = (SReputation *)user_data;
-    return r->rep[cat];
+    if (cnt > 0) {
+        (void)SC_ATOMIC_ADD(srep_cidr_memuse, memuse);
+        SCLogConfig("IP reputation: %d CIDR lookup tables compiled, "
+                "using %"PRIu64" bytes", cnt, memuse);
+    }
 }
 
 uint8_t SRepCIDRGetIPRepSrc(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint32_t version)
@@ -414,6 +467,58 @@ int SRepLoadCatFileFromFD(FILE *fp)
     return 0;
 }
 
+/** \internal
+ *  \brief set the reputation of a host in a category
+ *
+ *  \retval 0 ok
+ *  \retval -1 no host could be allocated
+ */
+static int SRepHostSetRep(Address *a, uint8_t cat, uint8_t value)
+{
+    Host *h = HostGetHostFromHash(a);
+    if (h == NULL)
+        return -1;
+
+    if (h->iprep == NULL) {
+        h->iprep = SCMalloc(sizeof(SReputation));
+        if (h->iprep != NULL) {
+            memset(h->iprep, 0x00, sizeof(SReputation));
+
+            HostIncrUsecnt(h);
+        }
+    }
+    if (h->iprep != NULL) {
+        SReputation *rep = h->iprep;
+
+        /* if version is outdated, it's an older entry that we'll
+         * now replace. */
+        if (rep->version != SRepGetVersion()) {
+            memset(rep, 0x00, sizeof(SReputation));
+        }
+
+        rep->version = SRepGetVersion();
+        rep->rep[cat] = value;
+
+        SCLogDebug("host %p iprep %p setting cat %u to value %u",
+            h, h->iprep, cat, value);
+#ifdef DEBUG
+        if (SCLogDebugEnabled()) {
+            int i;
+            for (i = 0; i < SREP_MAX_CATS; i++) {
+                if (rep->rep[i] == 0)
+                    continue;
+
+                SCLogDebug("--> host %p iprep %p cat %d to value %u",
+                        h, h->iprep, i, rep->rep[i]);
+            }
+        }
+#endif
+    }
+
+    HostRelease(h);
+    return 0;
+}
+
 static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
 {
     int r = 0;
@@ -474,50 +579,9 @@ int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
                 SCLogDebug("%s %u %u", ipstr, cat, value);
             }
 
-            Host *h = HostGetHostFromHash(&a);
-            if (h == NULL) {
+            if (SRepHostSetRep(&a, cat, value) < 0) {
                 SCLogError(SC_ERR_NO_REPUTATION, "failed to get a host, increase host.memcap");
                 break;
-            } else {
-                //SCLogInfo("host %p", h);
-
-                if (h->iprep == NULL) {
-                    h->iprep = SCMalloc(sizeof(SReputation));
-                    if (h->iprep != NULL) {
-                        memset(h->iprep, 0x00, sizeof(SReputation));
-
-                        HostIncrUsecnt(h);
-                    }
-                }
-                if (h->iprep != NULL) {
-                    SReputation *rep = h->iprep;
-
-                    /* if version is outdated, it's an older entry that we'll
-                     * now replace. */
-                    if (rep->version != SRepGetVersion()) {
-                        memset(rep, 0x00, sizeof(SReputation));
-                    }
-
-                    rep->version = SRepGetVersion();
-                    rep->rep[cat] = value;
-
-                    SCLogDebug("host %p iprep %p setting cat %u to value %u",
-                        h, h->iprep, cat, value);
-#ifdef DEBUG
-                    if (SCLogDebugEnabled()) {
-                        int i;
-                        for (i = 0; i < SREP_MAX_CATS; i++) {
-                            if (rep->rep[i] == 0)
-                                continue;
-
-                            SCLogDebug("--> host %p iprep %p cat %d to value %u",
-                                    h, h->iprep, i, rep->rep[i]);
-                        }
-                    }
-#endif
-                }
-
-                HostRelease(h);
             }
         }
     }
@@ -566,6 +630,537 @@ static char *SRepCompleteFilePath(char *file)
     return path;
 }
 
+/** a host entry of a delta */
+typedef struct SRepDeltaHost_ {
+    Address a;
+    uint8_t cat;
+    uint8_t value;
+    uint8_t remove;
+} SRepDeltaHost;
+
+/** netblock changes of a delta, per category */
+typedef struct SRepDeltaNetblocks_ {
+    SCRadixCompactChange *changes;
+    uint32_t cnt;
+    uint32_t size;
+} SRepDeltaNetblocks;
+
+struct SRepDelta_ {
+    SRepDeltaHost *hosts;
+    uint32_t hosts_cnt;
+    uint32_t hosts_size;
+
+    /** IPv4 and IPv6 netblocks */
+    SRepDeltaNetblocks netblocks[2][SREP_MAX_CATS];
+
+    uint32_t bad_lines;
+};
+
+/** a retired compact tree, freed once no lookup can be using it */
+typedef struct SRepRetired_ {
+    SRepCIDRTree *cidr_ctx;
+    SCRadixCompactTree *tree;
+    /** epoch the tree was replaced in */
+    uint64_t epoch;
+    struct SRepRetired_ *next;
+} SRepRetired;
+
+/** epoch a packet thread last passed a quiescent point in */
+struct SRepThread_ {
+    SC_ATOMIC_DECLARE(uint64_t, epoch);
+    SRepCIDRTree *cidr_ctx;
+    struct SRepThread_ *next;
+};
+
+/** serializes deltas and protects the retired list and the thread lists */
+static SCMutex srep_delta_lock = SCMUTEX_INITIALIZER;
+static SRepRetired *srep_retired = NULL;
+
+/** \internal
+ *  \brief check if all threads using the context of a retired tree have
+ *         passed a quiescent point since the tree was replaced
+ *
+ *  srep_delta_lock must be held.
+ */
+static int SRepRetiredIsUnused(const SRepRetired *r)
+{
+    const SRepThread *t;
+    for (t = r->cidr_ctx->threads; t != NULL; t = t->next) {
+        if (SC_ATOMIC_GET(t->epoch) < r->epoch)
+            return 0;
+    }
+    return 1;
+}
+
+/** \internal
+ *  \brief free retired trees
+ *
+ *  \param cidr_ctx free all trees of this context, or NULL to free
+ *                  the trees no thread can be using anymore
+ *
+ *  srep_delta_lock must be held.
+ */
+static void SRepRetiredFree(SRepCIDRTree *cidr_ctx)
+{
+    SRepRetired **prev = &srep_retired;
+    while (*prev != NULL) {
+        SRepRetired *r = *prev;
+        if (cidr_ctx != NULL ? r->cidr_ctx == cidr_ctx : SRepRetiredIsUnused(r)) {
+            *prev = r->next;
+            (void)SC_ATOMIC_SUB(srep_cidr_memuse, r->tree->memuse);
+            SCRadixCompactReleaseTree(r->tree);
+            SCFree(r);
+        } else {
+            prev = &r->next;
+        }
+    }
+}
+
+SRepDelta *SRepDeltaNew(void)
+{
+    SRepDelta *d = SCMalloc(sizeof(*d));
+    if (unlikely(d == NULL))
+        return NULL;
+    memset(d, 0, sizeof(*d));
+    return d;
+}
+
+void SRepDeltaFree(SRepDelta *d)
+{
+    int f, cat;
+
+    if (d == NULL)
+        return;
+    for (f = 0; f < 2; f++) {
+        for (cat = 0; cat < SREP_MAX_CATS; cat++) {
+            if (d->netblocks[f][cat].changes != NULL)
+                SCFree(d->netblocks[f][cat].changes);
+        }
+    }
+    if (d->hosts != NULL)
+        SCFree(d->hosts);
+    SCFree(d);
+}
+
+static int SRepDeltaAddNetblock(SRepDelta *d, int f, uint8_t cat,
+                                const SCRadixCompactChange *c)
+{
+    SRepDeltaNetblocks *nb = &d->netblocks[f][cat];
+    if (nb->cnt == nb->size) {
+        uint32_t size = nb->size ? nb->size * 2 : 64;
+        SCRadixCompactChange *ptmp = SCRealloc(nb->changes, size * sizeof(*ptmp));
+        if (ptmp == NULL)
+            return -1;
+        nb->changes = ptmp;
+        nb->size = size;
+    }
+    nb->changes[nb->cnt++] = *c;
+    return 0;
+}
+
+static int SRepDeltaAddHost(SRepDelta *d, const SRepDeltaHost *h)
+{
+    if (d->hosts_cnt == d->hosts_size) {
+        uint32_t size = d->hosts_size ? d->hosts_size * 2 : 64;
+        SRepDeltaHost *ptmp = SCRealloc(d->hosts, size * sizeof(*ptmp));
+        if (ptmp == NULL)
+            return -1;
+        d->hosts = ptmp;
+        d->hosts_size = size;
+    }
+    d->hosts[d->hosts_cnt++] = *h;
+    return 0;
+}
+
+static int SRepDeltaParseUint8(const char *str, uint8_t max, uint8_t *res)
+{
+    size_t len = strlen(str);
+    if (len == 0 || len > 3 ||
+        ByteExtractStringUint8(res, 10, (uint16_t)len, str) != (int)len)
+        return -1;
+    return *res <= max ? 0 : -1;
+}
+
+/**
+ *  \brief Add a line to a delta
+ *
+ *  The lines use the reputation file format, "<ip>,<category>,<score>",
+ *  where the ip can be a netblock. A line starting with a '-' removes the
+ *  entry: "-<ip>,<category>". Empty lines, comments and the "ip,..."
+ *  header are skipped.
+ *
+ *  \retval 0 ok
+ *  \retval -1 bad line
+ */
+int SRepDeltaAddLine(SRepDelta *d, const char *line)
+{
+    char buf[256];
+    char *saveptr = NULL;
+    uint8_t remove = 0;
+
+    while (isspace((unsigned char)*line))
+        line++;
+    if (*line == '\0' || *line == '#')
+        return 0;
+    if (*line == '-') {
+        remove = 1;
+        line++;
+    }
+    if (strlcpy(buf, line, sizeof(buf)) >= sizeof(buf))
+        goto bad;
+    size_t len = strlen(buf);
+    while (len > 0 && isspace((unsigned char)buf[len - 1]))
+        buf[--len] = '\0';
+
+    char *ip = strtok_r(buf, ",", &saveptr);
+    char *catstr = strtok_r(NULL, ",", &saveptr);
+    char *valstr = strtok_r(NULL, ",", &saveptr);
+    if (ip == NULL || catstr == NULL || strtok_r(NULL, ",", &saveptr) != NULL)
+        goto bad;
+    if (!remove && strcmp(ip, "ip") == 0)
+        return 0;
+
+    uint8_t cat = 0, value = 0;
+    if (SRepDeltaParseUint8(catstr, SREP_MAX_CATS - 1, &cat) < 0)
+        goto bad;
+    if (remove) {
+        if (valstr != NULL)
+            goto bad;
+    } else if (valstr == NULL || SRepDeltaParseUint8(valstr, 127, &value) < 0) {
+        goto bad;
+    }
+
+    char *mask = strchr(ip, '/');
+    if (mask != NULL) {
+        SCRadixCompactChange c;
+        memset(&c, 0, sizeof(c));
+        *mask++ = '\0';
+
+        int f;
+        uint8_t max;
+        if (inet_pton(AF_INET, ip, c.key) == 1) {
+            f = 0;
+            max = 32;
+        } else if (inet_pton(AF_INET6, ip, c.key) == 1) {
+            f = 1;
+            max = 128;
+        } else {
+            goto bad;
+        }
+        if (SRepDeltaParseUint8(mask, max, &c.netmask) < 0)
+            goto bad;
+        c.remove = remove;
+        c.user = SREP_CIDR_VALUE(value);
+
+        if (SRepDeltaAddNetblock(d, f, cat, &c) < 0)
+            return -1;
+    } else {
+        SRepDeltaHost h;
+        memset(&h, 0, sizeof(h));
+        if (inet_pton(AF_INET, ip, &h.a.address) == 1) {
+            h.a.family = AF_INET;
+        } else if (inet_pton(AF_INET6, ip, &h.a.address) == 1) {
+            h.a.family = AF_INET6;
+        } else {
+            goto bad;
+        }
+        h.cat = cat;
+        h.value = value;
+        h.remove = remove;
+
+        if (SRepDeltaAddHost(d, &h) < 0)
+            return -1;
+    }
+    return 0;
+
+bad:
+    d->bad_lines++;
+    return -1;
+}
+
+/**
+ *  \brief Add the lines of a delta file to a delta
+ *
+ *  \retval 0 ok, bad lines are logged and counted
+ *  \retval -1 file could not be opened
+ */
+int SRepDeltaLoadFile(SRepDelta *d, const char *filename)
+{
+    char line[8192] = "";
+
+    char *path = SRepCompleteFilePath((char *)filename);
+    if (path == NULL)
+        return -1;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep delta file %s: %s",
+                path, strerror(errno));
+        SCFree(path);
+        return -1;
+    }
+
+    while (fgets(line, (int)sizeof(line), fp) != NULL) {
+        if (SRepDeltaAddLine(d, line) < 0) {
+            SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%s\" in %s", line, path);
+        }
+    }
+
+    fclose(fp);
+    SCFree(path);
+    return 0;
+}
+
+/** \internal
+ *  \brief remove the reputation of a host in a category
+ *
+ *  The host's reputation is freed once no category is set.
+ */
+static void SRepHostRemoveRep(Address *a, uint8_t cat)
+{
+    Host *h = HostLookupHostFromHash(a);
+    if (h == NULL)
+        return;
+
+    SReputation *rep = h->iprep;
+    if (rep != NULL && rep->version == SRepGetVersion()) {
+        rep->rep[cat] = 0;
+
+        int i;
+        for (i = 0; i < SREP_MAX_CATS; i++) {
+            if (rep->rep[i] != 0)
+                break;
+        }
+        if (i == SREP_MAX_CATS) {
+            SCFree(h->iprep);
+            h->iprep = NULL;
+            HostDecrUsecnt(h);
+        }
+    }
+
+    HostRelease(h);
+}
+
+/** \internal
+ *  \brief replace the compact tree of a category by an updated copy
+ *
+ *  srep_delta_lock must be held.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, the tree is unchanged
+ */
+static int SRepDeltaUpdateTree(SRepCIDRTree *cidr_ctx, int f, uint8_t cat,
+        const SRepDeltaNetblocks *nb, SRepDeltaStats *stats)
+{
+    SCRadixTree *tree = f ? cidr_ctx->srepIPV6_tree[cat] : cidr_ctx->srepIPV4_tree[cat];
+    SCRadixCompactTree **slot = f ? &cidr_ctx->srepIPV6_compact[cat] :
+        &cidr_ctx->srepIPV4_compact[cat];
+
+    if (tree != NULL) {
+        SCLogWarning(SC_ERR_NO_REPUTATION, "IPv%d netblocks of category %u "
+                "use a radix tree and can't be updated, set "
+                "reputation-lookup to compact", f ? 6 : 4, cat);
+        return -1;
+    }
+
+    SCRadixCompactTree *old = *slot;
+    SRepRetired *r = NULL;
+    if (old != NULL) {
+        r = SCMalloc(sizeof(*r));
+        if (unlikely(r == NULL))
+            return -1;
+    }
+
+    SCRadixCompactTree *t = SCRadixCompactUpdateTree(old, f ? 128 : 32,
+            nb->changes, nb->cnt);
+    if (t == NULL) {
+        if (r != NULL)
+            SCFree(r);
+        return -1;
+    }
+    (void)SC_ATOMIC_ADD(srep_cidr_memuse, t->memuse);
+    stats->memuse_delta += (int64_t)t->memuse - (old ? (int64_t)old->memuse : 0);
+
+    /* publish the new tree. The CAS is a full barrier, so lookups that
+     * see the new pointer also see the tree it points to. */
+    (void)SCAtomicCompareAndSwap(slot, old, t);
+
+    if (r != NULL) {
+        r->cidr_ctx = cidr_ctx;
+        r->tree = old;
+        /* threads that see this epoch or later at a quiescent point
+         * will only load the new tree */
+        r->epoch = SC_ATOMIC_ADD(srep_epoch, 1);
+        r->next = srep_retired;
+        srep_retired = r;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief apply a delta to the host table and a CIDR context */
+static void SRepDeltaApplyCtx(SRepCIDRTree *cidr_ctx, SRepDelta *d,
+                              SRepDeltaStats *stats)
+{
+    struct timeval start, end;
+    uint32_t i;
+    int f, cat;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->errors = d->bad_lines;
+    gettimeofday(&start, NULL);
+
+    SCMutexLock(&srep_delta_lock);
+    SRepRetiredFree(NULL);
+
+    for (i = 0; i < d->hosts_cnt; i++) {
+        SRepDeltaHost *h = &d->hosts[i];
+        if (h->remove) {
+            SRepHostRemoveRep(&h->a, h->cat);
+        } else if (SRepHostSetRep(&h->a, h->cat, h->value) < 0) {
+            SCLogError(SC_ERR_NO_REPUTATION, "failed to get a host, increase host.memcap");
+            stats->errors++;
+            continue;
+        }
+        stats->hosts++;
+    }
+
+    for (f = 0; f < 2; f++) {
+        for (cat = 0; cat < SREP_MAX_CATS; cat++) {
+            const SRepDeltaNetblocks *nb = &d->netblocks[f][cat];
+            if (nb->cnt == 0)
+                continue;
+            if (SRepDeltaUpdateTree(cidr_ctx, f, (uint8_t)cat, nb, stats) < 0) {
+                stats->errors += nb->cnt;
+                continue;
+            }
+            stats->netblocks += nb->cnt;
+            stats->tables++;
+        }
+    }
+    SCMutexUnlock(&srep_delta_lock);
+
+    gettimeofday(&end, NULL);
+    stats->usecs = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+        end.tv_usec - start.tv_usec;
+    (void)SC_ATOMIC_ADD(srep_delta_cnt, 1);
+    (void)SC_ATOMIC_SET(srep_delta_usecs, stats->usecs);
+
+    SCLogInfo("IP reputation delta: %u hosts, %u netblocks in %u lookup "
+            "tables, %u errors, %"PRIu64" usecs, CIDR memuse changed by "
+            "%"PRIi64" bytes", stats->hosts, stats->netblocks, stats->tables,
+            stats->errors, stats->usecs, stats->memuse_delta);
+}
+
+/**
+ *  \brief Apply a delta to the running detection engine
+ *
+ *  Host entries are updated in place under the host lock. The CIDR lookup
+ *  tables with changes are rebuilt next to the ones in use and swapped in,
+ *  so packet threads never wait for the update. Deltas are lost on the next
+ *  rule reload, which reloads the reputation files.
+ *
+ *  \retval 0 ok, see stats for entries that failed
+ *  \retval -1 IP reputation is not in use
+ */
+int SRepDeltaApply(SRepDelta *d, SRepDeltaStats *stats)
+{
+    if (SRepGetVersion() == 0)
+        return -1;
+
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    if (de_ctx == NULL)
+        return -1;
+    if (de_ctx->srepCIDR_ctx == NULL) {
+        DetectEngineDeReference(&de_ctx);
+        return -1;
+    }
+
+    SRepDeltaApplyCtx(de_ctx->srepCIDR_ctx, d, stats);
+    DetectEngineDeReference(&de_ctx);
+    return 0;
+}
+
+/**
+ *  \brief register a packet thread doing lookups in the compact trees
+ *
+ *  Replaced trees are only freed once all registered threads passed a
+ *  quiescent point, see SRepThreadQuiesce.
+ *
+ *  \retval t thread state, to pass to SRepThreadQuiesce
+ *  \retval NULL on error
+ */
+SRepThread *SRepThreadRegister(SRepCIDRTree *cidr_ctx)
+{
+    SRepThread *t = SCMalloc(sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+    memset(t, 0, sizeof(*t));
+    SC_ATOMIC_INIT(t->epoch);
+
+    SCMutexLock(&srep_delta_lock);
+    /* the thread has no trees loaded yet, so it doesn't hold back
+     * the ones retired so far */
+    (void)SC_ATOMIC_SET(t->epoch, SC_ATOMIC_GET(srep_epoch));
+    t->cidr_ctx = cidr_ctx;
+    t->next = cidr_ctx->threads;
+    cidr_ctx->threads = t;
+    SCMutexUnlock(&srep_delta_lock);
+    return t;
+}
+
+void SRepThreadDeregister(SRepThread *t)
+{
+    if (t == NULL)
+        return;
+
+    SCMutexLock(&srep_delta_lock);
+    /* the context is gone already if its engine was freed first */
+    if (t->cidr_ctx != NULL) {
+        SRepThread **prev = &t->cidr_ctx->threads;
+        while (*prev != NULL) {
+            if (*prev == t) {
+                *prev = t->next;
+                break;
+            }
+            prev = &(*prev)->next;
+        }
+    }
+    SCMutexUnlock(&srep_delta_lock);
+    SCFree(t);
+}
+
+/**
+ *  \brief mark a quiescent point of a packet thread
+ *
+ *  To be called between packets, when the thread holds no pointers to
+ *  compact trees. Trees replaced before this point can't be used by the
+ *  thread anymore. A thread that stops calling this holds back freeing
+ *  the replaced trees of its engine until the engine is freed.
+ */
+void SRepThreadQuiesce(SRepThread *t)
+{
+    const uint64_t epoch = SC_ATOMIC_GET(srep_epoch);
+    /* the set is a full barrier, so lookups after this load the trees
+     * published before the epoch was bumped */
+    if (SC_ATOMIC_GET(t->epoch) != epoch)
+        (void)SC_ATOMIC_SET(t->epoch, epoch);
+}
+
+static uint64_t SRepCIDRMemuseCounter(void)
+{
+    return SC_ATOMIC_GET(srep_cidr_memuse);
+}
+
+static uint64_t SRepDeltaCounter(void)
+{
+    return SC_ATOMIC_GET(srep_delta_cnt);
+}
+
+static uint64_t SRepDeltaUsecsCounter(void)
+{
+    return SC_ATOMIC_GET(srep_delta_usecs);
+}
+
 /** \brief init reputation
  *
  *  \param de_ctx detection engine ctx for tracking iprep version
@@ -599,6 +1194,10 @@ int SRepInit(DetectEngineCtx *de_ctx)
 
     if (SRepGetVersion() == 0) {
         SC_ATOMIC_INIT(srep_eversion);
+        SC_ATOMIC_INIT(srep_cidr_memuse);
+        SC_ATOMIC_INIT(srep_delta_cnt);
+        SC_ATOMIC_INIT(srep_delta_usecs);
+        SC_ATOMIC_INIT(srep_epoch);
         init = 1;
     }
 
@@ -628,6 +1227,10 @@ int SRepInit(DetectEngineCtx *de_ctx)
                     "categories file %s", filename);
             return -1;
         }
+
+        StatsRegisterGlobalCounter("iprep.cidr_memuse", SRepCIDRMemuseCounter);
+        StatsRegisterGlobalCounter("iprep.deltas", SRepDeltaCounter);
+        StatsRegisterGlobalCounter("iprep.delta_usecs", SRepDeltaUsecsCounter);
     }
 
     de_ctx->srep_version = SRepIncrVersion();
@@ -649,6 +1252,18 @@ int SRepInit(DetectEngineCtx *de_ctx)
         }
     }
 
+    const char *lookup = NULL;
+    if (ConfGet("reputation-lookup", &lookup) == 1 && lookup != NULL &&
+        strcasecmp(lookup, "radix") == 0) {
+        SCLogConfig("IP reputation: using radix tree CIDR lookups");
+    } else {
+        if (lookup != NULL && strcasecmp(lookup, "compact") != 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value \"%s\" for "
+                    "reputation-lookup, using \"compact\"", lookup);
+        }
+        SRepCIDRCompile(cidr_ctx);
+    }
+
     /* Set effective rep version.
      * On live reload we will handle this after de_ctx has been swapped */
     if (init) {
@@ -672,8 +1287,29 @@ void SRepDestroy(DetectEngineCtx *de_ctx) {
                 SCRadixReleaseRadixTree(de_ctx->srepCIDR_ctx->srepIPV6_tree[i]);
                 de_ctx->srepCIDR_ctx->srepIPV6_tree[i] = NULL;
             }
+
+            if (de_ctx->srepCIDR_ctx->srepIPV4_compact[i] != NULL) {
+                (void)SC_ATOMIC_SUB(srep_cidr_memuse,
+                        de_ctx->srepCIDR_ctx->srepIPV4_compact[i]->memuse);
+                SCRadixCompactReleaseTree(de_ctx->srepCIDR_ctx->srepIPV4_compact[i]);
+                de_ctx->srepCIDR_ctx->srepIPV4_compact[i] = NULL;
+            }
+            if (de_ctx->srepCIDR_ctx->srepIPV6_compact[i] != NULL) {
+                (void)SC_ATOMIC_SUB(srep_cidr_memuse,
+                        de_ctx->srepCIDR_ctx->srepIPV6_compact[i]->memuse);
+                SCRadixCompactReleaseTree(de_ctx->srepCIDR_ctx->srepIPV6_compact[i]);
+                de_ctx->srepCIDR_ctx->srepIPV6_compact[i] = NULL;
+            }
         }
 
+        /* no thread uses this engine anymore */
+        SCMutexLock(&srep_delta_lock);
+        SRepRetiredFree(de_ctx->srepCIDR_ctx);
+        SRepThread *t;
+        for (t = de_ctx->srepCIDR_ctx->threads; t != NULL; t = t->next)
+            t->cidr_ctx = NULL;
+        SCMutexUnlock(&srep_delta_lock);
+
         SCFree(de_ctx->srepCIDR_ctx);
         de_ctx->srepCIDR_ctx = NULL;
     }
@@ -681,7 +1317,6 @@ void SRepDestroy(DetectEngineCtx *de_ctx) {
 
 #ifdef UNITTESTS
 #include "conf-yaml-loader.h"
-#include "detect-engine.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp.h"
@@ -898,6 +1533,137 @@ end:
     DetectEngineCtxFree(de_ctx);
     return result;
 }
+
+/** \test lookups in the compiled CIDR tables */
+static int SRepTest08(void)
+{
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+    Address a;
+    uint8_t cat = 0, value = 0;
+
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    SRepInit(de_ctx);
+
+    char str1[] = "192.168.0.0/16,1,10";
+    char str2[] = "192.168.1.0/24,1,20";
+    char str3[] = "192.168.1.128/25,2,30";
+    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str1, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str2, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str3, &a, &cat, &value) != 1);
+
+    SRepCIDRCompile(de_ctx->srepCIDR_ctx);
+    FAIL_IF_NULL(de_ctx->srepCIDR_ctx->srepIPV4_compact[1]);
+    FAIL_IF_NULL(de_ctx->srepCIDR_ctx->srepIPV4_compact[2]);
+    FAIL_IF_NOT_NULL(de_ctx->srepCIDR_ctx->srepIPV4_tree[1]);
+
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.168.0.1");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 1, 0) != 10);
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.168.1.200");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 1, 0) != 20);
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 2, 0) != 30);
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.168.1.1");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 2, 0) != 0);
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.169.0.1");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 1, 0) != 0);
+
+    UTHFreePacket(p);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test netblock deltas replace the compiled CIDR tables */
+static int SRepTest09(void)
+{
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+    Address a;
+    uint8_t cat = 0, value = 0;
+    SRepDeltaStats stats;
+
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    SRepInit(de_ctx);
+
+    char str1[] = "192.168.0.0/16,1,10";
+    char str2[] = "192.168.1.0/24,1,20";
+    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str1, &a, &cat, &value) != 1);
+    FAIL_IF(SRepSplitLine(de_ctx->srepCIDR_ctx, str2, &a, &cat, &value) != 1);
+    SRepCIDRCompile(de_ctx->srepCIDR_ctx);
+    SCRadixCompactTree *old = de_ctx->srepCIDR_ctx->srepIPV4_compact[1];
+    FAIL_IF_NULL(old);
+
+    /* a packet thread in the middle of a lookup */
+    SRepThread *t1 = SRepThreadRegister(de_ctx->srepCIDR_ctx);
+    FAIL_IF_NULL(t1);
+    SRepThread *t2 = SRepThreadRegister(de_ctx->srepCIDR_ctx);
+    FAIL_IF_NULL(t2);
+
+    SRepDelta *d = SRepDeltaNew();
+    FAIL_IF_NULL(d);
+    FAIL_IF(SRepDeltaAddLine(d, "# comment\n") != 0);
+    FAIL_IF(SRepDeltaAddLine(d, "192.168.1.0/24,1,50\n") != 0);
+    FAIL_IF(SRepDeltaAddLine(d, "-192.168.0.0/16,1\n") != 0);
+    FAIL_IF(SRepDeltaAddLine(d, "10.0.0.0/8,3,7") != 0);
+    FAIL_IF(SRepDeltaAddLine(d, "2001:db8::/32,3,8") != 0);
+    FAIL_IF(SRepDeltaAddLine(d, "10.0.0.0/33,3,7") != -1);
+    FAIL_IF(SRepDeltaAddLine(d, "10.0.0.0/8,3,128") != -1);
+    FAIL_IF(SRepDeltaAddLine(d, "-10.0.0.0/8,3,1") != -1);
+
+    SRepDeltaApplyCtx(de_ctx->srepCIDR_ctx, d, &stats);
+    SRepDeltaFree(d);
+    FAIL_IF(stats.netblocks != 4);
+    FAIL_IF(stats.tables != 3);
+    FAIL_IF(stats.errors != 3);
+    FAIL_IF(de_ctx->srepCIDR_ctx->srepIPV4_compact[1] == old);
+    FAIL_IF_NULL(srep_retired);
+    FAIL_IF(srep_retired->tree != old);
+
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.168.1.1");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 1, 0) != 50);
+    p->src.addr_data32[0] = UTHSetIPv4Address("192.168.2.1");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 1, 0) != 0);
+    p->src.addr_data32[0] = UTHSetIPv4Address("10.1.2.3");
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 3, 0) != 7);
+
+    /* the old tree is kept until both threads passed a quiescent point */
+    SRepThreadQuiesce(t1);
+    d = SRepDeltaNew();
+    FAIL_IF_NULL(d);
+    SRepDeltaApplyCtx(de_ctx->srepCIDR_ctx, d, &stats);
+    SRepDeltaFree(d);
+    FAIL_IF_NULL(srep_retired);
+    FAIL_IF(srep_retired->tree != old);
+
+    SRepThreadQuiesce(t2);
+    d = SRepDeltaNew();
+    FAIL_IF_NULL(d);
+    SRepDeltaApplyCtx(de_ctx->srepCIDR_ctx, d, &stats);
+    SRepDeltaFree(d);
+    FAIL_IF_NOT_NULL(srep_retired);
+
+    /* a tree replaced while t1 is gone is only held back by t2 */
+    SRepThreadDeregister(t1);
+    d = SRepDeltaNew();
+    FAIL_IF_NULL(d);
+    FAIL_IF(SRepDeltaAddLine(d, "10.0.0.0/8,3,9") != 0);
+    SRepDeltaApplyCtx(de_ctx->srepCIDR_ctx, d, &stats);
+    SRepDeltaFree(d);
+    FAIL_IF_NULL(srep_retired);
+    FAIL_IF(SRepCIDRGetIPRepSrc(de_ctx->srepCIDR_ctx, p, 3, 0) != 9);
+
+    UTHFreePacket(p);
+    DetectEngineCtxFree(de_ctx);
+    FAIL_IF_NOT_NULL(srep_retired);
+    /* the thread outlived its engine */
+    SRepThreadDeregister(t2);
+    PASS;
+}
 #endif
 
 #if 0
@@ -2339,6 +3105,8 @@ void SCReputationRegisterTests(void)
     UtRegisterTest("SRepTest05", SRepTest05);
     UtRegisterTest("SRepTest06", SRepTest06);
     UtRegisterTest("SRepTest07", SRepTest07);
+    UtRegisterTest("SRepTest08", SRepTest08);
+    UtRegisterTest("SRepTest09", SRepTest09);
 #endif /* UNITTESTS */
 }
 
@@ -27,12 +27,23 @@
 #define __REPUTATION_H__
 
 #include "host.h"
+#include "util-radix-compact.h"
 
 #define SREP_MAX_CATS 60
 
+/** packet thread using the compact trees, see SRepThreadQuiesce */
+typedef struct SRepThread_ SRepThread;
+
 typedef struct SRepCIDRTree_ {
     SCRadixTree *srepIPV4_tree[SREP_MAX_CATS];
     SCRadixTree *srepIPV6_tree[SREP_MAX_CATS];
+    /** compact versions of the trees, replacing them once all
+     *  reputation files are loaded. Deltas swap them while packet
+     *  threads use them, see SRepDeltaApply. */
+    SCRadixCompactTree *srepIPV4_compact[SREP_MAX_CATS];
+    SCRadixCompactTree *srepIPV6_compact[SREP_MAX_CATS];
+    /** threads doing lookups in the trees. Protected by the delta lock. */
+    SRepThread *threads;
 } SRepCIDRTree;
 
 typedef struct SReputation_ {
@@ -40,12 +51,34 @@ typedef struct SReputation_ {
     uint8_t rep[SREP_MAX_CATS];
 } SReputation;
 
+/** set of host and netblock changes to apply to the running engine */
+typedef struct SRepDelta_ SRepDelta;
+
+typedef struct SRepDeltaStats_ {
+    uint32_t hosts;         /**< host entries set or removed */
+    uint32_t netblocks;     /**< netblock entries set or removed */
+    uint32_t tables;        /**< CIDR lookup tables replaced */
+    uint32_t errors;        /**< bad lines and entries not applied */
+    uint64_t usecs;         /**< time it took to apply the delta */
+    int64_t memuse_delta;   /**< change in CIDR lookup table memory */
+} SRepDeltaStats;
+
 uint8_t SRepCatGetByShortname(char *shortname);
 int SRepInit(struct DetectEngineCtx_ *de_ctx);
 void SRepDestroy(struct DetectEngineCtx_ *de_ctx);
 void SRepReloadComplete(void);
 int SRepHostTimedOut(Host *);
 
+SRepDelta *SRepDeltaNew(void);
+void SRepDeltaFree(SRepDelta *);
+int SRepDeltaAddLine(SRepDelta *, const char *);
+int SRepDeltaLoadFile(SRepDelta *, const char *);
+int SRepDeltaApply(SRepDelta *, SRepDeltaStats *);
+
+SRepThread *SRepThreadRegister(SRepCIDRTree *cidr_ctx);
+void SRepThreadDeregister(SRepThread *t);
+void SRepThreadQuiesce(SRepThread *t);
+
 /** Reputation numbers (types) that we can use to lookup/update, etc
  *  Please, dont convert this to a enum since we want the same reputation
  *  codes always. */
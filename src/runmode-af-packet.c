@@ -55,6 +55,8 @@
 #include "util-ioctl.h"
 
 #include "source-af-packet.h"
+#include "util-ebpf.h"
+#include "flow-bypass.h"
 
 extern int max_pending_packets;
 
@@ -121,6 +123,7 @@ static void *ParseAFPConfig(const char *iface)
     intmax_t value;
     int boolval;
     const char *bpf_filter = NULL;
+    const char *ebpf_file = NULL;
     const char *out_iface = NULL;
     int cluster_type = PACKET_FANOUT_HASH;
 
@@ -145,10 +148,15 @@ static void *ParseAFPConfig(const char *iface)
     aconf->DerefFunc = AFPDerefConfig;
     aconf->flags = AFP_RING_MODE;
     aconf->bpf_filter = NULL;
+    aconf->ebpf_filter_file = NULL;
+    aconf->ebpf_filter_fd = -1;
+    aconf->xdp_filter_file = NULL;
+    aconf->xdp_filter_fd = -1;
     aconf->out_iface = NULL;
     aconf->copy_mode = AFP_COPY_MODE_NONE;
     aconf->block_timeout = 10;
     aconf->block_size = getpagesize() << AFP_BLOCK_SIZE_DEFAULT_ORDER;
+    aconf->batch_size = 1;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
         if (strlen(bpf_filter) > 0) {
@@ -355,6 +363,98 @@ static void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &boolval);
+#ifdef HAVE_PACKET_EBPF
+    /* load the XDP program, or else the eBPF socket filter */
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-filter-file", &ebpf_file) == 1 &&
+            strlen(ebpf_file) > 0) {
+        const char *xdp_mode = NULL;
+        aconf->xdp_filter_file = ebpf_file;
+        aconf->xdp_mode = EBPF_XDP_MODE_DRV;
+        if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &xdp_mode) == 1) {
+            if (strcmp(xdp_mode, "soft") == 0) {
+                aconf->xdp_mode = EBPF_XDP_MODE_SKB;
+            } else if (strcmp(xdp_mode, "driver") == 0) {
+                aconf->xdp_mode = EBPF_XDP_MODE_DRV;
+            } else if (strcmp(xdp_mode, "hw") == 0) {
+                aconf->xdp_mode = EBPF_XDP_MODE_HW;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "Invalid xdp-mode '%s' for %s, "
+                             "using 'driver'", xdp_mode, aconf->iface);
+            }
+        }
+        if (EBPFLoadFile(aconf->iface, ebpf_file, "xdp", &aconf->xdp_filter_fd,
+                         EBPF_XDP_CODE) != 0 ||
+                EBPFSetupXDP(aconf->iface, aconf->xdp_filter_fd, aconf->xdp_mode) != 0) {
+            SCLogError(SC_ERR_BPF, "Unable to set up XDP filter '%s' on %s, "
+                       "continuing without it", ebpf_file, aconf->iface);
+            aconf->xdp_filter_fd = -1;
+        } else {
+            SCLogConfig("Using XDP filter %s on %s", ebpf_file, aconf->iface);
+            if (boolval)
+                aconf->flags |= AFP_XDPBYPASS;
+        }
+    } else if (ConfGetChildValueWithDefault(if_root, if_default, "ebpf-filter-file", &ebpf_file) == 1 &&
+            strlen(ebpf_file) > 0) {
+        aconf->ebpf_filter_file = ebpf_file;
+        if (EBPFLoadFile(aconf->iface, ebpf_file, "filter", &aconf->ebpf_filter_fd,
+                         EBPF_SOCKET_FILTER) != 0) {
+            SCLogError(SC_ERR_BPF, "Unable to load eBPF filter '%s' for %s, "
+                       "continuing without it", ebpf_file, aconf->iface);
+            aconf->ebpf_filter_fd = -1;
+        } else {
+            SCLogConfig("Using eBPF filter %s on %s", ebpf_file, aconf->iface);
+            if (aconf->bpf_filter) {
+                SCLogWarning(SC_WARN_UNCOMMON, "bpf-filter is ignored on %s as "
+                             "an eBPF filter is used", aconf->iface);
+                aconf->bpf_filter = NULL;
+            }
+            if (boolval)
+                aconf->flags |= AFP_BYPASS;
+        }
+    }
+
+    if (aconf->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
+        /* bypassed packets never reach Suricata so it can't forward them */
+        if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "Bypass is not supported in "
+                         "copy-mode on %s, disabling it", aconf->iface);
+            aconf->flags &= ~(AFP_BYPASS|AFP_XDPBYPASS);
+        } else {
+            char *bypass_iface = SCStrdup(aconf->iface);
+            if (unlikely(bypass_iface == NULL)) {
+                aconf->flags &= ~(AFP_BYPASS|AFP_XDPBYPASS);
+            } else if (BypassedFlowManagerRegisterCheckFunc(
+                        EBPFCheckBypassedFlowTimeout, (void *)bypass_iface) != 0) {
+                /* without the check bypassed flows would never time out */
+                SCLogWarning(SC_ERR_INVALID_VALUE, "Unable to register the "
+                             "bypassed flow check on %s, disabling bypass",
+                             aconf->iface);
+                SCFree(bypass_iface);
+                aconf->flags &= ~(AFP_BYPASS|AFP_XDPBYPASS);
+            } else {
+                SCLogConfig("Using flow bypass with %s on %s",
+                            (aconf->flags & AFP_XDPBYPASS) ? "XDP" : "eBPF",
+                            aconf->iface);
+            }
+        }
+    } else if (boolval) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Bypass on %s needs an "
+                     "ebpf-filter-file or a xdp-filter-file", aconf->iface);
+    }
+#else
+    if (boolval) {
+        SCLogWarning(SC_ERR_UNIMPLEMENTED, "Bypass on %s needs eBPF support, "
+                     "see --enable-ebpf", aconf->iface);
+    }
+    if (ConfGetChildValueWithDefault(if_root, if_default, "ebpf-filter-file", &ebpf_file) == 1 ||
+            ConfGetChildValueWithDefault(if_root, if_default, "xdp-filter-file", &ebpf_file) == 1) {
+        SCLogWarning(SC_ERR_UNIMPLEMENTED, "eBPF filter '%s' ignored on %s, "
+                     "eBPF support is not built in", ebpf_file, aconf->iface);
+    }
+#endif
+
     if ((ConfGetChildValueIntWithDefault(if_root, if_default, "buffer-size", &value)) == 1) {
         aconf->buffer_size = value;
     } else {
@@ -378,6 +478,19 @@ static void *ParseAFPConfig(const char *iface)
         aconf->block_timeout = 10;
     }
 
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value)) == 1) {
+        if (value < 1 || value > TM_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "batch-size for %s must be between "
+                    "1 and %d, using 1", aconf->iface, TM_BATCH_SIZE_MAX);
+        } else {
+            if (!(aconf->flags & AFP_TPACKET_V3)) {
+                SCLogConfig("%s: batch-size is only used with tpacket-v3",
+                        aconf->iface);
+            }
+            aconf->batch_size = value;
+        }
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogConfig("Disabling promiscuous mode on iface %s",
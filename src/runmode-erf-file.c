@@ -17,6 +17,7 @@
 
 #include "suricata-common.h"
 #include "tm-threads.h"
+#include "tmqh-flow.h"
 #include "conf.h"
 #include "runmodes.h"
 #include "runmode-erf-file.h"
@@ -156,7 +157,7 @@ int RunModeErfFileAutoFp(void)
     ThreadVars *tv =
         TmThreadCreatePacketHandler(thread_name_autofp,
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, TmqhFlowGetQueueHandlerName(),
                                     "pktacqloop");
     SCFree(queues);
 
@@ -199,7 +200,7 @@ int RunModeErfFileAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhFlowGetQueueHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -17,6 +17,7 @@
 
 #include "suricata-common.h"
 #include "tm-threads.h"
+#include "tmqh-flow.h"
 #include "conf.h"
 #include "runmodes.h"
 #include "runmode-pcap-file.h"
@@ -74,6 +75,12 @@ int RunModeFilePcapSingle(void)
 
     PcapFileGlobalInit();
 
+    /* a directory is read file by file by the single reader */
+    if (PcapFileIsDirectory(file)) {
+        if (PcapFileDirectoryInit(file) < 0)
+            exit(EXIT_FAILURE);
+    }
+
     snprintf(tname, sizeof(tname), "%s#01", thread_name_single);
 
     /* create the threads */
@@ -169,6 +176,17 @@ int RunModeFilePcapAutoFp(void)
     /* Available cpus */
     uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
 
+    /* a directory can be read by several readers, each reading whole
+     * files and feeding the same flow queues */
+    int readers = 1;
+    if (PcapFileIsDirectory(file)) {
+        int nfiles = PcapFileDirectoryInit(file);
+        if (nfiles < 0)
+            exit(EXIT_FAILURE);
+        readers = PcapFileGetReaders(nfiles, ncpus);
+        SCLogConfig("pcap-file: using %d readers", readers);
+    }
+
     /* start with cpu 1 so that if we're creating an odd number of detect
      * threads we're not creating the most on CPU0. */
     if (ncpus > 0)
@@ -187,40 +205,41 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
-    snprintf(tname, sizeof(tname), "%s#01", thread_name_autofp);
+    for (thread = 0; thread < readers; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, thread+1);
 
-    /* create the threads */
-    ThreadVars *tv_receivepcap =
-        TmThreadCreatePacketHandler(tname,
-                                    "packetpool", "packetpool",
-                                    queues, "flow",
-                                    "pktacqloop");
-    SCFree(queues);
-
-    if (tv_receivepcap == NULL) {
-        SCLogError(SC_ERR_FATAL, "threading setup failed");
-        exit(EXIT_FAILURE);
-    }
-    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+        /* create the threads */
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(tname,
+                                        "packetpool", "packetpool",
+                                        queues, TmqhFlowGetQueueHandlerName(),
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+        TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
 
-    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
 
-    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
-        SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
-        exit(EXIT_FAILURE);
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
     }
+    SCFree(queues);
 
     for (thread = 0; thread < thread_max; thread++) {
         snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
@@ -231,7 +250,7 @@ int RunModeFilePcapAutoFp(void)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhFlowGetQueueHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -239,7 +258,7 @@ int RunModeFilePcapAutoFp(void)
             exit(EXIT_FAILURE);
         }
 
-        tm_module = TmModuleGetByName("FlowWorker");
+        TmModule *tm_module = TmModuleGetByName("FlowWorker");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
             exit(EXIT_FAILURE);
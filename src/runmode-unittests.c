@@ -33,6 +33,7 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
 #include "detect-engine-sigorder.h"
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
@@ -82,6 +83,7 @@
 
 #include "util-action.h"
 #include "util-radix-tree.h"
+#include "util-radix-compact.h"
 #include "util-host-os-info.h"
 #include "util-cidr.h"
 #include "util-unittest-helper.h"
@@ -120,6 +122,9 @@
 #include "detect-engine-siggroup.h"
 
 #include "util-streaming-buffer.h"
+#include "util-affinity.h"
+#include "source-pcap-file-native.h"
+#include "log-filestore.h"
 #include "util-lua.h"
 
 #endif /* UNITTESTS */
@@ -169,6 +174,7 @@ static void RegisterUnittests(void)
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
     SCRadixRegisterTests();
+    SCRadixCompactRegisterTests();
     DefragRegisterTests();
     SigGroupHeadRegisterTests();
     SCHInfoRegisterTests();
@@ -204,6 +210,7 @@ static void RegisterUnittests(void)
     DetectEngineHttpHRHRegisterTests();
     DetectEngineInspectModbusRegisterTests();
     DetectEngineRegisterTests();
+    PrefilterRegisterTests();
     DetectEngineSMTPFiledataRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
@@ -219,6 +226,9 @@ static void RegisterUnittests(void)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    AffinityRegisterTests();
+    PcapNativeRegisterTests();
+    LogFilestoreRegisterTests();
 }
 #endif
 
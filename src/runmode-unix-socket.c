@@ -38,6 +38,7 @@
 #include "ippair.h"
 #include "app-layer.h"
 #include "host-bit.h"
+#include "reputation.h"
 
 #include "util-profiling.h"
 
@@ -759,6 +760,87 @@ TmEcode UnixSocketUnregisterTenant(json_t *cmd, json_t* answer, void *data)
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Command to apply a delta to the IP reputation data
+ *
+ * \param cmd the content of command Arguments as a json_t object
+ * \param answer the json_t object that has to be used to answer
+ *
+ * Takes a "filename" of a delta file or an "entries" array of delta lines,
+ * see SRepDeltaAddLine. Message looks like:
+ * {"message": {"hosts": 1, "netblocks": 2, "tables": 1, "errors": 0,
+ *  "usecs": 1234, "memuse_delta": 512}, "return": "OK"}
+ */
+TmEcode UnixSocketIPRepDelta(json_t *cmd, json_t* answer, void *data_unused)
+{
+    SRepDeltaStats stats;
+
+    json_t *jfile = json_object_get(cmd, "filename");
+    json_t *jentries = json_object_get(cmd, "entries");
+    if (jfile != NULL && !json_is_string(jfile)) {
+        json_object_set_new(answer, "message", json_string("filename is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    if (jentries != NULL && !json_is_array(jentries)) {
+        json_object_set_new(answer, "message", json_string("entries is not an array"));
+        return TM_ECODE_FAILED;
+    }
+    if (jfile == NULL && jentries == NULL) {
+        json_object_set_new(answer, "message", json_string("filename or entries needed"));
+        return TM_ECODE_FAILED;
+    }
+
+    SRepDelta *d = SRepDeltaNew();
+    if (d == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+
+    if (jfile != NULL) {
+        const char *filename = json_string_value(jfile);
+        SCLogInfo("iprep-delta: %s", filename);
+        if (SRepDeltaLoadFile(d, filename) < 0) {
+            SRepDeltaFree(d);
+            json_object_set_new(answer, "message", json_string("couldn't open file"));
+            return TM_ECODE_FAILED;
+        }
+    }
+    if (jentries != NULL) {
+        size_t i;
+        for (i = 0; i < json_array_size(jentries); i++) {
+            json_t *jentry = json_array_get(jentries, i);
+            if (!json_is_string(jentry) ||
+                SRepDeltaAddLine(d, json_string_value(jentry)) < 0)
+            {
+                SRepDeltaFree(d);
+                json_object_set_new(answer, "message", json_string("invalid entry"));
+                return TM_ECODE_FAILED;
+            }
+        }
+    }
+
+    int r = SRepDeltaApply(d, &stats);
+    SRepDeltaFree(d);
+    if (r < 0) {
+        json_object_set_new(answer, "message", json_string("IP reputation is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message", json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(jdata, "hosts", json_integer(stats.hosts));
+    json_object_set_new(jdata, "netblocks", json_integer(stats.netblocks));
+    json_object_set_new(jdata, "tables", json_integer(stats.tables));
+    json_object_set_new(jdata, "errors", json_integer(stats.errors));
+    json_object_set_new(jdata, "usecs", json_integer(stats.usecs));
+    json_object_set_new(jdata, "memuse_delta", json_integer(stats.memuse_delta));
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+
 /**
  * \brief Command to add a hostbit
  *
@@ -52,9 +52,11 @@
 #include "util-checksum.h"
 #include "util-ioctl.h"
 #include "util-host-info.h"
+#include "util-ebpf.h"
 #include "tmqh-packetpool.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
+#include "flow-private.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -219,7 +221,7 @@ typedef struct AFPThreadVars_
     /* handle state */
     uint8_t afp_state;
     uint8_t copy_mode;
-    uint8_t flags;
+    uint16_t flags;
 
     /* IPS peer */
     AFPPeer *mpeer;
@@ -239,10 +241,19 @@ typedef struct AFPThreadVars_
     int ring_size;
     int block_size;
     int block_timeout;
+    /* packets are passed to the slots in batches of this size (tpacket_v3) */
+    uint32_t batch_size;
+    uint32_t batch_cnt;
+    Packet *batch[TM_BATCH_SIZE_MAX];
     /* socket buffer size */
     int buffer_size;
     /* Filter */
     const char *bpf_filter;
+    int ebpf_filter_fd;
+
+    /* flow tables of the eBPF/XDP bypass */
+    int v4_map_fd;
+    int v6_map_fd;
 
     int promisc;
 
@@ -277,6 +288,7 @@ TmEcode DecodeAFPThreadDeinit(ThreadVars *tv, void *data);
 TmEcode DecodeAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
 TmEcode AFPSetBPFFilter(AFPThreadVars *ptv);
+static void AFPSetBypassCallback(AFPThreadVars *ptv, Packet *p);
 static int AFPGetIfnumByDev(int fd, const char *ifname, int verbose);
 static int AFPGetDevFlags(int fd, const char *ifname);
 static int AFPDerefSocket(AFPPeer* peer);
@@ -541,6 +553,98 @@ static inline void AFPDumpCounters(AFPThreadVars *ptv)
 #endif
 }
 
+#ifdef HAVE_PACKET_EBPF
+/**
+ * \brief Bypass callback of the eBPF and XDP filters
+ *
+ * Adds both directions of the flow to the flow tables of the kernel
+ * program so that the following packets of the flow are dropped before
+ * reaching the socket. The keys use host byte order like the filters.
+ *
+ * \retval 1 if the flow is bypassed, 0 if not
+ */
+static int AFPBypassCallback(Packet *p)
+{
+    /* tunnels are not decoded by the kernel programs */
+    if (IS_TUNNEL_PKT(p)) {
+        return 0;
+    }
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    if (PKT_IS_IPV4(p)) {
+        struct flowv4_keys key;
+        memset(&key, 0, sizeof(key));
+        if (p->afp_v.v4_map_fd == -1) {
+            return 0;
+        }
+        key.src = ntohl(GET_IPV4_SRC_ADDR_U32(p));
+        key.dst = ntohl(GET_IPV4_DST_ADDR_U32(p));
+        key.sp = p->sp;
+        key.dp = p->dp;
+        key.ip_proto = IPV4_GET_IPPROTO(p);
+        if (EBPFCreateFlowForKey(p->afp_v.v4_map_fd, &key) != 0) {
+            return 0;
+        }
+        struct flowv4_keys rkey = key;
+        rkey.src = key.dst;
+        rkey.dst = key.src;
+        rkey.sp = key.dp;
+        rkey.dp = key.sp;
+        if (EBPFCreateFlowForKey(p->afp_v.v4_map_fd, &rkey) != 0) {
+            /* don't leave a half bypassed flow behind */
+            EBPFDeleteKey(p->afp_v.v4_map_fd, &key);
+            return 0;
+        }
+        return 1;
+    }
+    if (PKT_IS_IPV6(p)) {
+        struct flowv6_keys key;
+        int i;
+        memset(&key, 0, sizeof(key));
+        if (p->afp_v.v6_map_fd == -1) {
+            return 0;
+        }
+        for (i = 0; i < 4; i++) {
+            key.src[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
+            key.dst[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
+        }
+        key.sp = p->sp;
+        key.dp = p->dp;
+        key.ip_proto = IPV6_GET_L4PROTO(p);
+        if (EBPFCreateFlowForKey(p->afp_v.v6_map_fd, &key) != 0) {
+            return 0;
+        }
+        struct flowv6_keys rkey = key;
+        for (i = 0; i < 4; i++) {
+            rkey.src[i] = key.dst[i];
+            rkey.dst[i] = key.src[i];
+        }
+        rkey.sp = key.dp;
+        rkey.dp = key.sp;
+        if (EBPFCreateFlowForKey(p->afp_v.v6_map_fd, &rkey) != 0) {
+            /* don't leave a half bypassed flow behind */
+            EBPFDeleteKey(p->afp_v.v6_map_fd, &key);
+            return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+static void AFPSetBypassCallback(AFPThreadVars *ptv, Packet *p)
+{
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
+        p->BypassPacketsFlow = AFPBypassCallback;
+        p->afp_v.v4_map_fd = ptv->v4_map_fd;
+        p->afp_v.v6_map_fd = ptv->v6_map_fd;
+    }
+#endif
+}
+
 /**
  * \brief AF packet read function.
  *
@@ -605,6 +709,7 @@ static int AFPRead(AFPThreadVars *ptv)
 
     ptv->pkts++;
     p->livedev = ptv->livedev;
+    AFPSetBypassCallback(ptv, p);
 
     /* add forged header */
     if (ptv->cooked) {
@@ -872,6 +977,7 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
         ptv->pkts++;
         p->livedev = ptv->livedev;
         p->datalink = ptv->datalink;
+        AFPSetBypassCallback(ptv, p);
 
         if (h.h2->tp_len > h.h2->tp_snaplen) {
             SCLogDebug("Packet length (%d) > snaplen (%d), truncating",
@@ -979,6 +1085,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     ptv->pkts++;
     p->livedev = ptv->livedev;
     p->datalink = ptv->datalink;
+    AFPSetBypassCallback(ptv, p);
 
     if ((!(ptv->flags & AFP_VLAN_DISABLED)) &&
             (ppd->tp_status & TP_STATUS_VLAN_VALID || ppd->hv1.tp_vlan_tci)) {
@@ -1033,6 +1140,11 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         }
     }
 
+    if (ptv->batch_size > 1) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        SCReturnInt(AFP_READ_OK);
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ptv->tv, p);
         SCReturnInt(AFP_FAILURE);
@@ -1041,6 +1153,23 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCReturnInt(AFP_READ_OK);
 }
 
+/** \brief pass the batched packets to the slots
+ *
+ *  Must be called before the block the packets point into is released.
+ */
+static inline int AFPFlushBatch(AFPThreadVars *ptv)
+{
+    if (ptv->batch_cnt == 0)
+        return AFP_READ_OK;
+
+    uint32_t cnt = ptv->batch_cnt;
+    ptv->batch_cnt = 0;
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+        return AFP_FAILURE;
+    }
+    return AFP_READ_OK;
+}
+
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
@@ -1050,11 +1179,22 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
     for (i = 0; i < num_pkts; ++i) {
         if (unlikely(AFPParsePacketV3(ptv, pbd,
                              (struct tpacket3_hdr *)ppd) == AFP_FAILURE)) {
+            (void)AFPFlushBatch(ptv);
             SCReturnInt(AFP_READ_FAILURE);
         }
+        if (ptv->batch_cnt == ptv->batch_size) {
+            if (unlikely(AFPFlushBatch(ptv) == AFP_FAILURE)) {
+                SCReturnInt(AFP_READ_FAILURE);
+            }
+        }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
     }
 
+    /* the block is released after this, so process what we have */
+    if (unlikely(AFPFlushBatch(ptv) == AFP_FAILURE)) {
+        SCReturnInt(AFP_READ_FAILURE);
+    }
+
     SCReturnInt(AFP_READ_OK);
 }
 #endif /* HAVE_TPACKET_V3 */
@@ -2048,6 +2188,17 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         goto frame_err;
     }
 
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->ebpf_filter_fd != -1) {
+        if (setsockopt(ptv->socket, SOL_SOCKET, SO_ATTACH_BPF,
+                       &ptv->ebpf_filter_fd, sizeof(ptv->ebpf_filter_fd)) != 0) {
+            SCLogError(SC_ERR_AFP_CREATE, "Failed to attach eBPF filter: %s",
+                       strerror(errno));
+            goto frame_err;
+        }
+    }
+#endif
+
     /* Init is ok */
     AFPSwitchState(ptv, AFP_STATE_UP);
     return 0;
@@ -2155,10 +2306,21 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
     ptv->block_size = afpconfig->block_size;
+    ptv->batch_size = 1;
+#ifdef HAVE_TPACKET_V3
+    if (afpconfig->batch_size > 1 && (afpconfig->flags & AFP_TPACKET_V3)) {
+        ptv->batch_size = (uint32_t)afpconfig->batch_size;
+        if (ptv->batch_size > (uint32_t)max_pending_packets)
+            ptv->batch_size = (uint32_t)max_pending_packets;
+    }
+#endif
 
     ptv->promisc = afpconfig->promisc;
     ptv->checksum_mode = afpconfig->checksum_mode;
     ptv->bpf_filter = NULL;
+    ptv->ebpf_filter_fd = -1;
+    ptv->v4_map_fd = -1;
+    ptv->v6_map_fd = -1;
 
     ptv->threads = 1;
 #ifdef HAVE_PACKET_FANOUT
@@ -2177,6 +2339,19 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
         ptv->bpf_filter = afpconfig->bpf_filter;
     }
 
+#ifdef HAVE_PACKET_EBPF
+    ptv->ebpf_filter_fd = afpconfig->ebpf_filter_fd;
+    if (ptv->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
+        ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, EBPF_FLOW_TABLE_V4);
+        ptv->v6_map_fd = EBPFGetMapFDByName(ptv->iface, EBPF_FLOW_TABLE_V6);
+        if (ptv->v4_map_fd == -1 || ptv->v6_map_fd == -1) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "%s: flow tables not found in "
+                         "the eBPF/XDP program, disabling bypass", ptv->iface);
+            ptv->flags &= ~(AFP_BYPASS|AFP_XDPBYPASS);
+        }
+    }
+#endif
+
 #ifdef PACKET_STATISTICS
     ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
             ptv->tv);
@@ -2212,6 +2387,19 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->datalen = T_DATA_SIZE;
 #undef T_DATA_SIZE
 
+    /* with a single interface in IDS mode, flow hash fanout makes sure
+     * all packets of a flow come in through the same socket. Without the
+     * defrag flag, fragments are hashed on their addresses only and can
+     * reach another socket than the rest of their flow. */
+    if (LiveGetDeviceCount() == 1 && ptv->copy_mode == AFP_COPY_MODE_NONE &&
+            ptv->cluster_type == (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG)) {
+        tv->flow_affinity = 1;
+    } else if (flow_config.thread_partitions) {
+        SCLogConfig("AF_PACKET %s: flow affinity needs a single interface "
+                "in IDS mode with cluster_flow and defrag, using the shared "
+                "flow hash", ptv->iface);
+    }
+
     *data = (void *)ptv;
 
     afpconfig->DerefFunc(afpconfig);
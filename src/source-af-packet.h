@@ -51,6 +51,8 @@
 #define AFP_TPACKET_V3 (1<<4)
 #define AFP_VLAN_DISABLED (1<<5)
 #define AFP_MMAP_LOCKED (1<<6)
+#define AFP_BYPASS   (1<<7)
+#define AFP_XDPBYPASS   (1<<8)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
@@ -78,6 +80,8 @@ typedef struct AFPIfaceConfig_
     int block_size;
     /* block timeout for tpacket_v3 in milliseconds */
     int block_timeout;
+    /* number of packets passed to the slots at once for tpacket_v3 */
+    int batch_size;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -88,6 +92,11 @@ typedef struct AFPIfaceConfig_
     int copy_mode;
     ChecksumValidationMode checksum_mode;
     const char *bpf_filter;
+    const char *ebpf_filter_file;
+    int ebpf_filter_fd;
+    const char *xdp_filter_file;
+    int xdp_filter_fd;
+    uint8_t xdp_mode;
     const char *out_iface;
     SC_ATOMIC_DECLARE(unsigned int, ref);
     void (*DerefFunc)(void *);
@@ -126,14 +135,30 @@ typedef struct AFPPacketVars_
      */
     AFPPeer *mpeer;
     uint8_t copy_mode;
+#ifdef HAVE_PACKET_EBPF
+    /** fds of the flow tables used to bypass the flow */
+    int v4_map_fd;
+    int v6_map_fd;
+#endif
 } AFPPacketVars;
 
+#ifdef HAVE_PACKET_EBPF
 #define AFPV_CLEANUP(afpv) do {           \
     (afpv)->relptr = NULL;                \
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
+    (afpv)->v4_map_fd = -1;               \
+    (afpv)->v6_map_fd = -1;               \
 } while(0)
+#else
+#define AFPV_CLEANUP(afpv) do {           \
+    (afpv)->relptr = NULL;                \
+    (afpv)->copy_mode = 0;                \
+    (afpv)->peer = NULL;                  \
+    (afpv)->mpeer = NULL;                 \
+} while(0)
+#endif
 
 /**
  * @}
@@ -0,0 +1,1053 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * pcap and pcapng file reader that does not use libpcap.
+ *
+ * Regular files are mmap'd and the packets point into the mapping, so
+ * they don't have to be copied. The mapping is reference counted by the
+ * packets and only unmapped once the last one is released. The kernel is
+ * asked to read ahead of the current position with madvise.
+ *
+ * Gzip compressed files, or files that can't be mapped, are read through
+ * zlib by a decompressor thread that fills a small ring of chunks. The
+ * packets are then copied out of the chunks.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "threads.h"
+#include "source-pcap-file-native.h"
+#include "util-atomic.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-error.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#include <sys/mman.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_HDR_LEN            24
+#define PCAP_REC_LEN            16
+
+#define PCAPNG_BLOCK_SHB        0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB        0x00000001
+#define PCAPNG_BLOCK_SPB        0x00000003
+#define PCAPNG_BLOCK_EPB        0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL   9
+/** largest block we accept, anything larger means the file is corrupt */
+#define PCAPNG_MAX_BLOCK_LEN    (16 * 1024 * 1024)
+
+/** largest caplen we accept, same as libpcap */
+#define PCAP_NATIVE_MAX_CAPLEN  262144
+
+#define PCAP_NATIVE_CHUNK_SIZE  (1024 * 1024)
+#define PCAP_NATIVE_CHUNKS      4
+
+typedef struct PcapNativeIface_ {
+    int datalink;
+    uint32_t snaplen;
+    /** timestamp units per second */
+    uint64_t units;
+} PcapNativeIface;
+
+#ifdef HAVE_LIBZ
+typedef struct PcapNativeChunk_ {
+    uint8_t *data;
+    uint32_t len;
+} PcapNativeChunk;
+#endif
+
+struct PcapNative_ {
+    /** packets pointing into the mapping, plus one for the reader */
+    SC_ATOMIC_DECLARE(uint32_t, refcnt);
+
+    /* mmap mode */
+    uint8_t *map;
+    size_t map_len;
+    size_t offset;
+    int unmap;
+    size_t readahead;
+    size_t readahead_off;
+
+#ifdef HAVE_LIBZ
+    /* stream mode: ring of chunks filled by the decompressor thread */
+    gzFile gz;
+    pthread_t thread;
+    int thread_running;
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;
+    PcapNativeChunk chunks[PCAP_NATIVE_CHUNKS];
+    uint32_t chunk_prod;
+    uint32_t chunk_cons;
+    uint32_t chunk_cnt;
+    int eof;
+    int stop;
+    int gz_error;
+    /** chunk being read, owned by the reader until the next one is taken */
+    PcapNativeChunk *cur;
+    uint32_t cur_off;
+    /** records that span chunks are put together here */
+    uint8_t *buf;
+    uint32_t buf_size;
+#endif
+
+    /* file format */
+    int pcapng;
+    /** type of the first section header block already read */
+    int shb_read;
+    int swapped;
+    int nsec;
+    int datalink;
+    PcapNativeIface *ifaces;
+    uint32_t ifaces_cnt;
+    struct timeval last_ts;
+
+    int truncated;
+    int error;
+    char errbuf[256];
+};
+
+static inline uint16_t PcapNativeU16(const PcapNative *pn, const uint8_t *ptr)
+{
+    uint16_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return pn->swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t PcapNativeU32(const PcapNative *pn, const uint8_t *ptr)
+{
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return pn->swapped ? SCByteSwap32(v) : v;
+}
+
+static int PcapNativeSetError(PcapNative *pn, const char *msg)
+{
+    snprintf(pn->errbuf, sizeof(pn->errbuf), "%s", msg);
+    pn->error = 1;
+    return -1;
+}
+
+static void PcapNativeReadahead(PcapNative *pn)
+{
+    /* advise the next window once we're half way into the current one */
+    if (pn->readahead == 0 ||
+            pn->offset + pn->readahead / 2 < pn->readahead_off ||
+            pn->readahead_off >= pn->map_len)
+        return;
+
+    size_t len = pn->readahead;
+    if (len > pn->map_len - pn->readahead_off)
+        len = pn->map_len - pn->readahead_off;
+    (void)madvise(pn->map + pn->readahead_off, len, MADV_WILLNEED);
+    pn->readahead_off += len;
+}
+
+#ifdef HAVE_LIBZ
+static void *PcapNativeDecompressThread(void *arg)
+{
+    PcapNative *pn = (PcapNative *)arg;
+
+    /* block usr2.  usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName("PcapInflate") < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (1) {
+        SCCtrlMutexLock(&pn->mutex);
+        while (pn->chunk_cnt == PCAP_NATIVE_CHUNKS && !pn->stop)
+            SCCtrlCondWait(&pn->cond, &pn->mutex);
+        if (pn->stop) {
+            SCCtrlMutexUnlock(&pn->mutex);
+            break;
+        }
+        PcapNativeChunk *c = &pn->chunks[pn->chunk_prod];
+        SCCtrlMutexUnlock(&pn->mutex);
+
+        /* the chunk is ours until it's handed to the reader */
+        int r = gzread(pn->gz, c->data, PCAP_NATIVE_CHUNK_SIZE);
+
+        SCCtrlMutexLock(&pn->mutex);
+        if (r <= 0) {
+            if (r < 0)
+                pn->gz_error = 1;
+            pn->eof = 1;
+            SCCtrlCondBroadcast(&pn->cond);
+            SCCtrlMutexUnlock(&pn->mutex);
+            break;
+        }
+        c->len = (uint32_t)r;
+        pn->chunk_prod = (pn->chunk_prod + 1) % PCAP_NATIVE_CHUNKS;
+        pn->chunk_cnt++;
+        SCCtrlCondBroadcast(&pn->cond);
+        SCCtrlMutexUnlock(&pn->mutex);
+    }
+    return NULL;
+}
+
+/** \brief give the current chunk back and wait for the next one */
+static PcapNativeChunk *PcapNativeNextChunk(PcapNative *pn)
+{
+    SCCtrlMutexLock(&pn->mutex);
+    if (pn->cur != NULL) {
+        pn->chunk_cons = (pn->chunk_cons + 1) % PCAP_NATIVE_CHUNKS;
+        pn->chunk_cnt--;
+        pn->cur = NULL;
+        SCCtrlCondBroadcast(&pn->cond);
+    }
+    while (pn->chunk_cnt == 0 && !pn->eof)
+        SCCtrlCondWait(&pn->cond, &pn->mutex);
+    if (pn->chunk_cnt > 0) {
+        pn->cur = &pn->chunks[pn->chunk_cons];
+        pn->cur_off = 0;
+    }
+    SCCtrlMutexUnlock(&pn->mutex);
+    return pn->cur;
+}
+
+static const uint8_t *PcapNativeStreamRead(PcapNative *pn, uint32_t len)
+{
+    if (pn->cur == NULL || pn->cur_off == pn->cur->len) {
+        if (PcapNativeNextChunk(pn) == NULL)
+            return NULL;
+    }
+    if (pn->cur->len - pn->cur_off >= len) {
+        const uint8_t *ptr = pn->cur->data + pn->cur_off;
+        pn->cur_off += len;
+        return ptr;
+    }
+
+    /* the record spans chunks */
+    if (len > pn->buf_size) {
+        uint8_t *buf = SCRealloc(pn->buf, len);
+        if (unlikely(buf == NULL)) {
+            PcapNativeSetError(pn, "out of memory");
+            return NULL;
+        }
+        pn->buf = buf;
+        pn->buf_size = len;
+    }
+    uint32_t copied = 0;
+    while (copied < len) {
+        if (pn->cur_off == pn->cur->len && PcapNativeNextChunk(pn) == NULL) {
+            pn->truncated = 1;
+            return NULL;
+        }
+        uint32_t c = MIN(len - copied, pn->cur->len - pn->cur_off);
+        memcpy(pn->buf + copied, pn->cur->data + pn->cur_off, c);
+        pn->cur_off += c;
+        copied += c;
+    }
+    return pn->buf;
+}
+#endif /* HAVE_LIBZ */
+
+/**
+ * \brief get the next len bytes of the file
+ *
+ * In stream mode the pointer is only valid until the next call.
+ *
+ * \retval ptr or NULL at the end of the file
+ */
+static const uint8_t *PcapNativeRead(PcapNative *pn, uint32_t len)
+{
+    if (pn->map != NULL) {
+        if (pn->map_len - pn->offset < len) {
+            if (pn->map_len != pn->offset)
+                pn->truncated = 1;
+            return NULL;
+        }
+        const uint8_t *ptr = pn->map + pn->offset;
+        pn->offset += len;
+        PcapNativeReadahead(pn);
+        return ptr;
+    }
+#ifdef HAVE_LIBZ
+    return PcapNativeStreamRead(pn, len);
+#else
+    return NULL;
+#endif
+}
+
+/** \brief end of the data, check why */
+static int PcapNativeEnd(PcapNative *pn)
+{
+    if (pn->error)
+        return -1;
+    if (pn->truncated)
+        return PcapNativeSetError(pn, "truncated dump file");
+#ifdef HAVE_LIBZ
+    if (pn->gz_error) {
+        int err = 0;
+        const char *msg = gzerror(pn->gz, &err);
+        return PcapNativeSetError(pn, msg ? msg : "decompression failed");
+    }
+#endif
+    return 0;
+}
+
+static int PcapNativeReadHeader(PcapNative *pn)
+{
+    const uint8_t *hdr = PcapNativeRead(pn, 4);
+    if (hdr == NULL)
+        return PcapNativeSetError(pn, "file is empty");
+
+    uint32_t magic;
+    memcpy(&magic, hdr, sizeof(magic));
+    if (magic == PCAPNG_BLOCK_SHB) {
+        /* the section header is read as a block by PcapNativeNext */
+        pn->pcapng = 1;
+        pn->shb_read = 1;
+        return 0;
+    }
+
+    if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+        pn->swapped = 0;
+    } else if (SCByteSwap32(magic) == PCAP_MAGIC || SCByteSwap32(magic) == PCAP_MAGIC_NSEC) {
+        pn->swapped = 1;
+        magic = SCByteSwap32(magic);
+    } else {
+        return PcapNativeSetError(pn, "unknown file format");
+    }
+    pn->nsec = (magic == PCAP_MAGIC_NSEC);
+
+    /* version, thiszone, sigfigs, snaplen, network */
+    hdr = PcapNativeRead(pn, PCAP_HDR_LEN - 4);
+    if (hdr == NULL)
+        return PcapNativeSetError(pn, "truncated dump file header");
+    pn->datalink = PcapNativeU32(pn, hdr + 16) & 0xffff;
+    return 0;
+}
+
+static int PcapNativeAddIface(PcapNative *pn, const uint8_t *body, uint32_t len)
+{
+    if (len < 8)
+        return PcapNativeSetError(pn, "invalid interface description block");
+
+    PcapNativeIface *ifaces = SCRealloc(pn->ifaces,
+            (pn->ifaces_cnt + 1) * sizeof(PcapNativeIface));
+    if (unlikely(ifaces == NULL))
+        return PcapNativeSetError(pn, "out of memory");
+    pn->ifaces = ifaces;
+
+    PcapNativeIface *iface = &pn->ifaces[pn->ifaces_cnt++];
+    iface->datalink = PcapNativeU16(pn, body);
+    iface->snaplen = PcapNativeU32(pn, body + 4);
+    iface->units = 1000000;
+
+    uint32_t off = 8;
+    while (off + 4 <= len) {
+        uint16_t code = PcapNativeU16(pn, body + off);
+        uint16_t olen = PcapNativeU16(pn, body + off + 2);
+        off += 4;
+        if (code == 0 || olen > len - off)
+            break;
+        if (code == PCAPNG_OPT_IF_TSRESOL && olen >= 1) {
+            uint8_t v = body[off];
+            if (v & 0x80) {
+                v &= 0x7f;
+                iface->units = (v < 64) ? (1ULL << v) : 0;
+            } else if (v <= 19) {
+                iface->units = 1;
+                while (v--)
+                    iface->units *= 10;
+            } else {
+                iface->units = 0;
+            }
+            if (iface->units == 0)
+                return PcapNativeSetError(pn, "invalid if_tsresol");
+        }
+        off += (olen + 3) & ~3;
+    }
+    return 0;
+}
+
+static void PcapNativeSetTime(struct timeval *tv, uint64_t ts, uint64_t units)
+{
+    uint64_t frac = ts % units;
+    tv->tv_sec = (time_t)(ts / units);
+    if (units == 1000000)
+        tv->tv_usec = (suseconds_t)frac;
+    else if (units < 1000000)
+        /* frac < units, so this can't overflow */
+        tv->tv_usec = (suseconds_t)(frac * 1000000 / units);
+    else if (units % 1000000 == 0)
+        tv->tv_usec = (suseconds_t)(frac / (units / 1000000));
+    else
+        tv->tv_usec = (suseconds_t)((double)frac * 1000000.0 / (double)units);
+}
+
+static int PcapNativeNextNg(PcapNative *pn, struct pcap_pkthdr *h,
+        const uint8_t **data, int *datalink)
+{
+    while (1) {
+        uint32_t type, raw_len;
+
+        /* copy before the next read, in stream mode bh can go away */
+        if (pn->shb_read) {
+            pn->shb_read = 0;
+            const uint8_t *bh = PcapNativeRead(pn, 4);
+            if (bh == NULL) {
+                pn->truncated = 1;
+                return PcapNativeEnd(pn);
+            }
+            type = PCAPNG_BLOCK_SHB;
+            memcpy(&raw_len, bh, sizeof(raw_len));
+        } else {
+            const uint8_t *bh = PcapNativeRead(pn, 8);
+            if (bh == NULL)
+                return PcapNativeEnd(pn);
+            memcpy(&type, bh, sizeof(type));
+            memcpy(&raw_len, bh + 4, sizeof(raw_len));
+        }
+
+        if (type == PCAPNG_BLOCK_SHB) {
+            /* a new section, with its own byte order and interfaces */
+            const uint8_t *bom = PcapNativeRead(pn, 4);
+            if (bom == NULL) {
+                PcapNativeEnd(pn);
+                return PcapNativeSetError(pn, "truncated section header block");
+            }
+            uint32_t magic;
+            memcpy(&magic, bom, sizeof(magic));
+            if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+                pn->swapped = 0;
+            else if (SCByteSwap32(magic) == PCAPNG_BYTE_ORDER_MAGIC)
+                pn->swapped = 1;
+            else
+                return PcapNativeSetError(pn, "invalid section header block");
+
+            uint32_t total = pn->swapped ? SCByteSwap32(raw_len) : raw_len;
+            if (total < 28 || (total % 4) != 0 || total > PCAPNG_MAX_BLOCK_LEN)
+                return PcapNativeSetError(pn, "invalid section header block length");
+            if (PcapNativeRead(pn, total - 12) == NULL) {
+                PcapNativeEnd(pn);
+                return PcapNativeSetError(pn, "truncated section header block");
+            }
+            SCFree(pn->ifaces);
+            pn->ifaces = NULL;
+            pn->ifaces_cnt = 0;
+            continue;
+        }
+
+        uint32_t total = pn->swapped ? SCByteSwap32(raw_len) : raw_len;
+        if (total < 12 || (total % 4) != 0 || total > PCAPNG_MAX_BLOCK_LEN)
+            return PcapNativeSetError(pn, "invalid block length");
+
+        /* body and the trailing block length */
+        const uint8_t *body = PcapNativeRead(pn, total - 8);
+        if (body == NULL) {
+            pn->truncated = 1;
+            return PcapNativeEnd(pn);
+        }
+        uint32_t len = total - 12;
+
+        if (pn->swapped)
+            type = SCByteSwap32(type);
+
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                if (PcapNativeAddIface(pn, body, len) < 0)
+                    return -1;
+                break;
+
+            case PCAPNG_BLOCK_EPB: {
+                if (len < 20)
+                    return PcapNativeSetError(pn, "invalid enhanced packet block");
+                uint32_t ifid = PcapNativeU32(pn, body);
+                if (ifid >= pn->ifaces_cnt)
+                    return PcapNativeSetError(pn, "packet of unknown interface");
+                const PcapNativeIface *iface = &pn->ifaces[ifid];
+                uint64_t ts = ((uint64_t)PcapNativeU32(pn, body + 4) << 32) |
+                    PcapNativeU32(pn, body + 8);
+                uint32_t caplen = PcapNativeU32(pn, body + 12);
+                if (caplen > len - 20 || caplen > PCAP_NATIVE_MAX_CAPLEN)
+                    return PcapNativeSetError(pn, "invalid packet length");
+
+                PcapNativeSetTime(&pn->last_ts, ts, iface->units);
+                h->ts = pn->last_ts;
+                h->caplen = caplen;
+                h->len = PcapNativeU32(pn, body + 16);
+                *data = body + 20;
+                *datalink = iface->datalink;
+                return 1;
+            }
+
+            case PCAPNG_BLOCK_SPB: {
+                if (len < 4 || pn->ifaces_cnt == 0)
+                    return PcapNativeSetError(pn, "invalid simple packet block");
+                const PcapNativeIface *iface = &pn->ifaces[0];
+                uint32_t caplen = PcapNativeU32(pn, body);
+                h->len = caplen;
+                if (caplen > len - 4)
+                    caplen = len - 4;
+                if (iface->snaplen > 0 && caplen > iface->snaplen)
+                    caplen = iface->snaplen;
+                if (caplen > PCAP_NATIVE_MAX_CAPLEN)
+                    return PcapNativeSetError(pn, "invalid packet length");
+
+                /* no timestamp, use the one of the previous packet */
+                h->ts = pn->last_ts;
+                h->caplen = caplen;
+                *data = body + 4;
+                *datalink = iface->datalink;
+                return 1;
+            }
+
+            default:
+                /* statistics, name resolution, ... */
+                break;
+        }
+    }
+}
+
+/**
+ * \brief get the next packet
+ *
+ * \param data set to the packet data. Unless the file is mapped, only
+ *        valid until the next call.
+ * \param datalink set to the link type of the packet, as the LINKTYPE
+ *        value stored in the file
+ *
+ * \retval 1 packet, 0 end of file, -1 error
+ */
+int PcapNativeNext(PcapNative *pn, struct pcap_pkthdr *h,
+        const uint8_t **data, int *datalink)
+{
+    if (unlikely(pn->error))
+        return -1;
+    if (pn->pcapng)
+        return PcapNativeNextNg(pn, h, data, datalink);
+
+    const uint8_t *rec = PcapNativeRead(pn, PCAP_REC_LEN);
+    if (rec == NULL)
+        return PcapNativeEnd(pn);
+
+    uint32_t sec = PcapNativeU32(pn, rec);
+    uint32_t frac = PcapNativeU32(pn, rec + 4);
+    uint32_t caplen = PcapNativeU32(pn, rec + 8);
+    uint32_t len = PcapNativeU32(pn, rec + 12);
+    if (caplen > PCAP_NATIVE_MAX_CAPLEN)
+        return PcapNativeSetError(pn, "invalid packet length");
+
+    const uint8_t *pkt = PcapNativeRead(pn, caplen);
+    if (pkt == NULL) {
+        pn->truncated = 1;
+        return PcapNativeEnd(pn);
+    }
+
+    h->ts.tv_sec = sec;
+    h->ts.tv_usec = pn->nsec ? frac / 1000 : frac;
+    h->caplen = caplen;
+    h->len = len;
+    *data = pkt;
+    *datalink = pn->datalink;
+    return 1;
+}
+
+/** \brief packets point into the file mapping */
+int PcapNativeIsMapped(const PcapNative *pn)
+{
+    return pn->map != NULL;
+}
+
+const char *PcapNativeGetError(const PcapNative *pn)
+{
+    return pn->errbuf;
+}
+
+static PcapNative *PcapNativeAlloc(void)
+{
+    PcapNative *pn = SCMalloc(sizeof(PcapNative));
+    if (unlikely(pn == NULL))
+        return NULL;
+    memset(pn, 0, sizeof(PcapNative));
+    SC_ATOMIC_INIT(pn->refcnt);
+    SC_ATOMIC_SET(pn->refcnt, 1);
+    return pn;
+}
+
+static void PcapNativeFree(PcapNative *pn)
+{
+    if (pn->unmap)
+        munmap(pn->map, pn->map_len);
+    SC_ATOMIC_DESTROY(pn->refcnt);
+    SCFree(pn);
+}
+
+void PcapNativeRef(PcapNative *pn)
+{
+    (void)SC_ATOMIC_ADD(pn->refcnt, 1);
+}
+
+/** \brief drop a reference, the last one unmaps the file */
+void PcapNativeRelease(PcapNative *pn)
+{
+    if (SC_ATOMIC_SUB(pn->refcnt, 1) == 0)
+        PcapNativeFree(pn);
+}
+
+static int PcapNativeMap(PcapNative *pn, int fd, size_t len, uint64_t readahead)
+{
+    /* private and writable, so a decoder writing to the packet doesn't
+     * fault. Pages are only copied if that really happens. */
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    pn->map = map;
+    pn->map_len = len;
+    pn->unmap = 1;
+    (void)madvise(pn->map, pn->map_len, MADV_SEQUENTIAL);
+
+    if (readahead > 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        if (page <= 0)
+            page = 4096;
+        pn->readahead = (size_t)((readahead + page - 1) / page * page);
+        PcapNativeReadahead(pn);
+    }
+    return 0;
+}
+
+#ifdef HAVE_LIBZ
+static int PcapNativeStreamInit(PcapNative *pn, int fd)
+{
+    uint32_t i;
+
+    pn->gz = gzdopen(fd, "rb");
+    if (pn->gz == NULL)
+        return -1;
+    for (i = 0; i < PCAP_NATIVE_CHUNKS; i++) {
+        pn->chunks[i].data = SCMalloc(PCAP_NATIVE_CHUNK_SIZE);
+        if (unlikely(pn->chunks[i].data == NULL))
+            return -1;
+    }
+    SCCtrlMutexInit(&pn->mutex, NULL);
+    SCCtrlCondInit(&pn->cond, NULL);
+
+    int rc = pthread_create(&pn->thread, NULL, PcapNativeDecompressThread, pn);
+    if (rc != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create pcap "
+                "decompressor thread: %s", strerror(rc));
+        return -1;
+    }
+    pn->thread_running = 1;
+    return 0;
+}
+
+static void PcapNativeStreamDeinit(PcapNative *pn)
+{
+    uint32_t i;
+
+    if (pn->thread_running) {
+        SCCtrlMutexLock(&pn->mutex);
+        pn->stop = 1;
+        SCCtrlCondBroadcast(&pn->cond);
+        SCCtrlMutexUnlock(&pn->mutex);
+        pthread_join(pn->thread, NULL);
+        pn->thread_running = 0;
+        SCCtrlMutexDestroy(&pn->mutex);
+        SCCtrlCondDestroy(&pn->cond);
+    }
+    if (pn->gz != NULL) {
+        gzclose(pn->gz);
+        pn->gz = NULL;
+    }
+    for (i = 0; i < PCAP_NATIVE_CHUNKS; i++) {
+        if (pn->chunks[i].data != NULL) {
+            SCFree(pn->chunks[i].data);
+            pn->chunks[i].data = NULL;
+        }
+    }
+    if (pn->buf != NULL) {
+        SCFree(pn->buf);
+        pn->buf = NULL;
+    }
+}
+#endif /* HAVE_LIBZ */
+
+/**
+ * \brief open a pcap or pcapng file
+ *
+ * \param readahead bytes to read ahead of the current position when the
+ *        file is mapped, 0 to leave it to the kernel
+ *
+ * \retval pn reader or NULL on error
+ */
+PcapNative *PcapNativeOpen(const char *filename, uint64_t readahead)
+{
+    uint8_t magic[2] = { 0, 0 };
+    struct stat st;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SCLogError(SC_ERR_FOPEN, "%s: %s", filename, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        SCLogError(SC_ERR_FOPEN, "%s: %s", filename, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    PcapNative *pn = PcapNativeAlloc();
+    if (unlikely(pn == NULL)) {
+        close(fd);
+        return NULL;
+    }
+
+    int compressed = 0;
+    if (S_ISREG(st.st_mode) && pread(fd, magic, sizeof(magic), 0) == sizeof(magic))
+        compressed = (magic[0] == 0x1f && magic[1] == 0x8b);
+
+    if (S_ISREG(st.st_mode) && !compressed && st.st_size > 0 &&
+            (uint64_t)st.st_size <= SIZE_MAX &&
+            PcapNativeMap(pn, fd, (size_t)st.st_size, readahead) == 0) {
+        /* the mapping keeps the file */
+        close(fd);
+    } else {
+#ifdef HAVE_LIBZ
+        SCLogDebug("%s: reading through the decompressor thread", filename);
+        if (PcapNativeStreamInit(pn, fd) != 0) {
+            SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "%s: can't set up the "
+                    "decompressor", filename);
+            if (pn->gz == NULL)
+                close(fd);
+            PcapNativeClose(pn);
+            return NULL;
+        }
+#else
+        SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "%s: %s", filename, compressed ?
+                "compressed files need zlib support" : "can't map the file");
+        close(fd);
+        PcapNativeClose(pn);
+        return NULL;
+#endif
+    }
+
+    if (PcapNativeReadHeader(pn) != 0) {
+        SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "%s: %s", filename, pn->errbuf);
+        PcapNativeClose(pn);
+        return NULL;
+    }
+    return pn;
+}
+
+/**
+ * \brief close the reader
+ *
+ * The mapping stays until the last packet pointing into it is released.
+ */
+void PcapNativeClose(PcapNative *pn)
+{
+#ifdef HAVE_LIBZ
+    PcapNativeStreamDeinit(pn);
+#endif
+    if (pn->ifaces != NULL) {
+        SCFree(pn->ifaces);
+        pn->ifaces = NULL;
+    }
+    PcapNativeRelease(pn);
+}
+
+#ifdef UNITTESTS
+static PcapNative *PcapNativeTestOpen(uint8_t *buf, size_t len)
+{
+    PcapNative *pn = PcapNativeAlloc();
+    if (pn == NULL)
+        return NULL;
+    pn->map = buf;
+    pn->map_len = len;
+    if (PcapNativeReadHeader(pn) != 0) {
+        PcapNativeClose(pn);
+        return NULL;
+    }
+    return pn;
+}
+
+/** \test little endian pcap, 2 packets */
+static int PcapNativeTest01(void)
+{
+    uint8_t buf[] = {
+        0xd4, 0xc3, 0xb2, 0xa1, 0x02, 0x00, 0x04, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+        /* packet 1: ts 1.000002, 4 bytes of 8 */
+        0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+        0x04, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+        0xaa, 0xbb, 0xcc, 0xdd,
+        /* packet 2: ts 2.000000, 2 bytes */
+        0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+        0x11, 0x22,
+    };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    PcapNative *pn = PcapNativeTestOpen(buf, sizeof(buf));
+    FAIL_IF_NULL(pn);
+    FAIL_IF_NOT(PcapNativeIsMapped(pn));
+
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 1);
+    FAIL_IF_NOT(datalink == 1);
+    FAIL_IF_NOT(h.ts.tv_sec == 1 && h.ts.tv_usec == 2);
+    FAIL_IF_NOT(h.caplen == 4 && h.len == 8);
+    FAIL_IF_NOT(data == buf + 40);
+
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 1);
+    FAIL_IF_NOT(h.ts.tv_sec == 2 && h.caplen == 2);
+    FAIL_IF_NOT(data[0] == 0x11 && data[1] == 0x22);
+
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 0);
+    PcapNativeClose(pn);
+    PASS;
+}
+
+/** \test truncated packet is an error */
+static int PcapNativeTest02(void)
+{
+    uint8_t buf[] = {
+        0xa1, 0xb2, 0x3c, 0x4d, 0x00, 0x02, 0x00, 0x04,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x65,
+        /* big endian, nsec: ts 1.000005000, 4 bytes but only 2 there */
+        0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x13, 0x88,
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04,
+        0xaa, 0xbb,
+    };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    PcapNative *pn = PcapNativeTestOpen(buf, sizeof(buf));
+    FAIL_IF_NULL(pn);
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == -1);
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == -1);
+    PcapNativeClose(pn);
+    PASS;
+}
+
+/** \test pcapng with a nanosecond interface and an unknown block */
+static int PcapNativeTest03(void)
+{
+    uint8_t buf[] = {
+        /* SHB, 28 bytes */
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        /* IDB, ethernet, if_tsresol 9, 32 bytes */
+        0x01, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00,
+        0x09, 0x00, 0x01, 0x00, 0x09, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        /* unknown block, 12 bytes */
+        0x99, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00,
+        0x0c, 0x00, 0x00, 0x00,
+        /* EPB, ts 3000000007000 ns, 3 bytes padded to 4, 36 bytes */
+        0x06, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0xba, 0x02, 0x00, 0x00,
+        0x58, 0x4b, 0xef, 0x7d, 0x03, 0x00, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x00,
+        0x24, 0x00, 0x00, 0x00,
+    };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    PcapNative *pn = PcapNativeTestOpen(buf, sizeof(buf));
+    FAIL_IF_NULL(pn);
+
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 1);
+    FAIL_IF_NOT(datalink == 1);
+    FAIL_IF_NOT(h.ts.tv_sec == 3000 && h.ts.tv_usec == 7);
+    FAIL_IF_NOT(h.caplen == 3 && h.len == 3);
+    FAIL_IF_NOT(data[0] == 0x01 && data[2] == 0x03);
+
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 0);
+    PcapNativeClose(pn);
+    PASS;
+}
+
+/** \test packet of an interface that wasn't described */
+static int PcapNativeTest04(void)
+{
+    uint8_t buf[] = {
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        0x06, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+    };
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    PcapNative *pn = PcapNativeTestOpen(buf, sizeof(buf));
+    FAIL_IF_NULL(pn);
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == -1);
+    PcapNativeClose(pn);
+    PASS;
+}
+
+#ifdef HAVE_LIBZ
+/** caplen of the packets in the gzip tests, so that records span chunks */
+#define PCAP_NATIVE_TEST_CAPLEN 65000
+
+/**
+ * \brief write a gzip compressed pcap to a temp file
+ *
+ * Packet i has caplen PCAP_NATIVE_TEST_CAPLEN, timestamp i.i and all its
+ * bytes set to i. The last packet is cut short by cut bytes.
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int PcapNativeTestWriteGz(char *path, uint32_t pkts, uint32_t cut)
+{
+    /* written in host order, the reader handles both */
+    const uint32_t magic = PCAP_MAGIC, snaplen = 65535, linktype = 1;
+    const uint16_t major = 2, minor = 4;
+    uint8_t hdr[PCAP_HDR_LEN];
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, &magic, 4);
+    memcpy(hdr + 4, &major, 2);
+    memcpy(hdr + 6, &minor, 2);
+    memcpy(hdr + 16, &snaplen, 4);
+    memcpy(hdr + 20, &linktype, 4);
+
+    uint8_t *pkt = SCMalloc(PCAP_NATIVE_TEST_CAPLEN);
+    if (pkt == NULL)
+        return -1;
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        SCFree(pkt);
+        return -1;
+    }
+    gzFile gz = gzdopen(fd, "wb");
+    if (gz == NULL) {
+        close(fd);
+        unlink(path);
+        SCFree(pkt);
+        return -1;
+    }
+
+    int r = (gzwrite(gz, hdr, sizeof(hdr)) == (int)sizeof(hdr)) ? 0 : -1;
+    for (uint32_t i = 0; r == 0 && i < pkts; i++) {
+        uint32_t rec[4] = { i, i, PCAP_NATIVE_TEST_CAPLEN, PCAP_NATIVE_TEST_CAPLEN };
+        uint32_t len = PCAP_NATIVE_TEST_CAPLEN;
+        if (i == pkts - 1)
+            len -= cut;
+        memset(pkt, (int)(i & 0xff), len);
+        if (gzwrite(gz, rec, sizeof(rec)) != (int)sizeof(rec) ||
+                (len > 0 && gzwrite(gz, pkt, len) != (int)len))
+            r = -1;
+    }
+    if (gzclose(gz) != Z_OK)
+        r = -1;
+    SCFree(pkt);
+    if (r != 0)
+        unlink(path);
+    return r;
+}
+
+/** \test gzip compressed pcap read through the decompressor thread, with
+ *        records spanning the chunks */
+static int PcapNativeTest05(void)
+{
+    char path[] = "/tmp/suricata-pcap-native-XXXXXX";
+    const uint32_t pkts = 3 * PCAP_NATIVE_CHUNK_SIZE / PCAP_NATIVE_TEST_CAPLEN;
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    FAIL_IF(PcapNativeTestWriteGz(path, pkts, 0) != 0);
+    PcapNative *pn = PcapNativeOpen(path, 0);
+    unlink(path);
+    FAIL_IF_NULL(pn);
+    FAIL_IF(PcapNativeIsMapped(pn));
+
+    for (uint32_t i = 0; i < pkts; i++) {
+        FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 1);
+        FAIL_IF_NOT(datalink == 1);
+        FAIL_IF_NOT((uint32_t)h.ts.tv_sec == i && (uint32_t)h.ts.tv_usec == i);
+        FAIL_IF_NOT(h.caplen == PCAP_NATIVE_TEST_CAPLEN);
+        FAIL_IF_NOT(data[0] == (i & 0xff));
+        FAIL_IF_NOT(data[PCAP_NATIVE_TEST_CAPLEN / 2] == (i & 0xff));
+        FAIL_IF_NOT(data[PCAP_NATIVE_TEST_CAPLEN - 1] == (i & 0xff));
+    }
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 0);
+    PcapNativeClose(pn);
+    PASS;
+}
+
+/** \test gzip compressed pcap ending inside a record */
+static int PcapNativeTest06(void)
+{
+    char path[] = "/tmp/suricata-pcap-native-XXXXXX";
+    const uint32_t pkts = PCAP_NATIVE_CHUNK_SIZE / PCAP_NATIVE_TEST_CAPLEN + 2;
+    struct pcap_pkthdr h;
+    const uint8_t *data = NULL;
+    int datalink = 0;
+
+    FAIL_IF(PcapNativeTestWriteGz(path, pkts, 100) != 0);
+    PcapNative *pn = PcapNativeOpen(path, 0);
+    unlink(path);
+    FAIL_IF_NULL(pn);
+
+    for (uint32_t i = 0; i < pkts - 1; i++) {
+        FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == 1);
+        FAIL_IF_NOT(data[PCAP_NATIVE_TEST_CAPLEN - 1] == (i & 0xff));
+    }
+    FAIL_IF_NOT(PcapNativeNext(pn, &h, &data, &datalink) == -1);
+    FAIL_IF_NOT(strcmp(PcapNativeGetError(pn), "truncated dump file") == 0);
+    PcapNativeClose(pn);
+    PASS;
+}
+#endif /* HAVE_LIBZ */
+#endif /* UNITTESTS */
+
+void PcapNativeRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapNativeTest01", PcapNativeTest01);
+    UtRegisterTest("PcapNativeTest02", PcapNativeTest02);
+    UtRegisterTest("PcapNativeTest03", PcapNativeTest03);
+    UtRegisterTest("PcapNativeTest04", PcapNativeTest04);
+#ifdef HAVE_LIBZ
+    UtRegisterTest("PcapNativeTest05", PcapNativeTest05);
+    UtRegisterTest("PcapNativeTest06", PcapNativeTest06);
+#endif
+#endif
+}
@@ -0,0 +1,40 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * pcap and pcapng file reader that does not use libpcap
+ */
+
+#ifndef __SOURCE_PCAP_FILE_NATIVE_H__
+#define __SOURCE_PCAP_FILE_NATIVE_H__
+
+typedef struct PcapNative_ PcapNative;
+
+PcapNative *PcapNativeOpen(const char *filename, uint64_t readahead);
+int PcapNativeNext(PcapNative *pn, struct pcap_pkthdr *h,
+        const uint8_t **data, int *datalink);
+int PcapNativeIsMapped(const PcapNative *pn);
+const char *PcapNativeGetError(const PcapNative *pn);
+void PcapNativeRef(PcapNative *pn);
+void PcapNativeRelease(PcapNative *pn);
+void PcapNativeClose(PcapNative *pn);
+
+void PcapNativeRegisterTests(void);
+
+#endif /* __SOURCE_PCAP_FILE_NATIVE_H__ */
@@ -31,6 +31,7 @@
 #include "threadvars.h"
 #include "tm-queuehandlers.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-native.h"
 #include "util-time.h"
 #include "util-debug.h"
 #include "conf.h"
@@ -44,6 +45,14 @@
 #include "runmode-unix-socket.h"
 #include "util-checksum.h"
 #include "util-atomic.h"
+#include "util-misc.h"
+
+#include <dirent.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -59,22 +68,82 @@
 
 extern int max_pending_packets;
 
+typedef int (*PcapFileDecoderFunc)(ThreadVars *, DecodeThreadVars *, Packet *,
+        uint8_t *, uint16_t, PacketQueue *);
+
+/** a file of the directory mode */
+typedef struct PcapFileEntry_ {
+    char *filename;
+    /** time of the first packet */
+    struct timeval first_ts;
+} PcapFileEntry;
+
+struct PcapFileThreadVars_;
+
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
-    int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
-    int datalink;
-    struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
+    SC_ATOMIC_DECLARE(uint64_t, cnt); /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
 
+    /** read the files with the native reader instead of libpcap */
+    int native;
+    /** native reader: bytes to read ahead of the current position */
+    uint64_t readahead;
+
+    /** directory mode: files sorted by the time of their first packet,
+     *  handed out to the readers in that order */
+    PcapFileEntry *files;
+    uint32_t files_cnt;
+    uint32_t files_next;
+
+    /** directory mode: the readers, kept within max_skew of each other */
+    SCCtrlMutex readers_mutex;
+    SCCtrlCondT readers_cond;
+    struct PcapFileThreadVars_ *readers[PCAP_FILE_MAX_READERS];
+    uint32_t readers_cnt;
+    uint32_t readers_total; /**< readers registered, never decremented */
+    uint32_t readers_active;
+    uint32_t readers_waiting;
+    uint64_t max_skew; /**< usec */
+
+    /** aggregate benchmark of all readers */
+    uint32_t bench_readers;
+    uint64_t bench_pkts;
+    struct timeval bench_start;
+    struct timeval bench_end;
 } PcapFileGlobalVars;
 
+/** per thread performance counters for the benchmark mode */
+typedef struct PcapFileBenchmark_ {
+    struct timeval start;
+    struct timeval end;
+    int fd_cycles;
+    int fd_instructions;
+    uint64_t cycles;
+    uint64_t instructions;
+} PcapFileBenchmark;
+
 typedef struct PcapFileThreadVars_
 {
     uint32_t tenant_id;
 
+    pcap_t *pcap_handle;
+    PcapNative *native;
+    struct bpf_program filter;
+    int filter_set;
+    int datalink;
+    /** native reader: the filter is compiled at the first packet */
+    const char *bpf_string;
+    int filter_datalink;
+
+    /** time of the last packet read */
+    struct timeval cur_ts;
+    /** cur_ts as seen by the other readers, protected by readers_mutex */
+    struct timeval sync_ts;
+    /** reading files, protected by readers_mutex */
+    uint8_t active;
+
     /* counters */
     uint32_t pkts;
     uint64_t bytes;
@@ -87,6 +156,15 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /** packets are passed to the slots in batches of this size */
+    uint32_t batch_size;
+    uint32_t batch_cnt;
+    Packet *batch[TM_BATCH_SIZE_MAX];
+
+    /** benchmark mode: report pps and IPC at exit */
+    int benchmark;
+    PcapFileBenchmark bench;
 } PcapFileThreadVars;
 
 static PcapFileGlobalVars pcap_g;
@@ -130,7 +208,356 @@ void TmModuleDecodePcapFileRegister (void)
 void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SC_ATOMIC_INIT(pcap_g.cnt);
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+    SCCtrlMutexInit(&pcap_g.readers_mutex, NULL);
+    SCCtrlCondInit(&pcap_g.readers_cond, NULL);
+
+    const char *reader = NULL;
+    if (ConfGet("pcap-file.reader", &reader) == 1) {
+        if (strcmp(reader, "native") == 0) {
+            pcap_g.native = 1;
+        } else if (strcmp(reader, "libpcap") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.reader must be "
+                    "'libpcap' or 'native', using libpcap");
+        }
+    }
+
+    const char *readahead = NULL;
+    pcap_g.readahead = 8 * 1024 * 1024;
+    if (ConfGet("pcap-file.readahead", &readahead) == 1) {
+        if (ParseSizeStringU64(readahead, &pcap_g.readahead) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "error parsing pcap-file.readahead "
+                    "from conf file - %s, using 8mb", readahead);
+            pcap_g.readahead = 8 * 1024 * 1024;
+        }
+    }
+    if (pcap_g.native) {
+        SCLogConfig("pcap-file: using the native reader, readahead %" PRIu64,
+                pcap_g.readahead);
+    }
+}
+
+static PcapFileDecoderFunc PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernet;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_RAW:
+        case LINKTYPE_RAW2:
+            return DecodeRaw;
+        case LINKTYPE_NULL:
+            return DecodeNull;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Check if the pcap-file path is a directory
+ */
+int PcapFileIsDirectory(const char *path)
+{
+    struct stat st;
+    if (path == NULL || stat(path, &st) != 0)
+        return 0;
+    return S_ISDIR(st.st_mode);
+}
+
+static int PcapFileEntryCompare(const void *a, const void *b)
+{
+    const PcapFileEntry *fa = (const PcapFileEntry *)a;
+    const PcapFileEntry *fb = (const PcapFileEntry *)b;
+
+    if (timercmp(&fa->first_ts, &fb->first_ts, <))
+        return -1;
+    if (timercmp(&fa->first_ts, &fb->first_ts, >))
+        return 1;
+    return strcmp(fa->filename, fb->filename);
+}
+
+/**
+ * \brief Get the time of the first packet of a file
+ *
+ * \retval 0 ok, -1 if the file can't be read or has no packets
+ */
+static int PcapFileGetFirstTs(const char *path, struct timeval *ts)
+{
+    if (pcap_g.native) {
+        struct pcap_pkthdr h;
+        const uint8_t *data;
+        int datalink;
+
+        PcapNative *pn = PcapNativeOpen(path, 0);
+        if (pn == NULL) {
+            SCLogWarning(SC_ERR_FOPEN, "skipping %s", path);
+            return -1;
+        }
+        int r = PcapNativeNext(pn, &h, &data, &datalink);
+        PcapNativeClose(pn);
+        if (r != 1) {
+            SCLogInfo("skipping empty pcap file %s", path);
+            return -1;
+        }
+        *ts = h.ts;
+        return 0;
+    }
+
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    struct pcap_pkthdr *h;
+    const u_char *data;
+
+    pcap_t *pcap = pcap_open_offline(path, errbuf);
+    if (pcap == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "skipping %s: %s", path, errbuf);
+        return -1;
+    }
+    if (pcap_next_ex(pcap, &h, &data) != 1) {
+        SCLogInfo("skipping empty pcap file %s", path);
+        pcap_close(pcap);
+        return -1;
+    }
+    ts->tv_sec = h->ts.tv_sec;
+    ts->tv_usec = h->ts.tv_usec;
+    pcap_close(pcap);
+    return 0;
+}
+
+/**
+ * \brief Set up the directory mode
+ *
+ * All pcap files of the directory are read, in the order of the time of
+ * their first packet. Files that can't be opened by libpcap are skipped.
+ *
+ * \retval number of files to read, -1 on error
+ */
+int PcapFileDirectoryInit(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (dir == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open directory %s: %s",
+                dirname, strerror(errno));
+        return -1;
+    }
+
+    struct dirent *de;
+    uint32_t size = 0;
+    while ((de = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        struct stat st;
+        struct timeval first_ts;
+
+        if (de->d_name[0] == '.')
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dirname, de->d_name) >= (int)sizeof(path))
+            continue;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (PcapFileGetFirstTs(path, &first_ts) < 0)
+            continue;
+
+        if (pcap_g.files_cnt == size) {
+            uint32_t new_size = size ? size * 2 : 64;
+            PcapFileEntry *files = SCRealloc(pcap_g.files, new_size * sizeof(PcapFileEntry));
+            if (unlikely(files == NULL))
+                break;
+            pcap_g.files = files;
+            size = new_size;
+        }
+        PcapFileEntry *e = &pcap_g.files[pcap_g.files_cnt];
+        e->first_ts = first_ts;
+
+        e->filename = SCStrdup(path);
+        if (unlikely(e->filename == NULL))
+            break;
+        pcap_g.files_cnt++;
+    }
+    closedir(dir);
+
+    if (pcap_g.files_cnt == 0) {
+        SCLogError(SC_ERR_FOPEN, "no pcap files found in %s", dirname);
+        return -1;
+    }
+    qsort(pcap_g.files, pcap_g.files_cnt, sizeof(PcapFileEntry),
+            PcapFileEntryCompare);
+
+    intmax_t skew = 1000;
+    if (ConfGetInt("pcap-file.max-time-skew", &skew) == 1 && skew < 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.max-time-skew must be "
+                "positive, using 1000");
+        skew = 1000;
+    }
+    pcap_g.max_skew = (uint64_t)skew * 1000;
+
+    SCLogConfig("pcap-file: reading %u files from %s", pcap_g.files_cnt, dirname);
+    return (int)pcap_g.files_cnt;
+}
+
+/**
+ * \brief Get the number of reader threads for the directory mode
+ */
+int PcapFileGetReaders(int files, int ncpus)
+{
+    const char *readers_str = NULL;
+    int readers = ncpus / 4;
+
+    if (ConfGet("pcap-file.readers", &readers_str) == 1 &&
+            strcmp(readers_str, "auto") != 0) {
+        readers = atoi(readers_str);
+        if (readers < 1 || readers > PCAP_FILE_MAX_READERS) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.readers must be "
+                    "between 1 and %d, using 1", PCAP_FILE_MAX_READERS);
+            readers = 1;
+        }
+    }
+    if (readers < 1)
+        readers = 1;
+    if (readers > PCAP_FILE_MAX_READERS)
+        readers = PCAP_FILE_MAX_READERS;
+    if (readers > files)
+        readers = files;
+    return readers;
+}
+
+/** \internal
+ *  \brief pass the batched packets to the slots
+ */
+static void PcapFileFlushBatch(PcapFileThreadVars *ptv)
+{
+    if (ptv->batch_cnt == 0)
+        return;
+
+    uint32_t cnt = ptv->batch_cnt;
+    ptv->batch_cnt = 0;
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+        if (ptv->pcap_handle != NULL)
+            pcap_breakloop(ptv->pcap_handle);
+        ptv->cb_result = TM_ECODE_FAILED;
+    }
+}
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_SYS_SYSCALL_H)
+static int PcapFileBenchmarkOpenCounter(uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    /* count for this thread only, on any cpu */
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t PcapFileBenchmarkReadCounter(int fd)
+{
+    uint64_t val = 0;
+    if (fd < 0 || read(fd, &val, sizeof(val)) != sizeof(val))
+        return 0;
+    return val;
+}
+#endif
+
+static void PcapFileBenchmarkStart(PcapFileBenchmark *b)
+{
+    b->fd_cycles = -1;
+    b->fd_instructions = -1;
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_SYS_SYSCALL_H)
+    b->fd_cycles = PcapFileBenchmarkOpenCounter(PERF_COUNT_HW_CPU_CYCLES);
+    b->fd_instructions = PcapFileBenchmarkOpenCounter(PERF_COUNT_HW_INSTRUCTIONS);
+    if (b->fd_cycles < 0 || b->fd_instructions < 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "pcap-file benchmark: can't open cpu "
+                "counters: %s. Only reporting packets per second.", strerror(errno));
+    }
+    if (b->fd_cycles >= 0)
+        ioctl(b->fd_cycles, PERF_EVENT_IOC_ENABLE, 0);
+    if (b->fd_instructions >= 0)
+        ioctl(b->fd_instructions, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    gettimeofday(&b->start, NULL);
+}
+
+static void PcapFileBenchmarkStop(PcapFileBenchmark *b)
+{
+    gettimeofday(&b->end, NULL);
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_SYS_SYSCALL_H)
+    if (b->fd_cycles >= 0) {
+        ioctl(b->fd_cycles, PERF_EVENT_IOC_DISABLE, 0);
+        b->cycles = PcapFileBenchmarkReadCounter(b->fd_cycles);
+        close(b->fd_cycles);
+        b->fd_cycles = -1;
+    }
+    if (b->fd_instructions >= 0) {
+        ioctl(b->fd_instructions, PERF_EVENT_IOC_DISABLE, 0);
+        b->instructions = PcapFileBenchmarkReadCounter(b->fd_instructions);
+        close(b->fd_instructions);
+        b->fd_instructions = -1;
+    }
+#endif
+}
+
+static void PcapFileBenchmarkReport(const PcapFileThreadVars *ptv)
+{
+    const PcapFileBenchmark *b = &ptv->bench;
+    double secs = (double)(b->end.tv_sec - b->start.tv_sec) +
+        (double)(b->end.tv_usec - b->start.tv_usec) / 1000000.0;
+    double pps = secs > 0 ? (double)ptv->pkts / secs : 0;
+
+    if (b->cycles > 0) {
+        SCLogNotice("pcap-file benchmark: batch-size %u: %" PRIu32 " packets "
+                "in %.3fs, %.0f pps, %" PRIu64 " instructions, %" PRIu64 " cycles, "
+                "IPC %.3f", ptv->batch_size, ptv->pkts, secs, pps,
+                b->instructions, b->cycles,
+                (double)b->instructions / (double)b->cycles);
+    } else {
+        SCLogNotice("pcap-file benchmark: batch-size %u: %" PRIu32 " packets "
+                "in %.3fs, %.0f pps", ptv->batch_size, ptv->pkts, secs, pps);
+    }
+}
+
+/**
+ * \brief Directory mode: report the benchmark of all readers together
+ *
+ * Called by each reader at exit, the last one logs the result.
+ */
+static void PcapFileBenchmarkAggregate(const PcapFileThreadVars *ptv)
+{
+    SCCtrlMutexLock(&pcap_g.readers_mutex);
+    if (pcap_g.bench_readers == 0 ||
+            timercmp(&ptv->bench.start, &pcap_g.bench_start, <))
+        pcap_g.bench_start = ptv->bench.start;
+    if (timercmp(&ptv->bench.end, &pcap_g.bench_end, >))
+        pcap_g.bench_end = ptv->bench.end;
+    pcap_g.bench_pkts += ptv->pkts;
+    pcap_g.bench_readers++;
+
+    /* readers_cnt is decremented in the deinit of readers that already
+     * reported, so compare against the number of readers that ran */
+    if (pcap_g.bench_readers == pcap_g.readers_total) {
+        double secs = (double)(pcap_g.bench_end.tv_sec - pcap_g.bench_start.tv_sec) +
+            (double)(pcap_g.bench_end.tv_usec - pcap_g.bench_start.tv_usec) / 1000000.0;
+        double pps = secs > 0 ? (double)pcap_g.bench_pkts / secs : 0;
+        SCLogNotice("pcap-file benchmark: %u readers, %u files: %" PRIu64 " packets "
+                "in %.3fs, %.0f pps", pcap_g.readers_total, pcap_g.files_cnt,
+                pcap_g.bench_pkts, secs, pps);
+    }
+    SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+}
+
+static void PcapFileReleasePacket(Packet *p)
+{
+    PcapNative *pn = p->pcap_v.native;
+    p->pcap_v.native = NULL;
+    if (pn != NULL)
+        PcapNativeRelease(pn);
+    PacketFreeOrRelease(p);
 }
 
 static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
@@ -149,14 +576,26 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_sec = h->ts.tv_sec;
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = ptv->datalink;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
 
     p->pcap_v.tenant_id = ptv->tenant_id;
+    p->pcap_v.native = NULL;
     ptv->pkts++;
     ptv->bytes += h->caplen;
-
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    ptv->cur_ts = p->ts;
+
+    if (ptv->native != NULL && PcapNativeIsMapped(ptv->native)) {
+        /* point into the mapped file, the packet holds on to the mapping */
+        PcapNativeRef(ptv->native);
+        p->pcap_v.native = ptv->native;
+        p->ReleasePacket = PcapFileReleasePacket;
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+            SCReturn;
+        }
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
@@ -175,31 +614,326 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
+    if (ptv->batch_size > 1) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        if (ptv->batch_cnt == ptv->batch_size) {
+            PcapFileFlushBatch(ptv);
+        }
+        SCReturn;
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        if (ptv->pcap_handle != NULL)
+            pcap_breakloop(ptv->pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+static void PcapFileClose(PcapFileThreadVars *ptv)
+{
+    if (ptv->pcap_handle != NULL) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+    }
+    if (ptv->native != NULL) {
+        PcapNativeClose(ptv->native);
+        ptv->native = NULL;
+    }
+    if (ptv->filter_set) {
+        pcap_freecode(&ptv->filter);
+        ptv->filter_set = 0;
+    }
+}
+
 /**
- *  \brief Main PCAP file reading Loop function
+ * \brief Open a pcap file and set up the bpf filter
+ *
+ * \retval TM_ECODE_OK, TM_ECODE_FAILED if the file can't be used
  */
-TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
+static TmEcode PcapFileOpen(PcapFileThreadVars *ptv, const char *filename)
+{
+    const char *tmpbpfstring = NULL;
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+    SCLogInfo("reading pcap file %s", filename);
+
+    if (pcap_g.native) {
+        /* the link type is known per packet, see PcapFileNativeDispatch */
+        ptv->native = PcapNativeOpen(filename, pcap_g.readahead);
+        if (ptv->native == NULL)
+            return TM_ECODE_FAILED;
+        if (ConfGet("bpf-filter", &ptv->bpf_string) == 1) {
+            SCLogInfo("using bpf-filter \"%s\"", ptv->bpf_string);
+        } else {
+            ptv->bpf_string = NULL;
+        }
+        return TM_ECODE_OK;
+    }
+
+    ptv->pcap_handle = pcap_open_offline(filename, errbuf);
+    if (ptv->pcap_handle == NULL) {
+        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+        return TM_ECODE_FAILED;
+    }
+
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        if (pcap_compile(ptv->pcap_handle, &ptv->filter, (char *)tmpbpfstring, 1, 0) < 0) {
+            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
+                    pcap_geterr(ptv->pcap_handle));
+            PcapFileClose(ptv);
+            return TM_ECODE_FAILED;
+        }
+        ptv->filter_set = 1;
+
+        if (pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(ptv->pcap_handle));
+            PcapFileClose(ptv);
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    ptv->datalink = pcap_datalink(ptv->pcap_handle);
+    SCLogDebug("datalink %" PRId32 "", ptv->datalink);
+
+    if (PcapFileGetDecoder(ptv->datalink) == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.\n", ptv->datalink);
+        PcapFileClose(ptv);
+        return TM_ECODE_FAILED;
+    }
+
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Directory mode: open the next file that can be read
+ *
+ * \retval TM_ECODE_OK if a file was opened, TM_ECODE_DONE if all files
+ *         have been handed out
+ */
+static TmEcode PcapFileOpenNext(PcapFileThreadVars *ptv)
+{
+    PcapFileClose(ptv);
+
+    while (1) {
+        PcapFileEntry *e = NULL;
+
+        SCCtrlMutexLock(&pcap_g.readers_mutex);
+        if (pcap_g.files_next < pcap_g.files_cnt) {
+            e = &pcap_g.files[pcap_g.files_next++];
+            /* the other readers must not run ahead of this file */
+            ptv->cur_ts = e->first_ts;
+            ptv->sync_ts = e->first_ts;
+        }
+        SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+
+        if (e == NULL)
+            return TM_ECODE_DONE;
+        if (PcapFileOpen(ptv, e->filename) == TM_ECODE_OK)
+            return TM_ECODE_OK;
+    }
+}
+
+static void PcapFileReaderRegister(PcapFileThreadVars *ptv)
+{
+    SCCtrlMutexLock(&pcap_g.readers_mutex);
+    BUG_ON(pcap_g.readers_cnt >= PCAP_FILE_MAX_READERS);
+    pcap_g.readers[pcap_g.readers_cnt++] = ptv;
+    pcap_g.readers_total++;
+    pcap_g.readers_active++;
+    ptv->active = 1;
+    SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+}
+
+/**
+ * \brief Directory mode: the reader has no more files
+ *
+ * \retval 1 if this was the last active reader
+ */
+static int PcapFileReaderDone(PcapFileThreadVars *ptv)
+{
+    int last = 0;
+    SCCtrlMutexLock(&pcap_g.readers_mutex);
+    if (ptv->active) {
+        ptv->active = 0;
+        pcap_g.readers_active--;
+        last = (pcap_g.readers_active == 0);
+    }
+    SCCtrlCondBroadcast(&pcap_g.readers_cond);
+    SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+    return last;
+}
+
+static inline uint64_t PcapFileTimeDiff(const struct timeval *a, const struct timeval *b)
+{
+    if (timercmp(a, b, <=))
+        return 0;
+    return (uint64_t)(a->tv_sec - b->tv_sec) * 1000000 + a->tv_usec - b->tv_usec;
+}
+
+/**
+ * \brief Directory mode: keep the readers in step
+ *
+ * Packets of a flow may be in several files. To keep them in order, a
+ * reader waits while it is more than max-time-skew ahead of the slowest
+ * active reader. The slowest reader never waits.
+ */
+static void PcapFileSyncReaders(PcapFileThreadVars *ptv)
+{
+    SCCtrlMutexLock(&pcap_g.readers_mutex);
+    ptv->sync_ts = ptv->cur_ts;
+    if (pcap_g.readers_waiting > 0)
+        SCCtrlCondBroadcast(&pcap_g.readers_cond);
+
+    while (!(suricata_ctl_flags & SURICATA_STOP)) {
+        uint32_t u;
+        int ahead = 0;
+        for (u = 0; u < pcap_g.readers_cnt; u++) {
+            const PcapFileThreadVars *other = pcap_g.readers[u];
+            if (other == ptv || !other->active)
+                continue;
+            if (PcapFileTimeDiff(&ptv->sync_ts, &other->sync_ts) > pcap_g.max_skew) {
+                ahead = 1;
+                break;
+            }
+        }
+        if (!ahead)
+            break;
+
+        /* time out now and then to notice the engine stopping */
+        struct timeval tv;
+        struct timespec cond_time;
+        gettimeofday(&tv, NULL);
+        uint64_t usec = (uint64_t)tv.tv_usec + 100000;
+        cond_time.tv_sec = tv.tv_sec + (usec / 1000000);
+        cond_time.tv_nsec = (usec % 1000000) * 1000;
+
+        pcap_g.readers_waiting++;
+        SCCtrlCondTimedwait(&pcap_g.readers_cond, &pcap_g.readers_mutex, &cond_time);
+        pcap_g.readers_waiting--;
+    }
+    SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+}
+
+/**
+ * \brief Native reader: map the LINKTYPE of the file to a DLT value
+ *
+ * The files store LINKTYPE values, while pcap_open_dead and the decoders
+ * take DLT values, like libpcap returns them. Most are the same, except
+ * for a few that differ between platforms.
+ */
+static int PcapFileLinktypeToDlt(int linktype)
+{
+    switch (linktype) {
+        case LINKTYPE_RAW2:
+            return DLT_RAW;
+#ifdef DLT_C_HDLC
+        case 104:
+            return DLT_C_HDLC;
+#endif
+#ifdef DLT_LOOP
+        case 108:
+            return DLT_LOOP;
+#endif
+#ifdef DLT_PFLOG
+        case 117:
+            return DLT_PFLOG;
+#endif
+    }
+    return linktype;
+}
+
+/**
+ * \brief Native reader: pass up to cnt packets to the callback
+ *
+ * Works like pcap_dispatch. The bpf filter is compiled for the link type
+ * of the first packet; packets of other link types are dropped when a
+ * filter is set.
+ *
+ * \retval number of packets, 0 at the end of the file, -1 on error
+ */
+static int PcapFileNativeDispatch(PcapFileThreadVars *ptv, int cnt)
+{
+    struct pcap_pkthdr h;
+    const uint8_t *pkt;
+    int datalink;
+    int n = 0;
+
+    while (n < cnt) {
+        int r = PcapNativeNext(ptv->native, &h, &pkt, &datalink);
+        if (r <= 0)
+            return n > 0 ? n : r;
+        datalink = PcapFileLinktypeToDlt(datalink);
+
+        if (unlikely(PcapFileGetDecoder(datalink) == NULL)) {
+            SCLogDebug("skipping packet of unsupported datalink %d", datalink);
+            continue;
+        }
+
+        if (ptv->bpf_string != NULL) {
+            if (unlikely(!ptv->filter_set)) {
+                pcap_t *dead = pcap_open_dead(datalink, 65535);
+                if (dead == NULL ||
+                        pcap_compile(dead, &ptv->filter, (char *)ptv->bpf_string, 1, 0) < 0) {
+                    SCLogError(SC_ERR_BPF, "bpf compilation error %s",
+                            dead ? pcap_geterr(dead) : "");
+                    if (dead != NULL)
+                        pcap_close(dead);
+                    ptv->cb_result = TM_ECODE_FAILED;
+                    return -1;
+                }
+                pcap_close(dead);
+                ptv->filter_set = 1;
+                ptv->filter_datalink = datalink;
+            }
+            if (datalink != ptv->filter_datalink ||
+                    pcap_offline_filter(&ptv->filter, &h, pkt) == 0)
+                continue;
+        }
+
+        ptv->datalink = datalink;
+        PcapFileCallbackLoop((char *)ptv, &h, (u_char *)pkt);
+        n++;
+        if (unlikely(ptv->cb_result == TM_ECODE_FAILED))
+            break;
+    }
+    return n;
+}
+
+static const char *PcapFileGetError(PcapFileThreadVars *ptv)
+{
+    if (ptv->native != NULL)
+        return PcapNativeGetError(ptv->native);
+    if (ptv->pcap_handle != NULL)
+        return pcap_geterr(ptv->pcap_handle);
+    return "";
+}
+
+/**
+ *  \brief read packets until the end of the input, an error or the
+ *         engine stopping
+ */
+static TmEcode PcapFileReadLoop(ThreadVars *tv, PcapFileThreadVars *ptv)
 {
     SCEnter();
 
     int packet_q_len = 64;
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     int r;
-    TmSlot *s = (TmSlot *)slot;
 
-    ptv->slot = s->slot_next;
-    ptv->cb_result = TM_ECODE_OK;
+    /* let a dispatch fill at least one batch */
+    if ((int)ptv->batch_size > packet_q_len)
+        packet_q_len = (int)ptv->batch_size;
 
     while (1) {
         if (suricata_ctl_flags & SURICATA_STOP) {
+            if (pcap_g.files != NULL)
+                PcapFileReaderDone(ptv);
             SCReturnInt(TM_ECODE_OK);
         }
 
@@ -207,30 +941,59 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
+        if (pcap_g.readers_cnt > 1)
+            PcapFileSyncReaders(ptv);
+
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
-                          (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (ptv->native != NULL) {
+            r = PcapFileNativeDispatch(ptv, packet_q_len);
+        } else {
+            r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
+                              (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        }
+        /* don't hold on to packets between dispatch calls */
+        if (likely(ptv->cb_result != TM_ECODE_FAILED)) {
+            PcapFileFlushBatch(ptv);
+        } else {
+            uint32_t u;
+            for (u = 0; u < ptv->batch_cnt; u++)
+                TmqhOutputPacketpool(tv, ptv->batch[u]);
+            ptv->batch_cnt = 0;
+        }
+
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, PcapFileGetError(ptv));
             if (ptv->cb_result == TM_ECODE_FAILED) {
                 SCReturnInt(TM_ECODE_FAILED);
             }
+            /* directory mode: go on with the next file */
+            if (pcap_g.files != NULL) {
+                if (PcapFileOpenNext(ptv) == TM_ECODE_OK)
+                    continue;
+                if (!PcapFileReaderDone(ptv))
+                    SCReturnInt(TM_ECODE_DONE);
+            }
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
         } else if (unlikely(r == 0)) {
             SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
+            if (pcap_g.files != NULL && PcapFileOpenNext(ptv) == TM_ECODE_OK) {
+                continue;
+            }
+            /* directory mode: the last reader stops the engine */
+            if (pcap_g.files != NULL && !PcapFileReaderDone(ptv)) {
+                SCReturnInt(TM_ECODE_DONE);
+            }
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -240,8 +1003,7 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             if (! RunModeUnixSocketIsActive()) {
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -252,20 +1014,43 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ *  \brief Main PCAP file reading Loop function
+ */
+TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+
+    ptv->slot = s->slot_next;
+    ptv->cb_result = TM_ECODE_OK;
+
+    /* the benchmark covers the whole loop, whichever way it ends */
+    if (ptv->benchmark)
+        PcapFileBenchmarkStart(&ptv->bench);
+
+    TmEcode r = PcapFileReadLoop(tv, ptv);
+
+    if (ptv->benchmark)
+        PcapFileBenchmarkStop(&ptv->bench);
+
+    SCReturnInt(r);
+}
+
 TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **data)
 {
     SCEnter();
 
-    const char *tmpbpfstring = NULL;
     const char *tmpstring = NULL;
+    TmEcode r;
 
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("reading pcap file %s", (char *)initdata);
-
     PcapFileThreadVars *ptv = SCMalloc(sizeof(PcapFileThreadVars));
     if (unlikely(ptv == NULL))
         SCReturnInt(TM_ECODE_FAILED);
@@ -281,73 +1066,29 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
         }
     }
 
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
-        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+    if (pcap_g.files != NULL) {
+        /* directory mode, initdata is the directory */
+        r = PcapFileOpenNext(ptv);
+        if (r == TM_ECODE_DONE) {
+            SCLogError(SC_ERR_FOPEN, "no pcap file left to read in %s",
+                    (char *)initdata);
+            r = TM_ECODE_FAILED;
+        }
+        if (r == TM_ECODE_OK)
+            PcapFileReaderRegister(ptv);
+    } else {
+        r = PcapFileOpen(ptv, (char *)initdata);
+    }
+    if (r != TM_ECODE_OK) {
         SCFree(ptv);
         if (! RunModeUnixSocketIsActive()) {
-            return TM_ECODE_FAILED;
+            SCReturnInt(TM_ECODE_FAILED);
         } else {
             UnixSocketPcapFile(TM_ECODE_FAILED);
             SCReturnInt(TM_ECODE_DONE);
         }
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
-    } else {
-        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
-
-        if (pcap_compile(pcap_g.pcap_handle, &pcap_g.filter, (char *)tmpbpfstring, 1, 0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
-                    pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-
-        if (pcap_setfilter(pcap_g.pcap_handle, &pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-    }
-
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
-
-    switch (pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
-        case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
-        case LINKTYPE_RAW:
-        case LINKTYPE_RAW2:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-        case LINKTYPE_NULL:
-            pcap_g.Decoder = DecodeNull;
-            break;
-
-        default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
-            } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
-            }
-    }
-
     if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
         pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
     } else {
@@ -361,6 +1102,25 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
     }
     pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 
+    intmax_t batch_size = 1;
+    if (ConfGetInt("pcap-file.batch-size", &batch_size) == 1) {
+        if (batch_size < 1 || batch_size > TM_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.batch-size must be "
+                    "between 1 and %d, using 1", TM_BATCH_SIZE_MAX);
+            batch_size = 1;
+        } else if (batch_size > max_pending_packets) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "pcap-file.batch-size %" PRIdMAX
+                    " is larger than max-pending-packets, using %d",
+                    batch_size, max_pending_packets);
+            batch_size = max_pending_packets;
+        }
+    }
+    ptv->batch_size = (uint32_t)batch_size;
+    SCLogDebug("batch size %u", ptv->batch_size);
+
+    if (ConfGetBool("pcap-file.benchmark", &ptv->benchmark) != 1)
+        ptv->benchmark = 0;
+
     ptv->tv = tv;
     *data = (void *)ptv;
 
@@ -373,9 +1133,10 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
     if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            SC_ATOMIC_GET(pcap_g.cnt) < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-        uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+        uint64_t chrate = SC_ATOMIC_GET(pcap_g.cnt) /
+            SC_ATOMIC_GET(pcap_g.invalid_checksums);
         if (chrate < CHECKSUM_INVALID_RATIO)
             SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
@@ -387,6 +1148,11 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
                       chrate);
     }
     SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    if (ptv->benchmark) {
+        PcapFileBenchmarkReport(ptv);
+        if (pcap_g.readers_total > 1)
+            PcapFileBenchmarkAggregate(ptv);
+    }
     return;
 }
 
@@ -395,8 +1161,24 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     if (ptv) {
+        PcapFileClose(ptv);
         SCFree(ptv);
     }
+
+    /* directory mode: the last reader cleans up the file list */
+    if (pcap_g.files != NULL) {
+        SCCtrlMutexLock(&pcap_g.readers_mutex);
+        int last = (pcap_g.readers_cnt == 0 || --pcap_g.readers_cnt == 0);
+        SCCtrlMutexUnlock(&pcap_g.readers_mutex);
+        if (last) {
+            uint32_t u;
+            for (u = 0; u < pcap_g.files_cnt; u++)
+                SCFree(pcap_g.files[u].filename);
+            SCFree(pcap_g.files);
+            pcap_g.files = NULL;
+            pcap_g.files_cnt = 0;
+        }
+    }
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -422,7 +1204,9 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
     }
 
     /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    PcapFileDecoderFunc Decoder = PcapFileGetDecoder(p->datalink);
+    BUG_ON(Decoder == NULL);
+    Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
 #ifdef DEBUG
     BUG_ON(p->pkt_src != PKT_SRC_WIRE && p->pkt_src != PKT_SRC_FFR);
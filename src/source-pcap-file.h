@@ -31,5 +31,12 @@ void PcapIncreaseInvalidChecksum(void);
 
 void PcapFileGlobalInit(void);
 
+/** max number of reader threads in directory mode */
+#define PCAP_FILE_MAX_READERS 64
+
+int PcapFileIsDirectory(const char *);
+int PcapFileDirectoryInit(const char *);
+int PcapFileGetReaders(int, int);
+
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
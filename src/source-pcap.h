@@ -36,10 +36,14 @@ char *PcapLiveGetDevice(int);
 #define LIBPCAP_COPYWAIT    500
 #define LIBPCAP_PROMISC     1
 
+struct PcapNative_;
+
 /* per packet Pcap vars */
 typedef struct PcapPacketVars_
 {
     uint32_t tenant_id;
+    /** pcap-file native reader mapping the packet data points into */
+    struct PcapNative_ *native;
 } PcapPacketVars;
 
 /** needs to be able to contain Windows adapter id's, so
@@ -31,8 +31,6 @@
 #include "util-print.h"
 #include "util-validate.h"
 
-//static void PrintList2(TcpSegment *seg);
-
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg);
 
 static int check_overlap_different_data = 0;
@@ -42,6 +40,28 @@ void StreamTcpReassembleConfigEnableOverlapCheck(void)
     check_overlap_different_data = 1;
 }
 
+/*
+ *  Segment tree
+ */
+
+RB_GENERATE(TCPSEG, TcpSegment_, rb, TcpSegmentCompare);
+
+int TcpSegmentCompare(struct TcpSegment_ *a, struct TcpSegment_ *b)
+{
+    if (SEQ_GT(a->seq, b->seq))
+        return 1;
+    else if (SEQ_LT(a->seq, b->seq))
+        return -1;
+    else {
+        if (a->payload_len == b->payload_len)
+            return 0;
+        else if (a->payload_len > b->payload_len)
+            return 1;
+        else
+            return -1;
+    }
+}
+
 /*
  *  Inserts and overlap handling
  */
@@ -98,19 +118,24 @@ static inline int InsertSegmentDataCustom(TcpStream *stream, TcpSegment *seg, ui
 }
 
 /** \internal
- *  \brief insert the segment into the proper place in the list
+ *  \brief insert the segment into the proper place in the tree
  *         don't worry about the data or overlaps
  *
- *         If seq is equal to list seq, keep sorted by insert time.
+ *         If seq is equal to tree seq, sort by payload_len.
  *         1. seg 123 len 12
  *         2. seg 123 len 14
  *         3. seg 124 len 1
  *
+ *         If seq and payload_len are both equal the segment is an
+ *         exact duplicate of a segment already in the tree. It is
+ *         not inserted and the tree segment is returned in dup_seg.
+ *
+ *  \retval 2 not inserted, data overlap with dup_seg
  *  \retval 1 inserted with overlap detected
  *  \retval 0 inserted, no overlap
  *  \retval -1 error
  */
-static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, Packet *p)
+static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, TcpSegment **dup_seg, Packet *p)
 {
     /* before our base_seq we don't insert it in our list */
     if (SEQ_LEQ((seg->seq + TCP_SEG_LEN(seg)), stream->base_seq))
@@ -123,74 +148,51 @@ static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, Packet *p)
     }
 
     /* fast track */
-    if (stream->seg_list == NULL) {
-        SCLogDebug("empty list, inserting seg %p seq %" PRIu32 ", "
+    if (RB_EMPTY(&stream->seg_tree)) {
+        SCLogDebug("empty tree, inserting seg %p seq %" PRIu32 ", "
                    "len %" PRIu32 "", seg, seg->seq, TCP_SEG_LEN(seg));
-        stream->seg_list = seg;
-        seg->prev = NULL;
-        stream->seg_list_tail = seg;
+        RB_INSERT(TCPSEG, &stream->seg_tree, seg);
+        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
         return 0;
     }
 
-    /* insert the segment in the stream list using this fast track, if seg->seq
-       is equal or higher than stream->seg_list_tail.*/
-    if (SEQ_GEQ(seg->seq, (stream->seg_list_tail->seq +
-                    TCP_SEG_LEN(stream->seg_list_tail))))
-    {
-        SCLogDebug("seg beyond list tail, append");
-        stream->seg_list_tail->next = seg;
-        seg->prev = stream->seg_list_tail;
-        stream->seg_list_tail = seg;
+    /* insert the segment in the stream tree using this fast track, if seg->seq
+       is equal or higher than the right edge of all segments in the tree. */
+    if (SEQ_GEQ(seg->seq, stream->segs_right_edge)) {
+        SCLogDebug("seg beyond tree right edge, append");
+        RB_INSERT(TCPSEG, &stream->seg_tree, seg);
+        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
         return 0;
     }
 
-    /* walk the list to see where we can insert the segment.
-     * Check if a segment overlaps with us, if so we return 1 to indicate
-     * to the caller that we need to handle overlaps. */
-    TcpSegment *list_seg;
-    for (list_seg = stream->seg_list; list_seg != NULL; list_seg = list_seg->next)
-    {
-        if (SEQ_LT(seg->seq, list_seg->seq)) {
-            if (list_seg->prev != NULL) {
-                list_seg->prev->next = seg;
-            } else {
-                stream->seg_list = seg;
-            }
-            seg->prev = list_seg->prev;
-            seg->next = list_seg;
-            list_seg->prev = seg;
-
-            SCLogDebug("inserted %u before %p seq %u", seg->seq, list_seg, list_seg->seq);
+    /* insert and then check if there was any overlap with our direct
+     * neighbours. A tree segment with the same SEQ and length is returned
+     * by the insert, in which case seg isn't added to the tree. */
+    TcpSegment *res = RB_INSERT(TCPSEG, &stream->seg_tree, seg);
+    if (res != NULL) {
+        SCLogDebug("seg has a duplicate in the tree seq %u/%u",
+                res->seq, TCP_SEG_LEN(res));
+        *dup_seg = res;
+        return 2;
+    }
 
-            if (seg->prev != NULL) {
-                SCLogDebug("previous %u", seg->prev->seq);
-            }
-            if (seg->next != NULL) {
-                SCLogDebug("next %u", seg->next->seq);
-            }
-            if (seg->prev != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg->prev), seg->seq)) {
-                SCLogDebug("seg inserted with overlap (before)");
-                return 1;
-            }
-            else if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), seg->next->seq)) {
-                SCLogDebug("seg inserted with overlap (after)");
-                return 1;
-            }
+    if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), stream->segs_right_edge))
+        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
 
-            return 0;
-        }
-    }
-    /* if we got here we didn't insert. Append */
-    seg->prev = stream->seg_list_tail;
-    stream->seg_list_tail->next = seg;
-    stream->seg_list_tail = seg;
+    TcpSegment *prev = TCPSEG_RB_PREV(seg);
+    TcpSegment *next = TCPSEG_RB_NEXT(seg);
+    SCLogDebug("inserted %u, prev %u, next %u", seg->seq,
+            prev ? prev->seq : 0, next ? next->seq : 0);
 
-    if (seg->prev != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg->prev), seg->seq)) {
+    if (prev != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(prev), seg->seq)) {
         SCLogDebug("seg inserted with overlap (before)");
         return 1;
+    } else if (next != NULL && SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), next->seq)) {
+        SCLogDebug("seg inserted with overlap (after)");
+        return 1;
     }
 
-    SCLogDebug("default: append");
+    SCLogDebug("seg %u: no overlap", seg->seq);
     return 0;
 }
 
@@ -402,20 +404,22 @@ static int DoHandleDataOverlap(TcpStream *stream, TcpSegment *list, TcpSegment *
 #define MAX_IP_DATA (uint32_t)(65536 - 40) // min ip header and min tcp header
 
 /** \internal
- *  \brief walk segment list backwards to see if there are overlaps
+ *  \brief walk segment tree backwards to see if there are overlaps
  *
- *  Walk back from the current segment which is already in the list.
- *  We walk until we can't possibly overlap anymore.
+ *  Walk back from the tree segment 'start'. For a normal insert this is
+ *  the new segment itself, for an exact duplicate it's the segment
+ *  already in the tree. We walk until we can't possibly overlap anymore.
  */
-static int DoHandleDataCheckBackwards(TcpStream *stream, TcpSegment *seg, uint8_t *buf, Packet *p)
+static int DoHandleDataCheckBackwards(TcpStream *stream, TcpSegment *start,
+        TcpSegment *seg, uint8_t *buf, Packet *p)
 {
     int retval = 0;
 
-    SCLogDebug("check list backwards: insert data for segment %p seq %u len %u re %u",
+    SCLogDebug("check tree backwards: insert data for segment %p seq %u len %u re %u",
             seg, seg->seq, TCP_SEG_LEN(seg), SEG_SEQ_RIGHT_EDGE(seg));
 
-    TcpSegment *list = seg->prev;
-    do {
+    TcpSegment *list = TCPSEG_RB_PREV(start);
+    while (list != NULL) {
         int overlap = 0;
         if (SEQ_LEQ(SEG_SEQ_RIGHT_EDGE(list), stream->base_seq)) {
             // segment entirely before base_seq
@@ -434,29 +438,30 @@ static int DoHandleDataCheckBackwards(TcpStream *stream, TcpSegment *seg, uint8_
             retval |= DoHandleDataOverlap(stream, list, seg, buf, p);
         }
 
-        list = list->prev;
-    } while (list != NULL);
+        list = TCPSEG_RB_PREV(list);
+    }
 
     return retval;
 }
 
 /** \internal
- *  \brief walk segment list in forward direction to see if there are overlaps
+ *  \brief walk segment tree in forward direction to see if there are overlaps
  *
- *  Walk forward from the current segment which is already in the list.
- *  We walk until the next segs start with a SEQ beyond our right edge.
+ *  Walk forward from the tree segment 'start'. We walk until the next
+ *  segs start with a SEQ beyond our right edge.
  */
-static int DoHandleDataCheckForward(TcpStream *stream, TcpSegment *seg, uint8_t *buf, Packet *p)
+static int DoHandleDataCheckForward(TcpStream *stream, TcpSegment *start,
+        TcpSegment *seg, uint8_t *buf, Packet *p)
 {
     int retval = 0;
 
     uint32_t seg_re = SEG_SEQ_RIGHT_EDGE(seg);
 
-    SCLogDebug("check list forward: insert data for segment %p seq %u len %u re %u",
+    SCLogDebug("check tree forward: insert data for segment %p seq %u len %u re %u",
             seg, seg->seq, TCP_SEG_LEN(seg), seg_re);
 
-    TcpSegment *list = seg->next;
-    do {
+    TcpSegment *list = TCPSEG_RB_NEXT(start);
+    while (list != NULL) {
         int overlap = 0;
         if (SEQ_GT(seg_re, list->seq))
             overlap = 1;
@@ -473,14 +478,18 @@ static int DoHandleDataCheckForward(TcpStream *stream, TcpSegment *seg, uint8_t
             retval |= DoHandleDataOverlap(stream, list, seg, buf, p);
         }
 
-        list = list->next;
-    } while (list != NULL);
+        list = TCPSEG_RB_NEXT(list);
+    }
 
     return retval;
 }
 
+/** \internal
+ *  \param dup_seg tree segment that is an exact duplicate of seg, or NULL
+ *                 if seg itself was added to the tree
+ */
 static int DoHandleData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
-        TcpStream *stream, TcpSegment *seg, Packet *p)
+        TcpStream *stream, TcpSegment *seg, TcpSegment *dup_seg, Packet *p)
 {
     int result = 0;
 
@@ -493,20 +502,17 @@ static int DoHandleData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     uint8_t buf[p->payload_len];
     memcpy(buf, p->payload, p->payload_len);
 
-    /* new list head  */
-    if (seg->next != NULL && seg->prev == NULL) {
-        result = DoHandleDataCheckForward(stream, seg, buf, p);
-
-    /* new list tail */
-    } else if (seg->next == NULL && seg->prev != NULL) {
-        result = DoHandleDataCheckBackwards(stream, seg, buf, p);
-
-    /* middle of the list */
-    } else if (seg->next != NULL && seg->prev != NULL) {
-        result = DoHandleDataCheckBackwards(stream, seg, buf, p);
-        result |= DoHandleDataCheckForward(stream, seg, buf, p);
+    /* the duplicate fully overlaps us, so handle it first and then
+     * continue the walk from its place in the tree */
+    TcpSegment *start = seg;
+    if (dup_seg != NULL) {
+        result = DoHandleDataOverlap(stream, dup_seg, seg, buf, p);
+        start = dup_seg;
     }
 
+    result |= DoHandleDataCheckBackwards(stream, start, seg, buf, p);
+    result |= DoHandleDataCheckForward(stream, start, seg, buf, p);
+
     /* we had an overlap with different data */
     if (result) {
         StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
@@ -534,11 +540,12 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 {
 #ifdef DEBUG
     SCLogDebug("pre insert");
-    PrintList(stream->seg_list);
+    PrintList(stream);
 #endif
 
-    /* insert segment into list. Note: doesn't handle the data */
-    int r = DoInsertSegment (stream, seg, p);
+    /* insert segment into tree. Note: doesn't handle the data */
+    TcpSegment *dup_seg = NULL;
+    int r = DoInsertSegment (stream, seg, &dup_seg, p);
     if (r < 0) {
         StatsIncr(tv, ra_ctx->counter_tcp_reass_list_fail);
         StreamTcpSegmentReturntoPool(seg);
@@ -547,7 +554,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
 #ifdef DEBUG
     SCLogDebug("post insert");
-    PrintList(stream->seg_list);
+    PrintList(stream);
 #endif
 
     if (likely(r == 0)) {
@@ -560,18 +567,25 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
             SCReturnInt(-1);
         }
 
-    } else if (r == 1) {
+    } else if (r == 1 || r == 2) {
         /* XXX should we exclude 'retransmissions' here? */
         StatsIncr(tv, ra_ctx->counter_tcp_reass_overlap);
 
         /* now let's consider the data in the overlap case */
-        int res = DoHandleData(tv, ra_ctx, stream, seg, p);
+        int res = DoHandleData(tv, ra_ctx, stream, seg, dup_seg, p);
         if (res < 0) {
             StatsIncr(tv, ra_ctx->counter_tcp_reass_data_overlap_fail);
-            StreamTcpRemoveSegmentFromStream(stream, seg);
+            /* r == 2 means seg wasn't added to the tree */
+            if (r == 1)
+                StreamTcpRemoveSegmentFromStream(stream, seg);
             StreamTcpSegmentReturntoPool(seg);
             SCReturnInt(-1);
         }
+        if (r == 2) {
+            SCLogDebug("duplicate segment %u/%u, discard it",
+                    seg->seq, TCP_SEG_LEN(seg));
+            StreamTcpSegmentReturntoPool(seg);
+        }
     }
 
     SCReturnInt(0);
@@ -694,7 +708,7 @@ static inline uint64_t GetLeftEdge(TcpSession *ssn, TcpStream *stream)
          * lets adjust it to make sure in-use segments still have
          * data */
         TcpSegment *seg;
-        for (seg = stream->seg_list; seg != NULL; seg = seg->next)
+        RB_FOREACH(seg, TCPSEG, &stream->seg_tree)
         {
             if (TCP_SEG_OFFSET(seg) > left_edge) {
                 SCLogDebug("seg beyond left_edge, we're done");
@@ -714,18 +728,7 @@ static inline uint64_t GetLeftEdge(TcpSession *ssn, TcpStream *stream)
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
-    if (seg->prev == NULL) {
-        stream->seg_list = seg->next;
-        if (stream->seg_list != NULL)
-            stream->seg_list->prev = NULL;
-    } else {
-        seg->prev->next = seg->next;
-        if (seg->next != NULL)
-            seg->next->prev = seg->prev;
-    }
-
-    if (stream->seg_list_tail == seg)
-        stream->seg_list_tail = seg->prev;
+    RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
 }
 
 /** \brief Remove idle TcpSegments from TcpSession
@@ -808,8 +811,8 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
     }
 
     /* loop through the segments and fill one or more msgs */
-    TcpSegment *seg = stream->seg_list;
-    while (seg != NULL)
+    TcpSegment *seg = NULL, *safe = NULL;
+    RB_FOREACH_SAFE(seg, TCPSEG, &stream->seg_tree, safe)
     {
         SCLogDebug("seg %p, SEQ %"PRIu32", LEN %"PRIu16", SUM %"PRIu32,
                 seg, seg->seq, TCP_SEG_LEN(seg),
@@ -820,15 +823,13 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
             break;
         }
 
-        TcpSegment *next_seg = seg->next;
         StreamTcpRemoveSegmentFromStream(stream, seg);
         StreamTcpSegmentReturntoPool(seg);
-        seg = next_seg;
         SCLogDebug("removed segment");
         continue;
     }
 #ifdef DEBUG
-    PrintList(stream->seg_list);
+    PrintList(stream);
 #endif
     SCReturn;
 }
@@ -837,131 +838,49 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
  *  Utils
  */
 
-#if 0
-void PrintList2(TcpSegment *seg)
-{
-    TcpSegment *prev_seg = NULL;
-
-    if (seg == NULL)
-        return;
-
-    uint32_t next_seq = seg->seq;
-
-    while (seg != NULL) {
-        if (SEQ_LT(next_seq,seg->seq)) {
-            SCLogDebug("missing segment(s) for %" PRIu32 " bytes of data",
-                        (seg->seq - next_seq));
-        }
-
-        SCLogDebug("seg %10"PRIu32" len %" PRIu16 ", seg %p, prev %p, next %p",
-                    seg->seq, TCP_SEG_LEN(seg), seg, seg->prev, seg->next);
-
-        if (seg->prev != NULL && SEQ_LT(seg->seq,seg->prev->seq)) {
-            /* check for SEQ_LT cornercase where a - b is exactly 2147483648,
-             * which makes the marco return TRUE in both directions. This is
-             * a hack though, we're going to check next how we end up with
-             * a segment list with seq differences that big */
-            if (!(SEQ_LT(seg->prev->seq,seg->seq))) {
-                SCLogDebug("inconsistent list: SEQ_LT(seg->seq,seg->prev->seq)) =="
-                        " TRUE, seg->seq %" PRIu32 ", seg->prev->seq %" PRIu32 ""
-                        "", seg->seq, seg->prev->seq);
-            }
-        }
-
-        if (SEQ_LT(seg->seq,next_seq)) {
-            SCLogDebug("inconsistent list: SEQ_LT(seg->seq,next_seq)) == TRUE, "
-                       "seg->seq %" PRIu32 ", next_seq %" PRIu32 "", seg->seq,
-                       next_seq);
-        }
-
-        if (prev_seg != seg->prev) {
-            SCLogDebug("inconsistent list: prev_seg %p != seg->prev %p",
-                        prev_seg, seg->prev);
-        }
-
-        next_seq = seg->seq + TCP_SEG_LEN(seg);
-        SCLogDebug("next_seq is now %"PRIu32"", next_seq);
-        prev_seg = seg;
-        seg = seg->next;
-    }
-}
-#endif
-
-void PrintList(TcpSegment *seg)
+void PrintList(TcpStream *stream)
 {
     TcpSegment *prev_seg = NULL;
-//    TcpSegment *head_seg = seg;
+    TcpSegment *seg = NULL;
 
-    if (seg == NULL)
+    if (stream == NULL || RB_EMPTY(&stream->seg_tree))
         return;
 
-    uint32_t next_seq = seg->seq;
+    uint32_t next_seq = RB_MIN(TCPSEG, &stream->seg_tree)->seq;
 
-    while (seg != NULL) {
+    RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
         if (SEQ_LT(next_seq,seg->seq)) {
             SCLogDebug("missing segment(s) for %" PRIu32 " bytes of data",
                         (seg->seq - next_seq));
         }
 
-        SCLogDebug("seg %10"PRIu32" len %" PRIu16 ", seg %p, prev %p, next %p",
-                    seg->seq, TCP_SEG_LEN(seg), seg, seg->prev, seg->next);
+        SCLogDebug("seg %10"PRIu32" len %" PRIu16 ", seg %p, prev %p",
+                    seg->seq, TCP_SEG_LEN(seg), seg, prev_seg);
 
-        if (seg->prev != NULL && SEQ_LT(seg->seq,seg->prev->seq)) {
+        if (prev_seg != NULL && SEQ_LT(seg->seq,prev_seg->seq)) {
             /* check for SEQ_LT cornercase where a - b is exactly 2147483648,
              * which makes the marco return TRUE in both directions. This is
              * a hack though, we're going to check next how we end up with
              * a segment list with seq differences that big */
-            if (!(SEQ_LT(seg->prev->seq,seg->seq))) {
-                SCLogDebug("inconsistent list: SEQ_LT(seg->seq,seg->prev->seq)) == "
-                        "TRUE, seg->seq %" PRIu32 ", seg->prev->seq %" PRIu32 "",
-                        seg->seq, seg->prev->seq);
-//                PrintList2(head_seg);
-//                abort();
+            if (!(SEQ_LT(prev_seg->seq,seg->seq))) {
+                SCLogDebug("inconsistent tree: SEQ_LT(seg->seq,prev_seg->seq)) == "
+                        "TRUE, seg->seq %" PRIu32 ", prev_seg->seq %" PRIu32 "",
+                        seg->seq, prev_seg->seq);
             }
         }
 
         if (SEQ_LT(seg->seq,next_seq)) {
-            SCLogDebug("inconsistent list: SEQ_LT(seg->seq,next_seq)) == TRUE, "
+            SCLogDebug("inconsistent tree: SEQ_LT(seg->seq,next_seq)) == TRUE, "
                        "seg->seq %" PRIu32 ", next_seq %" PRIu32 "", seg->seq,
                        next_seq);
-//            PrintList2(head_seg);
-//            abort();
-        }
-
-        if (prev_seg != seg->prev) {
-            SCLogDebug("inconsistent list: prev_seg %p != seg->prev %p",
-                       prev_seg, seg->prev);
-//            PrintList2(head_seg);
-            abort();
         }
 
-        next_seq = seg->seq + TCP_SEG_LEN(seg);
+        next_seq = SEG_SEQ_RIGHT_EDGE(seg);
         SCLogDebug("next_seq is now %"PRIu32"", next_seq);
         prev_seg = seg;
-        seg = seg->next;
     }
 }
 
-#if 0
-void ValidateList(const TcpStream *stream)
-{
-    TcpSegment *seg = stream->seg_list;
-    TcpSegment *prev_seg = NULL;
-
-    BUG_ON(seg && seg->next == NULL && stream->seg_list != stream->seg_list_tail);
-    BUG_ON(stream->seg_list != stream->seg_list_tail && stream->seg_list_tail->prev == NULL);
-
-    while (seg != NULL) {
-        prev_seg = seg;
-        seg = seg->next;
-        BUG_ON(seg && seg->prev != prev_seg);
-
-        // equal is possible
-        BUG_ON(seg && SEQ_LT(seg->seq, prev_seg->seq));
-    }
-}
-#endif
-
 /*
  *  unittests
  */
@@ -26,7 +26,7 @@
 
 #include "stream-tcp-private.h"
 
-void PrintList(TcpSegment *);
+void PrintList(TcpStream *);
 
 #ifdef UNITTESTS
 void StreamTcpListRegisterTests(void);
@@ -24,6 +24,7 @@
 #ifndef __STREAM_TCP_PRIVATE_H__
 #define __STREAM_TCP_PRIVATE_H__
 
+#include "tree.h"
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
@@ -56,10 +57,20 @@ typedef struct TcpSegment_ {
     uint16_t payload_len;       /**< actual size of the payload */
     uint32_t seq;
     StreamingBufferSegment sbseg;
-    struct TcpSegment_ *next;
-    struct TcpSegment_ *prev;
+    RB_ENTRY(TcpSegment_) rb;
 } TcpSegment;
 
+/** \brief compare function for the Segment tree
+ *
+ *  Main sort point is the sequence number. When sequence numbers
+ *  are equal compare payload_len as secondary sort order.
+ */
+int TcpSegmentCompare(struct TcpSegment_ *a, struct TcpSegment_ *b);
+
+/* red-black tree prototype for TcpSegment */
+RB_HEAD(TCPSEG, TcpSegment_);
+RB_PROTOTYPE(TCPSEG, TcpSegment_, rb, TcpSegmentCompare);
+
 #define TCP_SEG_LEN(seg)        (seg)->payload_len
 #define TCP_SEG_OFFSET(seg)     (seg)->sbseg.stream_offset
 
@@ -91,8 +102,9 @@ typedef struct TcpStream_ {
 
     StreamingBuffer sb;
 
-    TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
-    TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
+    struct TCPSEG seg_tree;         /**< red black tree of TCP segments, ordered by SEQ. Segments
+                                         that are not yet (fully) used in reassembly */
+    uint32_t segs_right_edge;       /**< highest right edge (SEQ+len) of the segments in the tree */
 
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
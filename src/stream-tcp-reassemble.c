@@ -277,8 +277,6 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     if (seg == NULL)
         return;
 
-    seg->next = NULL;
-    seg->prev = NULL;
     PoolThreadReturn(segment_thread_pool, seg);
 }
 
@@ -289,20 +287,13 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
  */
 void StreamTcpReturnStreamSegments (TcpStream *stream)
 {
-    TcpSegment *seg = stream->seg_list;
-    TcpSegment *next_seg;
-
-    if (seg == NULL)
-        return;
-
-    while (seg != NULL) {
-        next_seg = seg->next;
+    TcpSegment *seg = NULL, *safe = NULL;
+    RB_FOREACH_SAFE(seg, TCPSEG, &stream->seg_tree, safe)
+    {
+        RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
         StreamTcpSegmentReturntoPool(seg);
-        seg = next_seg;
     }
-
-    stream->seg_list = NULL;
-    stream->seg_list_tail = NULL;
+    stream->segs_right_edge = 0;
 }
 
 /** \internal
@@ -626,7 +617,7 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     seg->seq = TCP_GET_SEQ(p);
 
     /* proto detection skipped, but now we do get data. Set event. */
-    if (stream->seg_list == NULL &&
+    if (RB_EMPTY(&stream->seg_tree) &&
         stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED) {
 
         AppLayerDecoderEventsSetEventRaw(&p->app_layer_events,
@@ -797,9 +788,9 @@ int StreamNeedsReassembly(const TcpSession *ssn, uint8_t direction)
 
     uint64_t right_edge = STREAM_BASE_OFFSET(stream) + stream->sb.buf_offset;
 
-    SCLogDebug("%s: list %p app %"PRIu64" (use: %s), raw %"PRIu64" (use: %s). Stream right edge: %"PRIu64,
+    SCLogDebug("%s: tree %p app %"PRIu64" (use: %s), raw %"PRIu64" (use: %s). Stream right edge: %"PRIu64,
             dirstr,
-            stream->seg_list,
+            RB_ROOT(&stream->seg_tree),
             STREAM_APP_PROGRESS(stream), use_app ? "yes" : "no",
             STREAM_RAW_PROGRESS(stream), use_raw ? "yes" : "no",
             right_edge);
@@ -827,12 +818,10 @@ static uint64_t GetStreamSize(TcpStream *stream)
         uint64_t size = 0;
         uint32_t cnt = 0;
 
-        TcpSegment *seg = stream->seg_list;
-        while (seg) {
+        TcpSegment *seg;
+        RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
             cnt++;
             size += (uint64_t)TCP_SEG_LEN(seg);
-
-            seg = seg->next;
         }
 
         SCLogDebug("size %"PRIu64", cnt %"PRIu32, size, cnt);
@@ -866,7 +855,7 @@ static void GetAppBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data
     const uint8_t *mydata;
     uint32_t mydata_len;
 
-    if (stream->sb.block_list == NULL) {
+    if (RB_EMPTY(&stream->sb.sbb_tree)) {
         SCLogDebug("getting one blob");
 
         StreamingBufferGetDataAtOffset(&stream->sb, &mydata, &mydata_len, offset);
@@ -874,7 +863,7 @@ static void GetAppBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data
         *data = mydata;
         *data_len = mydata_len;
     } else {
-        StreamingBufferBlock *blk = stream->sb.block_list;
+        StreamingBufferBlock *blk = stream->sb.head;
 
         if (blk->offset > offset) {
             SCLogDebug("gap, want data at offset %"PRIu64", "
@@ -924,14 +913,14 @@ static inline bool CheckGap(TcpSession *ssn, TcpStream *stream, Packet *p)
              * is beyond next_seq, we only consider it a gap now if we do
              * already have data beyond the gap. */
             if (SEQ_GT(stream->last_ack, stream->next_seq)) {
-                if (stream->sb.block_list == NULL) {
+                if (RB_EMPTY(&stream->sb.sbb_tree)) {
                     SCLogDebug("packet %"PRIu64": no GAP. "
                             "next_seq %u < last_ack %u, but no data in list",
                             p->pcap_cnt, stream->next_seq, stream->last_ack);
                     return false;
                 } else {
                     uint64_t next_seq_abs = STREAM_BASE_OFFSET(stream) + (stream->next_seq - stream->base_seq);
-                    StreamingBufferBlock *blk = stream->sb.block_list;
+                    StreamingBufferBlock *blk = stream->sb.head;
                     if (blk->offset > next_seq_abs && blk->offset < last_ack_abs) {
                         /* ack'd data after the gap */
                         SCLogDebug("packet %"PRIu64": GAP. "
@@ -1073,14 +1062,14 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         SCReturnInt(0);
     }
 
-    SCLogDebug("stream->seg_list %p", stream->seg_list);
+    SCLogDebug("stream->seg_tree %p", RB_ROOT(&stream->seg_tree));
 #ifdef DEBUG
-    PrintList(stream->seg_list);
+    PrintList(stream);
     GetSessionSize(ssn, p);
 #endif
     /* if no segments are in the list or all are already processed,
      * and state is beyond established, we send an empty msg */
-    TcpSegment *seg_tail = stream->seg_list_tail;
+    TcpSegment *seg_tail = RB_MAX(TCPSEG, &stream->seg_tree);
     if (seg_tail == NULL ||
             SEGMENT_BEFORE_OFFSET(stream, seg_tail, STREAM_APP_PROGRESS(stream)))
     {
@@ -1110,7 +1099,7 @@ static int GetRawBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data_
 {
     const uint8_t *mydata;
     uint32_t mydata_len;
-    if (stream->sb.block_list == NULL) {
+    if (RB_EMPTY(&stream->sb.sbb_tree)) {
         SCLogDebug("getting one blob");
 
         uint64_t roffset = offset;
@@ -1124,8 +1113,12 @@ static int GetRawBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data_
         *data_len = mydata_len;
         *data_offset = roffset;
     } else {
-        if (*iter == NULL)
-            *iter = stream->sb.block_list;
+        if (*iter == NULL) {
+            /* first call: look up the block for offset in the tree */
+            StreamingBufferBlock key = { .offset = offset, .len = 0 };
+            *iter = SBB_RB_FIND_INCLUSIVE(&stream->sb.sbb_tree, &key);
+            SCLogDebug("*iter %p", *iter);
+        }
         if (*iter == NULL) {
             *data = NULL;
             *data_len = 0;
@@ -1135,7 +1128,7 @@ static int GetRawBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data_
 
         if (offset) {
             while (*iter && ((*iter)->offset + (*iter)->len < offset))
-                *iter = (*iter)->next;
+                *iter = SBB_RB_NEXT(*iter);
             if (*iter == NULL) {
                 *data = NULL;
                 *data_len = 0;
@@ -1144,7 +1137,7 @@ static int GetRawBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data_
             }
         }
 
-        SCLogDebug("getting multiple blobs. Iter %p, %"PRIu64"/%u (next? %s)", *iter, (*iter)->offset, (*iter)->len, (*iter)->next ? "yes":"no");
+        SCLogDebug("getting multiple blobs. Iter %p, %"PRIu64"/%u (next? %s)", *iter, (*iter)->offset, (*iter)->len, SBB_RB_NEXT(*iter) ? "yes":"no");
 
         StreamingBufferSBBGetData(&stream->sb, (*iter), &mydata, &mydata_len);
 
@@ -1166,7 +1159,7 @@ static int GetRawBuffer(TcpStream *stream, const uint8_t **data, uint32_t *data_
             *data_offset = (*iter)->offset;
         }
 
-        *iter = (*iter)->next;
+        *iter = SBB_RB_NEXT(*iter);
     }
     return 0;
 }
@@ -1187,7 +1180,7 @@ bool StreamReassembleRawHasDataReady(TcpSession *ssn, Packet *p)
         stream = &ssn->server;
     }
 
-    if (stream->seg_list == NULL) {
+    if (RB_EMPTY(&stream->seg_tree)) {
         return false;
     }
 
@@ -1349,24 +1342,25 @@ static int StreamReassembleRawInline(TcpSession *ssn, const Packet *p,
     /* simply return progress from the block we inspected. */
     bool return_progress = false;
 
-    if (stream->sb.block_list == NULL) {
+    if (RB_EMPTY(&stream->sb.sbb_tree)) {
         /* continues block */
         StreamingBufferGetData(&stream->sb, &mydata, &mydata_len, &mydata_offset);
         return_progress = true;
 
     } else {
         /* find our block */
-        StreamingBufferBlock *iter = stream->sb.block_list;
-        for ( ; iter != NULL; iter = iter->next) {
-            uint64_t iter_re_abs = iter->offset + iter->len;
-            DEBUG_VALIDATE_BUG_ON(packet_leftedge_abs < iter->offset &&
-                    packet_rightedge_abs > iter->offset &&
-                    packet_rightedge_abs < iter_re_abs);
-
-            if (iter->offset <= packet_leftedge_abs && iter_re_abs >= packet_rightedge_abs) {
-                StreamingBufferSBBGetData(&stream->sb, iter, &mydata, &mydata_len);
-                mydata_offset = iter->offset;
-                break;
+        StreamingBufferBlock key = { .offset = packet_leftedge_abs,
+                                     .len = p->payload_len };
+        StreamingBufferBlock *sbb = SBB_RB_FIND_INCLUSIVE(&stream->sb.sbb_tree, &key);
+        if (sbb) {
+            uint64_t sbb_re_abs = sbb->offset + sbb->len;
+            DEBUG_VALIDATE_BUG_ON(packet_leftedge_abs < sbb->offset &&
+                    packet_rightedge_abs > sbb->offset &&
+                    packet_rightedge_abs < sbb_re_abs);
+
+            if (sbb->offset <= packet_leftedge_abs && sbb_re_abs >= packet_rightedge_abs) {
+                StreamingBufferSBBGetData(&stream->sb, sbb, &mydata, &mydata_len);
+                mydata_offset = sbb->offset;
             }
         }
     }
@@ -1643,13 +1637,13 @@ static int StreamTcpReassembleHandleSegmentUpdateACK (ThreadVars *tv,
         TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream, Packet *p)
 {
     SCEnter();
-    SCLogDebug("stream->seg_list %p", stream->seg_list);
+    SCLogDebug("stream->seg_tree %p", RB_ROOT(&stream->seg_tree));
 
     int r = 0;
     if (StreamTcpReassembleAppLayer(tv, ra_ctx, ssn, stream, p, UPDATE_DIR_OPPOSING) < 0)
         r = -1;
 
-    SCLogDebug("stream->seg_list %p", stream->seg_list);
+    SCLogDebug("stream->seg_tree %p", RB_ROOT(&stream->seg_tree));
     SCReturnInt(r);
 }
 
@@ -1737,9 +1731,7 @@ TcpSegment *StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx)
            segment request due to memcap limit */
         StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
     } else {
-        seg->next = NULL;
-        seg->prev = NULL;
-
+        memset(&seg->rb, 0, sizeof(seg->rb));
         memset(&seg->sbseg, 0, sizeof(seg->sbseg));
     }
 
@@ -2181,8 +2173,8 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list != NULL ||
-        ssn->server.seg_list != NULL ||
+        !RB_EMPTY(&ssn->client.seg_tree) ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != 0) {
         printf("failure 1\n");
         goto end;
@@ -2204,8 +2196,8 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list != NULL ||
-        ssn->server.seg_list != NULL ||
+        !RB_EMPTY(&ssn->client.seg_tree) ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != 0) {
         printf("failure 2\n");
         goto end;
@@ -2228,8 +2220,8 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list != NULL ||
-        ssn->server.seg_list != NULL ||
+        !RB_EMPTY(&ssn->client.seg_tree) ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != 0) {
         printf("failure 3\n");
         goto end;
@@ -2253,9 +2245,9 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next != NULL ||
-        ssn->server.seg_list != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) != NULL ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != STREAM_TOSERVER) {
         printf("failure 4\n");
         goto end;
@@ -2279,9 +2271,9 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next != NULL ||
-        ssn->server.seg_list != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) != NULL ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != STREAM_TOSERVER) {
         printf("failure 5\n");
         goto end;
@@ -2316,10 +2308,10 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next != NULL ||
-        ssn->server.seg_list != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) != NULL ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != STREAM_TOSERVER) {
         printf("failure 6\n");
         goto end;
@@ -2385,11 +2377,11 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next != NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) != NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 7\n");
         goto end;
@@ -2412,11 +2404,11 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next != NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) != NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 8\n");
         goto end;
@@ -2439,10 +2431,10 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 9\n");
         goto end;
@@ -2465,10 +2457,10 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 10\n");
         goto end;
@@ -2491,10 +2483,10 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 11\n");
         goto end;
@@ -2519,11 +2511,11 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 12\n");
         goto end;
@@ -2547,11 +2539,11 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 13\n");
         goto end;
@@ -2574,12 +2566,12 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list == NULL ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next == NULL ||
-        ssn->client.seg_list->next->next->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        RB_EMPTY(&ssn->client.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)))) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 14\n");
         goto end;
@@ -2602,11 +2594,11 @@ static int StreamTcpReassembleTest39 (void)
         ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list->next == NULL ||
-        ssn->client.seg_list->next->next == NULL ||
-        ssn->client.seg_list->next->next->next == NULL ||
-        ssn->server.seg_list == NULL ||
-        ssn->server.seg_list->next != NULL ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))) == NULL ||
+        TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)))) == NULL ||
+        RB_EMPTY(&ssn->server.seg_tree) ||
+        TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER) {
         printf("failure 15\n");
         goto end;
@@ -2636,9 +2628,9 @@ static int StreamTcpReassembleTest39 (void)
         //ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)// ||
         //!FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         //!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        //ssn->client.seg_list != NULL ||
-        //ssn->server.seg_list == NULL ||
-        //ssn->server.seg_list->next != NULL ||
+        //!RB_EMPTY(&ssn->client.seg_tree) ||
+        //RB_EMPTY(&ssn->server.seg_tree) ||
+        //TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)) != NULL ||
         //ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER)
     {
         printf("failure 15\n");
@@ -2666,8 +2658,8 @@ static int StreamTcpReassembleTest39 (void)
         //ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOSERVER) || !FLOW_IS_PP_DONE(&f, STREAM_TOSERVER) ||
         !FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) || FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT) ||
-        ssn->client.seg_list != NULL ||
-        ssn->server.seg_list != NULL ||
+        !RB_EMPTY(&ssn->client.seg_tree) ||
+        !RB_EMPTY(&ssn->server.seg_tree) ||
         ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER
         ) {
         printf("failure 16\n");
@@ -2795,8 +2787,8 @@ static int StreamTcpReassembleTest40 (void)
     }
 
     /* check is have the segment in the list and flagged or not */
-    if (ssn.client.seg_list == NULL ||
-        SEGMENT_BEFORE_OFFSET(&ssn.client, ssn.client.seg_list, STREAM_APP_PROGRESS(&ssn.client)))
+    if (RB_EMPTY(&ssn.client.seg_tree) ||
+        SEGMENT_BEFORE_OFFSET(&ssn.client, RB_MIN(TCPSEG, &ssn.client.seg_tree), STREAM_APP_PROGRESS(&ssn.client)))
     {
         printf("the list is NULL or the processed segment has not been flaged (7): ");
         goto end;
@@ -3319,7 +3311,7 @@ static int StreamTcpReassembleInlineTest08(void)
     p->tcph->th_seq = htonl(17);
     StreamTcpPruneSession(&f, STREAM_TOSERVER);
 
-    FAIL_IF (ssn.client.seg_list->seq != 2);
+    FAIL_IF (RB_MIN(TCPSEG, &ssn.client.seg_tree)->seq != 2);
 
     FLOW_DESTROY(&f);
     UTHFreePacket(p);
@@ -3387,8 +3379,8 @@ static int StreamTcpReassembleInlineTest09(void)
 
     p->tcph->th_seq = htonl(12);
 
-    if (ssn.client.seg_list->seq != 2) {
-        printf("expected segment 1 (seq 2) to be first in the list, got seq %"PRIu32": ", ssn.client.seg_list->seq);
+    if (RB_MIN(TCPSEG, &ssn.client.seg_tree)->seq != 2) {
+        printf("expected segment 1 (seq 2) to be first in the list, got seq %"PRIu32": ", RB_MIN(TCPSEG, &ssn.client.seg_tree)->seq);
         goto end;
     }
 
@@ -201,19 +201,19 @@ static int StreamTcpUtilStreamTest01(void)
         goto end;
     }
 
-    TcpSegment *seg = stream.seg_list;
+    TcpSegment *seg = RB_MIN(TCPSEG, &stream.seg_tree);
     if (seg->seq != 2) {
         printf("first seg in the list should have seq 2: ");
         goto end;
     }
 
-    seg = seg->next;
+    seg = TCPSEG_RB_NEXT(seg);
     if (seg->seq != 7) {
         printf("first seg in the list should have seq 7: ");
         goto end;
     }
 
-    seg = seg->next;
+    seg = TCPSEG_RB_NEXT(seg);
     if (seg->seq != 12) {
         printf("first seg in the list should have seq 12: ");
         goto end;
@@ -251,19 +251,19 @@ static int StreamTcpUtilStreamTest02(void)
         goto end;
     }
 
-    TcpSegment *seg = stream.seg_list;
+    TcpSegment *seg = RB_MIN(TCPSEG, &stream.seg_tree);
     if (seg->seq != 2) {
         printf("first seg in the list should have seq 2: ");
         goto end;
     }
 
-    seg = seg->next;
+    seg = TCPSEG_RB_NEXT(seg);
     if (seg->seq != 7) {
         printf("first seg in the list should have seq 7: ");
         goto end;
     }
 
-    seg = seg->next;
+    seg = TCPSEG_RB_NEXT(seg);
     if (seg->seq != 12) {
         printf("first seg in the list should have seq 12: ");
         goto end;
@@ -2291,10 +2291,10 @@ static inline uint32_t StreamTcpResetGetMaxAck(TcpStream *stream, uint32_t seq)
 {
     uint32_t ack = seq;
 
-    if (stream->seg_list_tail != NULL) {
-        if (SEQ_GT((stream->seg_list_tail->seq + TCP_SEG_LEN(stream->seg_list_tail)), ack))
+    if (!RB_EMPTY(&stream->seg_tree)) {
+        if (SEQ_GT(stream->segs_right_edge, ack))
         {
-            ack = stream->seg_list_tail->seq + TCP_SEG_LEN(stream->seg_list_tail);
+            ack = stream->segs_right_edge;
         }
     }
 
@@ -5725,7 +5725,7 @@ void StreamTcpPseudoPacketCreateStreamEndPacket(ThreadVars *tv, StreamTcpThread
     }
 
     /* no need for a pseudo packet if there is nothing left to reassemble */
-    if (ssn->server.seg_list == NULL && ssn->client.seg_list == NULL) {
+    if (RB_EMPTY(&ssn->server.seg_tree) && RB_EMPTY(&ssn->client.seg_tree)) {
         SCReturn;
     }
 
@@ -5899,11 +5899,12 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
     }
 
     /* for IDS, return ack'd segments. For IPS all. */
-    TcpSegment *seg = stream->seg_list;
-    for (; seg != NULL &&
-            ((stream_config.flags & STREAMTCP_INIT_FLAG_INLINE)
-             || SEQ_LT(seg->seq, stream->last_ack));)
-    {
+    TcpSegment *seg;
+    RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+        if (!((stream_config.flags & STREAMTCP_INIT_FLAG_INLINE)
+                    || SEQ_LT(seg->seq, stream->last_ack)))
+            break;
+
         const uint8_t *seg_data;
         uint32_t seg_datalen;
         StreamingBufferSegmentGetData(&stream->sb, &seg->sbseg, &seg_data, &seg_datalen);
@@ -5913,7 +5914,6 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
             SCLogDebug("Callback function has failed");
             return -1;
         }
-        seg = seg->next;
         cnt++;
     }
     return cnt;
@@ -6579,7 +6579,7 @@ static int StreamTcpTest09 (void)
 
     FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
 
-    FAIL_IF(((TcpSession *) (p->flow->protoctx))->client.seg_list->next != NULL);
+    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &((TcpSession *) (p->flow->protoctx))->client.seg_tree)) != NULL);
 
     StreamTcpSessionClear(p->flow->protoctx);
     SCFree(p);
@@ -8261,8 +8261,8 @@ static int StreamTcpTest23(void)
 
     FAIL_IF(StreamTcpReassembleHandleSegment(&tv, stt.ra_ctx, &ssn, &ssn.client, p, &pq) == -1);
 
-    FAIL_IF(ssn.client.seg_list_tail == NULL);
-    FAIL_IF(TCP_SEG_LEN(ssn.client.seg_list_tail) != 2);
+    FAIL_IF(RB_EMPTY(&ssn.client.seg_tree));
+    FAIL_IF(TCP_SEG_LEN(RB_MAX(TCPSEG, &ssn.client.seg_tree)) != 2);
 
     StreamTcpUTClearSession(&ssn);
     SCFree(p);
@@ -8326,8 +8326,8 @@ static int StreamTcpTest24(void)
 
     FAIL_IF(StreamTcpReassembleHandleSegment(&tv, stt.ra_ctx, &ssn, &ssn.client, p, &pq) == -1);
 
-    FAIL_IF(ssn.client.seg_list_tail == NULL);
-    FAIL_IF(TCP_SEG_LEN(ssn.client.seg_list_tail) != 4);
+    FAIL_IF(RB_EMPTY(&ssn.client.seg_tree));
+    FAIL_IF(TCP_SEG_LEN(RB_MAX(TCPSEG, &ssn.client.seg_tree)) != 4);
 
     StreamTcpUTClearSession(&ssn);
     SCFree(p);
@@ -8911,7 +8911,7 @@ static int StreamTcpTest30(void)
 
     if (StreamTcpCheckStreamContents(expected_content, 9, &ssn.client) != 1) {
         printf("the contents are not as expected(GET /EVIL), contents are: ");
-        PrintRawDataFp(stdout, ssn.client.seg_list->payload, 9);
+        PrintRawDataFp(stdout, RB_MIN(TCPSEG, &ssn.client.seg_tree)->payload, 9);
         result &= 0;
         goto end;
     }
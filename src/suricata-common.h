@@ -180,6 +180,8 @@
 #include <netdb.h>
 #endif
 
+/* the eBPF code needs linux/bpf.h, which conflicts with pcap's bpf.h */
+#ifndef SC_PCAP_DONT_INCLUDE_PCAP_H
 #ifdef HAVE_PCAP_H
 #include <pcap.h>
 #endif
@@ -187,10 +189,13 @@
 #ifdef HAVE_PCAP_PCAP_H
 #include <pcap/pcap.h>
 #endif
+#endif
 
+#ifndef PCAP_DONT_INCLUDE_PCAP_BPF_H
 #ifdef HAVE_PCAP_BPF_H
 #include <pcap/bpf.h>
 #endif
+#endif
 
 #if __CYGWIN__
 #if !defined _X86_ && !defined __x86_64
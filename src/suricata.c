@@ -48,6 +48,7 @@
 #include "util-atomic.h"
 #include "util-spm.h"
 #include "util-cpu.h"
+#include "util-affinity.h"
 #include "util-action.h"
 #include "util-pidfile.h"
 #include "util-ioctl.h"
@@ -63,6 +64,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-state.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -99,7 +101,10 @@
 
 #include "flow.h"
 #include "flow-timeout.h"
+#include "flow-hash.h"
 #include "flow-manager.h"
+#include "flow-bypass.h"
+#include "util-ebpf.h"
 #include "flow-var.h"
 #include "flow-bit.h"
 #include "pkt-var.h"
@@ -414,6 +419,9 @@ static void GlobalsDestroy(SCInstance *suri)
 #ifdef HAVE_AF_PACKET
     AFPPeersListClean();
 #endif
+#ifdef HAVE_PACKET_EBPF
+    EBPFDeinit();
+#endif
 
     SC_ATOMIC_DESTROY(engine_stage);
 
@@ -894,6 +902,7 @@ void RegisterAllModules(void)
     /* managers */
     TmModuleFlowManagerRegister();
     TmModuleFlowRecyclerRegister();
+    TmModuleBypassedFlowManagerRegister();
     /* nfq */
     TmModuleReceiveNFQRegister();
     TmModuleVerdictNFQRegister();
@@ -2213,6 +2222,7 @@ void PreRunInit(const int runmode)
         return;
 
     StatsInit();
+    AffinitySetupNumaFromConfig();
 #ifdef PROFILING
     SCProfilingRulesGlobalInit();
     SCProfilingKeywordsGlobalInit();
@@ -2226,6 +2236,7 @@ void PreRunInit(const int runmode)
     StreamTcpInitConfig(STREAM_VERBOSE);
     AppLayerParserPostStreamSetup();
     AppLayerRegisterGlobalCounters();
+    DeStateRegisterGlobalCounters();
 }
 
 /* tasks we need to run before packets start flowing,
@@ -2280,6 +2291,7 @@ void PostRunDeinit(const int runmode, struct timeval *start_time)
     StreamTcpFreeConfig(STREAM_VERBOSE);
     DefragDestroy();
     TmqResetQueues();
+    TmqhFlowResetQueues();
 #ifdef PROFILING
     if (profiling_rules_enabled)
         SCProfilingDump();
@@ -2895,6 +2907,7 @@ int main(int argc, char **argv)
 
     (void) SC_ATOMIC_CAS(&engine_stage, SURICATA_INIT, SURICATA_RUNTIME);
     PacketPoolPostRunmodes();
+    FlowHashSetupPartitions();
 
     /* Un-pause all the paused threads */
     TmThreadContinueThreads();
@@ -708,6 +708,114 @@ static int StreamTcpReassembleTest32(void)
     OVERLAP_END;
 }
 
+/** \test many small out of order segments.
+ *
+ *  First every other slot is filled in order, which appends to the tree,
+ *  then the gaps are filled in order, which inserts in front of segments
+ *  already in the tree. After each batch the tree has to hold all the
+ *  segments added so far, in SEQ order, and the right edge has to be the
+ *  end of the highest segment.
+ *
+ *  The cost per segment as the stream grows is measured by
+ *  qa/tcp-segment-storm-benchmark.py.
+ */
+static int StreamTcpReassembleTest33(void)
+{
+#define STRESS_SEGS 8192
+#define STRESS_BATCH 1024
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 0);
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < STRESS_SEGS / STRESS_BATCH; i++) {
+            for (int j = 0; j < STRESS_BATCH; j++) {
+                uint32_t seq = 1 + ((i * STRESS_BATCH + j) * 2) + pass;
+                FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream,
+                            seq, pass ? 'B' : 'A', 1) != 0);
+            }
+
+            uint32_t in_tree = 0;
+            TcpSegment *seg = NULL, *prev = NULL;
+            RB_FOREACH(seg, TCPSEG, &stream.seg_tree) {
+                FAIL_IF(prev != NULL && SEQ_LEQ(seg->seq, prev->seq));
+                prev = seg;
+                in_tree++;
+            }
+            FAIL_IF(in_tree != (uint32_t)((pass * STRESS_SEGS) + ((i + 1) * STRESS_BATCH)));
+            /* the highest segment is the last one added, unless the first
+             * pass already went past it */
+            uint32_t last = 1 + ((i + 1) * STRESS_BATCH - 1) * 2 + pass;
+            if (pass && last < STRESS_SEGS * 2 - 1)
+                last = STRESS_SEGS * 2 - 1;
+            FAIL_IF_NULL(prev);
+            FAIL_IF(prev->seq != last);
+            FAIL_IF(stream.segs_right_edge != last + 1);
+        }
+    }
+
+    uint8_t expect[STRESS_SEGS * 2];
+    for (int i = 0; i < STRESS_SEGS; i++) {
+        expect[i * 2] = 'A';
+        expect[i * 2 + 1] = 'B';
+    }
+    FAIL_IF(StreamingBufferCompareRawData(&stream.sb, expect, sizeof(expect)) == 0);
+
+    uint32_t cnt = 0;
+    TcpSegment *seg = NULL, *prev = NULL;
+    RB_FOREACH(seg, TCPSEG, &stream.seg_tree) {
+        FAIL_IF(prev != NULL && SEQ_LEQ(seg->seq, prev->seq));
+        prev = seg;
+        cnt++;
+    }
+    FAIL_IF(cnt != STRESS_SEGS * 2);
+
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+#undef STRESS_SEGS
+#undef STRESS_BATCH
+}
+
+/** \test exact duplicates are not added to the tree */
+static int StreamTcpReassembleTest34(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpStream stream;
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupStream(&stream, 0);
+    stream.os_policy = OS_POLICY_BSD;
+
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 5, 'B', 4) != 0);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 1, 'A', 4) != 0);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 5, 'C', 4) != 0);
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 5, 'D', 2) != 0);
+
+    FAIL_IF(VALIDATE(&stream, (uint8_t *)"AAAABBBB", 8) == 0);
+
+    TcpSegment *seg = RB_MIN(TCPSEG, &stream.seg_tree);
+    FAIL_IF_NULL(seg);
+    FAIL_IF(seg->seq != 1);
+    seg = TCPSEG_RB_NEXT(seg);
+    FAIL_IF_NULL(seg);
+    FAIL_IF(seg->seq != 5 || TCP_SEG_LEN(seg) != 2);
+    seg = TCPSEG_RB_NEXT(seg);
+    FAIL_IF_NULL(seg);
+    FAIL_IF(seg->seq != 5 || TCP_SEG_LEN(seg) != 4);
+    FAIL_IF_NOT_NULL(TCPSEG_RB_NEXT(seg));
+
+    StreamTcpUTClearStream(&stream);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 void StreamTcpListRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleTest01 -- BSD policy",
@@ -729,5 +837,9 @@ void StreamTcpListRegisterTests(void)
             StreamTcpReassembleTest31);
     UtRegisterTest("StreamTcpReassembleTest32",
             StreamTcpReassembleTest32);
+    UtRegisterTest("StreamTcpReassembleTest33 -- segment tree stress",
+            StreamTcpReassembleTest33);
+    UtRegisterTest("StreamTcpReassembleTest34 -- duplicate segments",
+            StreamTcpReassembleTest34);
 
 }
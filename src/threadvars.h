@@ -76,6 +76,10 @@ typedef struct ThreadVars_ {
     /** queue handlers */
     struct Packet_ * (*tmqh_in)(struct ThreadVars_ *);
     void (*InShutdownHandler)(struct ThreadVars_ *);
+    /** optional: setup of the input queue for this thread, e.g. counters */
+    void (*InThreadInit)(struct ThreadVars_ *);
+    /** optional: packets pending for this thread outside of its trans_q */
+    uint32_t (*InQueueLen)(struct ThreadVars_ *);
     void (*tmqh_out)(struct ThreadVars_ *, struct Packet_ *);
 
     /** slot functions */
@@ -93,6 +97,9 @@ typedef struct ThreadVars_ {
     uint16_t cpu_affinity; /** cpu or core number to set affinity to */
     uint16_t rank;
     int thread_priority; /** priority (real time) for this thread. Look at threads.h */
+    /** NUMA node to keep the thread on, set to the node the thread runs
+     *  on by TmThreadSetupOptions. -1 if unknown */
+    int numa_node;
 
     /* counters */
 
@@ -107,6 +114,11 @@ typedef struct ThreadVars_ {
 
     uint8_t cap_flags; /**< Flags to indicate the capabilities of all the
                             TmModules resgitered under this thread */
+
+    /** set by the capture method if all packets of a flow are guaranteed
+     *  to be handled by this thread. See FlowHashRegisterThread(). */
+    uint8_t flow_affinity;
+
     struct ThreadVars_ *next;
     struct ThreadVars_ *prev;
 } ThreadVars;
@@ -115,6 +127,7 @@ typedef struct ThreadVars_ {
 #define THREAD_SET_AFFINITY     0x01 /** CPU/Core affinity */
 #define THREAD_SET_PRIORITY     0x02 /** Real time priority */
 #define THREAD_SET_AFFTYPE      0x04 /** Priority and affinity */
+#define THREAD_SET_NUMA         0x08 /** NUMA node */
 
 #endif /* __THREADVARS_H__ */
 
@@ -48,6 +48,7 @@ void TmqhSetup (void)
 /** \brief Clean up registration time allocs */
 void TmqhCleanup(void)
 {
+    TmqhFlowResetQueues();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(const char *name)
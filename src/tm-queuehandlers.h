@@ -29,6 +29,7 @@ enum {
     TMQH_NFQ,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_FLOW_RING,
 
     TMQH_SIZE,
 };
@@ -37,6 +38,8 @@ typedef struct Tmqh_ {
     const char *name;
     Packet *(*InHandler)(ThreadVars *);
     void (*InShutdownHandler)(ThreadVars *);
+    void (*InThreadInit)(ThreadVars *);
+    uint32_t (*InQueueLen)(ThreadVars *);
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(const char *);
     void (*OutHandlerCtxFree)(void *);
@@ -64,6 +64,7 @@ typedef enum {
 
     TMM_FLOWMANAGER,
     TMM_FLOWRECYCLER,
+    TMM_BYPASSEDFLOWMANAGER,
     TMM_DETECTLOADER,
 
     TMM_UNIXMANAGER,
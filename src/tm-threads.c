@@ -173,6 +173,119 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief return all queued packets of the slots to the pool after a
+ *         failure in TmThreadsSlotProcessPktBatch()
+ */
+static void TmThreadsSlotBatchFailed(ThreadVars *tv, TmSlot *s)
+{
+    TmSlot *slot;
+    for (slot = s; slot != NULL; slot = slot->slot_next) {
+        TmqhReleasePacketsToPacketPool(&slot->slot_pre_pq);
+
+        SCMutexLock(&slot->slot_post_pq.mutex_q);
+        TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+        SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+    }
+    TmThreadsSetFlag(tv, THV_FAILED);
+}
+
+/**
+ *  \brief Process a batch of packets through the slots and queue them.
+ *
+ *  Unlike TmThreadsSlotProcessPkt(), each slot handles all packets of the
+ *  batch before the next slot runs, so the code and data of a slot stay
+ *  hot in the cpu caches. Packets a slot adds to its pre queue (tunnels,
+ *  defrag) are placed in front of the packet that created them, so every
+ *  slot still sees the packets in the order it would see them one by one.
+ *  Only if a slot adds more packets than the batch has room for, these
+ *  are run through the remaining slots right away.
+ *
+ *  \param s first slot to run
+ *  \param pkts packets to process, the array is not modified
+ *  \param cnt number of packets, at most TM_BATCH_SIZE_MAX
+ *
+ *  \retval TM_ECODE_OK or TM_ECODE_FAILED. In both cases the caller no
+ *          longer owns the packets.
+ */
+TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *s, Packet **pkts, uint32_t cnt)
+{
+    /* room for the packets plus the ones the slots add */
+    Packet *vec[2][TM_BATCH_SIZE_MAX * 2];
+    Packet **in = pkts;
+    uint32_t in_cnt = cnt;
+    uint32_t i, j;
+    int v = 0;
+    TmSlot *slot;
+
+    BUG_ON(cnt > TM_BATCH_SIZE_MAX);
+
+    for (slot = s; slot != NULL; slot = slot->slot_next) {
+        TmSlotFunc SlotFunc = SC_ATOMIC_GET(slot->SlotFunc);
+        void *slot_data = SC_ATOMIC_GET(slot->slot_data);
+        PacketQueue *post_pq = unlikely(slot->id == 0) ? &slot->slot_post_pq : NULL;
+        Packet **out = vec[v];
+        uint32_t out_cnt = 0;
+
+        for (i = 0; i < in_cnt; i++) {
+            Packet *p = in[i];
+
+            PACKET_PROFILING_TMM_START(p, slot->tm_id);
+            TmEcode r = SlotFunc(tv, p, slot_data, &slot->slot_pre_pq, post_pq);
+            PACKET_PROFILING_TMM_END(p, slot->tm_id);
+
+            if (unlikely(r == TM_ECODE_FAILED)) {
+                goto failed;
+            }
+
+            /* handle new packets */
+            while (slot->slot_pre_pq.top != NULL) {
+                Packet *extra_p = PacketDequeue(&slot->slot_pre_pq);
+                if (unlikely(extra_p == NULL))
+                    continue;
+
+                /* keep room for the rest of this slot's input */
+                if (out_cnt + (in_cnt - i) < TM_BATCH_SIZE_MAX * 2) {
+                    out[out_cnt++] = extra_p;
+                    continue;
+                }
+
+                /* batch is full, finish this packet the old way */
+                if (slot->slot_next != NULL) {
+                    r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
+                    if (unlikely(r == TM_ECODE_FAILED)) {
+                        TmqhOutputPacketpool(tv, extra_p);
+                        goto failed;
+                    }
+                }
+                tv->tmqh_out(tv, extra_p);
+            }
+
+            out[out_cnt++] = p;
+            continue;
+
+failed:
+            for (j = i; j < in_cnt; j++)
+                TmqhOutputPacketpool(tv, in[j]);
+            for (j = 0; j < out_cnt; j++)
+                TmqhOutputPacketpool(tv, out[j]);
+            TmThreadsSlotBatchFailed(tv, s);
+            return TM_ECODE_FAILED;
+        }
+
+        in = out;
+        in_cnt = out_cnt;
+        v ^= 1;
+    }
+
+    for (i = 0; i < in_cnt; i++) {
+        tv->tmqh_out(tv, in[i]);
+    }
+
+    /* post process pq */
+    return TmThreadsSlotProcessPostPq(tv, s);
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -320,6 +433,7 @@ static void *TmThreadsSlotPktAcqLoop(void *td)
         }
     }
 
+    PacketPoolRegisterCounters(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -444,6 +558,7 @@ static void *TmThreadsSlotPktAcqLoopAFL(void *td)
         }
     }
 
+    PacketPoolRegisterCounters(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -564,6 +679,9 @@ static void *TmThreadsSlotVar(void *td)
         }
     }
 
+    if (tv->InThreadInit != NULL)
+        tv->InThreadInit(tv);
+    PacketPoolRegisterCounters(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -1043,6 +1161,25 @@ TmEcode TmThreadSetCPU(ThreadVars *tv, uint8_t type)
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Keep the thread on a NUMA node
+ *
+ * Only used if threading.numa.enabled is set. The cpus of the thread are
+ * limited to the node and its memory is allocated on the node.
+ *
+ * \param node NUMA node, -1 for none
+ */
+TmEcode TmThreadSetNumaNode(ThreadVars *tv, int node)
+{
+    if (node < 0)
+        return TM_ECODE_OK;
+
+    tv->thread_setup_flags |= THREAD_SET_NUMA;
+    tv->numa_node = node;
+
+    return TM_ECODE_OK;
+}
+
 int TmThreadGetNbThreads(uint8_t type)
 {
     if (type >= MAX_CPU_SET) {
@@ -1061,21 +1198,31 @@ int TmThreadGetNbThreads(uint8_t type)
  */
 TmEcode TmThreadSetupOptions(ThreadVars *tv)
 {
+    int numa_node = -1;
+
     if (tv->thread_setup_flags & THREAD_SET_AFFINITY) {
         SCLogPerf("Setting affinity for thread \"%s\"to cpu/core "
                   "%"PRIu16", thread id %lu", tv->name, tv->cpu_affinity,
                   SCGetThreadIdLong());
         SetCPUAffinity(tv->cpu_affinity);
+        numa_node = AffinityGetCPUNumaNode(tv->cpu_affinity);
     }
 
 #if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+    cpu_set_t node_cs;
+
     if (tv->thread_setup_flags & THREAD_SET_PRIORITY)
         TmThreadSetPrio(tv);
     if (tv->thread_setup_flags & THREAD_SET_AFFTYPE) {
         ThreadsAffinityType *taf = &thread_affinity[tv->cpu_affinity];
         if (taf->mode_flag == EXCLUSIVE_AFFINITY) {
-            int cpu = AffinityGetNextCPU(taf);
+            int cpu;
+            if (tv->numa_node >= 0 && AffinityNumaEnabled())
+                cpu = AffinityGetNextCPUOnNode(taf, tv->numa_node);
+            else
+                cpu = AffinityGetNextCPU(taf);
             SetCPUAffinity(cpu);
+            numa_node = AffinityGetCPUNumaNode(cpu);
             /* If CPU is in a set overwrite the default thread prio */
             if (CPU_ISSET(cpu, &taf->lowprio_cpu)) {
                 tv->thread_priority = PRIO_LOW;
@@ -1090,16 +1237,33 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
                       "%d, thread id %lu", tv->thread_priority,
                       tv->name, cpu, SCGetThreadIdLong());
         } else {
-            SetCPUAffinitySet(&taf->cpu_set);
+            if (AffinityGetNumaNodeCpuset(tv->numa_node, &taf->cpu_set, &node_cs) > 0) {
+                SetCPUAffinitySet(&node_cs);
+                numa_node = tv->numa_node;
+            } else {
+                SetCPUAffinitySet(&taf->cpu_set);
+            }
             tv->thread_priority = taf->prio;
             SCLogPerf("Setting prio %d for thread \"%s\", "
                       "thread id %lu", tv->thread_priority,
                       tv->name, SCGetThreadIdLong());
         }
         TmThreadSetPrio(tv);
+    } else if (!(tv->thread_setup_flags & THREAD_SET_AFFINITY) &&
+            AffinityGetNumaNodeCpuset(tv->numa_node, NULL, &node_cs) > 0) {
+        SCLogPerf("Keeping thread \"%s\" on NUMA node %d, thread id %lu",
+                  tv->name, tv->numa_node, SCGetThreadIdLong());
+        SetCPUAffinitySet(&node_cs);
+        numa_node = tv->numa_node;
     }
 #endif
 
+    /* allocate the thread's packet pool and contexts on its node */
+    if (numa_node >= 0) {
+        AffinitySetThreadMemoryNode(numa_node);
+    }
+    tv->numa_node = numa_node;
+
     return TM_ECODE_OK;
 }
 
@@ -1133,6 +1297,7 @@ ThreadVars *TmThreadCreate(const char *name, const char *inq_name, const char *i
     if (unlikely(tv == NULL))
         goto error;
     memset(tv, 0, sizeof(ThreadVars));
+    tv->numa_node = -1;
 
     SC_ATOMIC_INIT(tv->flags);
     SCMutexInit(&tv->perf_public_ctx.m, NULL);
@@ -1168,6 +1333,8 @@ ThreadVars *TmThreadCreate(const char *name, const char *inq_name, const char *i
 
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
+        tv->InThreadInit = tmqh->InThreadInit;
+        tv->InQueueLen = tmqh->InQueueLen;
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
     }
 
@@ -1424,6 +1591,18 @@ void TmThreadRemove(ThreadVars *tv, int type)
     return;
 }
 
+/**
+ * \brief Number of packets waiting in the input queue of a thread,
+ *        including those its queue handler keeps outside of trans_q.
+ */
+static uint32_t TmThreadInQueueLen(ThreadVars *tv)
+{
+    uint32_t len = trans_q[tv->inq->id].len;
+    if (tv->InQueueLen != NULL)
+        len += tv->InQueueLen(tv);
+    return len;
+}
+
 /**
  * \brief Kill a thread.
  *
@@ -1450,8 +1629,7 @@ static int TmThreadKillThread(ThreadVars *tv)
          * packet acquire by now using TmThreadDisableReceiveThreads()*/
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
-            PacketQueue *q = &trans_q[tv->inq->id];
-            if (q->len != 0) {
+            if (TmThreadInQueueLen(tv) != 0) {
                 return 0;
             }
         }
@@ -1536,8 +1714,7 @@ again:
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (TmThreadInQueueLen(tv) != 0) {
                     SCMutexUnlock(&tv_root_lock);
 
                     total_wait_time += WAIT_TIME;
@@ -1611,8 +1788,7 @@ again:
                  * packet acquire by now using TmThreadDisableReceiveThreads()*/
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                    PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (TmThreadInQueueLen(tv) != 0) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1700,8 +1876,7 @@ again:
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (TmThreadInQueueLen(tv) != 0) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
@@ -38,6 +38,7 @@
 
 #include "conf.h"
 #include "util-unittest.h"
+#include "util-optimize.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
@@ -46,6 +47,23 @@ void *TmqhOutputFlowSetupCtx(const char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
 
+Packet *TmqhInputFlowRing(ThreadVars *t);
+void TmqhOutputFlowRingHash(ThreadVars *t, Packet *p);
+void TmqhOutputFlowRingIPPair(ThreadVars *t, Packet *p);
+void *TmqhOutputFlowRingSetupCtx(const char *queue_str);
+static void TmqhFlowInThreadInit(ThreadVars *tv);
+static uint32_t TmqhFlowRingQueueLen(ThreadVars *tv);
+
+/** per worker queue state, indexed by queue id. Created at setup time
+ *  under flow_queues_lock, freed by TmqhFlowResetQueues. */
+static TmqhFlowQueue *flow_queues[256];
+static SCMutex flow_queues_lock = SCMUTEX_INITIALIZER;
+
+/** 'autofp-queue.type' is "ring" */
+static int flow_ring_enabled = 0;
+/** number of times an idle worker polls its rings before it sleeps */
+static uint32_t flow_ring_busy_poll = 0;
+
 void TmqhFlowRegister(void)
 {
     tmqh_table[TMQH_FLOW].name = "flow";
@@ -53,6 +71,35 @@ void TmqhFlowRegister(void)
     tmqh_table[TMQH_FLOW].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
     tmqh_table[TMQH_FLOW].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
     tmqh_table[TMQH_FLOW].RegisterTests = TmqhFlowRegisterTests;
+    tmqh_table[TMQH_FLOW].InThreadInit = TmqhFlowInThreadInit;
+
+    tmqh_table[TMQH_FLOW_RING].name = "flow-ring";
+    tmqh_table[TMQH_FLOW_RING].InHandler = TmqhInputFlowRing;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxSetup = TmqhOutputFlowRingSetupCtx;
+    tmqh_table[TMQH_FLOW_RING].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
+    tmqh_table[TMQH_FLOW_RING].InThreadInit = TmqhFlowInThreadInit;
+    tmqh_table[TMQH_FLOW_RING].InQueueLen = TmqhFlowRingQueueLen;
+
+    const char *type = NULL;
+    if (ConfGet("autofp-queue.type", &type) == 1) {
+        if (strcasecmp(type, "ring") == 0) {
+            flow_ring_enabled = 1;
+        } else if (strcasecmp(type, "mutex") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue.type in conf.  Killing engine.",
+                       type);
+            exit(EXIT_FAILURE);
+        }
+    }
+    intmax_t busy_poll = 0;
+    if (ConfGetInt("autofp-queue.busy-poll", &busy_poll) == 1) {
+        if (busy_poll < 0 || busy_poll > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry "
+                       "for autofp-queue.busy-poll in conf.  Killing engine.");
+            exit(EXIT_FAILURE);
+        }
+        flow_ring_busy_poll = (uint32_t)busy_poll;
+    }
 
     const char *scheduler = NULL;
     if (ConfGet("autofp-scheduler", &scheduler) == 1) {
@@ -76,9 +123,23 @@ void TmqhFlowRegister(void)
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
     }
 
+    if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowIPPair)
+        tmqh_table[TMQH_FLOW_RING].OutHandler = TmqhOutputFlowRingIPPair;
+    else
+        tmqh_table[TMQH_FLOW_RING].OutHandler = TmqhOutputFlowRingHash;
+
     return;
 }
 
+/**
+ * \brief name of the queue handler the autofp runmodes should use
+ *        between the capture threads and the workers
+ */
+const char *TmqhFlowGetQueueHandlerName(void)
+{
+    return flow_ring_enabled ? "flow-ring" : "flow";
+}
+
 void TmqhFlowPrintAutofpHandler(void)
 {
 #define PRINT_IF_FUNC(f, msg)                       \
@@ -89,22 +150,99 @@ void TmqhFlowPrintAutofpHandler(void)
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
 
 #undef PRINT_IF_FUNC
+
+    if (flow_ring_enabled) {
+        SCLogConfig("AutoFP mode using lock-free rings, busy poll %u",
+                flow_ring_busy_poll);
+    }
+}
+
+/** \brief get the state of a worker queue, creating it if needed */
+static TmqhFlowQueue *TmqhFlowGetQueue(uint16_t id)
+{
+    SCMutexLock(&flow_queues_lock);
+    TmqhFlowQueue *fq = flow_queues[id];
+    if (fq == NULL) {
+        fq = SCMallocAligned(sizeof(TmqhFlowQueue), CLS);
+        if (fq != NULL) {
+            memset(fq, 0x00, sizeof(TmqhFlowQueue));
+            SC_ATOMIC_INIT(fq->sleeping);
+            SC_ATOMIC_INIT(fq->rings_cnt);
+            flow_queues[id] = fq;
+        }
+    }
+    SCMutexUnlock(&flow_queues_lock);
+    return fq;
+}
+
+/** \brief free all rings and worker queue state
+ *
+ *  Must only be called when no packet threads are running.
+ */
+void TmqhFlowResetQueues(void)
+{
+    uint32_t i;
+
+    SCMutexLock(&flow_queues_lock);
+    for (i = 0; i < sizeof(flow_queues) / sizeof(flow_queues[0]); i++) {
+        TmqhFlowQueue *fq = flow_queues[i];
+        if (fq == NULL)
+            continue;
+
+        uint16_t r;
+        for (r = 0; r < SC_ATOMIC_GET(fq->rings_cnt); r++) {
+            SCFree(fq->rings[r]->slots);
+            SCFreeAligned(fq->rings[r]);
+        }
+        SC_ATOMIC_DESTROY(fq->sleeping);
+        SC_ATOMIC_DESTROY(fq->rings_cnt);
+        SCFreeAligned(fq);
+        flow_queues[i] = NULL;
+    }
+    SCMutexUnlock(&flow_queues_lock);
+}
+
+static void TmqhFlowInThreadInit(ThreadVars *tv)
+{
+    TmqhFlowQueue *fq = TmqhFlowGetQueue(tv->inq->id);
+    if (fq == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc autofp queue state");
+        exit(EXIT_FAILURE);
+    }
+
+    fq->counter_depth = StatsRegisterAvgCounter("autofp.queue_depth", tv);
+    fq->counter_depth_max = StatsRegisterMaxCounter("autofp.queue_depth_max", tv);
+    fq->counter_sleep = StatsRegisterCounter("autofp.queue_sleep", tv);
+}
+
+static inline void TmqhFlowQueueDepth(ThreadVars *tv, TmqhFlowQueue *fq,
+        uint32_t depth)
+{
+    if (fq == NULL || fq->counter_depth == 0)
+        return;
+
+    StatsAddUI64(tv, fq->counter_depth, depth);
+    StatsSetUI64(tv, fq->counter_depth_max, depth);
 }
 
 /* same as 'simple' */
 Packet *TmqhInputFlow(ThreadVars *tv)
 {
     PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhFlowQueue *fq = flow_queues[tv->inq->id];
 
     StatsSyncCountersIfSignalled(tv);
 
     SCMutexLock(&q->mutex_q);
     if (q->len == 0) {
+        if (fq != NULL && fq->counter_sleep != 0)
+            StatsIncr(tv, fq->counter_sleep);
         /* if we have no packets in queue, wait... */
         SCCondWait(&q->cond_q, &q->mutex_q);
     }
 
     if (q->len > 0) {
+        TmqhFlowQueueDepth(tv, fq, q->len);
         Packet *p = PacketDequeue(q);
         SCMutexUnlock(&q->mutex_q);
         return p;
@@ -220,12 +358,10 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
-void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
+static inline int16_t TmqhFlowHashQueueId(TmqhFlowCtx *ctx, const Packet *p)
 {
     int16_t qid = 0;
 
-    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
-
     if (p->flags & PKT_WANTS_FLOW) {
         uint32_t hash = p->flow_hash;
         qid = hash % ctx->size;
@@ -235,6 +371,34 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
         if (ctx->last == ctx->size)
             ctx->last = 0;
     }
+    return qid;
+}
+
+/**
+ * \brief select the queue to output based on IP address pair.
+ */
+static inline int16_t TmqhFlowIPPairQueueId(TmqhFlowCtx *ctx, const Packet *p)
+{
+    uint32_t addr_hash = 0;
+    int i;
+
+    if (p->src.family == AF_INET6) {
+        for (i = 0; i < 4; i++) {
+            addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
+        }
+    } else {
+        addr_hash = p->src.addr_data32[0] + p->dst.addr_data32[0];
+    }
+
+    /* we don't have to worry about possible overflow, since
+     * ctx->size will be lesser than 2 ** 31 for sure */
+    return addr_hash % ctx->size;
+}
+
+void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    int16_t qid = TmqhFlowHashQueueId(ctx, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -253,31 +417,261 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
  */
 void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
 {
-    int16_t qid = 0;
-    uint32_t addr_hash = 0;
-    int i;
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    int16_t qid = TmqhFlowIPPairQueueId(ctx, p);
 
+    PacketQueue *q = ctx->queues[qid].q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+
+    return;
+}
+
+/**
+ * \brief create a ring from the calling capture thread to a worker queue
+ *
+ * The ring has room for more packets than the capture thread's packet
+ * pool holds, so normally it can't fill up.
+ */
+static TmqhFlowRing *TmqhFlowRingRegister(uint16_t id)
+{
+    extern intmax_t max_pending_packets;
+
+    TmqhFlowQueue *fq = TmqhFlowGetQueue(id);
+    if (fq == NULL)
+        return NULL;
+
+    uint32_t size = 64;
+    while (size <= (uint32_t)max_pending_packets)
+        size <<= 1;
+
+    TmqhFlowRing *ring = SCMallocAligned(sizeof(TmqhFlowRing), CLS);
+    if (unlikely(ring == NULL))
+        return NULL;
+    memset(ring, 0x00, sizeof(TmqhFlowRing));
+    SC_ATOMIC_INIT(ring->prod.tail);
+    SC_ATOMIC_INIT(ring->cons.head);
+    ring->mask = size - 1;
+    ring->fq = fq;
+    ring->slots = SCCalloc(size, sizeof(Packet *));
+    if (unlikely(ring->slots == NULL)) {
+        SCFreeAligned(ring);
+        return NULL;
+    }
+
+    SCMutexLock(&flow_queues_lock);
+    uint16_t cnt = SC_ATOMIC_GET(fq->rings_cnt);
+    if (cnt == TMQH_FLOW_RING_MAX_WRITERS) {
+        SCMutexUnlock(&flow_queues_lock);
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "too many writers for queue %u, "
+                "max %u", id, TMQH_FLOW_RING_MAX_WRITERS);
+        SCFree(ring->slots);
+        SCFreeAligned(ring);
+        return NULL;
+    }
+    fq->rings[cnt] = ring;
+    /* publish the ring to the worker */
+    (void)SC_ATOMIC_ADD(fq->rings_cnt, 1);
+    SCMutexUnlock(&flow_queues_lock);
+
+    return ring;
+}
+
+void *TmqhOutputFlowRingSetupCtx(const char *queue_str)
+{
+    TmqhFlowCtx *ctx = TmqhOutputFlowSetupCtx(queue_str);
+    if (ctx == NULL)
+        return NULL;
+
+    uint16_t i;
+    for (i = 0; i < ctx->size; i++) {
+        uint16_t id = (uint16_t)(ctx->queues[i].q - trans_q);
+        ctx->queues[i].ring = TmqhFlowRingRegister(id);
+        if (ctx->queues[i].ring == NULL) {
+            TmqhOutputFlowFreeCtx(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+/**
+ * \brief add a packet to the ring and wake up the worker if it sleeps
+ *
+ * The rings are owned by the worker queues, so they are not freed with
+ * the ctx of the capture thread.
+ */
+static inline void TmqhFlowRingEnqueue(TmqhFlowMode *m, Packet *p)
+{
+    TmqhFlowRing *ring = m->ring;
+    const uint32_t tail = SC_ATOMIC_GET(ring->prod.tail);
+
+    if (unlikely(tail - ring->prod.head_cache > ring->mask)) {
+        /* ring looks full: check the worker's progress. Only packets
+         * allocated outside of the packet pool can get us here. */
+        while (1) {
+            hw_barrier();
+            ring->prod.head_cache = SC_ATOMIC_GET(ring->cons.head);
+            if (tail - ring->prod.head_cache <= ring->mask)
+                break;
+            usleep(1);
+        }
+    }
+
+    ring->slots[tail & ring->mask] = p;
+    /* full barrier: the worker sees the packet before the new tail, and
+     * we see its sleeping flag after it sees the new tail */
+    (void)SC_ATOMIC_ADD(ring->prod.tail, 1);
+
+    if (SC_ATOMIC_GET(ring->fq->sleeping)) {
+        SCMutexLock(&m->q->mutex_q);
+        SCCondSignal(&m->q->cond_q);
+        SCMutexUnlock(&m->q->mutex_q);
+    }
+}
+
+void TmqhOutputFlowRingHash(ThreadVars *tv, Packet *p)
+{
     TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    int16_t qid = TmqhFlowHashQueueId(ctx, p);
 
-    if (p->src.family == AF_INET6) {
-        for (i = 0; i < 4; i++) {
-            addr_hash += p->src.addr_data32[i] + p->dst.addr_data32[i];
+    TmqhFlowRingEnqueue(&ctx->queues[qid], p);
+}
+
+void TmqhOutputFlowRingIPPair(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    int16_t qid = TmqhFlowIPPairQueueId(ctx, p);
+
+    TmqhFlowRingEnqueue(&ctx->queues[qid], p);
+}
+
+/**
+ * \brief take a batch of packets off the next ring that has any
+ *
+ * Rings are visited round robin so that one busy capture thread can't
+ * starve the others.
+ *
+ * \retval cnt number of packets now in the worker's batch
+ */
+static uint32_t TmqhFlowRingFill(ThreadVars *tv, TmqhFlowQueue *fq)
+{
+    const uint16_t rings_cnt = SC_ATOMIC_GET(fq->rings_cnt);
+    uint16_t r = fq->next_ring;
+    uint16_t n;
+
+    for (n = 0; n < rings_cnt; n++, r++) {
+        if (r >= rings_cnt)
+            r = 0;
+
+        TmqhFlowRing *ring = fq->rings[r];
+        const uint32_t head = SC_ATOMIC_GET(ring->cons.head);
+        const uint32_t avail = SC_ATOMIC_GET(ring->prod.tail) - head;
+        if (avail == 0)
+            continue;
+        /* read the packets only after the tail */
+        hw_barrier();
+
+        uint32_t cnt = MIN(avail, TMQH_FLOW_RING_BATCH);
+        uint32_t i;
+        for (i = 0; i < cnt; i++) {
+            fq->batch[i] = ring->slots[(head + i) & ring->mask];
         }
-    } else {
-        addr_hash = p->src.addr_data32[0] + p->dst.addr_data32[0];
+        /* give the slots back to the capture thread */
+        (void)SC_ATOMIC_ADD(ring->cons.head, cnt);
+
+        fq->next_ring = r + 1;
+        fq->batch_idx = 0;
+        fq->batch_cnt = cnt;
+        TmqhFlowQueueDepth(tv, fq, avail);
+        return cnt;
     }
+    return 0;
+}
 
-    /* we don't have to worry about possible overflow, since
-     * ctx->size will be lesser than 2 ** 31 for sure */
-    qid = addr_hash % ctx->size;
+static int TmqhFlowRingsEmpty(TmqhFlowQueue *fq)
+{
+    const uint16_t rings_cnt = SC_ATOMIC_GET(fq->rings_cnt);
+    uint16_t r;
+
+    for (r = 0; r < rings_cnt; r++) {
+        TmqhFlowRing *ring = fq->rings[r];
+        if (SC_ATOMIC_GET(ring->prod.tail) != SC_ATOMIC_GET(ring->cons.head))
+            return 0;
+    }
+    return 1;
+}
+
+static uint32_t TmqhFlowRingQueueLen(ThreadVars *tv)
+{
+    TmqhFlowQueue *fq = flow_queues[tv->inq->id];
+    if (fq == NULL)
+        return 0;
+
+    const uint16_t rings_cnt = SC_ATOMIC_GET(fq->rings_cnt);
+    uint32_t len = fq->batch_cnt - fq->batch_idx;
+    uint16_t r;
+
+    for (r = 0; r < rings_cnt; r++) {
+        TmqhFlowRing *ring = fq->rings[r];
+        len += SC_ATOMIC_GET(ring->prod.tail) - SC_ATOMIC_GET(ring->cons.head);
+    }
+    return len;
+}
+
+/**
+ * \brief get a packet from the rings of the capture threads
+ *
+ * Packets that other parts of the engine inject into the worker, like
+ * the flow timeout pseudo packets, still use the locked trans_q.
+ */
+Packet *TmqhInputFlowRing(ThreadVars *tv)
+{
+    TmqhFlowQueue *fq = flow_queues[tv->inq->id];
+    PacketQueue *q = &trans_q[tv->inq->id];
+    Packet *p = NULL;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    if (fq->batch_idx < fq->batch_cnt)
+        return fq->batch[fq->batch_idx++];
+
+    if (q->len > 0) {
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+        if (p != NULL)
+            return p;
+    }
+
+    uint32_t polls = 0;
+    do {
+        if (TmqhFlowRingFill(tv, fq) > 0)
+            return fq->batch[fq->batch_idx++];
+        cc_barrier();
+    } while (polls++ < flow_ring_busy_poll);
 
-    PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
+    (void)SC_ATOMIC_SET(fq->sleeping, 1);
+    /* check again after setting the flag: capture threads check it after
+     * adding a packet, so either we see the packet or we get a signal */
+    if (q->len == 0 && TmqhFlowRingsEmpty(fq)) {
+        if (fq->counter_sleep != 0)
+            StatsIncr(tv, fq->counter_sleep);
+        SCCondWait(&q->cond_q, &q->mutex_q);
+    }
+    (void)SC_ATOMIC_SET(fq->sleeping, 0);
+    if (q->len > 0)
+        p = PacketDequeue(q);
     SCMutexUnlock(&q->mutex_q);
 
-    return;
+    if (p == NULL && TmqhFlowRingFill(tv, fq) > 0)
+        p = fq->batch[fq->batch_idx++];
+
+    /* NULL if we have no pkt. Should only happen on signals. */
+    return p;
 }
 
 #ifdef UNITTESTS
@@ -418,6 +812,61 @@ end:
     return retval;
 }
 
+/**
+ *  \test packets sent over the rings arrive in order at the right queue
+ */
+static int TmqhFlowRingTest01(void)
+{
+    ThreadVars tv_out, tv_in0, tv_in1;
+    Packet *pkts[8];
+    int i;
+
+    memset(&tv_out, 0, sizeof(tv_out));
+    memset(&tv_in0, 0, sizeof(tv_in0));
+    memset(&tv_in1, 0, sizeof(tv_in1));
+    TmqResetQueues();
+
+    Tmq *tmq0 = TmqCreateQueue("queue1");
+    FAIL_IF_NULL(tmq0);
+    Tmq *tmq1 = TmqCreateQueue("queue2");
+    FAIL_IF_NULL(tmq1);
+    tv_in0.inq = tmq0;
+    tv_in1.inq = tmq1;
+
+    TmqhFlowCtx *ctx = TmqhOutputFlowRingSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(ctx);
+    FAIL_IF_NULL(ctx->queues[0].ring);
+    FAIL_IF_NULL(ctx->queues[1].ring);
+    tv_out.outctx = ctx;
+
+    for (i = 0; i < 8; i++) {
+        pkts[i] = PacketGetFromAlloc();
+        FAIL_IF_NULL(pkts[i]);
+        pkts[i]->flags |= PKT_WANTS_FLOW;
+        pkts[i]->flow_hash = i;
+        TmqhOutputFlowRingHash(&tv_out, pkts[i]);
+    }
+    FAIL_IF(TmqhFlowRingQueueLen(&tv_in0) != 4);
+    FAIL_IF(TmqhFlowRingQueueLen(&tv_in1) != 4);
+
+    for (i = 0; i < 8; i += 2) {
+        FAIL_IF(TmqhInputFlowRing(&tv_in0) != pkts[i]);
+    }
+    for (i = 1; i < 8; i += 2) {
+        FAIL_IF(TmqhInputFlowRing(&tv_in1) != pkts[i]);
+    }
+    FAIL_IF(TmqhFlowRingQueueLen(&tv_in0) != 0);
+    FAIL_IF(TmqhFlowRingQueueLen(&tv_in1) != 0);
+
+    for (i = 0; i < 8; i++) {
+        PacketFree(pkts[i]);
+    }
+    TmqhOutputFlowFreeCtx(ctx);
+    TmqhFlowResetQueues();
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +878,7 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01);
 #endif
 
     return;
@@ -24,8 +24,55 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** max number of capture threads writing to one worker queue through
+ *  the 'flow-ring' handler */
+#define TMQH_FLOW_RING_MAX_WRITERS  64
+/** max number of packets a worker takes off a ring at once */
+#define TMQH_FLOW_RING_BATCH        64
+
+/** \brief lock-free single producer, single consumer ring of packets
+ *         between one capture thread and one worker queue.
+ *
+ *  The producer and consumer indexes live on their own cache lines. The
+ *  producer keeps a copy of the consumer index so it only has to read
+ *  the shared one when the ring looks full. */
+typedef struct TmqhFlowRing_ {
+    struct {
+        SC_ATOMIC_DECLARE(uint32_t, tail);
+        uint32_t head_cache;
+    } __attribute__((aligned(CLS))) prod;
+    struct {
+        SC_ATOMIC_DECLARE(uint32_t, head);
+    } __attribute__((aligned(CLS))) cons;
+    uint32_t mask;
+    Packet **slots;
+    /** worker queue this ring feeds */
+    struct TmqhFlowQueue_ *fq;
+} TmqhFlowRing;
+
+/** \brief per worker queue state of the 'flow' and 'flow-ring' handlers */
+typedef struct TmqhFlowQueue_ {
+    /** set by the worker before it sleeps on the queue's cond */
+    SC_ATOMIC_DECLARE(int, sleeping);
+    /** rings writing to this queue, only ever grows at setup */
+    SC_ATOMIC_DECLARE(uint16_t, rings_cnt);
+    TmqhFlowRing *rings[TMQH_FLOW_RING_MAX_WRITERS];
+
+    /* below is only used by the worker thread */
+    uint16_t next_ring;
+    uint32_t batch_idx;
+    uint32_t batch_cnt;
+    Packet *batch[TMQH_FLOW_RING_BATCH];
+
+    uint16_t counter_depth;
+    uint16_t counter_depth_max;
+    uint16_t counter_sleep;
+} TmqhFlowQueue;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    /** ring to the queue, 'flow-ring' handler only */
+    TmqhFlowRing *ring;
 } TmqhFlowMode;
 
 /** \brief Ctx for the flow queue handler
@@ -42,5 +89,7 @@ void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
+const char *TmqhFlowGetQueueHandlerName(void);
+void TmqhFlowResetQueues(void);
 
 #endif /* __TMQH_FLOW_H__ */
@@ -49,6 +49,7 @@
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-cpu.h"
 
 /* Number of freed packet to save for one pool before freeing them. */
 #define MAX_PENDING_RETURN_PACKETS 32
@@ -139,25 +140,44 @@ void TmqhPacketpoolRegister (void)
 static int PacketPoolIsEmpty(PktPool *pool)
 {
     /* Check local stack first. */
-    if (pool->head || pool->return_stack.head)
+    if (pool->head || SC_ATOMIC_GET(pool->return_stack.head))
         return 0;
 
     return 1;
 }
 
-void PacketPoolWait(void)
+/** \brief sleep until other threads returned packets to our pool
+ *
+ *  The sync_now flag is set before the return stack is checked for the
+ *  last time. Producers check the flag after pushing their packets, so
+ *  either we see their packets or they see the flag and signal us.
+ */
+static void PacketPoolWaitForReturns(PktPool *pool)
 {
-    PktPool *my_pool = GetThreadPacketPool();
+    const uint64_t ticks = UtilCpuGetTicks();
+
+    SCMutexLock(&pool->return_stack.mutex);
+    while (SC_ATOMIC_GET(pool->return_stack.head) == NULL) {
+        (void)SC_ATOMIC_ADD(pool->return_stack.sync_now, 1);
+        if (SC_ATOMIC_GET(pool->return_stack.head) != NULL)
+            break;
+        SCCondWait(&pool->return_stack.cond, &pool->return_stack.mutex);
+    }
+    SCMutexUnlock(&pool->return_stack.mutex);
 
-    if (PacketPoolIsEmpty(my_pool)) {
-        SCMutexLock(&my_pool->return_stack.mutex);
-        SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-        SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-        SCMutexUnlock(&my_pool->return_stack.mutex);
+    if (pool->tv != NULL) {
+        StatsIncr(pool->tv, pool->counter_empty_wait);
+        StatsAddUI64(pool->tv, pool->counter_empty_wait_ticks,
+                UtilCpuGetTicks() - ticks);
     }
+}
+
+void PacketPoolWait(void)
+{
+    PktPool *my_pool = GetThreadPacketPool();
 
-    while(PacketPoolIsEmpty(my_pool))
-        cc_barrier();
+    if (PacketPoolIsEmpty(my_pool))
+        PacketPoolWaitForReturns(my_pool);
 }
 
 /** \brief Wait until we have the requested ammount of packets in the pool
@@ -188,25 +208,20 @@ void PacketPoolWaitForN(int n)
             p = p->next;
         }
 
-        /* continue counting in the return stack */
-        if (my_pool->return_stack.head != NULL) {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            p = my_pool->return_stack.head;
+        /* continue counting in the return stack. Other threads only add
+         * packets in front of the head, so the list can be walked
+         * without a lock. */
+        p = SC_ATOMIC_GET(my_pool->return_stack.head);
+        if (p != NULL) {
             while (p != NULL) {
-                if (++i == n) {
-                    SCMutexUnlock(&my_pool->return_stack.mutex);
+                if (++i == n)
                     return;
-                }
                 p = p->next;
             }
-            SCMutexUnlock(&my_pool->return_stack.mutex);
 
         /* or signal that we need packets and wait */
         } else {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-            SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-            SCMutexUnlock(&my_pool->return_stack.mutex);
+            PacketPoolWaitForReturns(my_pool);
         }
     }
 }
@@ -227,11 +242,40 @@ static void PacketPoolStorePacket(Packet *p)
 
 static void PacketPoolGetReturnedPackets(PktPool *pool)
 {
-    SCMutexLock(&pool->return_stack.mutex);
-    /* Move all the packets from the locked return stack to the local stack. */
-    pool->head = pool->return_stack.head;
-    pool->return_stack.head = NULL;
-    SCMutexUnlock(&pool->return_stack.mutex);
+    /* Move all the packets from the return stack to the local stack. We
+     * are the only thread taking packets off the return stack, so there
+     * is no ABA problem here. */
+    Packet *head;
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack.head);
+        if (head == NULL)
+            return;
+    } while (!SC_ATOMIC_CAS(&pool->return_stack.head, head, NULL));
+
+    pool->head = head;
+}
+
+/** \brief push a list of packets onto the return stack of another pool
+ *
+ *  \param pool pool the packets belong to
+ *  \param head first packet of the list
+ *  \param tail last packet of the list
+ */
+static void PacketPoolReturnList(PktPool *pool, Packet *head, Packet *tail)
+{
+    Packet *old;
+    do {
+        old = SC_ATOMIC_GET(pool->return_stack.head);
+        tail->next = old;
+    } while (!SC_ATOMIC_CAS(&pool->return_stack.head, old, head));
+
+    /* the owner is waiting for packets: wake it up */
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now)) {
+        SCMutexLock(&pool->return_stack.mutex);
+        SC_ATOMIC_RESET(pool->return_stack.sync_now);
+        SCCondSignal(&pool->return_stack.cond);
+        SCMutexUnlock(&pool->return_stack.mutex);
+    }
 }
 
 /** \brief Get a new packet from the packet pool
@@ -257,8 +301,7 @@ Packet *PacketPoolGetPacket(void)
         return p;
     }
 
-    /* Local Stack is empty, so check the return stack, which requires
-     * locking. */
+    /* Local Stack is empty, so check the return stack. */
     PacketPoolGetReturnedPackets(pool);
 
     /* Try to allocate again. Need to check for not empty again, since the
@@ -312,6 +355,8 @@ void PacketPoolReturnPacket(Packet *p)
             my_pool->pending_head = p;
             my_pool->pending_tail = p;
             my_pool->pending_count = 1;
+            if (my_pool->tv != NULL)
+                my_pool->pending_ticks = UtilCpuGetTicks();
         } else if (pending_pool == pool) {
             /* Another packet for the pending pool list. */
             p->next = my_pool->pending_head;
@@ -319,12 +364,13 @@ void PacketPoolReturnPacket(Packet *p)
             my_pool->pending_count++;
             if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
                 /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
+                PacketPoolReturnList(pool, my_pool->pending_head,
+                        my_pool->pending_tail);
+                if (my_pool->tv != NULL) {
+                    StatsIncr(my_pool->tv, my_pool->counter_return_batches);
+                    StatsAddUI64(my_pool->tv, my_pool->counter_return_latency,
+                            UtilCpuGetTicks() - my_pool->pending_ticks);
+                }
                 /* Clear the list of pending packets to return. */
                 my_pool->pending_pool = NULL;
                 my_pool->pending_head = NULL;
@@ -333,12 +379,7 @@ void PacketPoolReturnPacket(Packet *p)
             }
         } else {
             /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
-            p->next = pool->return_stack.head;
-            pool->return_stack.head = p;
-            SC_ATOMIC_RESET(pool->return_stack.sync_now);
-            SCMutexUnlock(&pool->return_stack.mutex);
-            SCCondSignal(&pool->return_stack.cond);
+            PacketPoolReturnList(pool, p, p);
         }
     }
 }
@@ -360,6 +401,7 @@ void PacketPoolInitEmpty(void)
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
 }
 
 void PacketPoolInit(void)
@@ -381,6 +423,7 @@ void PacketPoolInit(void)
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
 
     /* pre allocate packets */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
@@ -429,6 +472,8 @@ void PacketPoolDestroy(void)
     }
 
     SC_ATOMIC_DESTROY(my_pool->return_stack.sync_now);
+    SC_ATOMIC_DESTROY(my_pool->return_stack.head);
+    my_pool->tv = NULL;
 
 #ifdef DEBUG_VALIDATION
     my_pool->initialized = 0;
@@ -591,3 +636,28 @@ void PacketPoolPostRunmodes(void)
     SCLogDebug("detect threads %u, max packets %u, max_pending_return_packets %u",
             threads, (uint)threads, max_pending_return_packets);
 }
+
+/**
+ *  \brief Register the packet pool counters for the calling thread
+ *
+ *  Counters are updated by the thread owning the pool only:
+ *  packetpool.empty_wait and packetpool.empty_wait_ticks count how often
+ *  and how long it slept waiting for other threads to return packets,
+ *  packetpool.return_batches and packetpool.return_latency count the
+ *  lists of packets it returned to other pools and the ticks the first
+ *  packet of each list was held before being returned.
+ */
+void PacketPoolRegisterCounters(ThreadVars *tv)
+{
+    PktPool *my_pool = GetThreadPacketPool();
+
+    my_pool->counter_empty_wait =
+        StatsRegisterCounter("packetpool.empty_wait", tv);
+    my_pool->counter_empty_wait_ticks =
+        StatsRegisterAvgCounter("packetpool.empty_wait_ticks", tv);
+    my_pool->counter_return_batches =
+        StatsRegisterCounter("packetpool.return_batches", tv);
+    my_pool->counter_return_latency =
+        StatsRegisterAvgCounter("packetpool.return_latency", tv);
+    my_pool->tv = tv;
+}
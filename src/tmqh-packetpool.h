@@ -28,14 +28,16 @@
 #include "threads.h"
 #include "util-atomic.h"
 
-    /* Return stack, onto which other threads free packets. */
-typedef struct PktPoolLockedStack_{
-    /* linked list of free packets. */
+/* Return stack, onto which other threads free packets. Lists of packets
+ * are pushed with a single CAS and the owner takes the whole stack at
+ * once, so no locking is needed. The mutex and cond are only used by the
+ * owner to sleep while its pool is empty. */
+typedef struct PktPoolReturnStack_ {
+    SC_ATOMIC_DECLARE(Packet *, head);
+    SC_ATOMIC_DECLARE(int, sync_now);
     SCMutex mutex;
     SCCondT cond;
-    SC_ATOMIC_DECLARE(int, sync_now);
-    Packet *head;
-} __attribute__((aligned(CLS))) PktPoolLockedStack;
+} __attribute__((aligned(CLS))) PktPoolReturnStack;
 
 typedef struct PktPool_ {
     /* link listed of free packets local to this thread.
@@ -51,6 +53,16 @@ typedef struct PktPool_ {
     Packet *pending_head;
     Packet *pending_tail;
     uint32_t pending_count;
+    /* ticks when the first packet was added to the pending list */
+    uint64_t pending_ticks;
+
+    /* thread owning this pool and its counters, NULL if the thread
+     * did not register the counters */
+    ThreadVars *tv;
+    uint16_t counter_empty_wait;
+    uint16_t counter_empty_wait_ticks;
+    uint16_t counter_return_batches;
+    uint16_t counter_return_latency;
 
 #ifdef DEBUG_VALIDATION
     int initialized;
@@ -64,7 +76,7 @@ typedef struct PktPool_ {
     /* Return stack, where other threads put packets that they free that belong
      * to this thread.
      */
-    PktPoolLockedStack return_stack;
+    PktPoolReturnStack return_stack;
 } PktPool;
 
 Packet *TmqhInputPacketpool(ThreadVars *);
@@ -79,5 +91,6 @@ void PacketPoolInit(void);
 void PacketPoolInitEmpty(void);
 void PacketPoolDestroy(void);
 void PacketPoolPostRunmodes(void);
+void PacketPoolRegisterCounters(ThreadVars *tv);
 
 #endif /* __TMQH_PACKETPOOL_H__ */
@@ -30,6 +30,13 @@
 #include "threads.h"
 #include "queue.h"
 #include "runmodes.h"
+#include "util-unittest.h"
+
+#if defined HAVE_LINUX_MEMPOLICY_H && defined HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#define AFFINITY_NUMA 1
+#endif
 
 ThreadsAffinityType thread_affinity[MAX_CPU_SET] = {
     {
@@ -308,3 +315,423 @@ int AffinityGetNextCPU(ThreadsAffinityType *taf)
 #endif /* OS_WIN32 and __OpenBSD__ */
     return ncpu;
 }
+
+/**
+ * \brief Return next cpu of a NUMA node to use for a given thread family
+ *
+ * Same as AffinityGetNextCPU but only cpus of the node are used. If the
+ * set has no cpu on the node, any cpu of the set is returned.
+ *
+ * \retval the cpu to used given by its id
+ */
+int AffinityGetNextCPUOnNode(ThreadsAffinityType *taf, int node)
+{
+#if defined AFFINITY_NUMA && !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+    cpu_set_t cs;
+    if (AffinityGetNumaNodeCpuset(node, &taf->cpu_set, &cs) == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "%s has no cpu on NUMA "
+                "node %d, using other nodes", taf->name, node);
+        return AffinityGetNextCPU(taf);
+    }
+
+    int ncpu;
+    int ncpus = UtilCpuGetNumProcessorsOnline();
+    int iter = 0;
+    SCMutexLock(&taf->taf_mutex);
+    ncpu = taf->lcpu;
+    while (!CPU_ISSET(ncpu, &cs) && iter < 2) {
+        ncpu++;
+        if (ncpu >= ncpus) {
+            ncpu = 0;
+            iter++;
+        }
+    }
+    taf->lcpu = ncpu + 1;
+    if (taf->lcpu >= ncpus)
+        taf->lcpu = 0;
+    SCMutexUnlock(&taf->taf_mutex);
+    SCLogDebug("Setting affinity on CPU %d of node %d", ncpu, node);
+    return ncpu;
+#else
+    return AffinityGetNextCPU(taf);
+#endif
+}
+
+/**
+ * NUMA topology
+ *
+ * The nodes and their cpus are read from sysfs by
+ * AffinitySetupNumaFromConfig() when threading.numa.enabled is set.
+ */
+
+static int numa_enabled = 0;
+static int numa_interleave_flow_hash = 1;
+static int numa_nodes_cnt = 0;
+#if defined AFFINITY_NUMA
+/** highest node id + 1 */
+static int numa_nodes_max = 0;
+static cpu_set_t numa_node_cpus[AFFINITY_NUMA_MAX_NODES];
+
+/**
+ * \brief Parse a sysfs cpu list like "0-7,16-23"
+ *
+ * \retval 0 on success, -1 on an invalid list
+ */
+static int AffinityParseCpuList(const char *str, cpu_set_t *cs)
+{
+    CPU_ZERO(cs);
+    while (*str != '\0' && *str != '\n') {
+        char *end;
+        unsigned long a = strtoul(str, &end, 10);
+        unsigned long b = a;
+        if (end == str)
+            return -1;
+        if (*end == '-') {
+            str = end + 1;
+            b = strtoul(str, &end, 10);
+            if (end == str || b < a)
+                return -1;
+        }
+        if (b >= CPU_SETSIZE)
+            return -1;
+        for (; a <= b; a++) {
+            CPU_SET(a, cs);
+        }
+        if (*end == ',')
+            end++;
+        str = end;
+    }
+    return 0;
+}
+
+static int AffinityReadSysfs(const char *path, char *buf, size_t size)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fgets(buf, size, fp) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void AffinityNumaDiscover(void)
+{
+    char path[128];
+    char buf[1024];
+    int node;
+
+    numa_nodes_cnt = 0;
+    numa_nodes_max = 0;
+    for (node = 0; node < AFFINITY_NUMA_MAX_NODES; node++) {
+        CPU_ZERO(&numa_node_cpus[node]);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+                node);
+        if (AffinityReadSysfs(path, buf, sizeof(buf)) != 0)
+            continue;
+        if (AffinityParseCpuList(buf, &numa_node_cpus[node]) != 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid cpu list \"%s\" for "
+                    "NUMA node %d", buf, node);
+            CPU_ZERO(&numa_node_cpus[node]);
+            continue;
+        }
+        SCLogConfig("NUMA node %d: %d cpu(s)", node,
+                CPU_COUNT(&numa_node_cpus[node]));
+        numa_nodes_cnt++;
+        numa_nodes_max = node + 1;
+    }
+}
+#endif /* AFFINITY_NUMA */
+
+/**
+ * \brief Load the NUMA placement settings and discover the topology
+ *
+ * Needs to run before the flow hash is allocated.
+ */
+void AffinitySetupNumaFromConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("threading.numa.enabled", &enabled) != 1 || !enabled)
+        return;
+#if defined AFFINITY_NUMA
+    int interleave = 1;
+    if (ConfGetBool("threading.numa.interleave-flow-hash", &interleave) == 1)
+        numa_interleave_flow_hash = interleave;
+
+    AffinityNumaDiscover();
+    if (numa_nodes_cnt < 2) {
+        SCLogConfig("NUMA placement disabled: %d node(s) found",
+                numa_nodes_cnt);
+        return;
+    }
+    numa_enabled = 1;
+    SCLogConfig("NUMA placement enabled: %d nodes", numa_nodes_cnt);
+#else
+    SCLogWarning(SC_ERR_UNIMPLEMENTED, "NUMA placement is not supported "
+            "on this platform");
+#endif
+}
+
+int AffinityNumaEnabled(void)
+{
+    return numa_enabled;
+}
+
+int AffinityGetNumaNodeCount(void)
+{
+    return numa_nodes_cnt;
+}
+
+/**
+ * \brief Get the NUMA node of a cpu
+ * \retval node or -1 if unknown or NUMA placement is disabled
+ */
+int AffinityGetCPUNumaNode(int cpu)
+{
+#if defined AFFINITY_NUMA
+    int node;
+    if (!numa_enabled || cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+    for (node = 0; node < numa_nodes_max; node++) {
+        if (CPU_ISSET(cpu, &numa_node_cpus[node]))
+            return node;
+    }
+#endif
+    return -1;
+}
+
+/**
+ * \brief Get the NUMA node the NIC of an interface is attached to
+ * \retval node or -1 if unknown or NUMA placement is disabled
+ */
+int AffinityGetIfaceNumaNode(const char *iface)
+{
+#if defined AFFINITY_NUMA
+    char path[128];
+    char buf[32];
+    if (!numa_enabled || iface == NULL)
+        return -1;
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", iface);
+    if (AffinityReadSysfs(path, buf, sizeof(buf)) != 0)
+        return -1;
+    int node = atoi(buf);
+    if (node < 0 || node >= numa_nodes_max ||
+            CPU_COUNT(&numa_node_cpus[node]) == 0)
+        return -1;
+    SCLogConfig("%s: NIC is on NUMA node %d", iface, node);
+    return node;
+#else
+    return -1;
+#endif
+}
+
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+/**
+ * \brief Get the cpus of a NUMA node, optionally limited to a set
+ *
+ * \param base set to intersect with or NULL
+ * \param cs resulting set
+ *
+ * \retval number of cpus in cs
+ */
+int AffinityGetNumaNodeCpuset(int node, const cpu_set_t *base, cpu_set_t *cs)
+{
+    CPU_ZERO(cs);
+#if defined AFFINITY_NUMA
+    if (!numa_enabled || node < 0 || node >= numa_nodes_max)
+        return 0;
+    if (base != NULL) {
+        CPU_AND(cs, (cpu_set_t *)base, &numa_node_cpus[node]);
+    } else {
+        CPU_OR(cs, cs, &numa_node_cpus[node]);
+    }
+    return CPU_COUNT(cs);
+#else
+    return 0;
+#endif
+}
+#endif
+
+/**
+ * \brief Have the memory allocated by the calling thread come from a node
+ *
+ * Memory is preferably allocated on the node, it comes from other nodes
+ * if the node is out of memory.
+ *
+ * \param node NUMA node, -1 to go back to the default policy
+ */
+void AffinitySetThreadMemoryNode(int node)
+{
+#if defined AFFINITY_NUMA
+    if (!numa_enabled)
+        return;
+
+    long r;
+    if (node < 0 || node >= numa_nodes_max) {
+        r = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    } else {
+        unsigned long mask[AFFINITY_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        r = syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                AFFINITY_NUMA_MAX_NODES + 1);
+    }
+    if (r != 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "set_mempolicy for node %d failed: %s",
+                node, strerror(errno));
+    }
+#endif
+}
+
+/**
+ * \brief Save the memory policy of the calling thread
+ *
+ * To temporarily change it with AffinitySetThreadMemoryNode and put it
+ * back with AffinityRestoreThreadMemoryPolicy.
+ */
+void AffinitySaveThreadMemoryPolicy(AffinityMemoryPolicy *pol)
+{
+    memset(pol, 0, sizeof(*pol));
+#if defined AFFINITY_NUMA
+    if (!numa_enabled)
+        return;
+
+    if (syscall(SYS_get_mempolicy, &pol->mode, pol->mask,
+                AFFINITY_NUMA_MAX_NODES + 1, NULL, 0) != 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "get_mempolicy failed: %s",
+                strerror(errno));
+        return;
+    }
+    pol->saved = 1;
+#endif
+}
+
+/**
+ * \brief Restore the memory policy saved by AffinitySaveThreadMemoryPolicy
+ *
+ * If it couldn't be saved, the thread goes back to the default policy.
+ */
+void AffinityRestoreThreadMemoryPolicy(const AffinityMemoryPolicy *pol)
+{
+#if defined AFFINITY_NUMA
+    if (!numa_enabled)
+        return;
+
+    if (!pol->saved) {
+        AffinitySetThreadMemoryNode(-1);
+        return;
+    }
+    if (syscall(SYS_set_mempolicy, pol->mode, pol->mask,
+                AFFINITY_NUMA_MAX_NODES + 1) != 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "set_mempolicy failed: %s",
+                strerror(errno));
+    }
+#endif
+}
+
+#if defined AFFINITY_NUMA
+/**
+ * \brief Set the policy of the pages fully inside a memory area
+ *
+ * Pages already in use are moved to match the policy.
+ */
+static void AffinityMbind(void *ptr, size_t size, int mode,
+        const unsigned long *mask)
+{
+    uintptr_t page = (uintptr_t)getpagesize();
+    uintptr_t start = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+    if (end <= start)
+        return;
+
+    if (syscall(SYS_mbind, (void *)start, (unsigned long)(end - start),
+                mode, mask, AFFINITY_NUMA_MAX_NODES + 1, MPOL_MF_MOVE) != 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "mbind failed: %s", strerror(errno));
+    }
+}
+#endif
+
+/**
+ * \brief Spread the pages of a memory area over all NUMA nodes
+ *
+ * Only pages fully inside the area are affected.
+ */
+void AffinityInterleaveMemory(void *ptr, size_t size)
+{
+#if defined AFFINITY_NUMA
+    if (!numa_enabled || !numa_interleave_flow_hash || ptr == NULL)
+        return;
+
+    unsigned long mask[AFFINITY_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    int node;
+    for (node = 0; node < numa_nodes_max; node++) {
+        if (CPU_COUNT(&numa_node_cpus[node]) > 0)
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+    AffinityMbind(ptr, size, MPOL_INTERLEAVE, mask);
+#endif
+}
+
+/**
+ * \brief Have the pages of a memory area preferably come from a node
+ *
+ * Only pages fully inside the area are affected.
+ *
+ * \param node NUMA node, the area is left alone if it's unknown
+ */
+void AffinityBindMemoryNode(void *ptr, size_t size, int node)
+{
+#if defined AFFINITY_NUMA
+    if (!numa_enabled || ptr == NULL || node < 0 || node >= numa_nodes_max)
+        return;
+
+    unsigned long mask[AFFINITY_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    AffinityMbind(ptr, size, MPOL_PREFERRED, mask);
+#endif
+}
+
+#ifdef UNITTESTS
+#if defined AFFINITY_NUMA
+static int AffinityParseCpuListTest01(void)
+{
+    cpu_set_t cs;
+    FAIL_IF(AffinityParseCpuList("0-3,8,10-11\n", &cs) != 0);
+    FAIL_IF(CPU_COUNT(&cs) != 7);
+    FAIL_IF(!CPU_ISSET(0, &cs));
+    FAIL_IF(!CPU_ISSET(3, &cs));
+    FAIL_IF(CPU_ISSET(4, &cs));
+    FAIL_IF(!CPU_ISSET(8, &cs));
+    FAIL_IF(CPU_ISSET(9, &cs));
+    FAIL_IF(!CPU_ISSET(11, &cs));
+
+    FAIL_IF(AffinityParseCpuList("\n", &cs) != 0);
+    FAIL_IF(CPU_COUNT(&cs) != 0);
+    PASS;
+}
+
+static int AffinityParseCpuListTest02(void)
+{
+    cpu_set_t cs;
+    FAIL_IF(AffinityParseCpuList("3-1", &cs) == 0);
+    FAIL_IF(AffinityParseCpuList("a-b", &cs) == 0);
+    FAIL_IF(AffinityParseCpuList("1,-3", &cs) == 0);
+    FAIL_IF(AffinityParseCpuList("0-100000", &cs) == 0);
+    PASS;
+}
+#endif
+#endif /* UNITTESTS */
+
+void AffinityRegisterTests(void)
+{
+#ifdef UNITTESTS
+#if defined AFFINITY_NUMA
+    UtRegisterTest("AffinityParseCpuListTest01", AffinityParseCpuListTest01);
+    UtRegisterTest("AffinityParseCpuListTest02", AffinityParseCpuListTest02);
+#endif
+#endif /* UNITTESTS */
+}
@@ -85,5 +85,33 @@ void AffinitySetupLoadFromConfig(void);
 ThreadsAffinityType * GetAffinityTypeFromName(const char *name);
 
 int AffinityGetNextCPU(ThreadsAffinityType *taf);
+int AffinityGetNextCPUOnNode(ThreadsAffinityType *taf, int node);
+
+/** max number of NUMA nodes handled */
+#define AFFINITY_NUMA_MAX_NODES 64
+
+void AffinitySetupNumaFromConfig(void);
+int AffinityNumaEnabled(void);
+int AffinityGetNumaNodeCount(void);
+int AffinityGetCPUNumaNode(int cpu);
+int AffinityGetIfaceNumaNode(const char *iface);
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
+int AffinityGetNumaNodeCpuset(int node, const cpu_set_t *base, cpu_set_t *cs);
+#endif
+
+/** memory policy of a thread, see AffinitySaveThreadMemoryPolicy */
+typedef struct AffinityMemoryPolicy_ {
+    int saved;
+    int mode;
+    unsigned long mask[AFFINITY_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+} AffinityMemoryPolicy;
+
+void AffinitySetThreadMemoryNode(int node);
+void AffinitySaveThreadMemoryPolicy(AffinityMemoryPolicy *pol);
+void AffinityRestoreThreadMemoryPolicy(const AffinityMemoryPolicy *pol);
+void AffinityInterleaveMemory(void *ptr, size_t size);
+void AffinityBindMemoryNode(void *ptr, size_t size, int node);
+
+void AffinityRegisterTests(void);
 
 #endif /* __UTIL_AFFINITY_H__ */
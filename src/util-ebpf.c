@@ -0,0 +1,527 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * eBPF and XDP support for the AF_PACKET capture.
+ *
+ * The eBPF objects are loaded once per interface while parsing the
+ * configuration. The maps they contain are kept in a list by interface
+ * and name, so that the capture threads can get the file descriptors of
+ * the flow tables and add the keys of the flows they bypass. The
+ * bypassed flow manager walks the flow tables every second and removes
+ * the entries the kernel has not updated for EBPF_BYPASSED_FLOW_TIMEOUT
+ * seconds, accounting the packets and bytes the kernel dropped for them.
+ */
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H 1
+#define SC_PCAP_DONT_INCLUDE_PCAP_H 1
+#include "suricata-common.h"
+#include "flow-bypass.h"
+#include "util-ebpf.h"
+
+#ifdef HAVE_PACKET_EBPF
+
+#include <sys/resource.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "util-debug.h"
+#include "util-cpu.h"
+
+typedef struct EBPFMap_ {
+    char *iface;
+    char *name;
+    int fd;
+    struct EBPFMap_ *next;
+} EBPFMap;
+
+typedef struct EBPFObject_ {
+    struct bpf_object *obj;
+    /** interface the program is attached to in XDP mode, 0 if none */
+    unsigned int xdp_ifindex;
+    uint32_t xdp_flags;
+    struct EBPFObject_ *next;
+} EBPFObject;
+
+static SCMutex ebpf_lock = SCMUTEX_INITIALIZER;
+static EBPFMap *ebpf_maps = NULL;
+static EBPFObject *ebpf_objects = NULL;
+
+/** number of per cpu values of a flow table entry */
+static unsigned int ebpf_nr_cpus = 0;
+
+/** \internal
+ *  \brief get the number of possible cpus, which is the number of values
+ *         of an entry in a per cpu map
+ */
+static unsigned int EBPFNumPossibleCPUs(void)
+{
+    unsigned int start, end;
+    FILE *fp = fopen("/sys/devices/system/cpu/possible", "r");
+    if (fp != NULL) {
+        int n = fscanf(fp, "%u-%u", &start, &end);
+        fclose(fp);
+        if (n == 2 && end >= start)
+            return end + 1;
+        if (n == 1)
+            return start + 1;
+    }
+    return UtilCpuGetNumProcessorsConfigured();
+}
+
+static int EBPFAddMap(const char *iface, const char *name, int fd)
+{
+    EBPFMap *map = SCCalloc(1, sizeof(*map));
+    if (map == NULL)
+        return -1;
+    map->iface = SCStrdup(iface);
+    map->name = SCStrdup(name);
+    if (map->iface == NULL || map->name == NULL) {
+        if (map->iface)
+            SCFree(map->iface);
+        if (map->name)
+            SCFree(map->name);
+        SCFree(map);
+        return -1;
+    }
+    map->fd = fd;
+
+    SCMutexLock(&ebpf_lock);
+    map->next = ebpf_maps;
+    ebpf_maps = map;
+    SCMutexUnlock(&ebpf_lock);
+    return 0;
+}
+
+/**
+ * \brief get the file descriptor of a map of an eBPF object loaded for
+ *        an interface
+ *
+ * \retval fd the file descriptor, -1 if the map is not found
+ */
+int EBPFGetMapFDByName(const char *iface, const char *name)
+{
+    int fd = -1;
+
+    if (iface == NULL || name == NULL)
+        return -1;
+
+    SCMutexLock(&ebpf_lock);
+    EBPFMap *map;
+    for (map = ebpf_maps; map != NULL; map = map->next) {
+        if (strcmp(map->iface, iface) == 0 && strcmp(map->name, name) == 0) {
+            fd = map->fd;
+            break;
+        }
+    }
+    SCMutexUnlock(&ebpf_lock);
+    return fd;
+}
+
+/**
+ * \brief load an eBPF object and get the file descriptor of a program
+ *
+ * The maps of the object are registered for the interface, see
+ * EBPFGetMapFDByName().
+ *
+ * \param iface interface the program is loaded for
+ * \param path path of the eBPF object file
+ * \param section section of the program in the object
+ * \param val set to the file descriptor of the program
+ * \param flags EBPF_SOCKET_FILTER or EBPF_XDP_CODE
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int EBPFLoadFile(const char *iface, const char *path, const char *section,
+        int *val, uint8_t flags)
+{
+    struct bpf_object *bpfobj = NULL;
+    struct bpf_program *bpfprog = NULL;
+    struct bpf_map *map = NULL;
+    int found = 0;
+    char err_buf[128];
+
+    if (iface == NULL || path == NULL || section == NULL)
+        return -1;
+
+    /* loading the programs and creating the maps needs locked memory,
+     * the default limit is too low for the flow tables */
+    struct rlimit r = { RLIM_INFINITY, RLIM_INFINITY };
+    if (setrlimit(RLIMIT_MEMLOCK, &r) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to lock memory: %s (%d)",
+                strerror(errno), errno);
+        return -1;
+    }
+
+    if (ebpf_nr_cpus == 0)
+        ebpf_nr_cpus = EBPFNumPossibleCPUs();
+
+    bpfobj = bpf_object__open(path);
+    long error = libbpf_get_error(bpfobj);
+    if (error) {
+        libbpf_strerror(error, err_buf, sizeof(err_buf));
+        SCLogError(SC_ERR_BPF, "Unable to load eBPF objects in '%s': %s",
+                path, err_buf);
+        return -1;
+    }
+
+    bpf_object__for_each_program(bpfprog, bpfobj) {
+        const char *title = bpf_program__title(bpfprog, 0);
+        if (title != NULL && strcmp(title, section) == 0) {
+            if (flags & EBPF_SOCKET_FILTER) {
+                bpf_program__set_socket_filter(bpfprog);
+            } else {
+                bpf_program__set_xdp(bpfprog);
+            }
+            found = 1;
+            break;
+        }
+    }
+
+    if (found == 0) {
+        SCLogError(SC_ERR_BPF, "No section '%s' in '%s' file",
+                section, path);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    int ret = bpf_object__load(bpfobj);
+    if (ret != 0) {
+        libbpf_strerror(ret, err_buf, sizeof(err_buf));
+        SCLogError(SC_ERR_BPF, "Unable to load eBPF object '%s': %s (%d)",
+                path, err_buf, ret);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    int pfd = bpf_program__fd(bpfprog);
+    if (pfd < 0) {
+        SCLogError(SC_ERR_BPF, "Unable to find section '%s' in '%s'",
+                section, path);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    EBPFObject *eobj = SCCalloc(1, sizeof(*eobj));
+    if (eobj == NULL) {
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+    eobj->obj = bpfobj;
+
+    /* closing the object closes the maps and the program, so it is kept
+     * until EBPFDeinit() */
+    SCMutexLock(&ebpf_lock);
+    eobj->next = ebpf_objects;
+    ebpf_objects = eobj;
+    SCMutexUnlock(&ebpf_lock);
+
+    bpf_map__for_each(map, bpfobj) {
+        SCLogDebug("map '%s' of '%s' for %s", bpf_map__name(map), path, iface);
+        if (EBPFAddMap(iface, bpf_map__name(map), bpf_map__fd(map)) != 0) {
+            return -1;
+        }
+    }
+
+    SCLogConfig("%s: loaded eBPF %s program '%s' from '%s'", iface,
+            (flags & EBPF_SOCKET_FILTER) ? "socket filter" : "XDP",
+            section, path);
+
+    *val = pfd;
+    return 0;
+}
+
+/**
+ * \brief attach an XDP program to an interface
+ *
+ * \param iface the interface
+ * \param fd file descriptor of the program returned by EBPFLoadFile()
+ * \param mode one of the EBPF_XDP_MODE_* values
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int EBPFSetupXDP(const char *iface, int fd, uint8_t mode)
+{
+#ifdef HAVE_PACKET_XDP
+    uint32_t flags = 0;
+    char err_buf[128];
+
+    unsigned int ifindex = if_nametoindex(iface);
+    if (ifindex == 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unknown interface '%s'", iface);
+        return -1;
+    }
+
+    switch (mode) {
+        case EBPF_XDP_MODE_SKB:
+            flags = XDP_FLAGS_SKB_MODE;
+            break;
+        case EBPF_XDP_MODE_DRV:
+#ifdef XDP_FLAGS_DRV_MODE
+            flags = XDP_FLAGS_DRV_MODE;
+#endif
+            break;
+        case EBPF_XDP_MODE_HW:
+#ifdef XDP_FLAGS_HW_MODE
+            flags = XDP_FLAGS_HW_MODE;
+            break;
+#else
+            SCLogError(SC_ERR_BPF, "%s: XDP hardware mode is not supported "
+                    "by the kernel headers", iface);
+            return -1;
+#endif
+        default:
+            break;
+    }
+
+    int err = bpf_set_link_xdp_fd(ifindex, fd, flags);
+    if (err != 0) {
+        libbpf_strerror(err, err_buf, sizeof(err_buf));
+        SCLogError(SC_ERR_BPF, "Unable to set XDP program on '%s': %s (%d)",
+                iface, err_buf, err);
+        return -1;
+    }
+
+    /* remember where the program is attached, to remove it at exit */
+    SCMutexLock(&ebpf_lock);
+    EBPFObject *eobj;
+    for (eobj = ebpf_objects; eobj != NULL; eobj = eobj->next) {
+        struct bpf_program *bpfprog;
+        bpf_object__for_each_program(bpfprog, eobj->obj) {
+            if (bpf_program__fd(bpfprog) == fd) {
+                eobj->xdp_ifindex = ifindex;
+                eobj->xdp_flags = flags;
+            }
+        }
+    }
+    SCMutexUnlock(&ebpf_lock);
+
+    SCLogConfig("%s: XDP program attached", iface);
+    return 0;
+#else
+    SCLogError(SC_ERR_UNIMPLEMENTED, "%s: XDP support is not available, "
+            "rebuild with a libbpf providing bpf_set_link_xdp_fd", iface);
+    return -1;
+#endif
+}
+
+/**
+ * \brief add the key of a bypassed flow to a flow table
+ *
+ * \retval 0 ok, also if the key is in the table already
+ * \retval -1 error, e.g. the table is full
+ */
+int EBPFCreateFlowForKey(int mapfd, void *key)
+{
+    struct timespec ts;
+    unsigned int i;
+
+    if (mapfd < 0 || ebpf_nr_cpus == 0)
+        return -1;
+
+    struct pair *values = SCCalloc(ebpf_nr_cpus, sizeof(struct pair));
+    if (values == NULL)
+        return -1;
+
+    /* start the timeout now, the kernel updates the time of the cpu that
+     * sees a packet of the flow */
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        for (i = 0; i < ebpf_nr_cpus; i++)
+            values[i].time = now;
+    }
+
+    int ret = bpf_map_update_elem(mapfd, key, values, BPF_NOEXIST);
+    SCFree(values);
+    if (ret != 0 && errno != EEXIST) {
+        SCLogDebug("unable to add flow to the flow table: %s",
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief remove a key from a flow table
+ *
+ * For callers that can't include the libbpf headers, as they conflict
+ * with pcap's.
+ */
+void EBPFDeleteKey(int mapfd, void *key)
+{
+    if (mapfd < 0)
+        return;
+    if (bpf_map_delete_elem(mapfd, key) != 0 && errno != ENOENT) {
+        SCLogDebug("unable to remove flow from the flow table: %s",
+                strerror(errno));
+    }
+}
+
+/** \internal
+ *  \brief count each pair of flow table entries as one flow, using the
+ *         direction with the lowest address and port
+ */
+static int EBPFKeyIsFirstDirection(const uint8_t *key, size_t key_size)
+{
+    if (key_size == sizeof(struct flowv4_keys)) {
+        const struct flowv4_keys *k = (const struct flowv4_keys *)key;
+        return (k->src < k->dst || (k->src == k->dst && k->sp <= k->dp));
+    } else {
+        const struct flowv6_keys *k = (const struct flowv6_keys *)key;
+        int r = memcmp(k->src, k->dst, sizeof(k->src));
+        return (r < 0 || (r == 0 && k->sp <= k->dp));
+    }
+}
+
+/** \internal
+ *  \brief remove the timed out entries of a flow table
+ *
+ *  An entry is deleted only after the next key is fetched, as looking up
+ *  the key following a deleted one restarts at the first entry.
+ *
+ *  \retval number of entries removed, -1 on error
+ */
+static int EBPFForEachFlowTable(const char *iface, const char *name,
+        size_t key_size, FlowBypassStats *flowstats, struct timespec *ctime)
+{
+    uint8_t key[sizeof(struct flowv6_keys)];
+    uint8_t next_key[sizeof(struct flowv6_keys)];
+    int delete_key = 0;
+    int found = 0;
+    unsigned int i;
+
+    BUG_ON(key_size > sizeof(key));
+
+    int mapfd = EBPFGetMapFDByName(iface, name);
+    if (mapfd == -1)
+        return -1;
+
+    struct pair *values = SCCalloc(ebpf_nr_cpus, sizeof(struct pair));
+    if (values == NULL)
+        return -1;
+
+    memset(key, 0, sizeof(key));
+    while (bpf_map_get_next_key(mapfd, key, next_key) == 0) {
+        if (delete_key) {
+            bpf_map_delete_elem(mapfd, key);
+            delete_key = 0;
+        }
+
+        if (bpf_map_lookup_elem(mapfd, next_key, values) == 0) {
+            uint64_t packets = 0, bytes = 0, lastseen = 0;
+            for (i = 0; i < ebpf_nr_cpus; i++) {
+                packets += values[i].packets;
+                bytes += values[i].bytes;
+                if (values[i].time > lastseen)
+                    lastseen = values[i].time;
+            }
+
+            if (lastseen / 1000000000ULL + EBPF_BYPASSED_FLOW_TIMEOUT <
+                    (uint64_t)ctime->tv_sec) {
+                SCLogDebug("%s: removing bypassed flow entry, %"PRIu64
+                        " packets, %"PRIu64" bytes", iface, packets, bytes);
+                delete_key = 1;
+                if (EBPFKeyIsFirstDirection(next_key, key_size))
+                    flowstats->count++;
+                flowstats->packets += packets;
+                flowstats->bytes += bytes;
+                found++;
+            }
+        }
+        memcpy(key, next_key, key_size);
+    }
+    if (delete_key) {
+        bpf_map_delete_elem(mapfd, key);
+    }
+
+    SCFree(values);
+    return found;
+}
+
+/**
+ * \brief bypassed flow manager check function for the flow tables of an
+ *        interface
+ *
+ * \param data the interface name
+ */
+int EBPFCheckBypassedFlowTimeout(FlowBypassStats *bypassstats,
+        struct timespec *curtime, void *data)
+{
+    const char *iface = (const char *)data;
+    int found = 0;
+    int ret;
+
+    if (iface == NULL)
+        return 0;
+
+    ret = EBPFForEachFlowTable(iface, EBPF_FLOW_TABLE_V4,
+            sizeof(struct flowv4_keys), bypassstats, curtime);
+    if (ret > 0)
+        found += ret;
+    ret = EBPFForEachFlowTable(iface, EBPF_FLOW_TABLE_V6,
+            sizeof(struct flowv6_keys), bypassstats, curtime);
+    if (ret > 0)
+        found += ret;
+
+    return found;
+}
+
+/**
+ * \brief detach the XDP programs and release the eBPF objects and maps
+ */
+void EBPFDeinit(void)
+{
+    SCMutexLock(&ebpf_lock);
+    EBPFObject *eobj = ebpf_objects;
+    while (eobj != NULL) {
+        EBPFObject *next = eobj->next;
+#ifdef HAVE_PACKET_XDP
+        /* without Suricata nobody would remove the entries of the flow
+         * table anymore, so the program must not stay attached */
+        if (eobj->xdp_ifindex != 0) {
+            if (bpf_set_link_xdp_fd(eobj->xdp_ifindex, -1, eobj->xdp_flags) != 0) {
+                SCLogWarning(SC_ERR_BPF, "Unable to remove XDP program "
+                        "from interface %u", eobj->xdp_ifindex);
+            }
+        }
+#endif
+        bpf_object__close(eobj->obj);
+        SCFree(eobj);
+        eobj = next;
+    }
+    ebpf_objects = NULL;
+
+    EBPFMap *map = ebpf_maps;
+    while (map != NULL) {
+        EBPFMap *next = map->next;
+        SCFree(map->iface);
+        SCFree(map->name);
+        SCFree(map);
+        map = next;
+    }
+    ebpf_maps = NULL;
+    SCMutexUnlock(&ebpf_lock);
+}
+
+#endif /* HAVE_PACKET_EBPF */
@@ -0,0 +1,89 @@
+/* Copyright (C) 2018 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Loading of eBPF socket filters and XDP programs and access to the
+ * flow tables they use to drop the packets of bypassed flows.
+ */
+
+#ifndef __UTIL_EBPF_H__
+#define __UTIL_EBPF_H__
+
+#ifdef HAVE_PACKET_EBPF
+
+#include "flow-bypass.h"
+
+#define EBPF_SOCKET_FILTER  (1<<0)
+#define EBPF_XDP_CODE       (1<<1)
+
+/** XDP attach modes, see XDP_FLAGS_* in linux/if_link.h */
+#define EBPF_XDP_MODE_DEFAULT   0
+#define EBPF_XDP_MODE_SKB       1
+#define EBPF_XDP_MODE_DRV       2
+#define EBPF_XDP_MODE_HW        3
+
+/** names of the flow tables in the eBPF programs */
+#define EBPF_FLOW_TABLE_V4 "flow_table_v4"
+#define EBPF_FLOW_TABLE_V6 "flow_table_v6"
+
+/** flow table entries not updated by the kernel for this many seconds
+ *  are removed by the bypassed flow manager */
+#define EBPF_BYPASSED_FLOW_TIMEOUT 60
+
+/* The structures below must match the ones in ebpf/bypass_filter.c and
+ * ebpf/xdp_filter.c. Addresses and ports are in host byte order. */
+
+struct flowv4_keys {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sp;
+    uint16_t dp;
+    uint32_t ip_proto;
+};
+
+struct flowv6_keys {
+    uint32_t src[4];
+    uint32_t dst[4];
+    uint16_t sp;
+    uint16_t dp;
+    uint32_t ip_proto;
+};
+
+/** per cpu value of a flow table entry */
+struct pair {
+    uint64_t time;      /**< last seen, CLOCK_MONOTONIC in ns */
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+int EBPFLoadFile(const char *iface, const char *path, const char *section,
+        int *val, uint8_t flags);
+int EBPFSetupXDP(const char *iface, int fd, uint8_t mode);
+int EBPFGetMapFDByName(const char *iface, const char *name);
+
+int EBPFCreateFlowForKey(int mapfd, void *key);
+void EBPFDeleteKey(int mapfd, void *key);
+int EBPFCheckBypassedFlowTimeout(FlowBypassStats *bypassstats,
+        struct timespec *curtime, void *data);
+
+void EBPFDeinit(void);
+
+#endif /* HAVE_PACKET_EBPF */
+
+#endif /* __UTIL_EBPF_H__ */
@@ -26,12 +26,17 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #include "suricata-common.h" /* errno.h, string.h, etc. */
 #include "tm-modules.h"      /* LogFileCtx */
 #include "conf.h"            /* ConfNode, etc. */
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-byte.h"
+#include "util-misc.h"       /* ParseSizeStringU32 */
+#include "util-signal.h"
+#include "tm-threads.h"       /* TmThreadsGetCallingThread */
+#include "counters.h"
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
 
@@ -173,6 +178,27 @@ tryagain:
     return ret;
 }
 
+/** \brief check if the log file needs to be rotated, and if so reopen it
+ *
+ *  Must be called with fp_mutex held.
+ */
+static void SCLogFileCheckRotation(LogFileCtx *log_ctx)
+{
+    /* Check for rotation. */
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+
+    if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
+        time_t now = time(NULL);
+        if (now >= log_ctx->rotate_time) {
+            SCConfLogReopen(log_ctx);
+            log_ctx->rotate_time = now + log_ctx->rotate_interval;
+        }
+    }
+}
+
 /**
  * \brief Write buffer to log file.
  * \retval 0 on failure; otherwise, the return value of fwrite (number of
@@ -186,20 +212,7 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     if (log_ctx->is_sock) {
         ret = SCLogFileWriteSocket(buffer, buffer_len, log_ctx);
     } else {
-
-        /* Check for rotation. */
-        if (log_ctx->rotation_flag) {
-            log_ctx->rotation_flag = 0;
-            SCConfLogReopen(log_ctx);
-        }
-
-        if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
-            time_t now = time(NULL);
-            if (now >= log_ctx->rotate_time) {
-                SCConfLogReopen(log_ctx);
-                log_ctx->rotate_time = now + log_ctx->rotate_interval;
-            }
-        }
+        SCLogFileCheckRotation(log_ctx);
 
         if (log_ctx->fp) {
             clearerr(log_ctx->fp);
@@ -213,6 +226,601 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     return ret;
 }
 
+/* Async writer
+ *
+ * Each thread writing to the LogFileCtx gets its own ring buffer. The
+ * thread copies its records into the ring, the writer thread collects
+ * the data of all rings and writes it to the file using writev. Writing
+ * a record takes no lock: fp_mutex is only taken by the writer thread,
+ * once per batch.
+ */
+
+/** max number of iovecs passed to a single writev call */
+#define LOGFILE_ASYNC_IOV_MAX       64
+/** max time between flushes of the rings */
+#define LOGFILE_ASYNC_FLUSH_USEC    10000
+/** time a writer waits for space in its ring before checking again */
+#define LOGFILE_ASYNC_FULL_USEC     100
+/** min seconds between warnings about failed writes */
+#define LOGFILE_ASYNC_WARN_SECS     60
+
+/** \brief per thread ring buffer
+ *
+ *  Single producer: the thread owning the ring. Single consumer: the
+ *  writer thread. head and tail are absolute byte positions, the offset
+ *  in the buffer is 'pos & mask'.
+ */
+typedef struct LogFileAsyncRing_ {
+    uint8_t *buf;
+    uint32_t mask;
+
+    SC_ATOMIC_DECLARE(uint64_t, head);      /**< updated by producer */
+    SC_ATOMIC_DECLARE(uint64_t, tail);      /**< updated by writer thread */
+
+    /* stats, only updated by the producer */
+    SC_ATOMIC_DECLARE(uint64_t, records);   /**< records queued */
+    SC_ATOMIC_DECLARE(uint64_t, full);      /**< records that had to wait
+                                             *   for space in the ring */
+    SC_ATOMIC_DECLARE(uint64_t, dropped);   /**< records dropped as the
+                                             *   ring was full */
+
+    /** next ring, set on registration and never changed after */
+    struct LogFileAsyncRing_ *next;
+} LogFileAsyncRing;
+
+typedef struct LogFileAsync_ {
+    LogFileCtx *file_ctx;
+
+    /** size of each per thread ring, power of 2 */
+    uint32_t ring_size;
+    /** drop records if the ring is full instead of waiting */
+    bool drop_when_full;
+
+    pthread_t thread;
+    char thread_name[16];
+    SC_ATOMIC_DECLARE(int, run);
+
+    SCCtrlMutex wakeup_mutex;
+    SCCtrlCondT wakeup_cond;
+
+    /** key to look up the ring of the calling thread */
+    pthread_key_t ring_key;
+
+    /** list of per thread rings. New rings are added to the head of the
+     *  list under the lock, so the rest of the list can be walked
+     *  without it. */
+    SCMutex rings_mutex;
+    LogFileAsyncRing *rings;
+
+    /** number of writev batches, only updated by the writer thread */
+    SC_ATOMIC_DECLARE(uint64_t, batches);
+    /** records that could not be written, only updated by the writer
+     *  thread */
+    SC_ATOMIC_DECLARE(uint64_t, write_dropped);
+
+    /* rate limiting of the write failure warning, writer thread only */
+    time_t write_warn_ts;
+    uint64_t write_warn_cnt;
+
+    struct LogFileAsync_ *next;
+} LogFileAsync;
+
+/** list of all async writers, for the stats counters */
+static SCMutex async_list_mutex = SCMUTEX_INITIALIZER;
+static LogFileAsync *async_list = NULL;
+static unsigned int async_writer_cnt = 0;
+
+static inline LogFileAsyncRing *LogFileAsyncGetRings(LogFileAsync *async)
+{
+    SCMutexLock(&async->rings_mutex);
+    LogFileAsyncRing *rings = async->rings;
+    SCMutexUnlock(&async->rings_mutex);
+    return rings;
+}
+
+/** \internal
+ *  \brief count the records that were not written
+ *
+ *  Records end in a newline, so the number of records is the number of
+ *  newlines in the data that is left. A record that was written in part
+ *  is counted as well.
+ */
+static void LogFileAsyncWriteFailed(LogFileAsync *async,
+        const struct iovec *iov, int iovcnt, int err)
+{
+    uint64_t records = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const uint8_t *data = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        const uint8_t *nl;
+        while (len > 0 && (nl = memchr(data, '\n', len)) != NULL) {
+            records++;
+            len -= (nl + 1 - data);
+            data = nl + 1;
+        }
+    }
+    (void)SC_ATOMIC_ADD(async->write_dropped, records);
+
+    async->write_warn_cnt += records;
+    time_t now = time(NULL);
+    if (now - async->write_warn_ts >= LOGFILE_ASYNC_WARN_SECS) {
+        SCLogWarning(SC_ERR_FWRITE, "writing to %s failed: %s (%"PRIu64
+                " records dropped since the last warning)",
+                async->file_ctx->filename,
+                err ? strerror(err) : "file not open", async->write_warn_cnt);
+        async->write_warn_cnt = 0;
+        async->write_warn_ts = now;
+    }
+}
+
+/** \internal
+ *  \brief write out a batch, advancing the tails of the rings it
+ *         was collected from
+ *
+ *  If the data can't be written it is dropped, so that the rings don't
+ *  fill up and block the threads logging to them. The dropped records
+ *  are counted in logfile.async.dropped.
+ */
+static void LogFileAsyncWriteBatch(LogFileAsync *async,
+        struct iovec *iov, int iovcnt,
+        LogFileAsyncRing **rings, uint64_t *heads, int nrings)
+{
+    LogFileCtx *log_ctx = async->file_ctx;
+    int err = 0;
+
+    SCMutexLock(&log_ctx->fp_mutex);
+    SCLogFileCheckRotation(log_ctx);
+    if (log_ctx->fp != NULL) {
+        int fd = fileno(log_ctx->fp);
+        while (iovcnt > 0) {
+            ssize_t r = writev(fd, iov, iovcnt);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                break;
+            }
+            /* skip what was written, continue with the rest */
+            while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+                r -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (uint8_t *)iov->iov_base + r;
+                iov->iov_len -= r;
+            }
+        }
+    }
+    SCMutexUnlock(&log_ctx->fp_mutex);
+
+    if (unlikely(iovcnt > 0)) {
+        LogFileAsyncWriteFailed(async, iov, iovcnt, err);
+    }
+
+    for (int i = 0; i < nrings; i++) {
+        SC_ATOMIC_SET(rings[i]->tail, heads[i]);
+    }
+    (void)SC_ATOMIC_ADD(async->batches, 1);
+}
+
+/** \internal
+ *  \brief collect the data of all rings and write it out
+ *  \retval bytes number of bytes written
+ */
+static uint64_t LogFileAsyncFlush(LogFileAsync *async)
+{
+    struct iovec iov[LOGFILE_ASYNC_IOV_MAX];
+    LogFileAsyncRing *rings[LOGFILE_ASYNC_IOV_MAX / 2];
+    uint64_t heads[LOGFILE_ASYNC_IOV_MAX / 2];
+    int iovcnt = 0;
+    int nrings = 0;
+    uint64_t bytes = 0;
+
+    LogFileAsyncRing *ring = LogFileAsyncGetRings(async);
+    for ( ; ring != NULL; ring = ring->next) {
+        const uint64_t head = SC_ATOMIC_GET(ring->head);
+        /* make sure we don't read the data before the head */
+        hw_barrier();
+        const uint64_t tail = SC_ATOMIC_GET(ring->tail);
+        if (head == tail)
+            continue;
+
+        const uint32_t size = ring->mask + 1;
+        const uint32_t len = (uint32_t)(head - tail);
+        const uint32_t start = (uint32_t)(tail & ring->mask);
+        const uint32_t first = MIN(len, size - start);
+
+        iov[iovcnt].iov_base = ring->buf + start;
+        iov[iovcnt].iov_len = first;
+        iovcnt++;
+        if (len > first) {
+            /* wrapped around the end of the ring */
+            iov[iovcnt].iov_base = ring->buf;
+            iov[iovcnt].iov_len = len - first;
+            iovcnt++;
+        }
+        rings[nrings] = ring;
+        heads[nrings] = head;
+        nrings++;
+        bytes += len;
+
+        if (nrings == LOGFILE_ASYNC_IOV_MAX / 2) {
+            LogFileAsyncWriteBatch(async, iov, iovcnt, rings, heads, nrings);
+            iovcnt = 0;
+            nrings = 0;
+        }
+    }
+    if (nrings > 0) {
+        LogFileAsyncWriteBatch(async, iov, iovcnt, rings, heads, nrings);
+    }
+    return bytes;
+}
+
+/** \internal
+ *  \brief wake up the writer thread
+ *
+ *  Signal w/o taking the mutex, so writers don't contend on it. A
+ *  wakeup may get lost, in which case the writer thread wakes up on
+ *  its own after LOGFILE_ASYNC_FLUSH_USEC.
+ */
+static inline void LogFileAsyncWakeup(LogFileAsync *async)
+{
+    SCCtrlCondSignal(&async->wakeup_cond);
+}
+
+static void *LogFileAsyncThread(void *arg)
+{
+    LogFileAsync *async = (LogFileAsync *)arg;
+
+    /* block usr2.  usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName(async->thread_name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    while (SC_ATOMIC_GET(async->run)) {
+        /* if less than a quarter ring was written, sleep until woken up
+         * or until the flush interval passed */
+        if (LogFileAsyncFlush(async) >= async->ring_size / 4)
+            continue;
+
+        /* little data, wait for more to get larger batches. Writers
+         * wake us up if their ring is filling up. */
+        struct timeval tv;
+        struct timespec cond_time;
+        gettimeofday(&tv, NULL);
+        uint64_t usec = (uint64_t)tv.tv_usec + LOGFILE_ASYNC_FLUSH_USEC;
+        cond_time.tv_sec = tv.tv_sec + (usec / 1000000);
+        cond_time.tv_nsec = (usec % 1000000) * 1000;
+
+        SCCtrlMutexLock(&async->wakeup_mutex);
+        if (SC_ATOMIC_GET(async->run)) {
+            SCCtrlCondTimedwait(&async->wakeup_cond, &async->wakeup_mutex,
+                    &cond_time);
+        }
+        SCCtrlMutexUnlock(&async->wakeup_mutex);
+    }
+
+    /* drain what is left */
+    LogFileAsyncFlush(async);
+    return NULL;
+}
+
+/** \internal
+ *  \brief set up the ring for the calling thread */
+static LogFileAsyncRing *LogFileAsyncRingRegister(LogFileAsync *async)
+{
+    LogFileAsyncRing *ring = SCCalloc(1, sizeof(*ring));
+    if (unlikely(ring == NULL))
+        return NULL;
+    ring->buf = SCMalloc(async->ring_size);
+    if (unlikely(ring->buf == NULL)) {
+        SCFree(ring);
+        return NULL;
+    }
+    ring->mask = async->ring_size - 1;
+    SC_ATOMIC_INIT(ring->head);
+    SC_ATOMIC_INIT(ring->tail);
+    SC_ATOMIC_INIT(ring->records);
+    SC_ATOMIC_INIT(ring->full);
+    SC_ATOMIC_INIT(ring->dropped);
+
+    if (pthread_setspecific(async->ring_key, ring) != 0) {
+        SCFree(ring->buf);
+        SCFree(ring);
+        return NULL;
+    }
+
+    SCMutexLock(&async->rings_mutex);
+    ring->next = async->rings;
+    async->rings = ring;
+    SCMutexUnlock(&async->rings_mutex);
+
+    SCLogDebug("registered ring %p of %u bytes for %s", ring,
+            async->ring_size, async->file_ctx->filename);
+    return ring;
+}
+
+/** \internal
+ *  \brief wait until the writer thread wrote out all data queued in
+ *         the ring
+ *
+ *  The tail is only advanced after the data was written to the file.
+ */
+static void LogFileAsyncRingDrain(LogFileAsync *async, LogFileAsyncRing *ring)
+{
+    const uint64_t head = SC_ATOMIC_GET(ring->head);
+    while (SC_ATOMIC_GET(ring->tail) != head) {
+        if (SC_ATOMIC_GET(async->run) == 0) {
+            /* writer thread is gone, it drained the rings on exit */
+            break;
+        }
+        LogFileAsyncWakeup(async);
+        usleep(LOGFILE_ASYNC_FULL_USEC);
+    }
+}
+
+/**
+ * \brief Queue buffer for the async writer thread.
+ *
+ * If the thread's ring is full, we wait for the writer thread to make
+ * room, or drop the record if configured to do so.
+ *
+ * \retval 0 on success
+ * \retval -1 if the record was dropped
+ */
+static int LogFileAsyncWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+    const uint32_t len = (uint32_t)buffer_len;
+
+    LogFileAsyncRing *ring = pthread_getspecific(async->ring_key);
+    if (unlikely(ring == NULL)) {
+        ring = LogFileAsyncRingRegister(async);
+        if (ring == NULL) {
+            SCLogFileWrite(buffer, buffer_len, log_ctx);
+            return 0;
+        }
+    }
+
+    const uint32_t size = ring->mask + 1;
+    if (unlikely(len > size)) {
+        /* will never fit in the ring, write it directly. Wait for the
+         * writer thread to write out what this thread queued before, so
+         * the record doesn't overtake them. */
+        LogFileAsyncRingDrain(async, ring);
+        SCLogFileWrite(buffer, buffer_len, log_ctx);
+        return 0;
+    }
+
+    const uint64_t head = SC_ATOMIC_GET(ring->head);
+    uint64_t tail = SC_ATOMIC_GET(ring->tail);
+    if (size - (uint32_t)(head - tail) < len) {
+        if (async->drop_when_full) {
+            (void)SC_ATOMIC_ADD(ring->dropped, 1);
+            LogFileAsyncWakeup(async);
+            return -1;
+        }
+
+        (void)SC_ATOMIC_ADD(ring->full, 1);
+        do {
+            if (SC_ATOMIC_GET(async->run) == 0) {
+                /* writer thread is gone */
+                SCLogFileWrite(buffer, buffer_len, log_ctx);
+                return 0;
+            }
+            LogFileAsyncWakeup(async);
+            usleep(LOGFILE_ASYNC_FULL_USEC);
+            tail = SC_ATOMIC_GET(ring->tail);
+        } while (size - (uint32_t)(head - tail) < len);
+    }
+
+    const uint32_t start = (uint32_t)(head & ring->mask);
+    const uint32_t first = MIN(len, size - start);
+    memcpy(ring->buf + start, buffer, first);
+    if (len > first) {
+        memcpy(ring->buf, buffer + first, len - first);
+    }
+    /* publish the record. The CAS in SC_ATOMIC_SET acts as a barrier,
+     * so the data is visible before the new head. */
+    SC_ATOMIC_SET(ring->head, head + len);
+    (void)SC_ATOMIC_ADD(ring->records, 1);
+
+    /* wake up the writer when we cross the half full mark */
+    const uint32_t used = (uint32_t)(head - tail);
+    if (used < size / 2 && used + len >= size / 2) {
+        LogFileAsyncWakeup(async);
+    }
+    return 0;
+}
+
+static uint64_t LogFileAsyncCounter(const int type)
+{
+    uint64_t cnt = 0;
+
+    SCMutexLock(&async_list_mutex);
+    for (LogFileAsync *async = async_list; async != NULL; async = async->next) {
+        if (type == 0) {
+            cnt += SC_ATOMIC_GET(async->batches);
+            continue;
+        } else if (type == 3) {
+            cnt += SC_ATOMIC_GET(async->write_dropped);
+        }
+        LogFileAsyncRing *ring = LogFileAsyncGetRings(async);
+        for ( ; ring != NULL; ring = ring->next) {
+            if (type == 1)
+                cnt += SC_ATOMIC_GET(ring->records);
+            else if (type == 2)
+                cnt += SC_ATOMIC_GET(ring->full);
+            else
+                cnt += SC_ATOMIC_GET(ring->dropped);
+        }
+    }
+    SCMutexUnlock(&async_list_mutex);
+    return cnt;
+}
+
+static uint64_t LogFileAsyncBatchesCounter(void)
+{
+    return LogFileAsyncCounter(0);
+}
+
+static uint64_t LogFileAsyncRecordsCounter(void)
+{
+    return LogFileAsyncCounter(1);
+}
+
+static uint64_t LogFileAsyncFullCounter(void)
+{
+    return LogFileAsyncCounter(2);
+}
+
+static uint64_t LogFileAsyncDroppedCounter(void)
+{
+    return LogFileAsyncCounter(3);
+}
+
+/** \internal
+ *  \brief set up the async writer for a regular file
+ *  \param conf the 'async' node of the output
+ *  \retval 0 on success
+ *  \retval -1 on error
+ */
+static int LogFileAsyncSetup(ConfNode *conf, LogFileCtx *log_ctx)
+{
+    uint32_t ring_size = LOGFILE_ASYNC_BUFFER_SIZE_DEFAULT;
+    const char *buffer_size = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (buffer_size != NULL) {
+        if (ParseSizeStringU32(buffer_size, &ring_size) < 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "async.buffer-size: %s", buffer_size);
+            return -1;
+        }
+        if (ring_size < LOGFILE_ASYNC_BUFFER_SIZE_MIN) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "async.buffer-size "
+                    "%u too small, using %u", ring_size,
+                    LOGFILE_ASYNC_BUFFER_SIZE_MIN);
+            ring_size = LOGFILE_ASYNC_BUFFER_SIZE_MIN;
+        }
+    }
+    /* round up to a power of 2 so we can mask instead of divide */
+    uint32_t size = LOGFILE_ASYNC_BUFFER_SIZE_MIN;
+    while (size < ring_size && size < (1U << 31))
+        size <<= 1;
+    ring_size = size;
+
+    bool drop_when_full = false;
+    const char *on_full = ConfNodeLookupChildValue(conf, "on-full");
+    if (on_full != NULL) {
+        if (strcasecmp(on_full, "drop") == 0) {
+            drop_when_full = true;
+        } else if (strcasecmp(on_full, "wait") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "async.on-full: %s. Expected \"wait\" or \"drop\"",
+                    on_full);
+            return -1;
+        }
+    }
+
+    LogFileAsync *async = SCCalloc(1, sizeof(*async));
+    if (unlikely(async == NULL))
+        return -1;
+    async->file_ctx = log_ctx;
+    async->ring_size = ring_size;
+    async->drop_when_full = drop_when_full;
+    SC_ATOMIC_INIT(async->run);
+    SC_ATOMIC_INIT(async->batches);
+    SC_ATOMIC_INIT(async->write_dropped);
+    SCCtrlMutexInit(&async->wakeup_mutex, NULL);
+    SCCtrlCondInit(&async->wakeup_cond, NULL);
+    SCMutexInit(&async->rings_mutex, NULL);
+    if (pthread_key_create(&async->ring_key, NULL) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create key for "
+                "async log writer: %s", strerror(errno));
+        goto error;
+    }
+
+    SCMutexLock(&async_list_mutex);
+    unsigned int id = ++async_writer_cnt;
+    SCMutexUnlock(&async_list_mutex);
+    snprintf(async->thread_name, sizeof(async->thread_name),
+            "LogWriter#%02u", id);
+
+    SC_ATOMIC_SET(async->run, 1);
+    int rc = pthread_create(&async->thread, NULL, LogFileAsyncThread, async);
+    if (rc != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create async log "
+                "writer thread: %s", strerror(rc));
+        pthread_key_delete(async->ring_key);
+        goto error;
+    }
+
+    SCMutexLock(&async_list_mutex);
+    async->next = async_list;
+    async_list = async;
+    SCMutexUnlock(&async_list_mutex);
+
+    log_ctx->async = async;
+    log_ctx->Write = LogFileAsyncWrite;
+
+    StatsRegisterGlobalCounter("logfile.async.batches", LogFileAsyncBatchesCounter);
+    StatsRegisterGlobalCounter("logfile.async.records", LogFileAsyncRecordsCounter);
+    StatsRegisterGlobalCounter("logfile.async.backpressure", LogFileAsyncFullCounter);
+    StatsRegisterGlobalCounter("logfile.async.dropped", LogFileAsyncDroppedCounter);
+
+    SCLogConfig("async writer %s enabled: %u bytes per thread, %s when full",
+            async->thread_name, ring_size, drop_when_full ? "drop" : "wait");
+    return 0;
+
+error:
+    SCMutexDestroy(&async->rings_mutex);
+    SCCtrlCondDestroy(&async->wakeup_cond);
+    SCCtrlMutexDestroy(&async->wakeup_mutex);
+    SCFree(async);
+    return -1;
+}
+
+/** \internal
+ *  \brief stop the writer thread after it wrote out all queued records,
+ *         and free the async writer */
+static void LogFileAsyncFree(LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+
+    SC_ATOMIC_SET(async->run, 0);
+    LogFileAsyncWakeup(async);
+    pthread_join(async->thread, NULL);
+
+    /* records may have been queued while the thread shut down */
+    LogFileAsyncFlush(async);
+
+    SCMutexLock(&async_list_mutex);
+    LogFileAsync **a = &async_list;
+    while (*a != NULL && *a != async)
+        a = &(*a)->next;
+    if (*a != NULL)
+        *a = async->next;
+    SCMutexUnlock(&async_list_mutex);
+
+    LogFileAsyncRing *ring = async->rings;
+    while (ring != NULL) {
+        LogFileAsyncRing *next = ring->next;
+        SCFree(ring->buf);
+        SCFree(ring);
+        ring = next;
+    }
+    pthread_key_delete(async->ring_key);
+    SCMutexDestroy(&async->rings_mutex);
+    SCCtrlCondDestroy(&async->wakeup_cond);
+    SCCtrlMutexDestroy(&async->wakeup_mutex);
+    SCFree(async);
+
+    log_ctx->async = NULL;
+    log_ctx->Write = SCLogFileWrite;
+}
+
 /** \brief generate filename based on pattern
  *  \param pattern pattern to use
  *  \retval char* on success
@@ -339,6 +947,213 @@ static PcieFile *SCLogOpenPcieFp(LogFileCtx *log_ctx, const char *path,
 #endif
 }
 
+/* Per thread files
+ *
+ * Each thread writing to the LogFileCtx gets its own LogFileCtx and file,
+ * so threads don't share a lock. The thread's LogFileCtx is looked up
+ * through a pthread key and set up on its first write. The files are
+ * named after the thread, so a thread writes to the same file on every
+ * run. */
+
+typedef struct LogThreadedFileCtx_ {
+    /** key to look up the LogFileCtx of the calling thread */
+    pthread_key_t key;
+
+    /** protects slots and slot_count */
+    SCMutex mutex;
+    LogFileCtx **slots;
+    uint32_t slot_count;
+
+    /** append setting to open the files with */
+    char *append;
+} LogThreadedFileCtx;
+
+/** set as the LogFileCtx of a thread for which opening its file failed,
+ *  so we don't retry on every record */
+static char threaded_open_failed;
+
+/** \internal
+ *  \brief get the file name suffix for the calling thread
+ *
+ *  The suffix is the thread name with anything but letters, digits, '-'
+ *  and '_' replaced, e.g. 'W#01-eth0' becomes 'W_01-eth0'. Threads not
+ *  managed by the threading module use their thread id.
+ */
+static void LogFileThreadedSuffix(char *suffix, size_t suffix_size)
+{
+    ThreadVars *tv = TmThreadsGetCallingThread();
+    if (tv == NULL || tv->name[0] == '\0') {
+        snprintf(suffix, suffix_size, "%lu", SCGetThreadIdLong());
+        return;
+    }
+
+    strlcpy(suffix, tv->name, suffix_size);
+    for (char *c = suffix; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_')
+            *c = '_';
+    }
+}
+
+/** \internal
+ *  \brief get the file name for a thread: 'eve.json' becomes
+ *         'eve.<suffix>.json'
+ *  \retval 0 on success
+ *  \retval -1 if the name doesn't fit in the buffer
+ */
+static int LogFileThreadedName(const char *filename, const char *suffix,
+                               char *name, size_t name_size)
+{
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    const char *ext = strrchr(base, '.');
+
+    int r;
+    if (ext != NULL && ext != base) {
+        r = snprintf(name, name_size, "%.*s.%s%s",
+                (int)(ext - filename), filename, suffix, ext);
+    } else {
+        r = snprintf(name, name_size, "%s.%s", filename, suffix);
+    }
+    if (r < 0 || (size_t)r >= name_size)
+        return -1;
+    return 0;
+}
+
+/** \internal
+ *  \brief set up the LogFileCtx and file for the calling thread
+ *
+ *  On failure the thread is marked, so its records are dropped from
+ *  then on instead of retrying the open on every record.
+ */
+static LogFileCtx *LogFileThreadedNewCtx(LogFileCtx *parent_ctx)
+{
+    LogThreadedFileCtx *threads = parent_ctx->threads;
+    char suffix[32];
+    char name[PATH_MAX];
+    LogFileCtx *thread_ctx = NULL;
+
+    LogFileThreadedSuffix(suffix, sizeof(suffix));
+
+    SCMutexLock(&threads->mutex);
+    if (LogFileThreadedName(parent_ctx->filename, suffix, name, sizeof(name)) != 0) {
+        SCLogError(SC_ERR_SPRINTF, "per thread file name for %s too long",
+                parent_ctx->filename);
+        goto error;
+    }
+    for (uint32_t i = 0; i < threads->slot_count; i++) {
+        if (strcmp(threads->slots[i]->filename, name) == 0) {
+            SCLogError(SC_ERR_LOGDIR_CONFIG, "per thread log file %s is "
+                    "already used by another thread", name);
+            goto error;
+        }
+    }
+
+    LogFileCtx **slots = SCRealloc(threads->slots,
+            (threads->slot_count + 1) * sizeof(LogFileCtx *));
+    if (unlikely(slots == NULL))
+        goto error;
+    threads->slots = slots;
+
+    thread_ctx = LogFileNewCtx();
+    if (unlikely(thread_ctx == NULL))
+        goto error;
+    thread_ctx->filename = SCStrdup(name);
+    if (unlikely(thread_ctx->filename == NULL))
+        goto error;
+    thread_ctx->fp = SCLogOpenFileFp(name, threads->append, parent_ctx->filemode);
+    if (thread_ctx->fp == NULL)
+        goto error; // Error already logged by Open...Fp routine
+
+    thread_ctx->type = parent_ctx->type;
+    thread_ctx->filemode = parent_ctx->filemode;
+    thread_ctx->is_regular = 1;
+    thread_ctx->flags = parent_ctx->flags & LOGFILE_ROTATE_INTERVAL;
+    thread_ctx->rotate_time = parent_ctx->rotate_time;
+    thread_ctx->rotate_interval = parent_ctx->rotate_interval;
+    OutputRegisterFileRotationFlag(&thread_ctx->rotation_flag);
+
+    if (pthread_setspecific(threads->key, thread_ctx) != 0) {
+        SCLogError(SC_ERR_THREAD_INIT, "failed to set per thread log file "
+                "%s", name);
+        goto error;
+    }
+    threads->slots[threads->slot_count++] = thread_ctx;
+    SCMutexUnlock(&threads->mutex);
+
+    SCLogInfo("per thread log file %s opened", name);
+    return thread_ctx;
+
+error:
+    SCMutexUnlock(&threads->mutex);
+    if (thread_ctx != NULL)
+        LogFileFreeCtx(thread_ctx);
+    SCLogError(SC_ERR_LOGDIR_CONFIG, "dropping the records of this thread "
+            "for %s", parent_ctx->filename);
+    (void)pthread_setspecific(threads->key, &threaded_open_failed);
+    return NULL;
+}
+
+/** \brief Write buffer to the log file of the calling thread. */
+static int LogFileThreadedWrite(const char *buffer, int buffer_len, LogFileCtx *log_ctx)
+{
+    void *ptr = pthread_getspecific(log_ctx->threads->key);
+    if (unlikely(ptr == NULL)) {
+        ptr = LogFileThreadedNewCtx(log_ctx);
+    }
+    if (unlikely(ptr == NULL || ptr == &threaded_open_failed)) {
+        /* multiple threads may drop at the same time */
+        (void)SCAtomicAddAndFetch(&log_ctx->dropped, 1);
+        return -1;
+    }
+    LogFileCtx *thread_ctx = ptr;
+    return thread_ctx->Write(buffer, buffer_len, thread_ctx);
+}
+
+/** \internal
+ *  \brief set up per thread files for log_ctx
+ *  \retval 0 on success
+ *  \retval -1 on error
+ */
+static int LogFileThreadedSetup(LogFileCtx *log_ctx, const char *append)
+{
+    LogThreadedFileCtx *threads = SCCalloc(1, sizeof(*threads));
+    if (unlikely(threads == NULL))
+        return -1;
+    threads->append = SCStrdup(append);
+    if (unlikely(threads->append == NULL)) {
+        SCFree(threads);
+        return -1;
+    }
+    if (pthread_key_create(&threads->key, NULL) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create key for per "
+                "thread log files: %s", strerror(errno));
+        SCFree(threads->append);
+        SCFree(threads);
+        return -1;
+    }
+    SCMutexInit(&threads->mutex, NULL);
+
+    log_ctx->threads = threads;
+    log_ctx->Write = LogFileThreadedWrite;
+    return 0;
+}
+
+static void LogFileThreadedFree(LogFileCtx *log_ctx)
+{
+    LogThreadedFileCtx *threads = log_ctx->threads;
+
+    for (uint32_t i = 0; i < threads->slot_count; i++) {
+        LogFileFreeCtx(threads->slots[i]);
+    }
+    if (threads->slots != NULL)
+        SCFree(threads->slots);
+    pthread_key_delete(threads->key);
+    SCMutexDestroy(&threads->mutex);
+    SCFree(threads->append);
+    SCFree(threads);
+    log_ctx->threads = NULL;
+}
+
 /** \brief open a generic output "log file", which may be a regular file or a socket
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -473,12 +1288,31 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_DGRAM, 1);
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
-        if (log_ctx->fp == NULL)
-            return -1; // Error already logged by Open...Fp routine
         log_ctx->is_regular = 1;
-        if (rotate) {
-            OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
+        ConfNode *async = ConfNodeLookupChild(conf, "async");
+
+        if (ConfNodeChildValueIsTrue(conf, "threaded")) {
+            /* files are opened by the threads on their first write. Each
+             * file registers its own rotation flag. */
+            if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+                SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s: async "
+                        "writing is not used with per thread files",
+                        conf->name);
+            }
+            if (LogFileThreadedSetup(log_ctx, append) != 0)
+                return -1;
+        } else {
+            log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
+            if (log_ctx->fp == NULL)
+                return -1; // Error already logged by Open...Fp routine
+            if (rotate) {
+                OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
+            }
+
+            if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+                if (LogFileAsyncSetup(async, log_ctx) != 0)
+                    return -1;
+            }
         }
     } else if (strcasecmp(filetype, "pcie") == 0) {
         log_ctx->pcie_fp = SCLogOpenPcieFp(log_ctx, log_path, append);
@@ -539,7 +1373,8 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
         return -1;
     }
 
-    fclose(log_ctx->fp);
+    if (log_ctx->fp != NULL)
+        fclose(log_ctx->fp);
 
     /* Reopen the file. Append is forced in case the file was not
      * moved as part of a rotation process. */
@@ -583,6 +1418,15 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    /* write out everything that is still queued before closing */
+    if (lf_ctx->async != NULL) {
+        LogFileAsyncFree(lf_ctx);
+    }
+
+    if (lf_ctx->threads != NULL) {
+        LogFileThreadedFree(lf_ctx);
+    }
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
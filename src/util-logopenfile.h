@@ -47,6 +47,9 @@ typedef struct SyslogSetup_ {
     int alert_syslog_level;
 } SyslogSetup;
 
+struct LogFileAsync_;
+struct LogThreadedFileCtx_;
+
 
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
@@ -128,6 +131,14 @@ typedef struct LogFileCtx_ {
     /* Socket types may need to drop events to keep from blocking
      * Suricata. */
     uint64_t dropped;
+
+    /** Async writer state. If set, records are queued to per thread
+     *  ring buffers and written out by a dedicated writer thread. */
+    struct LogFileAsync_ *async;
+
+    /** Per thread files. If set, each thread writing to this LogFileCtx
+     *  gets its own file and LogFileCtx. */
+    struct LogThreadedFileCtx_ *threads;
 } LogFileCtx;
 
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
@@ -138,6 +149,10 @@ typedef struct LogFileCtx_ {
 #define LOGFILE_ALERTS_PRINTED  0x02
 #define LOGFILE_ROTATE_INTERVAL 0x04
 
+/* defaults for the async writer */
+#define LOGFILE_ASYNC_BUFFER_SIZE_DEFAULT   (1024 * 1024)
+#define LOGFILE_ASYNC_BUFFER_SIZE_MIN       (64 * 1024)
+
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
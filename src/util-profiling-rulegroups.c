@@ -28,6 +28,7 @@
 #include "decode.h"
 #include "detect.h"
 #include "detect-engine.h"
+#include "detect-engine-prefilter.h"
 #include "conf.h"
 
 #include "tm-threads.h"
@@ -54,6 +55,11 @@ typedef struct SCProfileSghData_ {
     uint64_t mpm_match_cnt_total;
     uint64_t mpm_match_cnt_max;
 
+    /* how the prefilter candidates were ordered */
+    uint64_t pf_sort_qsort;
+    uint64_t pf_sort_bitmap;
+    uint64_t pf_sort_radix;
+
 } SCProfileSghData;
 
 typedef struct SCProfileSghDetectCtx_ {
@@ -151,6 +157,9 @@ static void DoDumpJSON(SCProfileSghDetectCtx *rules_ctx, FILE *fp, const char *n
             json_object_set_new(jsm, "mpm_match_cnt_max", json_integer(d->mpm_match_cnt_max));
             json_object_set_new(jsm, "avgsigs", json_real(avgsigs));
             json_object_set_new(jsm, "post_prefilter_sigs_max", json_integer(d->post_prefilter_sigs_max));
+            json_object_set_new(jsm, "prefilter_sort_qsort", json_integer(d->pf_sort_qsort));
+            json_object_set_new(jsm, "prefilter_sort_bitmap", json_integer(d->pf_sort_bitmap));
+            json_object_set_new(jsm, "prefilter_sort_radix", json_integer(d->pf_sort_radix));
             json_array_append_new(jsa, jsm);
         }
     }
@@ -191,7 +200,7 @@ static void DoDump(SCProfileSghDetectCtx *rules_ctx, FILE *fp, const char *name)
     fprintf(fp, "  ----------------------------------------------"
             "------------------------------------------------------"
             "----------------------------\n");
-    fprintf(fp, "  %-16s %-15s %-15s %-15s %-15s %-15s %-15s %-15s\n", "Sgh", "Checks", "Non-MPM(gen)", "Non-Mpm(syn)", "MPM Matches", "MPM Match Max", "Post-Filter", "Post-Filter Max");
+    fprintf(fp, "  %-16s %-15s %-15s %-15s %-15s %-15s %-15s %-15s %-15s %-15s %-15s\n", "Sgh", "Checks", "Non-MPM(gen)", "Non-Mpm(syn)", "MPM Matches", "MPM Match Max", "Post-Filter", "Post-Filter Max", "Sort(qsort)", "Sort(bitmap)", "Sort(radix)");
     fprintf(fp, "  ---------------- "
                 "--------------- "
                 "--------------- "
@@ -200,6 +209,9 @@ static void DoDump(SCProfileSghDetectCtx *rules_ctx, FILE *fp, const char *name)
                 "--------------- "
                 "--------------- "
                 "--------------- "
+                "--------------- "
+                "--------------- "
+                "--------------- "
         "\n");
     for (i = 0; i < rules_ctx->cnt; i++) {
         SCProfileSghData *d = &rules_ctx->data[i];
@@ -217,7 +229,7 @@ static void DoDump(SCProfileSghDetectCtx *rules_ctx, FILE *fp, const char *name)
         }
 
         fprintf(fp,
-            "  %-16u %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15.2f %-15"PRIu64" %-15.2f %-15"PRIu64"\n",
+            "  %-16u %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15.2f %-15"PRIu64" %-15.2f %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15"PRIu64"\n",
             i,
             d->checks,
             d->non_mpm_generic,
@@ -225,7 +237,10 @@ static void DoDump(SCProfileSghDetectCtx *rules_ctx, FILE *fp, const char *name)
             avgmpms,
             d->mpm_match_cnt_max,
             avgsigs,
-            d->post_prefilter_sigs_max);
+            d->post_prefilter_sigs_max,
+            d->pf_sort_qsort,
+            d->pf_sort_bitmap,
+            d->pf_sort_radix);
     }
     fprintf(fp,"\n");
 }
@@ -290,9 +305,20 @@ SCProfilingSghUpdateCounter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *
         p->post_prefilter_sigs_total += det_ctx->match_array_cnt;
         if (det_ctx->match_array_cnt > p->post_prefilter_sigs_max)
             p->post_prefilter_sigs_max = det_ctx->match_array_cnt;
-        p->mpm_match_cnt_total += det_ctx->pmq.rule_id_array_cnt;
-        if (det_ctx->pmq.rule_id_array_cnt > p->mpm_match_cnt_max)
-            p->mpm_match_cnt_max = det_ctx->pmq.rule_id_array_cnt;
+        p->mpm_match_cnt_total += det_ctx->pf_candidates_cnt;
+        if (det_ctx->pf_candidates_cnt > p->mpm_match_cnt_max)
+            p->mpm_match_cnt_max = det_ctx->pf_candidates_cnt;
+        switch (det_ctx->pf_sort_method) {
+            case PREFILTER_SORT_QSORT:
+                p->pf_sort_qsort++;
+                break;
+            case PREFILTER_SORT_BITMAP:
+                p->pf_sort_bitmap++;
+                break;
+            case PREFILTER_SORT_RADIX:
+                p->pf_sort_radix++;
+                break;
+        }
     }
 }
 
@@ -357,6 +383,9 @@ static void SCProfilingSghThreadMerge(DetectEngineCtx *de_ctx, const DetectEngin
         ADD(non_mpm_syn);
         ADD(post_prefilter_sigs_total);
         ADD(mpm_match_cnt_total);
+        ADD(pf_sort_qsort);
+        ADD(pf_sort_bitmap);
+        ADD(pf_sort_radix);
 
         if (det_ctx->sgh_perf_data[i].mpm_match_cnt_max > de_ctx->profile_sgh_ctx->data[i].mpm_match_cnt_max)
             de_ctx->profile_sgh_ctx->data[i].mpm_match_cnt_max = det_ctx->sgh_perf_data[i].mpm_match_cnt_max;
@@ -0,0 +1,1020 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Read only, compact version of an IPv4 or IPv6 radix tree.
+ *
+ * A radix tree is compiled into a SCRadixCompactTree once all keys are
+ * added. Compiling flattens the prefixes into sorted address ranges, see
+ * SCRadixCompactTree. Lookups then touch a few small arrays instead of
+ * following a chain of nodes, prefixes and user data lists.
+ *
+ * A compact tree is never modified. SCRadixCompactUpdateTree builds a new
+ * tree from an existing one and a set of changes, so that the owner can
+ * swap the trees while lookups continue on the old one.
+ */
+
+#include "suricata-common.h"
+#include "util-radix-tree.h"
+#include "util-radix-compact.h"
+#include "util-debug.h"
+#include "util-error.h"
+#include "util-unittest.h"
+
+/** 128 bit address, IPv4 addresses only use the low 32 bits */
+typedef struct SCRadixCompactKey_ {
+    uint64_t hi;
+    uint64_t lo;
+} SCRadixCompactKey;
+
+/** a prefix from the radix tree or an update */
+typedef struct SCRadixCompactEntry_ {
+    SCRadixCompactKey start;
+    SCRadixCompactKey end;
+    uint8_t netmask;
+    /** update only: remove the prefix */
+    uint8_t remove;
+    /** order in which the prefixes were added */
+    uint32_t seq;
+    void *user;
+} SCRadixCompactEntry;
+
+typedef struct SCRadixCompactBuilder_ {
+    uint16_t key_bitlen;
+
+    SCRadixCompactEntry *entries;
+    uint32_t entries_cnt;
+    uint32_t entries_size;
+    /** duplicates, stored after the entries */
+    uint32_t dups_cnt;
+
+    SCRadixCompactKey *starts;
+    uint32_t *ranges;
+    uint32_t ranges_cnt;
+} SCRadixCompactBuilder;
+
+/** \internal
+ *  \brief key with the low 'bits' bits set */
+static SCRadixCompactKey SCRadixCompactKeyLowBits(uint8_t bits)
+{
+    SCRadixCompactKey k;
+
+    if (bits >= 128) {
+        k.hi = UINT64_MAX;
+        k.lo = UINT64_MAX;
+    } else if (bits > 64) {
+        k.hi = (1ULL << (bits - 64)) - 1;
+        k.lo = UINT64_MAX;
+    } else if (bits == 64) {
+        k.hi = 0;
+        k.lo = UINT64_MAX;
+    } else {
+        k.hi = 0;
+        k.lo = (1ULL << bits) - 1;
+    }
+    return k;
+}
+
+static int SCRadixCompactKeyCompare(const SCRadixCompactKey *a,
+                                    const SCRadixCompactKey *b)
+{
+    if (a->hi != b->hi)
+        return a->hi < b->hi ? -1 : 1;
+    if (a->lo != b->lo)
+        return a->lo < b->lo ? -1 : 1;
+    return 0;
+}
+
+static SCRadixCompactKey SCRadixCompactKeyFromStream(const uint8_t *stream,
+                                                     uint16_t key_bitlen)
+{
+    SCRadixCompactKey k = { 0, 0 };
+    int i;
+
+    if (key_bitlen == 32) {
+        for (i = 0; i < 4; i++)
+            k.lo = (k.lo << 8) | stream[i];
+    } else {
+        for (i = 0; i < 8; i++)
+            k.hi = (k.hi << 8) | stream[i];
+        for (i = 8; i < 16; i++)
+            k.lo = (k.lo << 8) | stream[i];
+    }
+    return k;
+}
+
+/** \internal
+ *  \brief set the start and end of the prefix 'key'/'netmask' */
+static void SCRadixCompactEntrySetKey(SCRadixCompactEntry *e, SCRadixCompactKey key,
+                                      uint8_t netmask, uint16_t key_bitlen)
+{
+    if (netmask > key_bitlen)
+        netmask = key_bitlen;
+
+    SCRadixCompactKey host = SCRadixCompactKeyLowBits(key_bitlen - netmask);
+    e->start.hi = key.hi & ~host.hi;
+    e->start.lo = key.lo & ~host.lo;
+    e->end.hi = key.hi | host.hi;
+    e->end.lo = key.lo | host.lo;
+    e->netmask = netmask;
+}
+
+static SCRadixCompactEntry *SCRadixCompactNewEntry(SCRadixCompactBuilder *b)
+{
+    if (b->entries_cnt == b->entries_size) {
+        uint32_t size = b->entries_size ? b->entries_size * 2 : 1024;
+        SCRadixCompactEntry *ptmp = SCRealloc(b->entries,
+                size * sizeof(SCRadixCompactEntry));
+        if (ptmp == NULL)
+            return NULL;
+        b->entries = ptmp;
+        b->entries_size = size;
+    }
+
+    SCRadixCompactEntry *e = &b->entries[b->entries_cnt];
+    memset(e, 0, sizeof(*e));
+    e->seq = b->entries_cnt++;
+    return e;
+}
+
+static int SCRadixCompactAddEntry(SCRadixCompactBuilder *b,
+                                  const uint8_t *stream, uint8_t netmask,
+                                  void *user)
+{
+    SCRadixCompactEntry *e = SCRadixCompactNewEntry(b);
+    if (e == NULL)
+        return -1;
+
+    SCRadixCompactEntrySetKey(e, SCRadixCompactKeyFromStream(stream, b->key_bitlen),
+            netmask, b->key_bitlen);
+    e->user = user;
+    return 0;
+}
+
+/** \internal
+ *  \brief collect the prefixes of a (sub)tree */
+static int SCRadixCompactAddNode(SCRadixCompactBuilder *b, SCRadixNode *node)
+{
+    while (node != NULL) {
+        if (node->prefix != NULL && node->prefix->bitlen == b->key_bitlen) {
+            SCRadixUserData *ud;
+            for (ud = node->prefix->user_data; ud != NULL; ud = ud->next) {
+                if (SCRadixCompactAddEntry(b, node->prefix->stream,
+                            ud->netmask, ud->user) < 0)
+                    return -1;
+            }
+        }
+
+        if (node->left != NULL && node->right != NULL) {
+            if (SCRadixCompactAddNode(b, node->left) < 0)
+                return -1;
+            node = node->right;
+        } else {
+            node = node->left != NULL ? node->left : node->right;
+        }
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief sort prefixes by start address, wider prefixes first */
+static int SCRadixCompactEntryCompare(const void *a, const void *b)
+{
+    const SCRadixCompactEntry *ea = a;
+    const SCRadixCompactEntry *eb = b;
+
+    int r = SCRadixCompactKeyCompare(&ea->start, &eb->start);
+    if (r != 0)
+        return r;
+    if (ea->netmask != eb->netmask)
+        return ea->netmask < eb->netmask ? -1 : 1;
+    return ea->seq < eb->seq ? -1 : 1;
+}
+
+/** \internal
+ *  \brief move duplicate prefixes behind the unique ones
+ *
+ *  The entries must be sorted. The first prefix added wins, the others
+ *  end up after entries_cnt, dups_cnt of them.
+ */
+static void SCRadixCompactDedupe(SCRadixCompactBuilder *b)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < b->entries_cnt; i++) {
+        SCRadixCompactEntry *e = &b->entries[i];
+        if (n > 0 && e->netmask == b->entries[n - 1].netmask &&
+            SCRadixCompactKeyCompare(&e->start, &b->entries[n - 1].start) == 0)
+            continue;
+        if (n != i) {
+            SCRadixCompactEntry tmp = b->entries[n];
+            b->entries[n] = *e;
+            *e = tmp;
+        }
+        n++;
+    }
+    b->dups_cnt = b->entries_cnt - n;
+    b->entries_cnt = n;
+}
+
+/** \internal
+ *  \brief start a new range at 'start', merging it with the last range
+ *         if that starts at the same address or has the same user */
+static void SCRadixCompactEmit(SCRadixCompactBuilder *b,
+                               SCRadixCompactKey start, uint32_t user_idx)
+{
+    if (b->ranges_cnt > 0 &&
+        SCRadixCompactKeyCompare(&b->starts[b->ranges_cnt - 1], &start) == 0)
+    {
+        b->ranges_cnt--;
+    }
+    if (b->ranges_cnt > 0 && b->ranges[b->ranges_cnt - 1] == user_idx)
+        return;
+
+    b->starts[b->ranges_cnt] = start;
+    b->ranges[b->ranges_cnt] = user_idx;
+    b->ranges_cnt++;
+}
+
+/** \internal
+ *  \brief turn the sorted, unique prefixes into non overlapping ranges
+ *
+ *  The prefixes enclosing the current address are kept on a stack. A
+ *  prefix starts a range with its own user data, when it ends the range
+ *  continues with the user data of the prefix enclosing it. The user data
+ *  of entry i ends up at index i + 1 of the tree's user array.
+ */
+static int SCRadixCompactBuildRanges(SCRadixCompactBuilder *b)
+{
+    SCRadixCompactEntry *stack[129];
+    int depth = 0;
+    uint32_t i;
+    const SCRadixCompactKey zero = { 0, 0 };
+
+    b->starts = SCMalloc((2 * b->entries_cnt + 1) * sizeof(SCRadixCompactKey));
+    b->ranges = SCMalloc((2 * b->entries_cnt + 1) * sizeof(uint32_t));
+    if (b->starts == NULL || b->ranges == NULL)
+        return -1;
+
+    SCRadixCompactEmit(b, zero, 0);
+
+    for (i = 0; i < b->entries_cnt; i++) {
+        SCRadixCompactEntry *e = &b->entries[i];
+
+        while (depth > 0 &&
+               SCRadixCompactKeyCompare(&stack[depth - 1]->end, &e->start) < 0)
+        {
+            SCRadixCompactKey next = stack[--depth]->end;
+            if (++next.lo == 0)
+                next.hi++;
+            SCRadixCompactEmit(b, next,
+                    depth ? (uint32_t)(stack[depth - 1] - b->entries) + 1 : 0);
+        }
+
+        SCRadixCompactEmit(b, e->start, i + 1);
+        BUG_ON(depth >= (int)(sizeof(stack) / sizeof(stack[0])));
+        stack[depth++] = e;
+    }
+
+    const SCRadixCompactKey max = SCRadixCompactKeyLowBits(b->key_bitlen);
+    while (depth > 0) {
+        SCRadixCompactKey next = stack[--depth]->end;
+        if (SCRadixCompactKeyCompare(&next, &max) == 0)
+            continue;
+        if (++next.lo == 0)
+            next.hi++;
+        SCRadixCompactEmit(b, next,
+                depth ? (uint32_t)(stack[depth - 1] - b->entries) + 1 : 0);
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief get the first index_bits bits of a range start */
+static inline uint32_t SCRadixCompactIndexKey(const SCRadixCompactTree *t,
+                                              const SCRadixCompactKey *k)
+{
+    if (t->key_bitlen == 32)
+        return (uint32_t)(k->lo >> t->index_shift);
+    return (uint32_t)(k->hi >> t->index_shift);
+}
+
+static int SCRadixCompactBuildTree(SCRadixCompactTree *t, SCRadixCompactBuilder *b)
+{
+    uint32_t i;
+
+    t->ranges_cnt = b->ranges_cnt;
+
+    /* about one range per index slot, within bounds */
+    uint8_t bits = SC_RADIX_COMPACT_INDEX_BITS_MIN;
+    while (bits < SC_RADIX_COMPACT_INDEX_BITS_MAX && (1U << (bits + 1)) <= b->ranges_cnt)
+        bits++;
+    t->index_bits = bits;
+    t->index_shift = (t->key_bitlen == 32 ? 32 : 64) - bits;
+
+    if (t->key_bitlen == 32) {
+        t->starts4 = SCMalloc(b->ranges_cnt * sizeof(uint32_t));
+        if (t->starts4 == NULL)
+            return -1;
+        for (i = 0; i < b->ranges_cnt; i++)
+            t->starts4[i] = (uint32_t)b->starts[i].lo;
+        t->memuse += b->ranges_cnt * sizeof(uint32_t);
+    } else {
+        t->starts6 = SCMalloc(b->ranges_cnt * 2 * sizeof(uint64_t));
+        if (t->starts6 == NULL)
+            return -1;
+        for (i = 0; i < b->ranges_cnt; i++) {
+            t->starts6[i * 2] = b->starts[i].hi;
+            t->starts6[i * 2 + 1] = b->starts[i].lo;
+        }
+        t->memuse += b->ranges_cnt * 2 * sizeof(uint64_t);
+    }
+
+    t->ranges = SCMalloc(b->ranges_cnt * sizeof(uint32_t));
+    if (t->ranges == NULL)
+        return -1;
+    memcpy(t->ranges, b->ranges, b->ranges_cnt * sizeof(uint32_t));
+    t->memuse += b->ranges_cnt * sizeof(uint32_t);
+
+    uint32_t slots = 1U << bits;
+    t->index = SCMalloc((slots + 1) * sizeof(uint32_t));
+    if (t->index == NULL)
+        return -1;
+    t->memuse += (slots + 1) * sizeof(uint32_t);
+
+    uint32_t r = 0;
+    for (i = 0; i <= slots; i++) {
+        while (r < b->ranges_cnt && SCRadixCompactIndexKey(t, &b->starts[r]) < i)
+            r++;
+        t->index[i] = r;
+    }
+
+    t->user = SCCalloc(b->entries_cnt + 1, sizeof(void *));
+    t->netmasks = SCMalloc(b->entries_cnt + 1);
+    if (t->user == NULL || t->netmasks == NULL)
+        return -1;
+    t->user_cnt = b->entries_cnt;
+    t->memuse += (b->entries_cnt + 1) * (sizeof(void *) + 1);
+
+    if (t->key_bitlen == 32) {
+        t->prefixes4 = SCMalloc((b->entries_cnt + 1) * sizeof(uint32_t));
+        if (t->prefixes4 == NULL)
+            return -1;
+        t->memuse += (b->entries_cnt + 1) * sizeof(uint32_t);
+    } else {
+        t->prefixes6 = SCMalloc((b->entries_cnt + 1) * 2 * sizeof(uint64_t));
+        if (t->prefixes6 == NULL)
+            return -1;
+        t->memuse += (b->entries_cnt + 1) * 2 * sizeof(uint64_t);
+    }
+
+    for (i = 0; i < b->entries_cnt; i++) {
+        const SCRadixCompactEntry *e = &b->entries[i];
+        t->user[i + 1] = e->user;
+        t->netmasks[i] = e->netmask;
+        if (t->key_bitlen == 32) {
+            t->prefixes4[i] = (uint32_t)e->start.lo;
+        } else {
+            t->prefixes6[i * 2] = e->start.hi;
+            t->prefixes6[i * 2 + 1] = e->start.lo;
+        }
+    }
+    return 0;
+}
+
+static void SCRadixCompactBuilderFree(SCRadixCompactBuilder *b)
+{
+    if (b->entries != NULL)
+        SCFree(b->entries);
+    if (b->starts != NULL)
+        SCFree(b->starts);
+    if (b->ranges != NULL)
+        SCFree(b->ranges);
+}
+
+/** \internal
+ *  \brief build a compact tree from sorted prefixes
+ *
+ *  Duplicate prefixes are moved out of the way, see SCRadixCompactDedupe.
+ */
+static SCRadixCompactTree *SCRadixCompactBuild(SCRadixCompactBuilder *b)
+{
+    SCRadixCompactDedupe(b);
+
+    SCRadixCompactTree *t = SCCalloc(1, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->key_bitlen = b->key_bitlen;
+
+    if (SCRadixCompactBuildRanges(b) < 0 || SCRadixCompactBuildTree(t, b) < 0) {
+        SCRadixCompactReleaseTree(t);
+        return NULL;
+    }
+
+    SCLogDebug("compiled %u prefixes into %u ranges, index bits %u, "
+            "%"PRIu64" bytes", b->entries_cnt, t->ranges_cnt, t->index_bits,
+            t->memuse);
+    return t;
+}
+
+/**
+ * \brief Compile a radix tree with IPv4 or IPv6 keys into a compact tree
+ *
+ *        On success the radix tree is released and the compact tree takes
+ *        over its user data, which is freed with the Free function of the
+ *        radix tree when the compact tree is released. On failure the
+ *        radix tree is left untouched.
+ *
+ * \param tree       radix tree to compile
+ * \param key_bitlen 32 for an IPv4 tree, 128 for an IPv6 tree
+ *
+ * \retval t compact tree or NULL on error
+ */
+SCRadixCompactTree *SCRadixCompactCompileTree(SCRadixTree *tree, uint16_t key_bitlen)
+{
+    SCRadixCompactBuilder b;
+    SCRadixCompactTree *t = NULL;
+
+    if (tree == NULL || (key_bitlen != 32 && key_bitlen != 128))
+        return NULL;
+
+    memset(&b, 0, sizeof(b));
+    b.key_bitlen = key_bitlen;
+
+    if (SCRadixCompactAddNode(&b, tree->head) < 0)
+        goto error;
+
+    if (b.entries_cnt > 0)
+        qsort(b.entries, b.entries_cnt, sizeof(SCRadixCompactEntry),
+              SCRadixCompactEntryCompare);
+
+    t = SCRadixCompactBuild(&b);
+    if (t == NULL)
+        goto error;
+
+    /* the tree takes over the user data, except for the duplicates */
+    if (tree->Free != NULL) {
+        uint32_t i;
+        for (i = b.entries_cnt; i < b.entries_cnt + b.dups_cnt; i++) {
+            if (b.entries[i].user != NULL)
+                tree->Free(b.entries[i].user);
+        }
+    }
+    SCRadixCompactBuilderFree(&b);
+
+    t->Free = tree->Free;
+    tree->Free = NULL;
+    SCRadixReleaseRadixTree(tree);
+    return t;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "failed to compile radix tree");
+    SCRadixCompactBuilderFree(&b);
+    return NULL;
+}
+
+/**
+ * \brief Build a new compact tree from a compact tree and a set of changes
+ *
+ *        The tree is not modified, so lookups can continue to use it while
+ *        the new tree is built. The prefixes the tree was compiled from are
+ *        merged with the changes, so an update costs a pass over the
+ *        prefixes and no radix tree is needed.
+ *
+ *        The user data of the prefixes that are not changed is shared by
+ *        both trees, so this only works for trees without a Free function.
+ *        The caller releases the old tree once it is no longer used.
+ *
+ * \param t           tree to update, or NULL to start from an empty tree
+ * \param key_bitlen  32 for IPv4, 128 for IPv6
+ * \param changes     prefixes to add, replace or remove. If a prefix is
+ *                    changed more than once the last change wins.
+ * \param changes_cnt number of changes
+ *
+ * \retval nt new compact tree or NULL on error
+ */
+SCRadixCompactTree *SCRadixCompactUpdateTree(const SCRadixCompactTree *t,
+        uint16_t key_bitlen, const SCRadixCompactChange *changes,
+        uint32_t changes_cnt)
+{
+    SCRadixCompactBuilder c;
+    SCRadixCompactBuilder b;
+    SCRadixCompactTree *nt = NULL;
+    uint32_t i, j;
+
+    if (key_bitlen != 32 && key_bitlen != 128)
+        return NULL;
+    if (t != NULL && (t->key_bitlen != key_bitlen || t->Free != NULL)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "compact tree can't be updated");
+        return NULL;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.key_bitlen = key_bitlen;
+    memset(&b, 0, sizeof(b));
+    b.key_bitlen = key_bitlen;
+
+    /* sort the changes, keeping the last change of each prefix */
+    for (i = 0; i < changes_cnt; i++) {
+        SCRadixCompactEntry *e = SCRadixCompactNewEntry(&c);
+        if (e == NULL)
+            goto error;
+        SCRadixCompactEntrySetKey(e,
+                SCRadixCompactKeyFromStream(changes[i].key, key_bitlen),
+                changes[i].netmask, key_bitlen);
+        e->remove = changes[i].remove;
+        e->user = changes[i].user;
+    }
+    if (c.entries_cnt > 0)
+        qsort(c.entries, c.entries_cnt, sizeof(SCRadixCompactEntry),
+              SCRadixCompactEntryCompare);
+    j = 0;
+    for (i = 0; i < c.entries_cnt; i++) {
+        if (j > 0 && c.entries[i].netmask == c.entries[j - 1].netmask &&
+            SCRadixCompactKeyCompare(&c.entries[i].start, &c.entries[j - 1].start) == 0)
+            j--;
+        c.entries[j++] = c.entries[i];
+    }
+    c.entries_cnt = j;
+
+    /* merge them with the prefixes of the tree, both are sorted */
+    const uint32_t prefixes_cnt = t != NULL ? t->user_cnt : 0;
+    i = 0;
+    j = 0;
+    while (i < prefixes_cnt || j < c.entries_cnt) {
+        SCRadixCompactEntry old;
+        int cmp;
+
+        if (i < prefixes_cnt) {
+            SCRadixCompactKey key;
+            if (key_bitlen == 32) {
+                key.hi = 0;
+                key.lo = t->prefixes4[i];
+            } else {
+                key.hi = t->prefixes6[i * 2];
+                key.lo = t->prefixes6[i * 2 + 1];
+            }
+            memset(&old, 0, sizeof(old));
+            SCRadixCompactEntrySetKey(&old, key, t->netmasks[i], key_bitlen);
+            old.user = t->user[i + 1];
+
+            if (j == c.entries_cnt) {
+                cmp = -1;
+            } else {
+                cmp = SCRadixCompactKeyCompare(&old.start, &c.entries[j].start);
+                if (cmp == 0 && old.netmask != c.entries[j].netmask)
+                    cmp = old.netmask < c.entries[j].netmask ? -1 : 1;
+            }
+        } else {
+            cmp = 1;
+        }
+
+        const SCRadixCompactEntry *src;
+        if (cmp < 0) {
+            src = &old;
+            i++;
+        } else {
+            src = &c.entries[j++];
+            if (cmp == 0)
+                i++;
+            if (src->remove)
+                continue;
+        }
+
+        SCRadixCompactEntry *e = SCRadixCompactNewEntry(&b);
+        if (e == NULL)
+            goto error;
+        uint32_t seq = e->seq;
+        *e = *src;
+        e->seq = seq;
+        e->remove = 0;
+    }
+
+    nt = SCRadixCompactBuild(&b);
+    if (nt == NULL)
+        goto error;
+
+    SCLogDebug("updated tree with %u prefixes with %u changes: %u prefixes, "
+            "%u ranges", prefixes_cnt, changes_cnt, nt->user_cnt,
+            nt->ranges_cnt);
+
+    SCRadixCompactBuilderFree(&c);
+    SCRadixCompactBuilderFree(&b);
+    return nt;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "failed to update compact tree");
+    SCRadixCompactBuilderFree(&c);
+    SCRadixCompactBuilderFree(&b);
+    return NULL;
+}
+
+/**
+ * \brief Merge neighbouring ranges with the same user data
+ *
+ *        Prefixes that are distinct in the radix tree can end up with the
+ *        same user data, for example when the owner deduplicates it after
+ *        compiling. The lookups then return the same answer for both ranges,
+ *        so they are merged into one.
+ */
+void SCRadixCompactMergeRanges(SCRadixCompactTree *t)
+{
+    uint32_t i, n = 0;
+
+    if (t == NULL || t->ranges_cnt == 0)
+        return;
+
+    for (i = 0; i < t->ranges_cnt; i++) {
+        if (n > 0) {
+            uint32_t a = t->ranges[n - 1];
+            uint32_t b = t->ranges[i];
+            if (a == b || (a != 0 && b != 0 && t->user[a] == t->user[b]))
+                continue;
+        }
+        if (t->key_bitlen == 32) {
+            t->starts4[n] = t->starts4[i];
+        } else {
+            t->starts6[n * 2] = t->starts6[i * 2];
+            t->starts6[n * 2 + 1] = t->starts6[i * 2 + 1];
+        }
+        t->ranges[n] = t->ranges[i];
+        n++;
+    }
+
+    SCLogDebug("merged %u ranges into %u", t->ranges_cnt, n);
+    if (n == t->ranges_cnt)
+        return;
+
+    /* shrinking can't fail in practice, if it does the arrays are
+     * just larger than needed */
+    const uint32_t removed = t->ranges_cnt - n;
+    t->ranges_cnt = n;
+    t->memuse -= (uint64_t)removed * (sizeof(uint32_t) +
+            (t->key_bitlen == 32 ? sizeof(uint32_t) : 2 * sizeof(uint64_t)));
+    uint32_t *ptmp = SCRealloc(t->ranges, n * sizeof(uint32_t));
+    if (ptmp != NULL)
+        t->ranges = ptmp;
+    if (t->key_bitlen == 32) {
+        ptmp = SCRealloc(t->starts4, n * sizeof(uint32_t));
+        if (ptmp != NULL)
+            t->starts4 = ptmp;
+    } else {
+        uint64_t *p64 = SCRealloc(t->starts6, n * 2 * sizeof(uint64_t));
+        if (p64 != NULL)
+            t->starts6 = p64;
+    }
+
+    const uint32_t slots = 1U << t->index_bits;
+    uint32_t r = 0;
+    for (i = 0; i <= slots; i++) {
+        while (r < n) {
+            uint64_t start = t->key_bitlen == 32 ? t->starts4[r] : t->starts6[r * 2];
+            if ((uint32_t)(start >> t->index_shift) >= i)
+                break;
+            r++;
+        }
+        t->index[i] = r;
+    }
+}
+
+/**
+ * \brief Release a compact tree and the user data it holds
+ */
+void SCRadixCompactReleaseTree(SCRadixCompactTree *t)
+{
+    if (t == NULL)
+        return;
+
+    if (t->user != NULL) {
+        if (t->Free != NULL) {
+            uint32_t i;
+            for (i = 1; i <= t->user_cnt; i++) {
+                if (t->user[i] != NULL)
+                    t->Free(t->user[i]);
+            }
+        }
+        SCFree(t->user);
+    }
+    if (t->starts4 != NULL)
+        SCFree(t->starts4);
+    if (t->starts6 != NULL)
+        SCFree(t->starts6);
+    if (t->ranges != NULL)
+        SCFree(t->ranges);
+    if (t->index != NULL)
+        SCFree(t->index);
+    if (t->prefixes4 != NULL)
+        SCFree(t->prefixes4);
+    if (t->prefixes6 != NULL)
+        SCFree(t->prefixes6);
+    if (t->netmasks != NULL)
+        SCFree(t->netmasks);
+    SCFree(t);
+}
+
+/**
+ * \brief Find the user data of the longest prefix matching an IPv4 address
+ *
+ * \param key_stream       IPv4 address in network order
+ * \param t                compact tree compiled from an IPv4 radix tree
+ * \param user_data_result set to the user data, or NULL if nothing matched
+ *
+ * \retval 1 if a prefix matched, 0 otherwise
+ */
+int SCRadixCompactFindKeyIPV4BestMatch(uint8_t *key_stream,
+        const SCRadixCompactTree *t, void **user_data_result)
+{
+    if (user_data_result != NULL)
+        *user_data_result = NULL;
+    if (t == NULL)
+        return 0;
+
+    const uint32_t key = ((uint32_t)key_stream[0] << 24) |
+        ((uint32_t)key_stream[1] << 16) | ((uint32_t)key_stream[2] << 8) |
+        (uint32_t)key_stream[3];
+    const uint32_t slot = key >> t->index_shift;
+    uint32_t lo = t->index[slot];
+    uint32_t hi = t->index[slot + 1];
+
+    /* last range starting at or before the key. If none of the ranges of
+     * this slot does, it's the last range of an earlier slot. Range 0
+     * starts at address 0, so lo ends up > 0. */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (t->starts4[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint32_t u = t->ranges[lo - 1];
+    if (u == 0)
+        return 0;
+    if (user_data_result != NULL)
+        *user_data_result = t->user[u];
+    return 1;
+}
+
+/**
+ * \brief Find the user data of the longest prefix matching an IPv6 address
+ *
+ * \param key_stream       IPv6 address in network order
+ * \param t                compact tree compiled from an IPv6 radix tree
+ * \param user_data_result set to the user data, or NULL if nothing matched
+ *
+ * \retval 1 if a prefix matched, 0 otherwise
+ */
+int SCRadixCompactFindKeyIPV6BestMatch(uint8_t *key_stream,
+        const SCRadixCompactTree *t, void **user_data_result)
+{
+    if (user_data_result != NULL)
+        *user_data_result = NULL;
+    if (t == NULL)
+        return 0;
+
+    const SCRadixCompactKey key = SCRadixCompactKeyFromStream(key_stream, 128);
+    const uint32_t slot = (uint32_t)(key.hi >> t->index_shift);
+    uint32_t lo = t->index[slot];
+    uint32_t hi = t->index[slot + 1];
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint64_t *s = &t->starts6[mid * 2];
+        if (s[0] < key.hi || (s[0] == key.hi && s[1] <= key.lo))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint32_t u = t->ranges[lo - 1];
+    if (u == 0)
+        return 0;
+    if (user_data_result != NULL)
+        *user_data_result = t->user[u];
+    return 1;
+}
+
+/* ------------------------------------------------------------------------ */
+
+#ifdef UNITTESTS
+
+/**
+ * \test nested and adjacent IPv4 prefixes give the same answers as the
+ *       radix tree they were compiled from
+ */
+static int SCRadixCompactTest01(void)
+{
+    const char *nets[] = { "0.0.0.0/0", "10.0.0.0/8", "10.1.0.0/16",
+        "10.1.2.0/24", "10.1.2.3/32", "10.1.3.0/24", "10.2.0.0/15",
+        "192.168.0.0/16", "192.168.0.0/24", "255.255.255.255/32", NULL };
+    const char *addrs[] = { "1.2.3.4", "10.0.0.1", "10.1.0.1", "10.1.2.2",
+        "10.1.2.3", "10.1.2.4", "10.1.3.255", "10.1.4.0", "10.2.0.0",
+        "10.3.255.255", "10.4.0.0", "192.168.0.1", "192.168.1.1",
+        "192.169.0.0", "255.255.255.254", "255.255.255.255", "0.0.0.0",
+        NULL };
+    uintptr_t i;
+
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    for (i = 0; nets[i] != NULL; i++) {
+        FAIL_IF_NULL(SCRadixAddKeyIPV4String(nets[i], tree, (void *)(i + 1)));
+    }
+
+    void *expect[32];
+    for (i = 0; addrs[i] != NULL; i++) {
+        struct in_addr in;
+        FAIL_IF(inet_pton(AF_INET, addrs[i], &in) != 1);
+        expect[i] = NULL;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&in, tree, &expect[i]);
+    }
+
+    SCRadixCompactTree *t = SCRadixCompactCompileTree(tree, 32);
+    FAIL_IF_NULL(t);
+    for (i = 0; addrs[i] != NULL; i++) {
+        struct in_addr in;
+        void *user = NULL;
+        FAIL_IF(inet_pton(AF_INET, addrs[i], &in) != 1);
+        int r = SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&in, t, &user);
+        FAIL_IF(user != expect[i]);
+        FAIL_IF(r != (user != NULL));
+    }
+
+    SCRadixCompactReleaseTree(t);
+    PASS;
+}
+
+/**
+ * \test IPv6 prefixes, with a gap between them
+ */
+static int SCRadixCompactTest02(void)
+{
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    FAIL_IF_NULL(SCRadixAddKeyIPV6String("2001:db8::/32", tree, (void *)1));
+    FAIL_IF_NULL(SCRadixAddKeyIPV6String("2001:db8:0:1::/64", tree, (void *)2));
+    FAIL_IF_NULL(SCRadixAddKeyIPV6String("2001:db8:0:1::1", tree, (void *)3));
+
+    SCRadixCompactTree *t = SCRadixCompactCompileTree(tree, 128);
+    FAIL_IF_NULL(t);
+
+    struct in6_addr in6;
+    void *user = NULL;
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:1::1", &in6) != 1);
+    FAIL_IF_NOT(SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&in6, t, &user));
+    FAIL_IF(user != (void *)3);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:1::2", &in6) != 1);
+    FAIL_IF_NOT(SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&in6, t, &user));
+    FAIL_IF(user != (void *)2);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:2::", &in6) != 1);
+    FAIL_IF_NOT(SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&in6, t, &user));
+    FAIL_IF(user != (void *)1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db9::", &in6) != 1);
+    FAIL_IF(SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&in6, t, &user));
+    FAIL_IF_NOT_NULL(user);
+    FAIL_IF(inet_pton(AF_INET6, "::", &in6) != 1);
+    FAIL_IF(SCRadixCompactFindKeyIPV6BestMatch((uint8_t *)&in6, t, &user));
+
+    SCRadixCompactReleaseTree(t);
+    PASS;
+}
+
+/**
+ * \test updates give the same answers as a tree compiled from scratch
+ */
+static int SCRadixCompactTest03(void)
+{
+    const char *addrs[] = { "10.0.0.1", "10.1.0.1", "10.1.2.3", "10.1.2.4",
+        "10.2.0.1", "11.0.0.1", "192.168.1.1", NULL };
+    void *expect[] = { (void *)1, (void *)5, (void *)3, (void *)5,
+        (void *)1, NULL, (void *)6, NULL };
+    SCRadixCompactChange changes[5];
+    uintptr_t i;
+
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.0.0.0/8", tree, (void *)1));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.1.0.0/16", tree, (void *)2));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.1.2.3", tree, (void *)3));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.2.0.0/16", tree, (void *)4));
+    SCRadixCompactTree *t = SCRadixCompactCompileTree(tree, 32);
+    FAIL_IF_NULL(t);
+
+    /* replace 10.1.0.0/16, remove 10.2.0.0/16, add 192.168.0.0/16 and
+     * remove a prefix that doesn't exist. The last change of a prefix
+     * wins. */
+    memset(changes, 0, sizeof(changes));
+    FAIL_IF(inet_pton(AF_INET, "10.1.0.0", changes[0].key) != 1);
+    changes[0].netmask = 16;
+    changes[0].user = (void *)7;
+    FAIL_IF(inet_pton(AF_INET, "10.2.0.0", changes[1].key) != 1);
+    changes[1].netmask = 16;
+    changes[1].remove = 1;
+    FAIL_IF(inet_pton(AF_INET, "192.168.0.0", changes[2].key) != 1);
+    changes[2].netmask = 16;
+    changes[2].user = (void *)6;
+    FAIL_IF(inet_pton(AF_INET, "11.0.0.0", changes[3].key) != 1);
+    changes[3].netmask = 8;
+    changes[3].remove = 1;
+    FAIL_IF(inet_pton(AF_INET, "10.1.0.0", changes[4].key) != 1);
+    changes[4].netmask = 16;
+    changes[4].user = (void *)5;
+
+    SCRadixCompactTree *nt = SCRadixCompactUpdateTree(t, 32, changes, 5);
+    FAIL_IF_NULL(nt);
+    FAIL_IF(nt->user_cnt != 4);
+    for (i = 0; addrs[i] != NULL; i++) {
+        struct in_addr in;
+        void *user = NULL;
+        FAIL_IF(inet_pton(AF_INET, addrs[i], &in) != 1);
+        (void)SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&in, nt, &user);
+        FAIL_IF(user != expect[i]);
+    }
+
+    /* the old tree is unchanged */
+    struct in_addr in;
+    void *user = NULL;
+    FAIL_IF(inet_pton(AF_INET, "10.2.0.1", &in) != 1);
+    FAIL_IF_NOT(SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&in, t, &user));
+    FAIL_IF(user != (void *)4);
+
+    /* updating an empty tree */
+    SCRadixCompactTree *et = SCRadixCompactUpdateTree(NULL, 32, &changes[2], 1);
+    FAIL_IF_NULL(et);
+    FAIL_IF(inet_pton(AF_INET, "192.168.1.1", &in) != 1);
+    FAIL_IF_NOT(SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&in, et, &user));
+    FAIL_IF(user != (void *)6);
+
+    SCRadixCompactReleaseTree(et);
+    SCRadixCompactReleaseTree(nt);
+    SCRadixCompactReleaseTree(t);
+    PASS;
+}
+
+/**
+ * \test merging neighbouring ranges with the same user data
+ */
+static int SCRadixCompactTest04(void)
+{
+    const char *addrs[] = { "9.255.255.255", "10.0.0.1", "10.1.0.1",
+        "10.2.0.1", "10.3.0.1", "10.4.0.1", "11.0.0.0", NULL };
+    void *expect[] = { NULL, (void *)1, (void *)1, (void *)2, (void *)1,
+        (void *)1, NULL };
+    uintptr_t i;
+
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.0.0.0/8", tree, (void *)1));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.1.0.0/16", tree, (void *)1));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.2.0.0/16", tree, (void *)2));
+    FAIL_IF_NULL(SCRadixAddKeyIPV4String("10.3.0.0/16", tree, (void *)1));
+
+    SCRadixCompactTree *t = SCRadixCompactCompileTree(tree, 32);
+    FAIL_IF_NULL(t);
+    FAIL_IF(t->ranges_cnt != 7);
+    uint64_t memuse = t->memuse;
+
+    SCRadixCompactMergeRanges(t);
+    /* 10.0.0.0-10.1.255.255 and 10.3.0.0-10.255.255.255 */
+    FAIL_IF(t->ranges_cnt != 5);
+    FAIL_IF(t->memuse >= memuse);
+
+    for (i = 0; addrs[i] != NULL; i++) {
+        struct in_addr in;
+        void *user = NULL;
+        FAIL_IF(inet_pton(AF_INET, addrs[i], &in) != 1);
+        int r = SCRadixCompactFindKeyIPV4BestMatch((uint8_t *)&in, t, &user);
+        FAIL_IF(user != expect[i]);
+        FAIL_IF(r != (user != NULL));
+    }
+
+    SCRadixCompactReleaseTree(t);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCRadixCompactRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCRadixCompactTest01", SCRadixCompactTest01);
+    UtRegisterTest("SCRadixCompactTest02", SCRadixCompactTest02);
+    UtRegisterTest("SCRadixCompactTest03", SCRadixCompactTest03);
+    UtRegisterTest("SCRadixCompactTest04", SCRadixCompactTest04);
+#endif
+}
@@ -0,0 +1,102 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Read only, compact version of an IPv4 or IPv6 radix tree.
+ */
+
+#ifndef __UTIL_RADIX_COMPACT_H__
+#define __UTIL_RADIX_COMPACT_H__
+
+#include "util-radix-tree.h"
+
+/** min and max number of address bits used to index the ranges */
+#define SC_RADIX_COMPACT_INDEX_BITS_MIN 8
+#define SC_RADIX_COMPACT_INDEX_BITS_MAX 24
+
+/**
+ * \brief Compact radix tree
+ *
+ * The prefixes of a radix tree are flattened into a sorted array of non
+ * overlapping address ranges that together cover the whole address space.
+ * Each range holds the user data of the longest prefix covering it, or
+ * none. The first index_bits bits of an address index a table with the
+ * first range starting in that part of the address space, so a lookup is
+ * an index load followed by a search through the few ranges sharing those
+ * bits. For large IPv4 tables this is close to a DIR-24-8 table while the
+ * memory use stays proportional to the number of prefixes.
+ */
+typedef struct SCRadixCompactTree_ {
+    /** 32 for IPv4, 128 for IPv6 */
+    uint16_t key_bitlen;
+    uint8_t index_bits;
+    uint8_t index_shift;
+
+    /** number of ranges */
+    uint32_t ranges_cnt;
+    /** range start addresses in host order: for IPv4 32 bits per range,
+     *  for IPv6 two 64 bit words (high, low) per range */
+    uint32_t *starts4;
+    uint64_t *starts6;
+    /** index in user of the user data of each range, 0 for no match */
+    uint32_t *ranges;
+
+    /** (1 << index_bits) + 1 entries: first range whose start has the
+     *  given first index_bits bits or more */
+    uint32_t *index;
+
+    /** user data of the prefixes, entry 0 is unused */
+    void **user;
+    uint32_t user_cnt;
+
+    /** the user_cnt unique prefixes the ranges were built from, sorted
+     *  by start address and netmask, so that the tree can be updated.
+     *  Prefix i has user data user[i + 1]. */
+    uint32_t *prefixes4;
+    uint64_t *prefixes6;
+    uint8_t *netmasks;
+
+    /** number of bytes allocated for the arrays above */
+    uint64_t memuse;
+
+    void (*Free)(void *);
+} SCRadixCompactTree;
+
+/** a prefix to add, replace or remove in SCRadixCompactUpdateTree */
+typedef struct SCRadixCompactChange_ {
+    /** address in network order, IPv4 addresses use the first 4 bytes */
+    uint8_t key[16];
+    uint8_t netmask;
+    /** 1 to remove the prefix, user is ignored */
+    uint8_t remove;
+    void *user;
+} SCRadixCompactChange;
+
+SCRadixCompactTree *SCRadixCompactCompileTree(SCRadixTree *, uint16_t);
+SCRadixCompactTree *SCRadixCompactUpdateTree(const SCRadixCompactTree *,
+        uint16_t, const SCRadixCompactChange *, uint32_t);
+void SCRadixCompactMergeRanges(SCRadixCompactTree *);
+void SCRadixCompactReleaseTree(SCRadixCompactTree *);
+
+int SCRadixCompactFindKeyIPV4BestMatch(uint8_t *, const SCRadixCompactTree *, void **);
+int SCRadixCompactFindKeyIPV6BestMatch(uint8_t *, const SCRadixCompactTree *, void **);
+
+void SCRadixCompactRegisterTests(void);
+
+#endif /* __UTIL_RADIX_COMPACT_H__ */
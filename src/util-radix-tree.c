@@ -358,15 +358,12 @@ static void SCRadixReleasePrefix(SCRadixPrefix *prefix, SCRadixTree *tree)
             SCFree(prefix->stream);
 
         user_data_temp1 = prefix->user_data;
-        if (tree->Free != NULL) {
-            while (user_data_temp1 != NULL) {
-                user_data_temp2 = user_data_temp1;
-                user_data_temp1 = user_data_temp1->next;
+        while (user_data_temp1 != NULL) {
+            user_data_temp2 = user_data_temp1;
+            user_data_temp1 = user_data_temp1->next;
+            if (tree->Free != NULL)
                 tree->Free(user_data_temp2->user);
-                SCRadixDeAllocSCRadixUserData(user_data_temp2);
-            }
-        } else if (user_data_temp1 != NULL) {
-            SCFree(user_data_temp1);
+            SCRadixDeAllocSCRadixUserData(user_data_temp2);
         }
 
         SCFree(prefix);
@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "config.h"
 #include "tm-threads.h"
+#include "tmqh-flow.h"
 #include "conf.h"
 #include "runmodes.h"
 #include "runmode-af-packet.h"
@@ -115,6 +116,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
     if ((nlive <= 1) && (live_dev != NULL)) {
         void *aconf;
         int threads_count;
+        int numa_node = AffinityGetIfaceNumaNode(live_dev);
 
         SCLogDebug("live_dev %s", live_dev);
 
@@ -135,7 +137,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(tname,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, TmqhFlowGetQueueHandlerName(), "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -158,6 +160,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
             TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
 
             TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
+            TmThreadSetNumaNode(tv_receive, numa_node);
 
             if (TmThreadSpawn(tv_receive) != TM_ECODE_OK) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
@@ -173,6 +176,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
             const char *visual_devname = LiveGetShortName(dev);
             void *aconf;
             int threads_count;
+            int numa_node;
 
             if (dev == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "Failed to lookup live dev %d", lthread);
@@ -187,6 +191,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
                 exit(EXIT_FAILURE);
             }
 
+            numa_node = AffinityGetIfaceNumaNode(dev);
             threads_count = ModThreadsCount(aconf);
             for (thread = 0; thread < threads_count; thread++) {
                 snprintf(tname, sizeof(tname), "%s#%02d-%s", thread_name,
@@ -195,7 +200,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(tname,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, TmqhFlowGetQueueHandlerName(), "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -215,6 +220,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
                 TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
 
                 TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
+                TmThreadSetNumaNode(tv_receive, numa_node);
 
                 if (TmThreadSpawn(tv_receive) != TM_ECODE_OK) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
@@ -232,7 +238,7 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhFlowGetQueueHandlerName(),
                                         "packetpool", "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
@@ -277,6 +283,7 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
 {
     int thread;
     int threads_count;
+    int numa_node = AffinityGetIfaceNumaNode(live_dev);
 
     if (single_mode) {
         threads_count = 1;
@@ -336,6 +343,7 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
         TmSlotSetFuncAppend(tv, tm_module, NULL);
 
         TmThreadSetCPU(tv, WORKER_CPU_SET);
+        TmThreadSetNumaNode(tv, numa_node);
 
         if (TmThreadSpawn(tv) != TM_ECODE_OK) {
             SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
@@ -461,7 +469,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
         ThreadVars *tv_receive =
             TmThreadCreatePacketHandler(tname,
                     "packetpool", "packetpool",
-                    queues, "flow", "pktacqloop");
+                    queues, TmqhFlowGetQueueHandlerName(), "pktacqloop");
         if (tv_receive == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -496,7 +504,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
+                                        qname, TmqhFlowGetQueueHandlerName(),
                                         "verdict-queue", "simple",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
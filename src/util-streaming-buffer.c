@@ -92,363 +92,214 @@ void StreamingBufferFree(StreamingBuffer *sb)
     }
 }
 
+RB_GENERATE(SBB, StreamingBufferBlock_, rb, SBBCompare);
+
+int SBBCompare(struct StreamingBufferBlock_ *a, struct StreamingBufferBlock_ *b)
+{
+    SCLogDebug("a %"PRIu64" len %u, b %"PRIu64" len %u",
+            a->offset, a->len, b->offset, b->len);
+
+    if (a->offset > b->offset)
+        SCReturnInt(1);
+    else if (a->offset < b->offset)
+        SCReturnInt(-1);
+    SCReturnInt(0);
+}
+
+/* find the first block that ends at or after elm->offset, so the block
+ * that contains the offset, or if the offset is in a gap, the first block
+ * after the gap. Block right edges are inclusive here. */
+StreamingBufferBlock *SBB_RB_FIND_INCLUSIVE(struct SBB *head, StreamingBufferBlock *elm)
+{
+    SCLogDebug("looking up %"PRIu64, elm->offset);
+
+    struct StreamingBufferBlock_ *tmp = RB_ROOT(head);
+    struct StreamingBufferBlock_ *res = NULL;
+    while (tmp) {
+        SCLogDebug("compare with %"PRIu64"/%u", tmp->offset, tmp->len);
+        if (elm->offset > tmp->offset + tmp->len) {
+            tmp = RB_RIGHT(tmp, rb);
+        } else {
+            res = tmp;
+            if (elm->offset >= tmp->offset)
+                break;
+            tmp = RB_LEFT(tmp, rb);
+        }
+    }
+    return res;
+}
+
 #ifdef DEBUG
 static void SBBPrintList(const StreamingBuffer *sb)
 {
-    const StreamingBufferBlock *sbb = sb->block_list;
-    while (sbb) {
+    StreamingBufferBlock *sbb = NULL;
+    RB_FOREACH(sbb, SBB, (struct SBB *)&sb->sbb_tree) {
         SCLogDebug("sbb: offset %"PRIu64", len %u", sbb->offset, sbb->len);
-        if (sbb->next) {
-            if ((sbb->offset + sbb->len) != sbb->next->offset) {
+        StreamingBufferBlock *next = SBB_RB_NEXT(sbb);
+        if (next) {
+            if ((sbb->offset + sbb->len) != next->offset) {
                 SCLogDebug("gap: offset %"PRIu64", len %"PRIu64, (sbb->offset + sbb->len),
-                        sbb->next->offset - (sbb->offset + sbb->len));
+                        next->offset - (sbb->offset + sbb->len));
             }
         }
-
-        sbb = sbb->next;
     }
 }
 #endif
 
-/* setup with gap between 2 blocks
- *
- * [block][gap][block]
- **/
-static void SBBInit(StreamingBuffer *sb,
-                    uint32_t rel_offset, uint32_t data_len)
+/** \internal
+ *  \brief merge sbb with the blocks that follow it if they touch or
+ *         overlap it */
+static void ConsolidateFwd(StreamingBuffer *sb, StreamingBufferBlock *sbb)
 {
-    BUG_ON(sb->block_list != NULL);
-    BUG_ON(sb->buf_offset > sb->stream_offset + rel_offset);
+    StreamingBufferBlock *tr, *s = sbb;
+    RB_FOREACH_FROM(tr, SBB, s) {
+        if (sbb == tr)
+            continue;
 
-    /* need to set up 2: existing data block and new data block */
-    StreamingBufferBlock *sbb = CALLOC(sb->cfg, 1, sizeof(*sbb));
-    if (sbb == NULL) {
-        return;
-    }
-    sbb->offset = sb->stream_offset;
-    sbb->len = sb->buf_offset;
+        const uint64_t s_re = sbb->offset + sbb->len;
+        if (tr->offset > s_re)
+            break;
 
-    StreamingBufferBlock *sbb2 = CALLOC(sb->cfg, 1, sizeof(*sbb2));
-    if (sbb2 == NULL) {
-        FREE(sb->cfg, sbb, sizeof(*sbb));
-        return;
+        SCLogDebug("-> (fwd) tr %p %"PRIu64"/%u", tr, tr->offset, tr->len);
+
+        /* tr ends beyond sbb: expand sbb to cover it */
+        const uint64_t tr_re = tr->offset + tr->len;
+        if (tr_re > s_re) {
+            sbb->len = tr_re - sbb->offset;
+        }
+
+        SBB_RB_REMOVE(&sb->sbb_tree, tr);
+        FREE(sb->cfg, tr, sizeof(StreamingBufferBlock));
     }
-    sbb2->offset = sb->stream_offset + rel_offset;
-    sbb2->len = data_len;
+}
 
-    sb->block_list = sbb;
-    sbb->next = sbb2;
-    sb->block_list_tail = sbb2;
+/** \internal
+ *  \brief merge sbb into the block before it if they touch or overlap
+ *  \retval sbb the block that now holds the data of the original sbb
+ */
+static StreamingBufferBlock *ConsolidateBackward(StreamingBuffer *sb,
+                                                 StreamingBufferBlock *sbb)
+{
+    StreamingBufferBlock *prev = SBB_RB_PREV(sbb);
+    if (prev == NULL)
+        return sbb;
 
-    SCLogDebug("sbb1 %"PRIu64", len %u, sbb2 %"PRIu64", len %u",
-            sbb->offset, sbb->len, sbb2->offset, sbb2->len);
-#ifdef DEBUG
-    SBBPrintList(sb);
-#endif
-    BUG_ON(sbb2->offset < sbb->len);
+    const uint64_t prev_re = prev->offset + prev->len;
+    if (prev_re < sbb->offset)
+        return sbb;
+
+    SCLogDebug("-> (bwd) prev %p %"PRIu64"/%u", prev, prev->offset, prev->len);
+
+    const uint64_t sbb_re = sbb->offset + sbb->len;
+    if (sbb_re > prev_re) {
+        prev->len = sbb_re - prev->offset;
+    }
+
+    SBB_RB_REMOVE(&sb->sbb_tree, sbb);
+    if (sb->head == sbb)
+        sb->head = prev;
+    FREE(sb->cfg, sbb, sizeof(StreamingBufferBlock));
+    return prev;
 }
 
-/* setup with leading gap
- *
- * [gap][block]
- **/
-static void SBBInitLeadingGap(StreamingBuffer *sb,
-                              uint64_t offset, uint32_t data_len)
+/** \internal
+ *  \brief add a block to the tree, merging it with its neighbours
+ *  \retval 0 ok
+ *  \retval -1 memory allocation failure
+ */
+static int SBBInsert(StreamingBuffer *sb, uint64_t offset, uint32_t len)
 {
-    BUG_ON(sb->block_list != NULL);
+    SCLogDebug("insert %"PRIu64"/%u", offset, len);
 
     StreamingBufferBlock *sbb = CALLOC(sb->cfg, 1, sizeof(*sbb));
     if (sbb == NULL)
-        return;
+        return -1;
     sbb->offset = offset;
-    sbb->len = data_len;
+    sbb->len = len;
 
-    sb->block_list = sbb;
-    sb->block_list_tail = sbb;
+    StreamingBufferBlock *res = SBB_RB_INSERT(&sb->sbb_tree, sbb);
+    if (res) {
+        /* block with the same offset already exists: expand it if needed
+         * and use it instead */
+        FREE(sb->cfg, sbb, sizeof(StreamingBufferBlock));
+        if (len <= res->len)
+            return 0;
+        res->len = len;
+        sbb = res;
+    } else if (sb->head == NULL || sbb->offset < sb->head->offset) {
+        sb->head = sbb;
+    }
 
-    SCLogDebug("sbb %"PRIu64", len %u",
-            sbb->offset, sbb->len);
+    sbb = ConsolidateBackward(sb, sbb);
+    ConsolidateFwd(sb, sbb);
 #ifdef DEBUG
     SBBPrintList(sb);
 #endif
-}
-
-static int IsBefore(StreamingBufferBlock *me, StreamingBufferBlock *you)
-{
-    if ((me->offset + me->len) < you->offset) {
-        return 1;
-    }
-    return 0;
-}
-
-static int StartsBefore(StreamingBufferBlock *me, StreamingBufferBlock *you)
-{
-    if (me->offset < you->offset)
-        return 1;
     return 0;
 }
 
-static int IsAfter(StreamingBufferBlock *me, StreamingBufferBlock *you)
+/* setup with gap between 2 blocks
+ *
+ * [block][gap][block]
+ **/
+static void SBBInit(StreamingBuffer *sb,
+                    uint32_t rel_offset, uint32_t data_len)
 {
-    if (you->offset + you->len < me->offset)
-        return 1;
-    return 0;
-}
+    BUG_ON(!RB_EMPTY(&sb->sbb_tree));
+    BUG_ON(sb->buf_offset > sb->stream_offset + rel_offset);
 
-static int IsOverlappedBy(StreamingBufferBlock *me, StreamingBufferBlock *you)
-{
-    if (you->offset <= me->offset && (you->offset + you->len) >= (me->offset + me->len))
-        return 1;
-    return 0;
-}
+    /* need to set up 2: existing data block and new data block */
+    if (SBBInsert(sb, sb->stream_offset, sb->buf_offset) != 0)
+        return;
+    if (SBBInsert(sb, sb->stream_offset + rel_offset, data_len) != 0) {
+        SBBFree(sb);
+        return;
+    }
 
-static int EndsAfter(StreamingBufferBlock *me, StreamingBufferBlock *you)
-{
-    if ((me->offset + me->len) > (you->offset + you->len))
-        return 1;
-    return 0;
+    SCLogDebug("sbb1 %"PRIu64", len %u, sbb2 %"PRIu64", len %u",
+            sb->stream_offset, sb->buf_offset,
+            sb->stream_offset + rel_offset, data_len);
 }
 
-static StreamingBufferBlock *GetNew(StreamingBuffer *sb,
-                                    uint64_t offset, uint32_t len,
-                                    StreamingBufferBlock *next)
+/* setup with leading gap
+ *
+ * [gap][block]
+ **/
+static void SBBInitLeadingGap(StreamingBuffer *sb,
+                              uint64_t offset, uint32_t data_len)
 {
-    StreamingBufferBlock *new_sbb = CALLOC(sb->cfg, 1, sizeof(*new_sbb));
-    if (new_sbb == NULL)
-        return NULL;
-    new_sbb->offset = offset;
-    new_sbb->len = len;
-    new_sbb->next = next;
-    return new_sbb;
-}
+    BUG_ON(!RB_EMPTY(&sb->sbb_tree));
 
-/* expand our sbb forward if possible */
-static int SBBUpdateLookForward(StreamingBuffer *sb,
-                                StreamingBufferBlock *sbb,
-                                StreamingBufferBlock *my_block)
-{
-    SCLogDebug("EndsAfter: consider next");
+    (void)SBBInsert(sb, offset, data_len);
 
-    while (sbb->offset + sbb->len == sbb->next->offset)
-    {
-        SCLogDebug("EndsAfter: gobble up next: %u/%u", (uint)sbb->next->offset, sbb->next->len);
-        uint64_t right_edge = sbb->next->offset + sbb->next->len;
-        uint32_t expand_by = right_edge - (sbb->offset + sbb->len);
-        sbb->len += expand_by;
-        SCLogDebug("EndsAfter: expand_by %u (part 2)", expand_by);
-        SCLogDebug("EndsAfter: (loop) sbb now %u/%u", (uint)sbb->offset, sbb->len);
-
-        /* we can gobble up next */
-        StreamingBufferBlock *to_free = sbb->next;
-        sbb->next = sbb->next->next;
-        FREE(sb->cfg, to_free, sizeof(StreamingBufferBlock));
-        if (sbb->next == NULL)
-            sb->block_list_tail = sbb;
-
-        /* update my block */
-        if (expand_by >= my_block->len) {
-            return 1;
-        }
-
-        my_block->len -= expand_by;
-        my_block->offset += expand_by;
-
-        if (sbb->next == NULL) {
-            /* if we have nothing left in the list we're almost done,
-             * except we need to check if we have some of our block
-             * left */
-            sbb->len += my_block->len;
-            my_block->offset += my_block->len;
-            my_block->len = 0;
-            return 1;
-        } else {
-            /* if next is not directly connected and we have some
-             * block len left, expand sbb further */
-            uint32_t gap = sbb->next->offset - (sbb->offset + sbb->len);
-            SCLogDebug("EndsAfter: we now have a gap of %u and a block of %u/%u", gap, (uint)my_block->offset, my_block->len);
-
-            if (my_block->len < gap) {
-                sbb->len += my_block->len;
-                my_block->offset += my_block->len;
-                my_block->len = 0;
-                return 1;
-            } else {
-                sbb->len += gap;
-                my_block->offset += gap;
-                my_block->len -= gap;
-                SCLogDebug("EndsAfter: (loop) block at %u/%u, sbb %u/%u", (uint)my_block->offset, my_block->len, (uint)sbb->offset, sbb->len);
-                SCLogDebug("EndsAfter: (loop) sbb->next %u/%u", (uint)sbb->next->offset, sbb->next->len);
-            }
-        }
-    }
-    return 0;
+    SCLogDebug("sbb %"PRIu64", len %u", offset, data_len);
 }
 
-static void SBBUpdate(StreamingBuffer *sb,
-                      uint32_t rel_offset, uint32_t data_len)
+static inline void SBBUpdate(StreamingBuffer *sb,
+                             uint32_t rel_offset, uint32_t data_len)
 {
-    StreamingBufferBlock my_block = { .offset = sb->stream_offset + rel_offset,
-                                      .len = data_len,
-                                      .next = NULL  };
-    const uint64_t my_block_right_edge = my_block.offset + my_block.len;
-
-    StreamingBufferBlock *tail = sb->block_list_tail;
-
-    /* fast path 1: expands tail */
-    if (tail && ((tail->offset + tail->len) == my_block.offset))
-    {
-        tail->len = my_block_right_edge - tail->offset;
-        goto done;
-    }
-    /* fast path 2: new isolated block after tail */
-    else if (tail && IsAfter(&my_block, tail)) {
-        StreamingBufferBlock *new_sbb = GetNew(sb, my_block.offset, my_block.len, NULL);
-        sb->block_list_tail = tail->next = new_sbb;
-        SCLogDebug("tail: new block at %u/%u", (uint)my_block.offset, my_block.len);
-        goto done;
-    }
-
-    BUG_ON(sb->block_list == NULL);
-#ifdef DEBUG
-    SBBPrintList(sb);
-#endif
-    SCLogDebug("PreInsert: block at %u/%u", (uint)my_block.offset, my_block.len);
-    StreamingBufferBlock *sbb = sb->block_list, *prev = NULL;
-    while (sbb) {
-        SCLogDebug("sbb %"PRIu64"/%u data %"PRIu64"/%u. Next %s", sbb->offset, sbb->len,
-                my_block.offset, my_block.len, sbb->next ? "true" : "false");
-
-        if (IsBefore(&my_block, sbb)) {
-            StreamingBufferBlock *new_sbb = GetNew(sb, my_block.offset, my_block.len, sbb);
-
-            /* place before, maybe replace list head */
-            if (sbb == sb->block_list) {
-                sb->block_list = new_sbb;
-            } else {
-                prev->next = new_sbb;
-            }
-            SCLogDebug("IsBefore: new block at %u/%u", (uint)my_block.offset, my_block.len);
-            break;
-
-        } else if (IsOverlappedBy(&my_block, sbb)) {
-            /* nothing to do */
-            SCLogDebug("IsOverlappedBy: overlapped block at %u/%u", (uint)my_block.offset, my_block.len);
-            break;
-
-        } else if (IsAfter(&my_block, sbb)) {
-
-            /* if no next, place after, otherwise, iterate */
-            if (sbb->next == NULL) {
-                StreamingBufferBlock *new_sbb = GetNew(sb, my_block.offset, my_block.len, NULL);
-                sbb->next = new_sbb;
-                sb->block_list_tail = new_sbb;
-                SCLogDebug("new block at %u/%u", (uint)my_block.offset, my_block.len);
-                break;
-            }
-            SCLogDebug("IsAfter: block at %u/%u, is after sbb", (uint)my_block.offset, my_block.len);
-
-        } else {
-
-            /* those were the simple cases */
-
-            if (StartsBefore(&my_block, sbb)) {
-                /* expand sbb */
-                uint32_t expand_by = sbb->offset - my_block.offset;
-                SCLogDebug("StartsBefore: expand_by %u", expand_by);
-                sbb->offset = my_block.offset;
-                sbb->len += expand_by;
-
-                /* if my_block ends before sbb right edge, we are done */
-                if (my_block_right_edge <= (sbb->offset + sbb->len))
-                    break;
-
-                my_block.offset = sbb->offset + sbb->len;
-                my_block.len = my_block_right_edge - my_block.offset;
-                SCLogDebug("StartsBefore: block now %u/%u", (uint)my_block.offset, my_block.len);
-
-                if (sbb->next == NULL) {
-                    sbb->len += my_block.len;
-                    break;
-                }
-                /* expand, but consider next */
-                uint64_t right_edge = my_block_right_edge;
-                if (right_edge > sbb->next->offset) {
-                    right_edge = sbb->next->offset;
-                }
-
-                expand_by = right_edge - (sbb->offset + sbb->len);
-                SCLogDebug("EndsAfter: expand_by %u", expand_by);
-                sbb->len += expand_by;
-                SCLogDebug("EndsAfter: sbb now %u/%u", (uint)sbb->offset, sbb->len);
-
-                my_block.offset = sbb->offset + sbb->len;
-                my_block.len = my_block_right_edge - my_block.offset;
-                SCLogDebug("StartsBefore: sbb now %u/%u", (uint)sbb->offset, sbb->len);
-
-            } else if (EndsAfter(&my_block, sbb)) {
-                /* expand sbb, but we need to mind "next" */
-
-                if (sbb->next == NULL) {
-                    /* last, so just expand sbb */
-                    sbb->len = my_block_right_edge - sbb->offset;
-                    break;
-                }
-
-                /* expand, but consider next */
-                uint64_t right_edge = my_block_right_edge;
-                if (right_edge > sbb->next->offset) {
-                    right_edge = sbb->next->offset;
-                }
-
-                uint32_t expand_by = right_edge - (sbb->offset + sbb->len);
-                SCLogDebug("EndsAfter: expand_by %u", expand_by);
-                sbb->len += expand_by;
-                SCLogDebug("EndsAfter: sbb now %u/%u", (uint)sbb->offset, sbb->len);
-
-                my_block.offset = sbb->offset + sbb->len;
-                my_block.len = my_block_right_edge - my_block.offset;
-            }
-
-            if (sbb->next != NULL) {
-                SCLogDebug("EndsAfter: consider next");
-
-                if (SBBUpdateLookForward(sb, sbb, &my_block) == 1)
-                    goto done;
-            }
-
-            SCLogDebug("EndsAfter: block at %u/%u, is after sbb", (uint)my_block.offset, my_block.len);
-
-            if (my_block.len == 0)
-                break;
-        }
-        prev = sbb;
-        sbb = sbb->next;
-    }
-done:
-    SCLogDebug("PostInsert: block at %u/%u", (uint)my_block.offset, my_block.len);
-    SCLogDebug("PostInsert");
-#ifdef DEBUG
-    SBBPrintList(sb);
-#endif
+    (void)SBBInsert(sb, sb->stream_offset + rel_offset, data_len);
 }
 
 static void SBBFree(StreamingBuffer *sb)
 {
-    StreamingBufferBlock *sbb = sb->block_list;
-    while (sbb) {
-        StreamingBufferBlock *next = sbb->next;
+    StreamingBufferBlock *sbb = NULL, *safe = NULL;
+    RB_FOREACH_SAFE(sbb, SBB, &sb->sbb_tree, safe) {
+        SBB_RB_REMOVE(&sb->sbb_tree, sbb);
         FREE(sb->cfg, sbb, sizeof(StreamingBufferBlock));
-        sbb = next;
     }
-    sb->block_list = NULL;
+    sb->head = NULL;
 }
 
 static void SBBPrune(StreamingBuffer *sb)
 {
-    StreamingBufferBlock *sbb = sb->block_list;
-    while (sbb) {
-        /* completely beyond window, we're done */
-        if (sbb->offset > sb->stream_offset)
+    StreamingBufferBlock *sbb = NULL, *safe = NULL;
+    RB_FOREACH_SAFE(sbb, SBB, &sb->sbb_tree, safe) {
+        /* completely beyond window, we're done. A block that starts
+         * exactly at the window start is only dropped if it is the last
+         * one, as then the buffer is continuous again. */
+        if (sbb->offset > sb->stream_offset ||
+            (sbb->offset == sb->stream_offset && safe != NULL))
             break;
 
         /* partly before, partly beyond. Adjust */
@@ -462,14 +313,10 @@ static void SBBPrune(StreamingBuffer *sb)
             break;
         }
 
-        StreamingBufferBlock *next = sbb->next;
+        SBB_RB_REMOVE(&sb->sbb_tree, sbb);
         FREE(sb->cfg, sbb, sizeof(StreamingBufferBlock));
-
-        sbb = next;
-        sb->block_list = next;
-        if (sbb && sbb->next == NULL)
-            sb->block_list_tail = NULL;
     }
+    sb->head = RB_MIN(SBB, &sb->sbb_tree);
 }
 
 /**
@@ -610,7 +457,7 @@ StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint
         uint32_t rel_offset = sb->buf_offset;
         sb->buf_offset += data_len;
 
-        if (sb->block_list) {
+        if (!RB_EMPTY(&sb->sbb_tree)) {
             SBBUpdate(sb, rel_offset, data_len);
         }
         return seg;
@@ -652,7 +499,7 @@ int StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
     uint32_t rel_offset = sb->buf_offset;
     sb->buf_offset += data_len;
 
-    if (sb->block_list) {
+    if (!RB_EMPTY(&sb->sbb_tree)) {
         SBBUpdate(sb, rel_offset, data_len);
     }
     return 0;
@@ -691,7 +538,7 @@ int StreamingBufferAppendNoTrack(StreamingBuffer *sb,
     uint32_t rel_offset = sb->buf_offset;
     sb->buf_offset += data_len;
 
-    if (sb->block_list) {
+    if (!RB_EMPTY(&sb->sbb_tree)) {
         SBBUpdate(sb, rel_offset, data_len);
     }
     return 0;
@@ -739,7 +586,7 @@ int StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
     SCLogDebug("rel_offset %u sb->stream_offset %"PRIu64", buf_offset %u",
             rel_offset, sb->stream_offset, sb->buf_offset);
 
-    if (sb->block_list == NULL) {
+    if (RB_EMPTY(&sb->sbb_tree)) {
         SCLogDebug("empty sbb list");
 
         if (sb->stream_offset == offset) {
@@ -1145,7 +992,7 @@ static int StreamingBufferTest04(void)
 
     StreamingBufferSegment seg1;
     FAIL_IF(StreamingBufferAppend(sb, &seg1, (const uint8_t *)"ABCDEFGH", 8) != 0);
-    FAIL_IF(sb->block_list != NULL);
+    FAIL_IF(!RB_EMPTY(&sb->sbb_tree));
     StreamingBufferSegment seg2;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg2, (const uint8_t *)"01234567", 8, 14) != 0);
     FAIL_IF(sb->stream_offset != 0);
@@ -1154,12 +1001,12 @@ static int StreamingBufferTest04(void)
     FAIL_IF(seg2.stream_offset != 14);
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg1));
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg2));
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 8);
-    FAIL_IF(sb->block_list->next == NULL);
-    FAIL_IF(sb->block_list->next->offset != 14);
-    FAIL_IF(sb->block_list->next->len != 8);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 8);
+    FAIL_IF(SBB_RB_NEXT(sb->head) == NULL);
+    FAIL_IF(SBB_RB_NEXT(sb->head)->offset != 14);
+    FAIL_IF(SBB_RB_NEXT(sb->head)->len != 8);
     Dump(sb);
     DumpSegment(sb, &seg1);
     DumpSegment(sb, &seg2);
@@ -1172,10 +1019,10 @@ static int StreamingBufferTest04(void)
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg1));
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg2));
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg3));
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 22);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 22);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
     Dump(sb);
     DumpSegment(sb, &seg1);
     DumpSegment(sb, &seg2);
@@ -1192,10 +1039,10 @@ static int StreamingBufferTest04(void)
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg2));
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg3));
     FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb,&seg4));
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 22);
-    FAIL_IF(sb->block_list->next == NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 22);
+    FAIL_IF(SBB_RB_NEXT(sb->head) == NULL);
     Dump(sb);
     DumpSegment(sb, &seg1);
     DumpSegment(sb, &seg2);
@@ -1272,18 +1119,18 @@ static int StreamingBufferTest06(void)
     StreamingBufferSegment seg5;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg5, (const uint8_t *)"ABCDEFGHIJ", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferSegment seg6;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg6, (const uint8_t *)"abcdefghij", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferFree(sb);
     PASS;
@@ -1313,18 +1160,18 @@ static int StreamingBufferTest07(void)
     StreamingBufferSegment seg5;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg5, (const uint8_t *)"ABCDEFGHIJ", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferSegment seg6;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg6, (const uint8_t *)"abcdefghij", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferFree(sb);
     PASS;
@@ -1354,18 +1201,18 @@ static int StreamingBufferTest08(void)
     StreamingBufferSegment seg5;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg5, (const uint8_t *)"ABCDEFGHIJ", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferSegment seg6;
     FAIL_IF(StreamingBufferAppend(sb, &seg6, (const uint8_t *)"abcdefghij", 10) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 20);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 20);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferFree(sb);
     PASS;
@@ -1395,18 +1242,18 @@ static int StreamingBufferTest09(void)
     StreamingBufferSegment seg5;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg5, (const uint8_t *)"ABCDEFGHIJ", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferSegment seg6;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg6, (const uint8_t *)"abcdefghij", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferFree(sb);
     PASS;
@@ -1442,23 +1289,157 @@ static int StreamingBufferTest10(void)
     StreamingBufferSegment seg7;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg7, (const uint8_t *)"ABCDEFGHIJ", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
 
     StreamingBufferSegment seg8;
     FAIL_IF(StreamingBufferInsertAt(sb, &seg8, (const uint8_t *)"abcdefghij", 10, 0) != 0);
     Dump(sb);
-    FAIL_IF(sb->block_list == NULL);
-    FAIL_IF(sb->block_list->offset != 0);
-    FAIL_IF(sb->block_list->len != 10);
-    FAIL_IF(sb->block_list->next != NULL);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 0);
+    FAIL_IF(sb->head->len != 10);
+    FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test block tree: window slides to the start of a block while more
+ *        blocks follow, and SBB_RB_FIND_INCLUSIVE lookups */
+static int StreamingBufferTest11(void)
+{
+    StreamingBufferConfig cfg = { 0, 8, 64, NULL, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    StreamingBufferSegment seg1, seg2, seg3;
+    FAIL_IF(StreamingBufferAppend(sb, &seg1, (const uint8_t *)"ABCDEFGH", 8) != 0);
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg2, (const uint8_t *)"01234567", 8, 14) != 0);
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg3, (const uint8_t *)"WXYZ", 4, 30) != 0);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head != RB_MIN(SBB, &sb->sbb_tree));
+
+    StreamingBufferBlock key = { .offset = 10, .len = 0 };
+    StreamingBufferBlock *sbb = SBB_RB_FIND_INCLUSIVE(&sb->sbb_tree, &key);
+    FAIL_IF_NULL(sbb);
+    FAIL_IF(sbb->offset != 14);
+    key.offset = 22;
+    sbb = SBB_RB_FIND_INCLUSIVE(&sb->sbb_tree, &key);
+    FAIL_IF_NULL(sbb);
+    FAIL_IF(sbb->offset != 14);
+    key.offset = 25;
+    sbb = SBB_RB_FIND_INCLUSIVE(&sb->sbb_tree, &key);
+    FAIL_IF_NULL(sbb);
+    FAIL_IF(sbb->offset != 30);
+    key.offset = 35;
+    sbb = SBB_RB_FIND_INCLUSIVE(&sb->sbb_tree, &key);
+    FAIL_IF_NOT_NULL(sbb);
+
+    StreamingBufferSlideToOffset(sb, 14);
+    FAIL_IF(sb->stream_offset != 14);
+    FAIL_IF(RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF(sb->head->offset != 14);
+    FAIL_IF(sb->head->len != 8);
+    FAIL_IF(SBB_RB_NEXT(sb->head) == NULL);
+    FAIL_IF(SBB_RB_NEXT(sb->head)->offset != 30);
+    FAIL_IF(SBB_RB_NEXT(sb->head)->len != 4);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb,&seg2,(const uint8_t *)"01234567", 8));
+
+    /* block at window start is the last one: we're continuous again */
+    StreamingBufferSlideToOffset(sb, 30);
+    FAIL_IF(!RB_EMPTY(&sb->sbb_tree));
+    FAIL_IF_NOT_NULL(sb->head);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb,&seg3,(const uint8_t *)"WXYZ", 4));
 
     StreamingBufferFree(sb);
     PASS;
 }
 
+/** \test insert many blocks in ascending, descending and random order,
+ *        checking the block tree after every batch
+ *
+ *  The cost of the block tree updates with random insertion orders is
+ *  measured by qa/tcp-segment-storm-benchmark.py --order random.
+ */
+static int StreamingBufferTest12(void)
+{
+#define SBB_BLOCKS 4096
+#define SBB_BLOCK_SIZE 8
+#define SBB_BATCH 512
+    uint32_t order[SBB_BLOCKS];
+    uint8_t *expect = SCMalloc(SBB_BLOCKS * SBB_BLOCK_SIZE);
+    FAIL_IF_NULL(expect);
+    for (uint32_t i = 0; i < SBB_BLOCKS * SBB_BLOCK_SIZE; i++) {
+        expect[i] = 'A' + ((i / SBB_BLOCK_SIZE) % 26);
+    }
+
+    for (int o = 0; o < 3; o++) {
+        for (uint32_t i = 0; i < SBB_BLOCKS; i++) {
+            order[i] = (o == 1) ? (SBB_BLOCKS - 1 - i) : i;
+        }
+        if (o == 2) {
+            /* fixed seed xorshift so runs are comparable */
+            uint32_t rnd = 2463534242U;
+            for (uint32_t i = SBB_BLOCKS - 1; i > 0; i--) {
+                rnd ^= rnd << 13;
+                rnd ^= rnd >> 17;
+                rnd ^= rnd << 5;
+                uint32_t j = rnd % (i + 1);
+                uint32_t tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+            }
+        }
+
+        StreamingBufferConfig cfg = { 0, 0, 4096, NULL, NULL, NULL, NULL };
+        StreamingBuffer *sb = StreamingBufferInit(&cfg);
+        FAIL_IF(sb == NULL);
+
+        for (uint32_t b = 0; b < SBB_BLOCKS / SBB_BATCH; b++) {
+            for (uint32_t i = b * SBB_BATCH; i < (b + 1) * SBB_BATCH; i++) {
+                StreamingBufferSegment seg;
+                const uint64_t offset = (uint64_t)order[i] * SBB_BLOCK_SIZE;
+                FAIL_IF(StreamingBufferInsertAt(sb, &seg, expect + offset,
+                            SBB_BLOCK_SIZE, offset) != 0);
+            }
+
+            /* once there are gaps, the blocks are ordered, disjoint and
+             * not touching, and together hold all data inserted so far */
+            if (!RB_EMPTY(&sb->sbb_tree)) {
+                StreamingBufferBlock *sbb = NULL, *prev = NULL;
+                uint64_t covered = 0;
+                FAIL_IF(sb->head != RB_MIN(SBB, &sb->sbb_tree));
+                RB_FOREACH(sbb, SBB, &sb->sbb_tree) {
+                    FAIL_IF(sbb->len == 0);
+                    FAIL_IF(prev != NULL && prev->offset + prev->len >= sbb->offset);
+                    covered += sbb->len;
+                    prev = sbb;
+                }
+                FAIL_IF(covered != (uint64_t)(b + 1) * SBB_BATCH * SBB_BLOCK_SIZE);
+            }
+        }
+
+        /* all gaps are filled, so at most a single block may remain */
+        if (!RB_EMPTY(&sb->sbb_tree)) {
+            FAIL_IF(sb->head != RB_MIN(SBB, &sb->sbb_tree));
+            FAIL_IF(sb->head->offset != 0);
+            FAIL_IF(sb->head->len != SBB_BLOCKS * SBB_BLOCK_SIZE);
+            FAIL_IF(SBB_RB_NEXT(sb->head) != NULL);
+        }
+        FAIL_IF(StreamingBufferCompareRawData(sb, expect,
+                    SBB_BLOCKS * SBB_BLOCK_SIZE) == 0);
+        StreamingBufferFree(sb);
+    }
+
+    SCFree(expect);
+    PASS;
+#undef SBB_BLOCKS
+#undef SBB_BLOCK_SIZE
+#undef SBB_BATCH
+}
+
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -1474,5 +1455,8 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
     UtRegisterTest("StreamingBufferTest09", StreamingBufferTest09);
     UtRegisterTest("StreamingBufferTest10", StreamingBufferTest10);
+    UtRegisterTest("StreamingBufferTest11", StreamingBufferTest11);
+    UtRegisterTest("StreamingBufferTest12 -- block tree insert orders",
+            StreamingBufferTest12);
 #endif
 }
@@ -59,6 +59,8 @@
 #ifndef __UTIL_STREAMING_BUFFER_H__
 #define __UTIL_STREAMING_BUFFER_H__
 
+#include "tree.h"
+
 #define STREAMING_BUFFER_NOFLAGS     0
 #define STREAMING_BUFFER_AUTOSLIDE  (1<<0)
 
@@ -76,13 +78,23 @@ typedef struct StreamingBufferConfig_ {
 
 /**
  *  \brief block of continues data
+ *
+ *  Blocks are kept in a tree ordered by offset. Blocks in the tree never
+ *  overlap or touch: on insert they are merged with their neighbours.
  */
 typedef struct StreamingBufferBlock_ {
     uint64_t offset;
+    RB_ENTRY(StreamingBufferBlock_) rb;
     uint32_t len;
-    struct StreamingBufferBlock_ *next;
 } StreamingBufferBlock;
 
+int SBBCompare(struct StreamingBufferBlock_ *a, struct StreamingBufferBlock_ *b);
+
+/* red-black tree prototype for SBB */
+RB_HEAD(SBB, StreamingBufferBlock_);
+RB_PROTOTYPE(SBB, StreamingBufferBlock_, rb, SBBCompare);
+StreamingBufferBlock *SBB_RB_FIND_INCLUSIVE(struct SBB *head, StreamingBufferBlock *elm);
+
 typedef struct StreamingBuffer_ {
     const StreamingBufferConfig *cfg;
     uint64_t stream_offset; /**< offset of the start of the memory block */
@@ -91,17 +103,17 @@ typedef struct StreamingBuffer_ {
     uint32_t buf_size;      /**< size of memory block */
     uint32_t buf_offset;    /**< how far we are in buf_size */
 
-    StreamingBufferBlock *block_list;
-    StreamingBufferBlock *block_list_tail;
+    struct SBB sbb_tree;    /**< red black tree of Stream Buffer Blocks */
+    StreamingBufferBlock *head; /**< head, should always be the same as RB_MIN */
 #ifdef DEBUG
     uint32_t buf_size_max;
 #endif
 } StreamingBuffer;
 
 #ifndef DEBUG
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL};
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, };
 #else
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, NULL, NULL, 0 };
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, 0 };
 #endif
 
 typedef struct StreamingBufferSegment_ {